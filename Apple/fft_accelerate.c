@@ -30,37 +30,68 @@ static float *_input_real;
 static float *_input_imaginary;
 static float *_output_real;
 static float *_output_imaginary;
-static float *_hamming;
+static fft_window_t _window;
+static float *_window_table;
 static float *_sq_mags;
 
 static vDSP_DFT_Setup _dft_setup;
 
+// the windows are scaled to the average of the hamming window, to keep the levels of all windows the same
 static void
-_init_buffers (int fft_size) {
+_generate_window (fft_window_t window, int n_samples) {
+    switch (window) {
+    case FFT_WINDOW_HANN: {
+        vDSP_hann_window(_window_table, n_samples, vDSP_HANN_DENORM);
+        float scale = 0.54f / 0.5f;
+        vDSP_vsmul(_window_table, 1, &scale, _window_table, 1, n_samples);
+        break;
+    }
+    case FFT_WINDOW_BLACKMAN_HARRIS:
+        for (int n = 0; n < n_samples; n++) {
+            double x = 2 * M_PI * n / n_samples;
+            _window_table[n] = (float)((0.35875 - 0.48829 * cos (x) + 0.14128 * cos (2 * x) - 0.01168 * cos (3 * x)) * 0.54 / 0.35875);
+        }
+        break;
+    default:
+        vDSP_hamm_window(_window_table, n_samples, 0);
+        break;
+    }
+}
+
+static void
+_init_buffers (int fft_size, fft_window_t window) {
+    if (window < 0 || window >= FFT_WINDOW_COUNT) {
+        window = FFT_WINDOW_DEFAULT;
+    }
+    if (fft_size == _fft_size && window != _window) {
+        _window = window;
+        _generate_window (window, fft_size * 2);
+    }
     if (fft_size != _fft_size) {
         fft_free ();
 
         _input_real = calloc (fft_size * 2, sizeof (float));
         _input_imaginary = calloc (fft_size * 2, sizeof (float));
-        _hamming = calloc (fft_size * 2, sizeof (float));
+        _window_table = calloc (fft_size * 2, sizeof (float));
         _sq_mags = calloc (fft_size, sizeof (float));
         _output_real = calloc (fft_size * 2, sizeof (float));
         _output_imaginary = calloc (fft_size * 2, sizeof (float));
 
         _dft_setup = vDSP_DFT_zop_CreateSetup(NULL, fft_size * 2, FFT_FORWARD);
-        vDSP_hamm_window(_hamming, fft_size * 2, 0);
+        _window = window;
+        _generate_window (window, fft_size * 2);
 
         _fft_size = fft_size;
     }
 }
 
 void
-fft_calculate (const float *data, float *freq, int fft_size) {
+fft_calculate (const float *data, float *freq, int fft_size, fft_window_t window) {
     int dft_size = fft_size * 2;
 
-    _init_buffers (fft_size);
+    _init_buffers (fft_size, window);
 
-    vDSP_vmul(data, 1, _hamming, 1, _input_real, 1, dft_size);
+    vDSP_vmul(data, 1, _window_table, 1, _input_real, 1, dft_size);
 
     vDSP_DFT_Execute(_dft_setup, _input_real, _input_imaginary, _output_real, _output_imaginary);
 
@@ -81,7 +112,7 @@ void
 fft_free (void) {
     free (_input_real);
     free (_input_imaginary);
-    free (_hamming);
+    free (_window_table);
     free (_sq_mags);
     free (_output_real);
     free (_output_imaginary);
@@ -90,7 +121,7 @@ fft_free (void) {
     }
     _input_real = NULL;
     _input_imaginary = NULL;
-    _hamming = NULL;
+    _window_table = NULL;
     _sq_mags = NULL;
     _dft_setup = NULL;
     _output_real = NULL;
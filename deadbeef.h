@@ -71,6 +71,7 @@ extern "C" {
 // that there's a better replacement in the newer deadbeef versions.
 
 // api version history:
+// 1.16 -- adds pcm_interleave, the job scheduler, and deferred metadata loading
 // 1.15 -- deadbeef-1.9.0 (medialib branch)
 // 1.14 -- deadbeef-1.8.8
 // 1.12 -- deadbeef-1.8.4
@@ -99,7 +100,7 @@ extern "C" {
 // 0.1 -- deadbeef-0.2.0
 
 #define DB_API_VERSION_MAJOR 1
-#define DB_API_VERSION_MINOR 15
+#define DB_API_VERSION_MINOR 16
 
 #if defined(__clang__)
 
@@ -136,6 +137,12 @@ extern "C" {
 #define DDB_API_LEVEL DB_API_VERSION_MINOR
 #endif
 
+#if (DDB_WARN_DEPRECATED && DDB_API_LEVEL >= 16)
+#define DEPRECATED_116 DDB_DEPRECATED("since deadbeef API 1.16")
+#else
+#define DEPRECATED_116
+#endif
+
 #if (DDB_WARN_DEPRECATED && DDB_API_LEVEL >= 15)
 #define DEPRECATED_115 DDB_DEPRECATED("since deadbeef API 1.15")
 #else
@@ -264,6 +271,7 @@ enum {
     DDB_IS_SUBTRACK = (1<<0), // file is not single-track, might have metainfo in external file
     DDB_IS_READONLY = (1<<1), // check this flag to block tag writing (e.g. in iso.wv)
     DDB_HAS_EMBEDDED_CUESHEET = (1<<2),
+    DDB_IS_DEFERRED = (1<<3), // only :URI and :DECODER are known yet, the rest of the metadata is being loaded in background (since 1.16)
 
     DDB_TAG_ID3V1 = (1<<8),
     DDB_TAG_ID3V22 = (1<<9),
@@ -778,6 +786,24 @@ typedef enum {
 } ddb_insert_file_result_t;
 #endif
 
+#if (DDB_API_LEVEL >= 16)
+// Priorities of the jobs in the core job scheduler
+typedef enum {
+    // Work which playback is waiting for. Always runs first.
+    DDB_JOB_PRIORITY_HIGH = 0,
+    // Work which the user is waiting for, e.g. loading the visible album art.
+    DDB_JOB_PRIORITY_INTERACTIVE = 1,
+    // Batch work, e.g. scanning or converting files.
+    // Background jobs never occupy all worker threads at once.
+    DDB_JOB_PRIORITY_BACKGROUND = 2,
+} ddb_job_priority_t;
+
+// Handle of a job submitted to the core job scheduler
+typedef struct ddb_job_s {
+    int _unused;
+} ddb_job_t;
+#endif
+
 // forward decl for plugin struct
 struct DB_plugin_s;
 
@@ -1619,6 +1645,7 @@ typedef struct {
     /// @param callback The callback which will be called every time new fft data is ready
     ///
     /// Use the @c nframes field in the @c data to get the number of frequency samples.
+    /// It is set by the viz.fft_size config option (4096 by default), and can change between the calls.
     ///
     /// Max number of channels is DDB_FREQ_MAX_CHANNELS.
     ///
@@ -1640,6 +1667,63 @@ typedef struct {
         void *user_data
     );
 #endif
+
+    // since 1.16
+#if (DDB_API_LEVEL >= 16)
+    /// Write @c nframes of int32 samples from the channel arrays in @c src into @c dst,
+    /// as interleaved little endian samples of @c dst_bps bits (8, 16, 24 or 32).
+    ///
+    /// @param src_stride The distance between consecutive samples of one channel, 1 for planar data
+    /// @param src_shift Left shift applied to each sample, e.g. 4 to write 20 bit samples as 24 bit
+    ///
+    /// This is intended for decoders, which get planar data from the codec library.
+    /// Channel reordering can be done by passing the channel pointers in the output order.
+    /// Uses SIMD code where available.
+    void (*pcm_interleave_int32) (char *dst, int dst_bps, const int32_t * const *src, int src_stride, int src_shift, int channels, int nframes);
+
+    /// Same as pcm_interleave_int32, for float samples in the [-1,1] range.
+    /// If @c dst_is_float is set, the output is float, and @c dst_bps is ignored.
+    /// Otherwise the samples are converted to signed integers of @c dst_bps bits, with clipping.
+    void (*pcm_interleave_float32) (char *dst, int dst_bps, int dst_is_float, const float * const *src, int src_stride, int channels, int nframes);
+
+    /// Job scheduler.
+    /// Runs the jobs on a shared pool of worker threads, sized by the number of CPUs,
+    /// so that the plugins don't need to start their own threads for CPU-heavy work.
+    ///
+    /// Submit a job, which will call @c fn with @c ctx on a worker thread.
+    /// @c fn is always called exactly once, even if the job is cancelled before it starts,
+    /// so that it can free the @c ctx. It should check @c job_is_cancelled before, and while doing the work.
+    /// Jobs submitted from inside of a job are preferably run by the same worker thread.
+    /// Returns the job handle, which must be released by the caller with @c job_release.
+    ddb_job_t *(*job_submit) (ddb_job_priority_t priority, void (*fn) (ddb_job_t *job, void *ctx), void *ctx);
+
+    /// Wait for the job to finish.
+    /// If the job hasn't started yet, it's moved to the high priority queue.
+    /// When called from inside of another job, the job runs on the calling thread instead,
+    /// so it's safe to wait for a job from inside of another job.
+    /// Returns 0 if the job finished, or -1 if it was cancelled.
+    int (*job_wait) (ddb_job_t *job);
+
+    /// Request the job to stop. Doesn't wait.
+    void (*job_cancel) (ddb_job_t *job);
+
+    /// Returns 1 if @c job_cancel was called for the job, or if the player is shutting down.
+    int (*job_is_cancelled) (ddb_job_t *job);
+
+    /// Release the job handle returned by job_submit.
+    /// Releasing doesn't cancel the job, so this can be called right after submit for fire-and-forget jobs.
+    void (*job_release) (ddb_job_t *job);
+
+    /// Deferred metadata loading.
+    /// When the playlist.deferred_metadata config option is set, the added files are inserted
+    /// with the DDB_IS_DEFERRED flag, and only the :URI and :DECODER metadata,
+    /// and the rest is read in background. Each loaded track sends DB_EV_TRACKINFOCHANGED,
+    /// or DB_EV_PLAYLISTCHANGED if the file turned out to contain multiple tracks, which replace the deferred one.
+    ///
+    /// Move the track to the front of the loading queue, e.g. when its row becomes visible.
+    /// Does nothing if the track is not deferred.
+    void (*pl_request_deferred_metadata) (ddb_playItem_t *it);
+#endif
 } DB_functions_t;
 
 // NOTE: an item placement must be selected like this
@@ -1871,6 +1955,13 @@ enum {
     // Supposed to be used by converter, replaygain scanner, etc.
     DDB_DECODER_HINT_RAW_SIGNAL = 0x8,
 #endif
+#if (DDB_API_LEVEL >= 16)
+    // The output is going to be processed in float32, e.g. by the DSP chain, or a float output.
+    // Decoders which can produce float32 at no extra cost, should do so when this flag is set,
+    // instead of integer PCM, which would be converted back to float.
+    // The decoder reports the actual format in DB_fileinfo_t.fmt as usual.
+    DDB_DECODER_HINT_FLOAT32 = 0x10,
+#endif
 };
 
 // decoder plugin
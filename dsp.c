@@ -375,6 +375,10 @@ streamer_dsp_init (void) {
     }
 }
 
+int
+dsp_is_active (void) {
+    return _dsp_on;
+}
 
 int
 dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
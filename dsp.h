@@ -59,6 +59,10 @@ streamer_set_dsp_chain_real (ddb_dsp_context_t *chain);
 ddb_dsp_context_t *
 dsp_clone (ddb_dsp_context_t *from);
 
+// Returns 1 if there are any enabled DSP plugins
+int
+dsp_is_active (void);
+
 int
 dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
            ddb_waveformat_t *out_fmt, char **out_bytes, int *out_numbytes, float *out_dsp_ratio);
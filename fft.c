@@ -17,123 +17,254 @@
  * the use of this software.
  */
 
-// this version has a few changes compared to the original audacious fft.c
+// this version is based on the original audacious fft.c, but it is rewritten
+// as a real-input transform on split real/imaginary arrays, with SIMD butterflies;
 // please find the original file in audacious
 
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
-#include <complex.h>
-#include "fft.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include "fft.h"
+
+// The 2*M real samples are packed as M complex numbers (even samples as real, odd as imaginary parts),
+// transformed by an M point complex fft, and the spectrum of the real signal is split out of the result.
+// This takes half of the work of running a complex fft over the real samples.
+
+#if defined(__SSE__) && (defined(__GNUC__) || defined(__clang__))
+#define USE_SSE 1
+#include <xmmintrin.h>
+#else
+#define USE_SSE 0
+#endif
 
-static int _fft_size;
-static float *_hamming;          /* hamming window, scaled to sum to 1 */
-static int *_reversed;           /* bit-reversal table */
-static float complex *_roots;    /* N-th roots of unity */
-static int LOGN;                 /* log N (base 2) */
-static int N;                    /* _fft_size * 2 */
+#if defined(__aarch64__)
+#define USE_NEON 1
+#include <arm_neon.h>
+#else
+#define USE_NEON 0
+#endif
+
+static int _fft_size;               /* M, the size of the complex transform */
+static fft_window_t _window;
+static float *_window_table;        /* 2*M entries, scaled to average 1 */
+static int *_reversed;              /* bit-reversal table, M entries */
+static float *_twiddle_re;          /* exp(-pi*i*b/half) of each stage, at offset half-1 */
+static float *_twiddle_im;
+static float *_split_re;            /* exp(-2*pi*i*k/(2*M)) */
+static float *_split_im;
+static float *_re;                  /* work buffers */
+static float *_im;
 
-#ifndef HAVE_LOG2
-static inline float log2(float x) {return (float)log(x)/M_LN2;}
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
 #endif
 
 static void
 _free_buffers (void) {
-    free (_hamming);
+    free (_window_table);
     free (_reversed);
-    free (_roots);
-    _hamming = NULL;
+    free (_twiddle_re);
+    free (_twiddle_im);
+    free (_split_re);
+    free (_split_im);
+    free (_re);
+    free (_im);
+    _window_table = NULL;
     _reversed = NULL;
-    _roots = NULL;
+    _twiddle_re = NULL;
+    _twiddle_im = NULL;
+    _split_re = NULL;
+    _split_im = NULL;
+    _re = NULL;
+    _im = NULL;
+    _fft_size = 0;
 }
 
-/* Reverse the order of the lowest LOGN bits in an integer. */
+static void
+_generate_window (fft_window_t window, int n_samples) {
+    for (int n = 0; n < n_samples; n++) {
+        double x = 2 * M_PI * n / n_samples;
+        double w;
+        switch (window) {
+        case FFT_WINDOW_HANN:
+            w = (0.5 - 0.5 * cos (x)) / 0.5;
+            break;
+        case FFT_WINDOW_BLACKMAN_HARRIS:
+            w = (0.35875 - 0.48829 * cos (x) + 0.14128 * cos (2 * x) - 0.01168 * cos (3 * x)) / 0.35875;
+            break;
+        default:
+            w = 1 - 0.85 * cos (x);
+            break;
+        }
+        _window_table[n] = (float)w;
+    }
+}
 
 static int
-_bit_reverse (int x)
-{
-    int y = 0;
-
-    for (int n = LOGN; n --; )
-    {
-        y = (y << 1) | (x & 1);
-        x >>= 1;
+_init_buffers (int fft_size, fft_window_t window) {
+    if (window < 0 || window >= FFT_WINDOW_COUNT) {
+        window = FFT_WINDOW_DEFAULT;
+    }
+    if (_fft_size == fft_size) {
+        if (_window != window) {
+            _window = window;
+            _generate_window (window, fft_size * 2);
+        }
+        return 0;
     }
 
-    return y;
-}
+    _free_buffers ();
 
-/* Generate lookup tables. */
+    int M = fft_size;
+    _window_table = malloc (M * 2 * sizeof (float));
+    _reversed = malloc (M * sizeof (int));
+    _twiddle_re = malloc (M * sizeof (float));
+    _twiddle_im = malloc (M * sizeof (float));
+    _split_re = malloc (M * sizeof (float));
+    _split_im = malloc (M * sizeof (float));
+    _re = malloc (M * sizeof (float));
+    _im = malloc (M * sizeof (float));
+    if (!_window_table || !_reversed || !_twiddle_re || !_twiddle_im || !_split_re || !_split_im || !_re || !_im) {
+        _free_buffers ();
+        return -1;
+    }
 
-static void
-_generate_tables (void)
-{
-    for (int n = 0; n < N; n ++)
-        _hamming[n] = 1 - 0.85f * cosf (2 * (float)M_PI * n / N);
-    for (int n = 0; n < N; n ++)
-        _reversed[n] = _bit_reverse (n);
-    for (int n = 0; n < N / 2; n ++)
-        _roots[n] = cexpf (2 * (float)M_PI * I * n / N);
-}
+    _window = window;
+    _generate_window (window, M * 2);
 
-static void
-_init_buffers (int fft_size) {
-    if (_fft_size != fft_size) {
-        _free_buffers();
-        _fft_size = fft_size;
-        N = fft_size * 2;
-        _hamming = calloc (N, sizeof (float));
-        _reversed = calloc (N, sizeof (float));
-        _roots = calloc (fft_size, sizeof (float complex));
-        LOGN = (int)log2(N);
-        _generate_tables();
+    int logn = 0;
+    while ((1 << logn) < M) {
+        logn++;
+    }
+    for (int n = 0; n < M; n++) {
+        int x = n;
+        int y = 0;
+        for (int b = logn; b--; ) {
+            y = (y << 1) | (x & 1);
+            x >>= 1;
+        }
+        _reversed[n] = y;
+    }
+
+    for (int half = 1; half < M; half <<= 1) {
+        for (int b = 0; b < half; b++) {
+            _twiddle_re[half - 1 + b] = (float)cos (M_PI * b / half);
+            _twiddle_im[half - 1 + b] = (float)-sin (M_PI * b / half);
+        }
+    }
+
+    for (int k = 0; k < M; k++) {
+        _split_re[k] = (float)cos (M_PI * k / M);
+        _split_im[k] = (float)-sin (M_PI * k / M);
     }
+
+    _fft_size = M;
+    return 0;
 }
 
 static void
-_do_fft (float complex *a)
-{
-    int half = 1;       /* (2^s)/2 */
-    int inv = N / 2;    /* N/(2^s) */
+_do_fft (void) {
+    int M = _fft_size;
 
     /* loop through steps */
-    while (inv)
-    {
+    for (int half = 1; half < M; half <<= 1) {
+        const float *wr = _twiddle_re + half - 1;
+        const float *wi = _twiddle_im + half - 1;
+
         /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
-        {
+        for (int g = 0; g < M; g += half << 1) {
+            float *ar = _re + g;
+            float *ai = _im + g;
+            float *br = ar + half;
+            float *bi = ai + half;
+            int b = 0;
+
             /* loop through butterflies */
-            for (int b = 0, r = 0; b < half; b ++, r += inv)
-            {
-                float complex even = a[g + b];
-                float complex odd = _roots[r] * a[g + half + b];
-                a[g + b] = even + odd;
-                a[g + half + b] = even - odd;
+#if USE_SSE
+            for (; b + 4 <= half; b += 4) {
+                __m128 xr = _mm_loadu_ps (br + b);
+                __m128 xi = _mm_loadu_ps (bi + b);
+                __m128 twr = _mm_loadu_ps (wr + b);
+                __m128 twi = _mm_loadu_ps (wi + b);
+                __m128 tr = _mm_sub_ps (_mm_mul_ps (xr, twr), _mm_mul_ps (xi, twi));
+                __m128 ti = _mm_add_ps (_mm_mul_ps (xr, twi), _mm_mul_ps (xi, twr));
+                __m128 er = _mm_loadu_ps (ar + b);
+                __m128 ei = _mm_loadu_ps (ai + b);
+                _mm_storeu_ps (ar + b, _mm_add_ps (er, tr));
+                _mm_storeu_ps (ai + b, _mm_add_ps (ei, ti));
+                _mm_storeu_ps (br + b, _mm_sub_ps (er, tr));
+                _mm_storeu_ps (bi + b, _mm_sub_ps (ei, ti));
+            }
+#elif USE_NEON
+            for (; b + 4 <= half; b += 4) {
+                float32x4_t xr = vld1q_f32 (br + b);
+                float32x4_t xi = vld1q_f32 (bi + b);
+                float32x4_t twr = vld1q_f32 (wr + b);
+                float32x4_t twi = vld1q_f32 (wi + b);
+                float32x4_t tr = vmlsq_f32 (vmulq_f32 (xr, twr), xi, twi);
+                float32x4_t ti = vmlaq_f32 (vmulq_f32 (xr, twi), xi, twr);
+                float32x4_t er = vld1q_f32 (ar + b);
+                float32x4_t ei = vld1q_f32 (ai + b);
+                vst1q_f32 (ar + b, vaddq_f32 (er, tr));
+                vst1q_f32 (ai + b, vaddq_f32 (ei, ti));
+                vst1q_f32 (br + b, vsubq_f32 (er, tr));
+                vst1q_f32 (bi + b, vsubq_f32 (ei, ti));
+            }
+#endif
+            for (; b < half; b++) {
+                float tr = br[b] * wr[b] - bi[b] * wi[b];
+                float ti = br[b] * wi[b] + bi[b] * wr[b];
+                float er = ar[b];
+                float ei = ai[b];
+                ar[b] = er + tr;
+                ai[b] = ei + ti;
+                br[b] = er - tr;
+                bi[b] = ei - ti;
             }
         }
-
-        half <<= 1;
-        inv >>= 1;
     }
 }
 
 void
-fft_calculate (const float *data, float *freq, int fft_size) {
-    _init_buffers(fft_size);
-
-    // fft code shamelessly stolen from audacious
-    // thanks, John
-    float complex a[N];
-    for (int n = 0; n < N; n ++) {
-        a[_reversed[n]] = data[n] * _hamming[n];
+fft_calculate (const float *data, float *freq, int fft_size, fft_window_t window) {
+    if (fft_size < 2 || (fft_size & (fft_size - 1)) || _init_buffers (fft_size, window) < 0) {
+        if (fft_size > 0) {
+            memset (freq, 0, fft_size * sizeof (float));
+        }
+        return;
     }
-    _do_fft(a);
 
-    for (int n = 0; n < N / 2 - 1; n ++)
-        freq[n] = 2 * cabsf (a[1 + n]) / N;
-    freq[N / 2 - 1] = cabsf(a[N / 2]) / N;
+    int M = fft_size;
+    float N = M * 2;
+
+    for (int n = 0; n < M; n++) {
+        int r = _reversed[n];
+        _re[r] = data[2 * n] * _window_table[2 * n];
+        _im[r] = data[2 * n + 1] * _window_table[2 * n + 1];
+    }
+
+    _do_fft ();
+
+    // X[k] = E[k] + W^k * O[k], where E and O are the spectra of the even and odd samples:
+    // E[k] = (Z[k] + conj(Z[M-k])) / 2, O[k] = (Z[k] - conj(Z[M-k])) / 2i
+    for (int k = 1; k < M; k++) {
+        float zr = _re[k];
+        float zi = _im[k];
+        float cr = _re[M - k];
+        float ci = -_im[M - k];
+        float er = (zr + cr) * 0.5f;
+        float ei = (zi + ci) * 0.5f;
+        float o_r = (zi - ci) * 0.5f;
+        float o_i = -(zr - cr) * 0.5f;
+        float xr = er + _split_re[k] * o_r - _split_im[k] * o_i;
+        float xi = ei + _split_re[k] * o_i + _split_im[k] * o_r;
+        freq[k - 1] = 2 * sqrtf (xr * xr + xi * xi) / N;
+    }
+    // X[M] = E[0] - O[0]
+    freq[M - 1] = fabsf (_re[0] - _im[0]) / N;
 }
 
 void
@@ -29,8 +29,17 @@ extern "C" {
 }
 #endif
 
+typedef enum {
+    FFT_WINDOW_DEFAULT, // raised cosine, 1 - 0.85 * cos
+    FFT_WINDOW_HANN,
+    FFT_WINDOW_BLACKMAN_HARRIS, // 4 term, for the best sidelobe rejection at large fft sizes
+    FFT_WINDOW_COUNT
+} fft_window_t;
+
+// Calculates the magnitude spectrum of fft_size*2 real samples into fft_size bins.
+// The window and the tables are cached between the calls with the same fft_size and window.
 void
-fft_calculate (const float *data, float *freq, int fft_size);
+fft_calculate (const float *data, float *freq, int fft_size, fft_window_t window);
 
 void
 fft_free (void);
@@ -0,0 +1,431 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  routines for packing decoder output into interleaved PCM
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+#include <string.h>
+#include "interleave.h"
+#include "fastftoi.h"
+
+// Most of the decoded audio is stereo, which gets the vectorized code paths.
+// AVX2 code is compiled for the target with function attributes, and selected at runtime.
+// NEON is always available on aarch64.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define USE_AVX2 1
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define USE_AVX2 0
+#endif
+
+#if defined(__aarch64__)
+#define USE_NEON 1
+#include <arm_neon.h>
+#else
+#define USE_NEON 0
+#endif
+
+// {{{ generic
+static void
+_interleave_int32_generic (char *dst, int dst_bps, const int32_t * const *src, int src_stride, int src_shift, int channels, int nframes) {
+    int samplesize = dst_bps / 8;
+    int framesize = samplesize * channels;
+    for (int c = 0; c < channels; c++) {
+        const int32_t *in = src[c];
+        char *out = dst + c * samplesize;
+        switch (dst_bps) {
+        case 8:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                *out = (char)(*in << src_shift);
+            }
+            break;
+        case 16:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                *(int16_t *)out = (int16_t)(*in << src_shift);
+            }
+            break;
+        case 24:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                int32_t sample = *in << src_shift;
+                out[0] = sample & 0xff;
+                out[1] = (sample >> 8) & 0xff;
+                out[2] = (sample >> 16) & 0xff;
+            }
+            break;
+        case 32:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                *(int32_t *)out = *in << src_shift;
+            }
+            break;
+        }
+    }
+}
+
+static void
+_interleave_float32_generic (char *dst, int dst_bps, int dst_is_float, const float * const *src, int src_stride, int channels, int nframes) {
+    int samplesize = dst_bps / 8;
+    int framesize = samplesize * channels;
+
+    if (dst_is_float) {
+        for (int c = 0; c < channels; c++) {
+            const float *in = src[c];
+            float *out = (float *)dst + c;
+            for (int i = 0; i < nframes; i++, in += src_stride, out += channels) {
+                *out = *in;
+            }
+        }
+        return;
+    }
+
+    fpu_control ctl = 0;
+    fpu_setround (&ctl);
+    for (int c = 0; c < channels; c++) {
+        const float *in = src[c];
+        char *out = dst + c * samplesize;
+        switch (dst_bps) {
+        case 8:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                int sample = ftoi (*in * 0x80);
+                *out = (char)(sample > 0x7f ? 0x7f : sample < -0x80 ? -0x80 : sample);
+            }
+            break;
+        case 16:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                int sample = ftoi (*in * 0x8000);
+                *(int16_t *)out = (int16_t)(sample > 0x7fff ? 0x7fff : sample < -0x8000 ? -0x8000 : sample);
+            }
+            break;
+        case 24:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                int32_t sample = (int32_t)ftoi (*in * 0x800000);
+                sample = sample > 0x7fffff ? 0x7fffff : sample < -0x800000 ? -0x800000 : sample;
+                out[0] = sample & 0xff;
+                out[1] = (sample >> 8) & 0xff;
+                out[2] = (sample >> 16) & 0xff;
+            }
+            break;
+        case 32:
+            for (int i = 0; i < nframes; i++, in += src_stride, out += framesize) {
+                float sample = *in;
+                if (sample > (float)0x7fffffff/0x80000000) {
+                    sample = (float)0x7fffffff/0x80000000;
+                }
+                else if (sample < -1.f) {
+                    sample = -1.f;
+                }
+                *(int32_t *)out = (int32_t)ftoi (sample * (float)0x80000000);
+            }
+            break;
+        }
+    }
+    fpu_restore (ctl);
+}
+// }}}
+
+// {{{ avx2
+#if USE_AVX2
+// The kernels return the number of frames done, the rest is handled by the generic code
+AVX2_TARGET static int
+_interleave_stereo_int32_avx2 (char *dst, int dst_bps, const int32_t *l, const int32_t *r, int shift, int nframes) {
+    __m128i sh = _mm_cvtsi32_si128 (shift);
+    int i = 0;
+    switch (dst_bps) {
+    case 16:
+        for (; i + 8 <= nframes; i += 8) {
+            __m256i vl = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(l + i)), sh);
+            __m256i vr = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(r + i)), sh);
+            // lo: L0 R0 L1 R1 | L4 R4 L5 R5, hi: L2 R2 L3 R3 | L6 R6 L7 R7
+            __m256i lo = _mm256_unpacklo_epi32 (vl, vr);
+            __m256i hi = _mm256_unpackhi_epi32 (vl, vr);
+            // keep the low 16 bits of each sample
+            lo = _mm256_srai_epi32 (_mm256_slli_epi32 (lo, 16), 16);
+            hi = _mm256_srai_epi32 (_mm256_slli_epi32 (hi, 16), 16);
+            _mm256_storeu_si256 ((__m256i *)(dst + i * 4), _mm256_packs_epi32 (lo, hi));
+        }
+        break;
+    case 24: {
+        // per 128 bit lane: drop the high byte of each of the 4 samples
+        const __m128i shuf = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        // each 16 byte store writes 4 bytes past the 12 bytes of data, which are overwritten by the next store,
+        // so there must be at least one more frame after the last iteration.
+        for (; i + 8 < nframes; i += 8) {
+            __m256i vl = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(l + i)), sh);
+            __m256i vr = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(r + i)), sh);
+            __m256i lo = _mm256_unpacklo_epi32 (vl, vr);
+            __m256i hi = _mm256_unpackhi_epi32 (vl, vr);
+            char *out = dst + i * 6;
+            _mm_storeu_si128 ((__m128i *)(out), _mm_shuffle_epi8 (_mm256_castsi256_si128 (lo), shuf));
+            _mm_storeu_si128 ((__m128i *)(out + 12), _mm_shuffle_epi8 (_mm256_castsi256_si128 (hi), shuf));
+            _mm_storeu_si128 ((__m128i *)(out + 24), _mm_shuffle_epi8 (_mm256_extracti128_si256 (lo, 1), shuf));
+            _mm_storeu_si128 ((__m128i *)(out + 36), _mm_shuffle_epi8 (_mm256_extracti128_si256 (hi, 1), shuf));
+        }
+        break;
+    }
+    case 32:
+        for (; i + 8 <= nframes; i += 8) {
+            __m256i vl = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(l + i)), sh);
+            __m256i vr = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(r + i)), sh);
+            __m256i lo = _mm256_unpacklo_epi32 (vl, vr);
+            __m256i hi = _mm256_unpackhi_epi32 (vl, vr);
+            _mm256_storeu_si256 ((__m256i *)(dst + i * 8), _mm256_permute2x128_si256 (lo, hi, 0x20));
+            _mm256_storeu_si256 ((__m256i *)(dst + i * 8 + 32), _mm256_permute2x128_si256 (lo, hi, 0x31));
+        }
+        break;
+    }
+    return i;
+}
+
+AVX2_TARGET static int
+_pack_mono_int32_avx2 (char *dst, int dst_bps, const int32_t *src, int shift, int nsamples) {
+    __m128i sh = _mm_cvtsi32_si128 (shift);
+    int i = 0;
+    switch (dst_bps) {
+    case 16:
+        for (; i + 16 <= nsamples; i += 16) {
+            __m256i a = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(src + i)), sh);
+            __m256i b = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(src + i + 8)), sh);
+            a = _mm256_srai_epi32 (_mm256_slli_epi32 (a, 16), 16);
+            b = _mm256_srai_epi32 (_mm256_slli_epi32 (b, 16), 16);
+            // packs works per 128 bit lane: a0 b0 a1 b1 -> a0 a1 b0 b1
+            __m256i p = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8);
+            _mm256_storeu_si256 ((__m256i *)(dst + i * 2), p);
+        }
+        break;
+    case 24: {
+        const __m128i shuf = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        // overlapping stores as above, 4 extra bytes need 2 more samples
+        for (; i + 10 <= nsamples; i += 8) {
+            __m256i a = _mm256_sll_epi32 (_mm256_loadu_si256 ((const __m256i *)(src + i)), sh);
+            char *out = dst + i * 3;
+            _mm_storeu_si128 ((__m128i *)(out), _mm_shuffle_epi8 (_mm256_castsi256_si128 (a), shuf));
+            _mm_storeu_si128 ((__m128i *)(out + 12), _mm_shuffle_epi8 (_mm256_extracti128_si256 (a, 1), shuf));
+        }
+        break;
+    }
+    }
+    return i;
+}
+
+AVX2_TARGET static int
+_interleave_stereo_float32_avx2 (char *dst, int dst_bps, int dst_is_float, const float *l, const float *r, int nframes) {
+    int i = 0;
+    if (dst_is_float) {
+        for (; i + 8 <= nframes; i += 8) {
+            __m256 vl = _mm256_loadu_ps (l + i);
+            __m256 vr = _mm256_loadu_ps (r + i);
+            __m256 lo = _mm256_unpacklo_ps (vl, vr);
+            __m256 hi = _mm256_unpackhi_ps (vl, vr);
+            _mm256_storeu_ps ((float *)dst + i * 2, _mm256_permute2f128_ps (lo, hi, 0x20));
+            _mm256_storeu_ps ((float *)dst + i * 2 + 8, _mm256_permute2f128_ps (lo, hi, 0x31));
+        }
+    }
+    else if (dst_bps == 16) {
+        const __m256 scale = _mm256_set1_ps (0x8000);
+        const __m256 maxval = _mm256_set1_ps (1.f);
+        const __m256 minval = _mm256_set1_ps (-1.f);
+        for (; i + 8 <= nframes; i += 8) {
+            // clamp before the int32 conversion to avoid overflow, the saturating pack clips 32768 to 32767
+            __m256 fl = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (l + i), minval), maxval);
+            __m256 fr = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (r + i), minval), maxval);
+            __m256i vl = _mm256_cvtps_epi32 (_mm256_mul_ps (fl, scale));
+            __m256i vr = _mm256_cvtps_epi32 (_mm256_mul_ps (fr, scale));
+            __m256i lo = _mm256_unpacklo_epi32 (vl, vr);
+            __m256i hi = _mm256_unpackhi_epi32 (vl, vr);
+            _mm256_storeu_si256 ((__m256i *)(dst + i * 4), _mm256_packs_epi32 (lo, hi));
+        }
+    }
+    return i;
+}
+
+static int
+_have_avx2 (void) {
+    static int have_avx2 = -1;
+    if (have_avx2 < 0) {
+        __builtin_cpu_init ();
+        have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+    return have_avx2;
+}
+#endif
+// }}}
+
+// {{{ neon
+#if USE_NEON
+static int
+_interleave_stereo_int32_neon (char *dst, int dst_bps, const int32_t *l, const int32_t *r, int shift, int nframes) {
+    int32x4_t sh = vdupq_n_s32 (shift);
+    int i = 0;
+    switch (dst_bps) {
+    case 16:
+        for (; i + 4 <= nframes; i += 4) {
+            int16x4x2_t v;
+            v.val[0] = vmovn_s32 (vshlq_s32 (vld1q_s32 (l + i), sh));
+            v.val[1] = vmovn_s32 (vshlq_s32 (vld1q_s32 (r + i), sh));
+            vst2_s16 ((int16_t *)dst + i * 2, v);
+        }
+        break;
+    case 32:
+        for (; i + 4 <= nframes; i += 4) {
+            int32x4x2_t v;
+            v.val[0] = vshlq_s32 (vld1q_s32 (l + i), sh);
+            v.val[1] = vshlq_s32 (vld1q_s32 (r + i), sh);
+            vst2q_s32 ((int32_t *)dst + i * 2, v);
+        }
+        break;
+    }
+    return i;
+}
+
+static int
+_pack_mono_int32_neon (char *dst, int dst_bps, const int32_t *src, int shift, int nsamples) {
+    int32x4_t sh = vdupq_n_s32 (shift);
+    int i = 0;
+    if (dst_bps == 16) {
+        for (; i + 8 <= nsamples; i += 8) {
+            int16x4_t a = vmovn_s32 (vshlq_s32 (vld1q_s32 (src + i), sh));
+            int16x4_t b = vmovn_s32 (vshlq_s32 (vld1q_s32 (src + i + 4), sh));
+            vst1q_s16 ((int16_t *)dst + i, vcombine_s16 (a, b));
+        }
+    }
+    return i;
+}
+
+static int
+_interleave_stereo_float32_neon (char *dst, int dst_bps, int dst_is_float, const float *l, const float *r, int nframes) {
+    int i = 0;
+    if (dst_is_float) {
+        for (; i + 4 <= nframes; i += 4) {
+            float32x4x2_t v;
+            v.val[0] = vld1q_f32 (l + i);
+            v.val[1] = vld1q_f32 (r + i);
+            vst2q_f32 ((float *)dst + i * 2, v);
+        }
+    }
+    else if (dst_bps == 16) {
+        float32x4_t scale = vdupq_n_f32 (0x8000);
+        for (; i + 4 <= nframes; i += 4) {
+            int16x4x2_t v;
+            v.val[0] = vqmovn_s32 (vcvtnq_s32_f32 (vmulq_f32 (vld1q_f32 (l + i), scale)));
+            v.val[1] = vqmovn_s32 (vcvtnq_s32_f32 (vmulq_f32 (vld1q_f32 (r + i), scale)));
+            vst2_s16 ((int16_t *)dst + i * 2, v);
+        }
+    }
+    return i;
+}
+#endif
+// }}}
+
+void
+pcm_interleave_int32 (char *dst, int dst_bps, const int32_t * const *src, int src_stride, int src_shift, int channels, int nframes) {
+    if (dst_bps != 8 && dst_bps != 16 && dst_bps != 24 && dst_bps != 32) {
+        return;
+    }
+
+    // already interleaved data is packed as a single channel
+    if (channels > 1 && src_stride == channels) {
+        int c;
+        for (c = 1; c < channels && src[c] == src[0] + c; c++);
+        if (c == channels) {
+            nframes *= channels;
+            channels = 1;
+            src_stride = 1;
+        }
+    }
+
+    int done = 0;
+    if (channels == 1 && src_stride == 1) {
+        if (src_shift == 0 && dst_bps == 32) {
+            memcpy (dst, src[0], nframes * sizeof (int32_t));
+            return;
+        }
+#if USE_AVX2
+        if (_have_avx2 ()) {
+            done = _pack_mono_int32_avx2 (dst, dst_bps, src[0], src_shift, nframes);
+        }
+#elif USE_NEON
+        done = _pack_mono_int32_neon (dst, dst_bps, src[0], src_shift, nframes);
+#endif
+    }
+    else if (channels == 2 && src_stride == 1) {
+#if USE_AVX2
+        if (_have_avx2 ()) {
+            done = _interleave_stereo_int32_avx2 (dst, dst_bps, src[0], src[1], src_shift, nframes);
+        }
+#elif USE_NEON
+        done = _interleave_stereo_int32_neon (dst, dst_bps, src[0], src[1], src_shift, nframes);
+#endif
+    }
+
+    if (done < nframes) {
+        const int32_t *tail[channels];
+        for (int c = 0; c < channels; c++) {
+            tail[c] = src[c] + done * src_stride;
+        }
+        _interleave_int32_generic (dst + done * channels * (dst_bps / 8), dst_bps, tail, src_stride, src_shift, channels, nframes - done);
+    }
+}
+
+void
+pcm_interleave_float32 (char *dst, int dst_bps, int dst_is_float, const float * const *src, int src_stride, int channels, int nframes) {
+    if (dst_is_float) {
+        dst_bps = 32;
+    }
+    else if (dst_bps != 8 && dst_bps != 16 && dst_bps != 24 && dst_bps != 32) {
+        return;
+    }
+
+    if (channels > 1 && src_stride == channels) {
+        int c;
+        for (c = 1; c < channels && src[c] == src[0] + c; c++);
+        if (c == channels) {
+            nframes *= channels;
+            channels = 1;
+            src_stride = 1;
+        }
+    }
+
+    int done = 0;
+    if (channels == 2 && src_stride == 1) {
+#if USE_AVX2
+        if (_have_avx2 ()) {
+            done = _interleave_stereo_float32_avx2 (dst, dst_bps, dst_is_float, src[0], src[1], nframes);
+        }
+#elif USE_NEON
+        done = _interleave_stereo_float32_neon (dst, dst_bps, dst_is_float, src[0], src[1], nframes);
+#endif
+    }
+    else if (channels == 1 && src_stride == 1 && dst_is_float) {
+        memcpy (dst, src[0], nframes * sizeof (float));
+        return;
+    }
+
+    if (done < nframes) {
+        const float *tail[channels];
+        for (int c = 0; c < channels; c++) {
+            tail[c] = src[c] + done * src_stride;
+        }
+        _interleave_float32_generic (dst + done * channels * (dst_bps / 8), dst_bps, dst_is_float, tail, src_stride, channels, nframes - done);
+    }
+}
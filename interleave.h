@@ -0,0 +1,45 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  routines for packing decoder output into interleaved PCM
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+#ifndef __INTERLEAVE_H
+#define __INTERLEAVE_H
+
+#include <stdint.h>
+
+// Write nframes of int32 samples from the channel arrays in src into dst,
+// as interleaved samples of dst_bps bits (8, 16, 24 or 32).
+// src_stride is the distance between two consecutive samples of a channel (1 for planar data),
+// src_shift is the left shift applied to each sample, e.g. to pad 20 bit samples to 24 bit.
+void
+pcm_interleave_int32 (char *dst, int dst_bps, const int32_t * const *src, int src_stride, int src_shift, int channels, int nframes);
+
+// Same for float samples, which are written as float if dst_is_float is set,
+// or converted to signed integers of dst_bps bits, with clipping.
+void
+pcm_interleave_float32 (char *dst, int dst_bps, int dst_is_float, const float * const *src, int src_stride, int channels, int nframes);
+
+#endif
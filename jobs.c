@@ -0,0 +1,361 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  job scheduler, running plugin and core jobs on a shared thread pool
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "jobs.h"
+#include "threading.h"
+
+// The scheduler is meant for coarse jobs, like processing a whole file,
+// so all queues are protected by a single lock.
+// Each worker has its own queues for the jobs submitted from inside of its jobs,
+// which it runs newest first, while idle workers take the oldest ones.
+
+#define MAX_WORKERS 32
+#define NUM_PRIORITIES 3
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+} job_state_t;
+
+struct job_s;
+
+typedef struct {
+    struct job_s *head;
+    struct job_s *tail;
+} job_queue_t;
+
+typedef struct job_s {
+    void (*fn) (ddb_job_t *job, void *ctx);
+    void *ctx;
+    ddb_job_priority_t priority;
+    job_state_t state;
+    int refc;
+    int cancelled;
+    job_queue_t *queue; // the queue where the job is waiting
+    struct job_s *prev;
+    struct job_s *next;
+} job_t;
+
+typedef struct {
+    intptr_t tid;
+    pthread_t self;
+    job_queue_t queues[NUM_PRIORITIES];
+} job_worker_t;
+
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _work_cond = PTHREAD_COND_INITIALIZER; // a job was queued
+static pthread_cond_t _done_cond = PTHREAD_COND_INITIALIZER; // a job has finished
+
+static job_queue_t _queues[NUM_PRIORITIES];
+static job_worker_t _workers[MAX_WORKERS];
+static int _num_workers;
+static int _max_workers;
+static int _idle_workers;
+static int _wakeups; // idle workers which were signalled, and have not woken up yet
+static int _running_background;
+static int _terminate;
+
+static void
+_queue_append (job_queue_t *queue, job_t *job) {
+    job->queue = queue;
+    job->prev = queue->tail;
+    job->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = job;
+    }
+    else {
+        queue->head = job;
+    }
+    queue->tail = job;
+}
+
+static job_t *
+_queue_remove (job_t *job) {
+    job_queue_t *queue = job->queue;
+    if (job->prev) {
+        job->prev->next = job->next;
+    }
+    else {
+        queue->head = job->next;
+    }
+    if (job->next) {
+        job->next->prev = job->prev;
+    }
+    else {
+        queue->tail = job->prev;
+    }
+    job->queue = NULL;
+    job->prev = job->next = NULL;
+    return job;
+}
+
+static void
+_job_unref (job_t *job) {
+    if (--job->refc == 0) {
+        free (job);
+    }
+}
+
+static job_worker_t *
+_current_worker (void) {
+    pthread_t self = pthread_self ();
+    for (int i = 0; i < _num_workers; i++) {
+        if (_workers[i].tid && pthread_equal (_workers[i].self, self)) {
+            return &_workers[i];
+        }
+    }
+    return NULL;
+}
+
+static job_t *
+_pick_job (job_worker_t *worker) {
+    for (int p = 0; p < NUM_PRIORITIES; p++) {
+        // keep one worker free from background jobs
+        if (p == DDB_JOB_PRIORITY_BACKGROUND && !_terminate && _running_background >= _max_workers - 1) {
+            break;
+        }
+        if (worker->queues[p].tail) {
+            return _queue_remove (worker->queues[p].tail);
+        }
+        if (_queues[p].head) {
+            return _queue_remove (_queues[p].head);
+        }
+        for (int i = 0; i < _num_workers; i++) {
+            if (_workers[i].queues[p].head) {
+                return _queue_remove (_workers[i].queues[p].head);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Runs the job with the lock held, and unlocks while the job function is executing
+static void
+_run_job (job_t *job) {
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock (&_mutex);
+    job->fn ((ddb_job_t *)job, job->ctx);
+    pthread_mutex_lock (&_mutex);
+    job->state = JOB_DONE;
+    pthread_cond_broadcast (&_done_cond);
+    _job_unref (job);
+}
+
+static void
+_worker_thread (void *ctx) {
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-jobs", 0, 0, 0, 0);
+#endif
+    job_worker_t *worker = ctx;
+
+    pthread_mutex_lock (&_mutex);
+    worker->self = pthread_self ();
+    for (;;) {
+        job_t *job = _pick_job (worker);
+        if (!job) {
+            if (_terminate) {
+                break;
+            }
+            _idle_workers++;
+            pthread_cond_wait (&_work_cond, &_mutex);
+            _idle_workers--;
+            if (_wakeups > 0) {
+                _wakeups--;
+            }
+            continue;
+        }
+
+        int background = job->priority == DDB_JOB_PRIORITY_BACKGROUND;
+        if (background) {
+            _running_background++;
+        }
+        _run_job (job);
+        if (background) {
+            _running_background--;
+        }
+    }
+    pthread_mutex_unlock (&_mutex);
+}
+
+// Wakes up an idle worker, or starts a new one, to run a queued job.
+// Returns 0 if all workers are busy, and no more can be started.
+static int
+_wake_worker (void) {
+    // an idle worker which was already signalled is taken by another job
+    if (_idle_workers > _wakeups) {
+        _wakeups++;
+        pthread_cond_signal (&_work_cond);
+        return 1;
+    }
+    if (_num_workers < _max_workers) {
+        job_worker_t *w = &_workers[_num_workers];
+        w->tid = thread_start (_worker_thread, w);
+        if (w->tid) {
+            _num_workers++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+jobs_init (void) {
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    _max_workers = ncpu < 2 ? 2 : ncpu > MAX_WORKERS ? MAX_WORKERS : (int)ncpu;
+    __atomic_store_n (&_terminate, 0, __ATOMIC_SEQ_CST);
+}
+
+void
+jobs_free (void) {
+    pthread_mutex_lock (&_mutex);
+    __atomic_store_n (&_terminate, 1, __ATOMIC_SEQ_CST);
+    for (int p = 0; p < NUM_PRIORITIES; p++) {
+        for (job_t *job = _queues[p].head; job; job = job->next) {
+            __atomic_store_n (&job->cancelled, 1, __ATOMIC_SEQ_CST);
+        }
+        for (int i = 0; i < _num_workers; i++) {
+            for (job_t *job = _workers[i].queues[p].head; job; job = job->next) {
+                __atomic_store_n (&job->cancelled, 1, __ATOMIC_SEQ_CST);
+            }
+        }
+    }
+    pthread_cond_broadcast (&_work_cond);
+    pthread_mutex_unlock (&_mutex);
+
+    // the workers run the remaining jobs, which are cancelled, and exit
+    for (int i = 0; i < _num_workers; i++) {
+        thread_join (_workers[i].tid);
+    }
+
+    pthread_mutex_lock (&_mutex);
+    memset (_workers, 0, sizeof (_workers));
+    _num_workers = 0;
+    _idle_workers = 0;
+    _wakeups = 0;
+    pthread_mutex_unlock (&_mutex);
+}
+
+ddb_job_t *
+job_submit (ddb_job_priority_t priority, void (*fn) (ddb_job_t *job, void *ctx), void *ctx) {
+    if (priority < 0 || priority >= NUM_PRIORITIES) {
+        priority = DDB_JOB_PRIORITY_BACKGROUND;
+    }
+
+    job_t *job = calloc (1, sizeof (job_t));
+    job->fn = fn;
+    job->ctx = ctx;
+    job->priority = priority;
+    job->refc = 2; // caller and scheduler
+
+    pthread_mutex_lock (&_mutex);
+
+    if (_terminate) {
+        // shutting down: let the job clean up right away
+        job->cancelled = 1;
+        _run_job (job);
+        pthread_mutex_unlock (&_mutex);
+        return (ddb_job_t *)job;
+    }
+
+    job_worker_t *worker = _current_worker ();
+    _queue_append (worker ? &worker->queues[priority] : &_queues[priority], job);
+
+    if (!_wake_worker () && !_num_workers) {
+        // no threads to run the job
+        _queue_remove (job);
+        _run_job (job);
+    }
+
+    pthread_mutex_unlock (&_mutex);
+    return (ddb_job_t *)job;
+}
+
+int
+job_wait (ddb_job_t *_job) {
+    job_t *job = (job_t *)_job;
+    pthread_mutex_lock (&_mutex);
+    if (job->state == JOB_QUEUED) {
+        job_worker_t *worker = _current_worker ();
+        int background = job->priority == DDB_JOB_PRIORITY_BACKGROUND;
+        _queue_remove (job);
+        if (worker && (!background || _running_background < _max_workers - 1)) {
+            // a worker blocked on a queued job could leave no threads to run it, so it runs the job instead
+            if (background) {
+                _running_background++;
+            }
+            _run_job (job);
+            if (background) {
+                _running_background--;
+            }
+        }
+        else {
+            // someone is blocked on the job, let the next free worker run it
+            job->priority = DDB_JOB_PRIORITY_HIGH;
+            _queue_append (&_queues[DDB_JOB_PRIORITY_HIGH], job);
+            if (_terminate || (!_wake_worker () && (worker || !_num_workers))) {
+                // no thread can take it, or the remaining jobs are being cancelled
+                _queue_remove (job);
+                _run_job (job);
+            }
+        }
+    }
+    while (job->state != JOB_DONE) {
+        pthread_cond_wait (&_done_cond, &_mutex);
+    }
+    int cancelled = __atomic_load_n (&job->cancelled, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock (&_mutex);
+    return cancelled ? -1 : 0;
+}
+
+void
+job_cancel (ddb_job_t *_job) {
+    job_t *job = (job_t *)_job;
+    __atomic_store_n (&job->cancelled, 1, __ATOMIC_SEQ_CST);
+}
+
+int
+job_is_cancelled (ddb_job_t *_job) {
+    job_t *job = (job_t *)_job;
+    return __atomic_load_n (&job->cancelled, __ATOMIC_SEQ_CST) || __atomic_load_n (&_terminate, __ATOMIC_SEQ_CST);
+}
+
+void
+job_release (ddb_job_t *_job) {
+    if (!_job) {
+        return;
+    }
+    pthread_mutex_lock (&_mutex);
+    _job_unref ((job_t *)_job);
+    pthread_mutex_unlock (&_mutex);
+}
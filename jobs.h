@@ -0,0 +1,57 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  job scheduler, running plugin and core jobs on a shared thread pool
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+
+#ifndef __JOBS_H
+#define __JOBS_H
+
+#include "deadbeef.h"
+
+void
+jobs_init (void);
+
+// Cancels the pending jobs, and waits for all jobs to finish.
+// Must be called after stopping the plugins, and before unloading them.
+void
+jobs_free (void);
+
+ddb_job_t *
+job_submit (ddb_job_priority_t priority, void (*fn) (ddb_job_t *job, void *ctx), void *ctx);
+
+int
+job_wait (ddb_job_t *job);
+
+void
+job_cancel (ddb_job_t *job);
+
+int
+job_is_cancelled (ddb_job_t *job);
+
+void
+job_release (ddb_job_t *job);
+
+#endif
@@ -25,6 +25,8 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "logger.h"
 #include "deadbeef.h"
 #include "threading.h"
@@ -49,6 +51,33 @@ static char *init_buffer_ptr;
 static char *init_buffer_info;
 static char *init_buffer_info_ptr;
 
+// The messages are formatted by the calling thread into a ring of fixed-size records,
+// and written to the console and the log viewers by the logger thread,
+// so that a slow terminal or log viewer can't block the streamer or output threads.
+// Any number of threads can add messages without locking (bounded MPMC queue by D. Vyukov),
+// and when the ring is full, the messages are dropped and counted.
+#define LOG_RING_SIZE 256 // must be power of 2
+#define LOG_TEXT_SIZE 2048
+
+typedef struct {
+    uint32_t seq;
+    uint32_t layers;
+    DB_plugin_t *plugin;
+    char text[LOG_TEXT_SIZE];
+} log_record_t;
+
+static log_record_t *_ring;
+static uint32_t _ring_head; // next record to write
+static uint32_t _ring_tail; // next record to read, only used by the logger thread
+static uint32_t _dropped;
+
+static intptr_t _logger_tid;
+static int _writers; // the threads between _log_reserve and _log_commit, which may still touch the ring
+static pthread_mutex_t _logger_cond_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _logger_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _writers_cond = PTHREAD_COND_INITIALIZER; // signaled when the last writer is done after the logger thread was stopped
+static int _logger_sleeping;
+static int _logger_terminate;
 
 #ifdef ANDROID
 #include <android/log.h>
@@ -56,17 +85,25 @@ static void
 console_write (const char *text) {
     __android_log_write(ANDROID_LOG_INFO,ANDROID_LOGGER_TAG,text);
 }
+
+static void
+console_flush (void) {
+}
 #else
 static void
 console_write (const char *text) {
     fwrite (text, strlen(text), 1, stderr);
+}
+
+static void
+console_flush (void) {
     fflush (stderr);
 }
 #endif
 
+// must be called with _mutex locked
 static void
-_log_internal (DB_plugin_t *plugin, uint32_t layers, const char *text) {
-    mutex_lock (_mutex);
+_log_deliver (DB_plugin_t *plugin, uint32_t layers, const char *text) {
     console_write (text);
     size_t len = strlen (text);
     for (logger_t *l = _loggers; l; l = l->next) {
@@ -86,9 +123,144 @@ _log_internal (DB_plugin_t *plugin, uint32_t layers, const char *text) {
             *init_buffer_info_ptr = 0;
         }
     }
+}
+
+// Unregisters a writer, see _log_reserve.
+// Once the logger thread is stopped, the last writer wakes up ddb_logger_free.
+static void
+_log_writer_done (void) {
+    if (__atomic_sub_fetch (&_writers, 1, __ATOMIC_SEQ_CST) == 0 && !__atomic_load_n (&_logger_tid, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock (&_logger_cond_mutex);
+        pthread_cond_broadcast (&_writers_cond);
+        pthread_mutex_unlock (&_logger_cond_mutex);
+    }
+}
+
+// Sets *prec to the record to be filled and passed to _log_commit,
+// or to NULL if the logger thread is not running, and the message has to be written directly.
+// Returns -1 if the ring is full.
+// A reserved record must be passed to _log_commit, which releases the ring.
+static int
+_log_reserve (log_record_t **prec) {
+    *prec = NULL;
+    // registered before checking the thread, so that ddb_logger_free can wait until the ring is not in use
+    __atomic_fetch_add (&_writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n (&_logger_tid, __ATOMIC_SEQ_CST)) {
+        _log_writer_done ();
+        return 0;
+    }
+    uint32_t pos = __atomic_load_n (&_ring_head, __ATOMIC_RELAXED);
+    for (;;) {
+        log_record_t *rec = &_ring[pos & (LOG_RING_SIZE-1)];
+        uint32_t seq = __atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n (&_ring_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *prec = rec;
+                return 0;
+            }
+        }
+        else if (diff < 0) {
+            _log_writer_done ();
+            return -1;
+        }
+        else {
+            pos = __atomic_load_n (&_ring_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void
+_log_commit (log_record_t *rec) {
+    uint32_t pos = __atomic_load_n (&rec->seq, __ATOMIC_RELAXED);
+    __atomic_store_n (&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+    // The logger thread sets the flag before checking the ring for the last time, and waits under the lock,
+    // so either it sees this record, or the signal is sent while it's waiting.
+    if (__atomic_load_n (&_logger_sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock (&_logger_cond_mutex);
+        pthread_cond_signal (&_logger_cond);
+        pthread_mutex_unlock (&_logger_cond_mutex);
+    }
+    _log_writer_done ();
+}
+
+static log_record_t *
+_log_peek (void) {
+    log_record_t *rec = &_ring[_ring_tail & (LOG_RING_SIZE-1)];
+    uint32_t seq = __atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE);
+    return seq == _ring_tail + 1 ? rec : NULL;
+}
+
+static void
+_log_release (log_record_t *rec) {
+    __atomic_store_n (&rec->seq, _ring_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    _ring_tail++;
+}
+
+static void
+_logger_thread (void *ctx) {
+    for (;;) {
+        log_record_t *rec = _log_peek ();
+        if (!rec) {
+            if (__atomic_load_n (&_logger_terminate, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            // Producers only signal while this flag is set, see _log_commit
+            pthread_mutex_lock (&_logger_cond_mutex);
+            __atomic_store_n (&_logger_sleeping, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence (__ATOMIC_SEQ_CST);
+            while (!_log_peek () && !__atomic_load_n (&_logger_terminate, __ATOMIC_SEQ_CST)) {
+                pthread_cond_wait (&_logger_cond, &_logger_cond_mutex);
+            }
+            __atomic_store_n (&_logger_sleeping, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock (&_logger_cond_mutex);
+            continue;
+        }
+
+        mutex_lock (_mutex);
+        do {
+            _log_deliver (rec->plugin, rec->layers, rec->text);
+            _log_release (rec);
+        } while ((rec = _log_peek ()));
+        uint32_t dropped = __atomic_exchange_n (&_dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            char text[100];
+            snprintf (text, sizeof (text), "logger: %u messages dropped\n", dropped);
+            _log_deliver (NULL, DDB_LOG_LAYER_DEFAULT, text);
+        }
+        console_flush ();
+        mutex_unlock (_mutex);
+    }
+}
+
+static void
+_log_internal (DB_plugin_t *plugin, uint32_t layers, const char *text) {
+    mutex_lock (_mutex);
+    _log_deliver (plugin, layers, text);
+    console_flush ();
     mutex_unlock(_mutex);
 }
 
+static void
+_log_format (DB_plugin_t *plugin, uint32_t layers, const char *fmt, va_list ap) {
+    log_record_t *rec;
+    if (_log_reserve (&rec) < 0) {
+        __atomic_fetch_add (&_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (rec) {
+        rec->plugin = plugin;
+        rec->layers = layers;
+        (void) vsnprintf(rec->text, sizeof (rec->text), fmt, ap);
+        _log_commit (rec);
+        return;
+    }
+
+    char text[LOG_TEXT_SIZE];
+    (void) vsnprintf(text, sizeof (text), fmt, ap);
+    _log_internal (plugin, layers, text);
+}
+
 static int
 _is_log_visible (DB_plugin_t *plugin, uint32_t layers) {
     if (plugin && !(plugin->flags&DDB_PLUGIN_FLAG_LOGGING)) {
@@ -111,6 +283,17 @@ ddb_logger_init (void) {
     init_buffer_ptr = init_buffer;
     init_buffer_info = calloc(1, INIT_BUFFER_SIZE);
     init_buffer_info_ptr = init_buffer_info;
+
+    // if the logger thread can't be started, messages are written directly
+    _ring = calloc (LOG_RING_SIZE, sizeof (log_record_t));
+    if (_ring) {
+        for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+            _ring[i].seq = i;
+        }
+        _ring_head = _ring_tail = 0;
+        _logger_terminate = 0;
+        __atomic_store_n (&_logger_tid, thread_start (_logger_thread, NULL), __ATOMIC_RELEASE);
+    }
     return 0;
 }
 
@@ -130,6 +313,25 @@ ddb_logger_stop_buffering (void) {
 
 void
 ddb_logger_free (void) {
+    intptr_t tid = __atomic_exchange_n (&_logger_tid, 0, __ATOMIC_SEQ_CST);
+    if (tid) {
+        // New messages are written directly from now on.
+        // The writers which got a record before that are in the middle of formatting a message, wait for them to commit.
+        // The check is done under the lock, which the last writer takes to signal, so the wakeup can't be missed.
+        pthread_mutex_lock (&_logger_cond_mutex);
+        while (__atomic_load_n (&_writers, __ATOMIC_SEQ_CST)) {
+            pthread_cond_wait (&_writers_cond, &_logger_cond_mutex);
+        }
+
+        // write out the queued messages, and quit
+        __atomic_store_n (&_logger_terminate, 1, __ATOMIC_SEQ_CST);
+        pthread_cond_signal (&_logger_cond);
+        pthread_mutex_unlock (&_logger_cond_mutex);
+        thread_join (tid);
+    }
+    free (_ring);
+    _ring = NULL;
+
     if (_mutex) {
         mutex_lock (_mutex);
 
@@ -150,13 +352,10 @@ ddb_log_detailed (DB_plugin_t *plugin, uint32_t layers, const char *fmt, ...) {
         return;
     }
 
-    char text[2048];
     va_list ap;
     va_start(ap, fmt);
-    (void) vsnprintf(text, sizeof (text), fmt, ap);
+    _log_format (plugin, layers, fmt, ap);
     va_end(ap);
-
-    _log_internal (plugin, layers, text);
 }
 
 void
@@ -165,29 +364,20 @@ ddb_vlog_detailed (DB_plugin_t *plugin, uint32_t layers, const char *fmt, va_lis
         return;
     }
 
-    char text[2048];
-    (void) vsnprintf(text, sizeof (text), fmt, ap);
-
-    _log_internal (plugin, layers, text);
+    _log_format (plugin, layers, fmt, ap);
 }
 
 void
 ddb_log (const char *fmt, ...) {
-    char text[2048];
     va_list ap;
     va_start(ap, fmt);
-    (void) vsnprintf(text, sizeof (text), fmt, ap);
+    _log_format (NULL, 0, fmt, ap);
     va_end(ap);
-
-    _log_internal (NULL, 0, text);
 }
 
 void
 ddb_vlog (const char *fmt, va_list ap) {
-    char text[2048];
-    (void) vsnprintf(text, sizeof (text), fmt, ap);
-
-    _log_internal (NULL, 0, text);
+    _log_format (NULL, 0, fmt, ap);
 }
 
 void
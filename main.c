@@ -86,6 +86,7 @@
 #include "playqueue.h"
 #include "tf.h"
 #include "logger.h"
+#include "metaloader.h"
 
 #ifdef OSX_APPBUNDLE
 #include "scriptable/scriptable.h"
@@ -999,6 +1000,9 @@ main_cleanup_and_quit (void) {
         server_tid = 0;
     }
 
+    // stop loading the deferred tracks, the rest will be loaded on the next start
+    metaloader_free ();
+
     // save config
     pl_save_all ();
     conf_save ();
@@ -1419,6 +1423,7 @@ main (int argc, char *argv[]) {
     streamer_playmodes_init ();
 
     pl_load_all ();
+    metaloader_queue_all ();
 
     // execute server commands in local context
     int noloadpl = 0;
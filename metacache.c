@@ -33,7 +33,8 @@
 typedef struct metacache_str_s {
     struct metacache_str_s *next;
     size_t value_length;
-    uint32_t refcount;
+    uint32_t hash;
+    uint32_t refcount; // must be located at str-5, see metacache_ref
     char cmpidx; // positive means "equals", negative means "notequals"
     char str[1];
 } metacache_str_t;
@@ -43,9 +44,13 @@ typedef struct {
     metacache_str_t *chain;
 } metacache_hash_t;
 
+// initial number of buckets, the table doubles when the average chain gets longer than MAX_LOAD_FACTOR
 #define HASH_SIZE 4096
+#define MAX_LOAD_FACTOR 2
 
-static metacache_hash_t hash[HASH_SIZE];
+static metacache_hash_t _initial_hash[HASH_SIZE];
+static metacache_hash_t *hash = _initial_hash;
+static uint32_t hash_size = HASH_SIZE;
 
 static uint32_t
 metacache_get_hash_sdbm (const char *str, size_t len) {
@@ -64,10 +69,10 @@ metacache_get_hash_sdbm (const char *str, size_t len) {
 
 static metacache_str_t *
 metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
-    metacache_hash_t *bucket = &hash[h];
+    metacache_hash_t *bucket = &hash[h & (hash_size-1)];
     metacache_str_t *chain = bucket->chain;
     while (chain) {
-        if (chain->value_length == len && !memcmp (chain->str, value, len)) {
+        if (chain->hash == h && chain->value_length == len && !memcmp (chain->str, value, len)) {
             return chain;
         }
         chain = chain->next;
@@ -79,23 +84,60 @@ static int n_strings = 0;
 static int n_inserts = 0;
 static int n_buckets = 0;
 
+static void
+metacache_grow (void) {
+    uint32_t new_size = hash_size * 2;
+    metacache_hash_t *new_hash = calloc (new_size, sizeof (metacache_hash_t));
+    if (!new_hash) {
+        return;
+    }
+    n_buckets = 0;
+    for (uint32_t i = 0; i < hash_size; i++) {
+        metacache_str_t *chain = hash[i].chain;
+        while (chain) {
+            metacache_str_t *next = chain->next;
+            metacache_hash_t *bucket = &new_hash[chain->hash & (new_size-1)];
+            if (!bucket->chain) {
+                n_buckets++;
+            }
+            chain->next = bucket->chain;
+            bucket->chain = chain;
+            chain = next;
+        }
+    }
+    if (hash != _initial_hash) {
+        free (hash);
+    }
+    hash = new_hash;
+    hash_size = new_size;
+}
+
 const char *
 metacache_add_value (const char *value, size_t len) {
+    return metacache_add_value_refs (value, len, 1);
+}
+
+const char *
+metacache_add_value_refs (const char *value, size_t len, uint32_t refcount) {
     //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
     uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    metacache_str_t *data = metacache_find_in_bucket (h, value, len);
     n_inserts++;
     if (data) {
-        data->refcount++;
+        data->refcount += refcount;
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
+    if (n_strings >= hash_size * MAX_LOAD_FACTOR) {
+        metacache_grow ();
+    }
+    metacache_hash_t *bucket = &hash[h & (hash_size-1)];
     if (!bucket->chain) {
         n_buckets++;
     }
     data = malloc (sizeof (metacache_str_t) + len);
     memset (data, 0, sizeof (metacache_str_t) + len);
-    data->refcount = 1;
+    data->refcount = refcount;
+    data->hash = h;
     memcpy (data->str, value, len);
     data->value_length = len;
     data->next = bucket->chain;
@@ -112,7 +154,7 @@ metacache_add_string (const char *str) {
 void
 metacache_remove_value (const char *value, size_t valuesize) {
     uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
+    metacache_hash_t *bucket = &hash[h & (hash_size-1)];
     metacache_str_t *chain = bucket->chain;
     metacache_str_t *prev = NULL;
     while (chain) {
@@ -126,6 +168,7 @@ metacache_remove_value (const char *value, size_t valuesize) {
                     bucket->chain = chain->next;
                 }
                 free (chain);
+                n_strings--;
             }
             break;
         }
@@ -161,7 +204,7 @@ metacache_get_string (const char *str) {
 const char *
 metacache_get_value (const char *value, size_t len) {
     uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    metacache_str_t *data = metacache_find_in_bucket (h, value, len);
     n_inserts++;
     if (data) {
         data->refcount++;
@@ -27,6 +27,9 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Adds a new NULL-terminated string, or finds an existing one
 const char *
 metacache_add_string (const char *str);
@@ -43,6 +46,10 @@ metacache_remove_string (const char *str);
 const char *
 metacache_add_value (const char *value, size_t valuesize);
 
+// Same as metacache_add_value, but adds `refcount` references at once
+const char *
+metacache_add_value_refs (const char *value, size_t valuesize, uint32_t refcount);
+
 // Returns an existing value of specified size, or NULL if it doesn't exist
 const char *
 metacache_get_value (const char *value, size_t valuesize);
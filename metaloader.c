@@ -0,0 +1,220 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  background loading of the metadata of deferred tracks
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metaloader.h"
+#include "jobs.h"
+
+// Deferred tracks are loaded in the order they were queued,
+// except for the requested ones (e.g. the visible rows), which are loaded first, newest first.
+// A requested track stays in the main queue too, and is skipped there once loaded.
+//
+// The lock order is playlist lock -> loader lock,
+// so no playlist functions (including pl_item_ref/unref) are called with the loader lock held.
+
+#define MAX_JOBS 2
+#define MAX_REQUESTED 128
+
+typedef struct metaloader_item_s {
+    playItem_t *it;
+    struct metaloader_item_s *next;
+} metaloader_item_t;
+
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _done_cond = PTHREAD_COND_INITIALIZER; // a job has exited
+static metaloader_item_t *_head;
+static metaloader_item_t *_tail;
+static playItem_t *_requested[MAX_REQUESTED];
+static int _num_requested;
+static int _running_jobs;
+static int _terminate;
+
+// Takes over the reference to the returned item
+static playItem_t *
+_pop_locked (void) {
+    if (_num_requested > 0) {
+        return _requested[--_num_requested];
+    }
+    metaloader_item_t *item = _head;
+    if (!item) {
+        return NULL;
+    }
+    _head = item->next;
+    if (!_head) {
+        _tail = NULL;
+    }
+    playItem_t *it = item->it;
+    free (item);
+    return it;
+}
+
+static void
+_metaloader_job (ddb_job_t *job, void *ctx) {
+    for (;;) {
+        pthread_mutex_lock (&_mutex);
+        playItem_t *it = NULL;
+        if (!_terminate && !job_is_cancelled (job)) {
+            it = _pop_locked ();
+        }
+        if (!it) {
+            _running_jobs--;
+            pthread_cond_broadcast (&_done_cond);
+            pthread_mutex_unlock (&_mutex);
+            return;
+        }
+        pthread_mutex_unlock (&_mutex);
+
+        pl_item_load_deferred (it);
+        pl_item_unref (it);
+    }
+}
+
+static void
+_start_job (void) {
+    pthread_mutex_lock (&_mutex);
+    if (_terminate || _running_jobs >= MAX_JOBS) {
+        pthread_mutex_unlock (&_mutex);
+        return;
+    }
+    _running_jobs++;
+    pthread_mutex_unlock (&_mutex);
+
+    // the job may run right away on this thread, so the lock must not be held here
+    job_release (job_submit (DDB_JOB_PRIORITY_BACKGROUND, _metaloader_job, NULL));
+}
+
+void
+metaloader_queue (playItem_t *it) {
+    metaloader_item_t *item = calloc (1, sizeof (metaloader_item_t));
+    if (!item) {
+        return;
+    }
+    pl_item_ref (it);
+    item->it = it;
+
+    pthread_mutex_lock (&_mutex);
+    if (_terminate) {
+        pthread_mutex_unlock (&_mutex);
+        pl_item_unref (it);
+        free (item);
+        return;
+    }
+    if (_tail) {
+        _tail->next = item;
+    }
+    else {
+        _head = item;
+    }
+    _tail = item;
+    pthread_mutex_unlock (&_mutex);
+
+    _start_job ();
+}
+
+void
+metaloader_queue_all (void) {
+    pl_lock ();
+    for (playlist_t *plt = plt_get_list (); plt; plt = plt->next) {
+        for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+            if (it->_flags & DDB_IS_DEFERRED) {
+                metaloader_queue (it);
+            }
+        }
+    }
+    pl_unlock ();
+}
+
+void
+metaloader_request (playItem_t *it) {
+    if (!(pl_get_item_flags (it) & DDB_IS_DEFERRED)) {
+        return;
+    }
+
+    pl_item_ref (it);
+    playItem_t *dropped = NULL;
+
+    pthread_mutex_lock (&_mutex);
+    if (_terminate) {
+        pthread_mutex_unlock (&_mutex);
+        pl_item_unref (it);
+        return;
+    }
+
+    // already requested: move to the top
+    int i;
+    for (i = 0; i < _num_requested; i++) {
+        if (_requested[i] == it) {
+            break;
+        }
+    }
+    if (i < _num_requested) {
+        dropped = it; // the extra reference
+        memmove (&_requested[i], &_requested[i+1], (_num_requested - i - 1) * sizeof (playItem_t *));
+        _num_requested--;
+    }
+    else if (_num_requested == MAX_REQUESTED) {
+        // forget the oldest request, the track is still in the main queue
+        dropped = _requested[0];
+        memmove (&_requested[0], &_requested[1], (_num_requested - 1) * sizeof (playItem_t *));
+        _num_requested--;
+    }
+    _requested[_num_requested++] = it;
+    pthread_mutex_unlock (&_mutex);
+
+    if (dropped) {
+        pl_item_unref (dropped);
+    }
+
+    _start_job ();
+}
+
+void
+metaloader_free (void) {
+    pthread_mutex_lock (&_mutex);
+    _terminate = 1;
+    while (_running_jobs > 0) {
+        pthread_cond_wait (&_done_cond, &_mutex);
+    }
+    metaloader_item_t *head = _head;
+    _head = _tail = NULL;
+    playItem_t *requested[MAX_REQUESTED];
+    int num_requested = _num_requested;
+    memcpy (requested, _requested, num_requested * sizeof (playItem_t *));
+    _num_requested = 0;
+    pthread_mutex_unlock (&_mutex);
+
+    while (head) {
+        metaloader_item_t *next = head->next;
+        pl_item_unref (head->it);
+        free (head);
+        head = next;
+    }
+    for (int i = 0; i < num_requested; i++) {
+        pl_item_unref (requested[i]);
+    }
+}
@@ -0,0 +1,51 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  background loading of the metadata of deferred tracks
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+#ifndef __METALOADER_H
+#define __METALOADER_H
+
+#include "playlist.h"
+
+// Stops the loader jobs, and drops the queued tracks.
+// The tracks which didn't load stay deferred, and are queued again on the next start.
+void
+metaloader_free (void);
+
+// Append a deferred track to the end of the loading queue.
+void
+metaloader_queue (playItem_t *it);
+
+// Queue all deferred tracks of all playlists, e.g. after loading the playlists.
+void
+metaloader_queue_all (void);
+
+// Load the track before the queued ones, e.g. when it becomes visible.
+// Does nothing for the tracks which are not deferred.
+void
+metaloader_request (playItem_t *it);
+
+#endif
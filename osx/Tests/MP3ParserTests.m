@@ -122,6 +122,27 @@
     XCTAssertEqual(info.pcmsample, 32256);
 }
 
+- (void)test_2secSquareNoXHSeekWithIndex_SameResultAsWithoutIndex {
+    mp3info_t info;
+    mp3info_t indexed_info;
+    mp3_seek_index_t index = {0};
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/2sec-square-nolamehdr.mp3", dbplugindir);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+    int res = mp3_parse_file_indexed (&indexed_info, MP3_PARSE_FULLSCAN, fp, fsize, 0, 0, -1, &index);
+    XCTAssert (!res);
+    XCTAssertEqual(index.complete, 1);
+    XCTAssertGreaterThan(index.count, 1);
+    res = mp3_parse_file_indexed (&indexed_info, 0, fp, fsize, 0, 0, 80000, &index);
+    XCTAssert (!res);
+    res = mp3_parse_file (&info, 0, fp, fsize, 0, 0, 80000);
+    XCTAssert (!res);
+    XCTAssertEqual(indexed_info.packet_offs, info.packet_offs);
+    XCTAssertEqual(indexed_info.pcmsample, info.pcmsample);
+    mp3_seek_index_free (&index);
+}
+
 // the file contains garbage/invalid data around the middle of the file, with packet markers.
 // we still expect the parser to deal with it
 - (void)test_2secSquareWithGarbage_Reports88200SamplesLength {
@@ -38,6 +38,10 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
+#include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
 #include <time.h>
@@ -70,6 +74,7 @@
 #include "sort.h"
 #include "cueutil.h"
 #include "playmodes.h"
+#include "metaloader.h"
 
 // disable custom title function, until we have new title formatting (0.7)
 #define DISABLE_CUSTOM_TITLE
@@ -96,6 +101,15 @@
 #define PLAYLIST_MAJOR_VER 1
 #define PLAYLIST_MINOR_VER 2
 
+// The playlist tabs stored in the config folder use a separate compact format (see plt_save_compact),
+// with a deduplicated string table and fixed-size track records,
+// optionally followed by a journal of changes (see _dbpl_journal_flush).
+// It has its own magic, so that older versions reject it instead of misparsing it as DBPL.
+// Playlists exported via plt_save keep using the DBPL format.
+#define PLAYLIST_COMPACT_MAGIC "DBPC"
+#define PLAYLIST_COMPACT_MAJOR_VER 1
+#define PLAYLIST_COMPACT_MINOR_VER 0
+
 #if (PLAYLIST_MINOR_VER<2)
 #error writing playlists in format <1.2 is not supported
 #endif
@@ -121,6 +135,10 @@ static playlist_t _dummy_playlist = {
 
 static int no_remove_notify;
 
+// background rewrite of a playlist file with a long journal
+static intptr_t _dbpl_compact_tid;
+static int _dbpl_compact_running;
+
 static playlist_t *addfiles_playlist; // current playlist for adding files/folders; set in pl_add_files_begin
 
 int conf_cue_prefer_embedded = 0;
@@ -173,6 +191,10 @@ pl_init (void) {
 
 void
 pl_free (void) {
+    if (_dbpl_compact_tid) {
+        thread_join (_dbpl_compact_tid);
+        _dbpl_compact_tid = 0;
+    }
     LOCK;
     playqueue_clear ();
     _plt_loading = 1;
@@ -678,10 +700,161 @@ plt_get_modification_idx (playlist_t *plt) {
     return idx;
 }
 
+// {{{ playlist journal, in-memory part
+// Changes made after a playlist was saved are recorded here, and appended to
+// the playlist file as a journal on the next save (see _dbpl_journal_flush),
+// instead of rewriting the whole file.
+
+enum {
+    DBPL_JOURNAL_INSERT = 1,
+    DBPL_JOURNAL_REMOVE = 2,
+    DBPL_JOURNAL_REPLACE = 3,
+    DBPL_JOURNAL_CLEAR = 4,
+    DBPL_JOURNAL_ORDER = 5,
+    DBPL_JOURNAL_PLT_META = 6,
+    DBPL_JOURNAL_COMMIT = 7,
+};
+
+#define DBPL_JOURNAL_NO_ID 0xffffffff
+
+typedef struct {
+    int type;
+    uint32_t id;
+    uint32_t after_id; // DBPL_JOURNAL_INSERT
+    playItem_t *it; // DBPL_JOURNAL_INSERT, DBPL_JOURNAL_REPLACE: the data is written at flush time
+    uint32_t *order; // DBPL_JOURNAL_ORDER
+    uint32_t order_count;
+} dbpl_journal_op_t;
+
+typedef struct dbpl_journal_s {
+    uint8_t header[32]; // copy of the file header, to make sure the journal is appended to the right file
+    uint64_t base_size; // size of the file without the journal
+    uint64_t size; // size of the journal
+    uint32_t next_id;
+    dbpl_journal_op_t *ops;
+    int op_count;
+    int op_alloc;
+    unsigned compacting : 1;
+    unsigned flush_requested : 1;
+} dbpl_journal_t;
+
+static void
+_dbpl_journal_clear_ops (dbpl_journal_t *j) {
+    for (int i = 0; i < j->op_count; i++) {
+        dbpl_journal_op_t *op = &j->ops[i];
+        if (op->it) {
+            op->it->journal_pending = 0;
+            pl_item_unref (op->it);
+        }
+        free (op->order);
+    }
+    j->op_count = 0;
+}
+
+static void
+_plt_journal_free (playlist_t *plt) {
+    if (plt->journal) {
+        _dbpl_journal_clear_ops (plt->journal);
+        free (plt->journal->ops);
+        free (plt->journal);
+        plt->journal = NULL;
+    }
+}
+
+static dbpl_journal_op_t *
+_plt_journal_add_op (playlist_t *plt, int type, uint32_t id) {
+    dbpl_journal_t *j = plt->journal;
+    if (j->op_count == j->op_alloc) {
+        int n = j->op_alloc ? j->op_alloc * 2 : 64;
+        dbpl_journal_op_t *ops = realloc (j->ops, n * sizeof (dbpl_journal_op_t));
+        if (!ops) {
+            // can't record the change, the next save will rewrite the file
+            _plt_journal_free (plt);
+            return NULL;
+        }
+        j->ops = ops;
+        j->op_alloc = n;
+    }
+    dbpl_journal_op_t *op = &j->ops[j->op_count++];
+    memset (op, 0, sizeof (dbpl_journal_op_t));
+    op->type = type;
+    op->id = id;
+    return op;
+}
+
+static void
+_plt_journal_item_inserted (playlist_t *plt, playItem_t *it) {
+    if (!plt->journal) {
+        return;
+    }
+    it->journal_id = plt->journal->next_id++;
+    playItem_t *prev = it->prev[PL_MAIN];
+    dbpl_journal_op_t *op = _plt_journal_add_op (plt, DBPL_JOURNAL_INSERT, it->journal_id);
+    if (op) {
+        op->after_id = prev ? prev->journal_id : DBPL_JOURNAL_NO_ID;
+        op->it = it;
+        pl_item_ref (it);
+        it->journal_pending = 1;
+    }
+}
+
+static void
+_plt_journal_item_removed (playlist_t *plt, playItem_t *it) {
+    if (plt->journal) {
+        _plt_journal_add_op (plt, DBPL_JOURNAL_REMOVE, it->journal_id);
+    }
+}
+
+void
+pl_item_journal_modified (playItem_t *it) {
+    if (!it->plt) {
+        return; // not in a playlist, nothing to record
+    }
+    LOCK;
+    playlist_t *plt = it->plt;
+    if (plt && plt->journal && !it->journal_pending) {
+        dbpl_journal_op_t *op = _plt_journal_add_op (plt, DBPL_JOURNAL_REPLACE, it->journal_id);
+        if (op) {
+            op->it = it;
+            pl_item_ref (it);
+            it->journal_pending = 1;
+        }
+    }
+    UNLOCK;
+}
+
+void
+plt_journal_order_changed (playlist_t *plt) {
+    LOCK;
+    if (plt->journal) {
+        uint32_t *order = malloc ((plt->count[PL_MAIN] ? plt->count[PL_MAIN] : 1) * sizeof (uint32_t));
+        if (!order) {
+            _plt_journal_free (plt);
+            UNLOCK;
+            return;
+        }
+        uint32_t n = 0;
+        for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+            order[n++] = it->journal_id;
+        }
+        dbpl_journal_op_t *op = _plt_journal_add_op (plt, DBPL_JOURNAL_ORDER, DBPL_JOURNAL_NO_ID);
+        if (op) {
+            op->order = order;
+            op->order_count = n;
+        }
+        else {
+            free (order);
+        }
+    }
+    UNLOCK;
+}
+// }}}
+
 void
 plt_free (playlist_t *plt) {
     LOCK;
 
+    _plt_journal_free (plt);
     plt_clear (plt);
 
     if (plt->title) {
@@ -837,9 +1010,16 @@ plt_move (int from, int to) {
 void
 plt_clear (playlist_t *plt) {
     pl_lock ();
+    // record a single clear instead of removing every item
+    dbpl_journal_t *journal = plt->journal;
+    plt->journal = NULL;
     while (plt->head[PL_MAIN]) {
         plt_remove_item (plt, plt->head[PL_MAIN]);
     }
+    plt->journal = journal;
+    if (plt->journal) {
+        _plt_journal_add_op (plt, DBPL_JOURNAL_CLEAR, DBPL_JOURNAL_NO_ID);
+    }
     plt->current_row[PL_MAIN] = -1;
     plt->current_row[PL_SEARCH] = -1;
     plt_modified (plt);
@@ -901,6 +1081,17 @@ fileadd_filter_test (ddb_file_found_data_t *data) {
     return 0;
 }
 
+// Inserts a track with just the URI and the decoder guess, to be loaded later by the metaloader
+static playItem_t *
+_plt_insert_deferred (playlist_t *plt, playItem_t *after, const char *fname, DB_decoder_t *decoder) {
+    playItem_t *it = pl_item_alloc_init (fname, decoder->plugin.id);
+    it->_flags |= DDB_IS_DEFERRED;
+    after = plt_insert_item (plt, after, it);
+    metaloader_queue (it);
+    pl_item_unref (it);
+    return after;
+}
+
 static playItem_t *
 plt_insert_file_int (
                      int visibility,
@@ -1088,7 +1279,13 @@ plt_insert_file_int (
 
                     file_recognized = 1;
 
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)plt, DB_PLAYITEM (after), fname);
+                    playItem_t *inserted;
+                    if (plt->defer_metadata) {
+                        inserted = _plt_insert_deferred (plt, after, fname, decoders[i]);
+                    }
+                    else {
+                        inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)plt, DB_PLAYITEM (after), fname);
+                    }
                     if (inserted != NULL) {
                         if (callback && callback (inserted, user_data) < 0) {
                             *pabort = 1;
@@ -1130,7 +1327,13 @@ plt_insert_file_int (
                     }
 
                     file_recognized = 1;
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)plt, DB_PLAYITEM (after), fname);
+                    playItem_t *inserted;
+                    if (plt->defer_metadata) {
+                        inserted = _plt_insert_deferred (plt, after, fname, decoders[i]);
+                    }
+                    else {
+                        inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)plt, DB_PLAYITEM (after), fname);
+                    }
                     if (inserted != NULL) {
                         if (callback && callback (inserted, user_data) < 0) {
                             *pabort = 1;
@@ -1453,6 +1656,163 @@ pl_add_files_end (void) {
     return plt_add_files_end (addfiles_playlist, 0);
 }
 
+// Shuffle order tree.
+// Playlist items are kept in a treap ordered by (shufflerating, address), with
+// the number of items and played items stored in every subtree. This lets the
+// streamer find the next/prev track in shuffle mode, or a random track, without
+// walking the whole playlist under the lock.
+// The tree is built on first query, and is kept up to date by insert/remove and
+// the played/shufflerating setters until the next reshuffle.
+
+static inline uint32_t
+_shuffle_priority (playItem_t *it) {
+    uint64_t h = (uint64_t)(uintptr_t)it;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+static inline int
+_shuffle_less (playItem_t *a, playItem_t *b) {
+    if (a->shufflerating != b->shufflerating) {
+        return a->shufflerating < b->shufflerating;
+    }
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+static inline void
+_shuffle_update (playItem_t *t) {
+    t->shuffle_count = 1;
+    t->shuffle_played = t->played;
+    if (t->shuffle_left) {
+        t->shuffle_count += t->shuffle_left->shuffle_count;
+        t->shuffle_played += t->shuffle_left->shuffle_played;
+    }
+    if (t->shuffle_right) {
+        t->shuffle_count += t->shuffle_right->shuffle_count;
+        t->shuffle_played += t->shuffle_right->shuffle_played;
+    }
+}
+
+// split t into the items ordered before key, and the rest
+static void
+_shuffle_split (playItem_t *t, playItem_t *key, playItem_t **l, playItem_t **r) {
+    if (!t) {
+        *l = *r = NULL;
+        return;
+    }
+    if (_shuffle_less (t, key)) {
+        _shuffle_split (t->shuffle_right, key, &t->shuffle_right, r);
+        *l = t;
+    }
+    else {
+        _shuffle_split (t->shuffle_left, key, l, &t->shuffle_left);
+        *r = t;
+    }
+    _shuffle_update (t);
+}
+
+static playItem_t *
+_shuffle_merge (playItem_t *l, playItem_t *r) {
+    if (!l) {
+        return r;
+    }
+    if (!r) {
+        return l;
+    }
+    if (_shuffle_priority (l) > _shuffle_priority (r)) {
+        l->shuffle_right = _shuffle_merge (l->shuffle_right, r);
+        _shuffle_update (l);
+        return l;
+    }
+    r->shuffle_left = _shuffle_merge (l, r->shuffle_left);
+    _shuffle_update (r);
+    return r;
+}
+
+static playItem_t *
+_shuffle_insert (playItem_t *t, playItem_t *it) {
+    if (!t || _shuffle_priority (it) > _shuffle_priority (t)) {
+        _shuffle_split (t, it, &it->shuffle_left, &it->shuffle_right);
+        _shuffle_update (it);
+        return it;
+    }
+    if (_shuffle_less (it, t)) {
+        t->shuffle_left = _shuffle_insert (t->shuffle_left, it);
+    }
+    else {
+        t->shuffle_right = _shuffle_insert (t->shuffle_right, it);
+    }
+    _shuffle_update (t);
+    return t;
+}
+
+static playItem_t *
+_shuffle_remove (playItem_t *t, playItem_t *it) {
+    if (!t) {
+        return NULL;
+    }
+    if (t == it) {
+        playItem_t *res = _shuffle_merge (t->shuffle_left, t->shuffle_right);
+        it->shuffle_left = it->shuffle_right = NULL;
+        return res;
+    }
+    if (_shuffle_less (it, t)) {
+        t->shuffle_left = _shuffle_remove (t->shuffle_left, it);
+    }
+    else {
+        t->shuffle_right = _shuffle_remove (t->shuffle_right, it);
+    }
+    _shuffle_update (t);
+    return t;
+}
+
+// recalculate the counters on the path to it, after its played flag changed
+static void
+_shuffle_touch (playItem_t *t, playItem_t *it) {
+    if (!t) {
+        return;
+    }
+    if (t != it) {
+        _shuffle_touch (_shuffle_less (it, t) ? t->shuffle_left : t->shuffle_right, it);
+    }
+    _shuffle_update (t);
+}
+
+static void
+_plt_shuffle_tree_insert (playlist_t *plt, playItem_t *it) {
+    if (plt->shuffle_tree_valid) {
+        plt->shuffle_root = _shuffle_insert (plt->shuffle_root, it);
+    }
+}
+
+static void
+_plt_shuffle_tree_remove (playlist_t *plt, playItem_t *it) {
+    if (plt->shuffle_tree_valid) {
+        plt->shuffle_root = _shuffle_remove (plt->shuffle_root, it);
+    }
+}
+
+static void
+_plt_shuffle_tree_invalidate (playlist_t *plt) {
+    plt->shuffle_root = NULL;
+    plt->shuffle_tree_valid = 0;
+}
+
+static void
+_plt_shuffle_tree_build (playlist_t *plt) {
+    if (plt->shuffle_tree_valid) {
+        return;
+    }
+    plt->shuffle_root = NULL;
+    plt->shuffle_tree_valid = 1;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        it->shuffle_left = it->shuffle_right = NULL;
+        _plt_shuffle_tree_insert (plt, it);
+    }
+}
+
 int
 plt_remove_item (playlist_t *playlist, playItem_t *it) {
     if (!it)
@@ -1465,6 +1825,11 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
 
     // remove from both lists
     LOCK;
+    if (it->plt == playlist) {
+        _plt_shuffle_tree_remove (playlist, it);
+        _plt_journal_item_removed (playlist, it);
+        it->plt = NULL;
+    }
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
         if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
             playlist->count[iter]--;
@@ -1613,6 +1978,35 @@ pl_get_idx_of_iter (playItem_t *it, int iter) {
     return idx;
 }
 
+static const char *
+_pl_item_album_artist (playItem_t *it) {
+    const char *aa = pl_find_meta_raw (it, "band");
+    if (!aa) {
+        aa = pl_find_meta_raw (it, "album artist");
+    }
+    if (!aa) {
+        aa = pl_find_meta_raw (it, "albumartist");
+    }
+    return aa;
+}
+
+// tracks of the same album get the same rating in album shuffle mode
+static void
+_plt_item_init_shufflerating (playItem_t *it) {
+    playItem_t *prev = it->prev[PL_MAIN];
+    if (streamer_get_shuffle () == DDB_SHUFFLE_ALBUMS && prev && pl_find_meta_raw (prev, "album") == pl_find_meta_raw (it, "album")) {
+        const char *aa = _pl_item_album_artist (it);
+        const char *prev_aa = _pl_item_album_artist (prev);
+        if ((aa && prev_aa && aa == prev_aa) || pl_find_meta_raw (prev, "artist") == pl_find_meta_raw (it, "artist")) {
+            it->shufflerating = prev->shufflerating;
+            it->played = 0;
+            return;
+        }
+    }
+    it->shufflerating = rand ();
+    it->played = 0;
+}
+
 playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     LOCK;
@@ -1640,35 +2034,13 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
         }
     }
     it->in_playlist = 1;
+    it->plt = playlist;
 
     playlist->count[PL_MAIN]++;
 
-    // shuffle
-    playItem_t *prev = it->prev[PL_MAIN];
-    const char *aa = NULL, *prev_aa = NULL;
-    if (prev) {
-        aa = pl_find_meta_raw (it, "band");
-        if (!aa) {
-            aa = pl_find_meta_raw (it, "album artist");
-        }
-        if (!aa) {
-            aa = pl_find_meta_raw (it, "albumartist");
-        }
-        prev_aa = pl_find_meta_raw (prev, "band");
-        if (!prev_aa) {
-            prev_aa = pl_find_meta_raw (prev, "album artist");
-        }
-        if (!prev_aa) {
-            prev_aa = pl_find_meta_raw (prev, "albumartist");
-        }
-    }
-    if (streamer_get_shuffle () == DDB_SHUFFLE_ALBUMS && prev && pl_find_meta_raw (prev, "album") == pl_find_meta_raw (it, "album") && ((aa && prev_aa && aa == prev_aa) || pl_find_meta_raw (prev, "artist") == pl_find_meta_raw (it, "artist"))) {
-        it->shufflerating = prev->shufflerating;
-    }
-    else {
-        it->shufflerating = rand ();
-    }
-    it->played = 0;
+    _plt_item_init_shufflerating (it);
+    _plt_shuffle_tree_insert (playlist, it);
+    _plt_journal_item_inserted (playlist, it);
 
     // totaltime
     float dur = pl_get_item_duration (it);
@@ -1682,6 +2054,32 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     return it;
 }
 
+// Appends an item with existing reference to the end of the playlist, without sending notifications.
+// Must be called with the playlist lock held.
+static void
+_plt_append_item (playlist_t *playlist, playItem_t *it) {
+    it->next[PL_MAIN] = NULL;
+    it->prev[PL_MAIN] = playlist->tail[PL_MAIN];
+    if (playlist->tail[PL_MAIN]) {
+        playlist->tail[PL_MAIN]->next[PL_MAIN] = it;
+    }
+    else {
+        playlist->head[PL_MAIN] = it;
+    }
+    playlist->tail[PL_MAIN] = it;
+    it->in_playlist = 1;
+    it->plt = playlist;
+    playlist->count[PL_MAIN]++;
+
+    _plt_item_init_shufflerating (it);
+    _plt_shuffle_tree_insert (playlist, it);
+    _plt_journal_item_inserted (playlist, it);
+
+    if (it->_duration > 0) {
+        playlist->totaltime += it->_duration;
+    }
+}
+
 playItem_t *
 pl_insert_item (playItem_t *after, playItem_t *it) {
     return plt_insert_item (addfiles_playlist ? addfiles_playlist : _current_playlist, after, it);
@@ -1725,108 +2123,1412 @@ pl_item_alloc_init (const char *fname, const char *decoder_id) {
     return it;
 }
 
-void
-pl_item_ref (playItem_t *it) {
-    LOCK;
-    it->_refc++;
-    //fprintf (stderr, "\033[0;34m+it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    UNLOCK;
-}
+void
+pl_item_ref (playItem_t *it) {
+    LOCK;
+    it->_refc++;
+    //fprintf (stderr, "\033[0;34m+it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
+    UNLOCK;
+}
+
+static void
+pl_item_free (playItem_t *it) {
+    LOCK;
+    if (it) {
+        while (it->meta) {
+            pl_meta_free_values (it->meta);
+            DB_metaInfo_t *m = it->meta;
+            it->meta = m->next;
+            free (m);
+        }
+
+        free (it);
+    }
+    UNLOCK;
+}
+
+void
+pl_item_unref (playItem_t *it) {
+    LOCK;
+    it->_refc--;
+    //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
+    if (it->_refc < 0) {
+        trace ("\033[0;31mplaylist: bad refcount on item %p\033[37;0m\n", it);
+        assert(0);
+    }
+    if (it->_refc <= 0) {
+        //printf ("\033[0;31mdeleted %s\033[37;0m\n", pl_find_meta_raw (it, ":URI"));
+        pl_item_free (it);
+    }
+    UNLOCK;
+}
+
+int
+plt_delete_selected (playlist_t *playlist) {
+    LOCK;
+    int i = 0;
+    int ret = -1;
+    playItem_t *next = NULL;
+    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = next, i++) {
+        next = it->next[PL_MAIN];
+        if (it->selected) {
+            if (ret == -1) {
+                ret = i;
+            }
+            plt_remove_item (playlist, it);
+        }
+    }
+    if (playlist->current_row[PL_MAIN] >= playlist->count[PL_MAIN]) {
+        playlist->current_row[PL_MAIN] = playlist->count[PL_MAIN] - 1;
+    }
+    if (playlist->current_row[PL_SEARCH] >= playlist->count[PL_SEARCH]) {
+        playlist->current_row[PL_SEARCH] = playlist->count[PL_SEARCH] - 1;
+    }
+    UNLOCK;
+    return ret;
+}
+
+int
+pl_delete_selected (void) {
+    LOCK;
+    int ret = plt_delete_selected (_current_playlist);
+    UNLOCK;
+    return ret;
+}
+
+void
+plt_crop_selected (playlist_t *playlist) {
+    LOCK;
+    playItem_t *next = NULL;
+    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = next) {
+        next = it->next[PL_MAIN];
+        if (!it->selected) {
+            plt_remove_item (playlist, it);
+        }
+    }
+    UNLOCK;
+}
+
+void
+pl_crop_selected (void) {
+    LOCK;
+    plt_crop_selected (_current_playlist);
+    UNLOCK;
+}
+
+static uint16_t
+length_to_uint16 (size_t len) {
+    return (uint16_t)min(0xffff, len);
+}
+
+static uint8_t
+length_to_uint8 (size_t len) {
+    return (uint8_t)min(0xff, len);
+}
+
+// {{{ compact playlist format (1.3)
+//
+// The whole file consists of fixed-size tables, and can be mapped into memory and loaded in bulk.
+// All metadata keys and values are deduplicated into a single string table,
+// and referenced by index from the track and playlist metadata tables.
+//
+// header
+// dbpl_string_t[string_count]
+// dbpl_track_t[track_count]
+// dbpl_meta_pair_t[meta_count] -- metadata of all tracks, in track order
+// dbpl_meta_pair_t[plt_meta_count] -- playlist metadata
+// string data, strings_size bytes
+// journal, until the end of the file
+
+typedef struct {
+    char magic[4];
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t reserved;
+    uint32_t track_count;
+    uint32_t string_count;
+    uint32_t meta_count;
+    uint32_t plt_meta_count;
+    uint64_t strings_size;
+} dbpl_header_t;
+
+typedef struct {
+    uint32_t offs;
+    uint32_t size; // including the terminating 0
+} dbpl_string_t;
+
+#define DBPL_TRACK_HAS_STARTSAMPLE64 1
+#define DBPL_TRACK_HAS_ENDSAMPLE64 2
+
+typedef struct {
+    int32_t startsample;
+    int32_t endsample;
+    int64_t startsample64;
+    int64_t endsample64;
+    float duration;
+    uint32_t flags;
+    uint32_t meta_count;
+    uint32_t track_flags;
+} dbpl_track_t;
+
+typedef struct {
+    uint32_t key;
+    uint32_t value;
+} dbpl_meta_pair_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    int mapped;
+
+    const dbpl_header_t *header;
+    const dbpl_string_t *strings;
+    const dbpl_track_t *tracks;
+    const dbpl_meta_pair_t *meta;
+    const dbpl_meta_pair_t *plt_meta;
+    const char *string_data;
+    uint64_t base_size; // size of the data before the journal
+    const uint8_t *journal;
+    uint64_t journal_size;
+
+    uint32_t *refs; // number of references to each string
+    playItem_t **items; // items with empty metadata nodes, to be filled by _dbpl_compact_link
+} dbpl_compact_t;
+
+static void
+_dbpl_compact_free (dbpl_compact_t *pl) {
+    if (pl->items) {
+        for (uint32_t i = 0; i < pl->header->track_count; i++) {
+            playItem_t *it = pl->items[i];
+            if (!it) {
+                continue;
+            }
+            while (it->meta) {
+                DB_metaInfo_t *m = it->meta;
+                it->meta = m->next;
+                free (m);
+            }
+            free (it);
+        }
+        free (pl->items);
+    }
+    free (pl->refs);
+    if (pl->mapped) {
+        munmap (pl->data, pl->size);
+    }
+    else {
+        free (pl->data);
+    }
+    free (pl);
+}
+
+static int
+_dbpl_compact_validate (dbpl_compact_t *pl) {
+    const dbpl_header_t *hdr = pl->header;
+
+    uint64_t offs = sizeof (dbpl_header_t);
+    pl->strings = (const dbpl_string_t *)(pl->data + offs);
+    offs += (uint64_t)hdr->string_count * sizeof (dbpl_string_t);
+    pl->tracks = (const dbpl_track_t *)(pl->data + offs);
+    offs += (uint64_t)hdr->track_count * sizeof (dbpl_track_t);
+    pl->meta = (const dbpl_meta_pair_t *)(pl->data + offs);
+    offs += (uint64_t)hdr->meta_count * sizeof (dbpl_meta_pair_t);
+    pl->plt_meta = (const dbpl_meta_pair_t *)(pl->data + offs);
+    offs += (uint64_t)hdr->plt_meta_count * sizeof (dbpl_meta_pair_t);
+    pl->string_data = (const char *)(pl->data + offs);
+    offs += hdr->strings_size;
+    if (offs > pl->size) {
+        return -1;
+    }
+    pl->base_size = offs;
+    pl->journal = pl->data + offs;
+    pl->journal_size = pl->size - offs;
+
+    for (uint32_t i = 0; i < hdr->string_count; i++) {
+        const dbpl_string_t *s = &pl->strings[i];
+        if (s->size == 0 || (uint64_t)s->offs + s->size > hdr->strings_size || pl->string_data[s->offs + s->size - 1]) {
+            return -1;
+        }
+    }
+
+    uint64_t meta_count = 0;
+    for (uint32_t i = 0; i < hdr->track_count; i++) {
+        meta_count += pl->tracks[i].meta_count;
+    }
+    if (meta_count != hdr->meta_count) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < hdr->meta_count + hdr->plt_meta_count; i++) {
+        const dbpl_meta_pair_t *m = &pl->meta[i];
+        if (m->key >= hdr->string_count || m->value >= hdr->string_count) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Maps the file and prepares all tracks, without touching any playlist or metacache state,
+// so it can be called from any thread without holding the playlist lock.
+// Returns 0 on success, 1 if the file is not in the compact format, -1 on error.
+static int
+_dbpl_compact_open (const char *fname, dbpl_compact_t **result) {
+    *result = NULL;
+
+    int fd = open (fname, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat (fd, &st)) {
+        close (fd);
+        return -1;
+    }
+
+    // too short for the compact header, but can be a small DBPL file
+    dbpl_header_t hdr;
+    if (st.st_size < sizeof (dbpl_header_t) || read (fd, &hdr, sizeof (hdr)) != sizeof (hdr)) {
+        close (fd);
+        return 1;
+    }
+    if (strncmp (hdr.magic, PLAYLIST_COMPACT_MAGIC, 4)) {
+        close (fd);
+        return 1;
+    }
+    if (hdr.majorver != PLAYLIST_COMPACT_MAJOR_VER) {
+        close (fd);
+        return -1;
+    }
+
+    dbpl_compact_t *pl = calloc (1, sizeof (dbpl_compact_t));
+    pl->size = st.st_size;
+#ifndef __MINGW32__
+    pl->data = mmap (NULL, pl->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pl->data != MAP_FAILED) {
+        pl->mapped = 1;
+        // the advice values are not flags, and can't be combined
+        madvise (pl->data, pl->size, MADV_SEQUENTIAL);
+        madvise (pl->data, pl->size, MADV_WILLNEED);
+    }
+    else
+#endif
+    {
+        pl->data = malloc (pl->size);
+        if (!pl->data || pread (fd, pl->data, pl->size, 0) != pl->size) {
+            free (pl->data);
+            pl->data = NULL;
+        }
+    }
+    close (fd);
+    if (!pl->data) {
+        free (pl);
+        return -1;
+    }
+
+    pl->header = (const dbpl_header_t *)pl->data;
+    if (_dbpl_compact_validate (pl)) {
+        _dbpl_compact_free (pl);
+        return -1;
+    }
+
+    const dbpl_header_t *h = pl->header;
+    pl->refs = calloc (h->string_count ? h->string_count : 1, sizeof (uint32_t));
+    pl->items = calloc (h->track_count ? h->track_count : 1, sizeof (playItem_t *));
+    if (!pl->refs || !pl->items) {
+        _dbpl_compact_free (pl);
+        return -1;
+    }
+
+    const dbpl_meta_pair_t *m = pl->meta;
+    for (uint32_t i = 0; i < h->track_count; i++) {
+        const dbpl_track_t *trk = &pl->tracks[i];
+        playItem_t *it = pl_item_alloc ();
+        it->startsample = trk->startsample;
+        it->endsample = trk->endsample;
+        it->startsample64 = trk->startsample64;
+        it->endsample64 = trk->endsample64;
+        it->has_startsample64 = (trk->track_flags & DBPL_TRACK_HAS_STARTSAMPLE64) ? 1 : 0;
+        it->has_endsample64 = (trk->track_flags & DBPL_TRACK_HAS_ENDSAMPLE64) ? 1 : 0;
+        it->_duration = trk->duration;
+        it->_flags = trk->flags;
+
+        DB_metaInfo_t *tail = NULL;
+        for (uint32_t j = 0; j < trk->meta_count; j++, m++) {
+            DB_metaInfo_t *meta = calloc (1, sizeof (DB_metaInfo_t));
+            if (tail) {
+                tail->next = meta;
+            }
+            else {
+                it->meta = meta;
+            }
+            tail = meta;
+            pl->refs[m->key]++;
+            pl->refs[m->value]++;
+        }
+        pl->items[i] = it;
+    }
+
+    *result = pl;
+    return 0;
+}
+
+// Interns the strings, and appends the prepared tracks to the end of the playlist.
+// Returns the last added item, or NULL if nothing was added.
+static playItem_t *
+_dbpl_compact_link (playlist_t *plt, dbpl_compact_t *pl) {
+    const dbpl_header_t *h = pl->header;
+    LOCK;
+    const char **interned = malloc ((h->string_count ? h->string_count : 1) * sizeof (const char *));
+    for (uint32_t i = 0; i < h->string_count; i++) {
+        const dbpl_string_t *s = &pl->strings[i];
+        interned[i] = pl->refs[i] ? metacache_add_value_refs (pl->string_data + s->offs, s->size, pl->refs[i]) : NULL;
+    }
+
+    const dbpl_meta_pair_t *pair = pl->meta;
+    for (uint32_t i = 0; i < h->track_count; i++) {
+        playItem_t *it = pl->items[i];
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next, pair++) {
+            m->key = interned[pair->key];
+            m->value = interned[pair->value];
+            m->valuesize = pl->strings[pair->value].size;
+        }
+        _plt_append_item (plt, it);
+        pl->items[i] = NULL; // the playlist owns the reference now
+    }
+    if (h->track_count) {
+        plt_modified (plt);
+    }
+
+    for (uint32_t i = 0; i < h->plt_meta_count; i++) {
+        pair = &pl->plt_meta[i];
+        plt_add_meta (plt, pl->string_data + pl->strings[pair->key].offs, pl->string_data + pl->strings[pair->value].offs);
+    }
+    free (interned);
+    playItem_t *last = h->track_count ? plt->tail[PL_MAIN] : NULL;
+    UNLOCK;
+    return last;
+}
+
+typedef struct {
+    dbpl_string_t *strings;
+    const char **string_ptrs;
+    uint32_t string_count;
+    uint32_t strings_allocated;
+    uint64_t strings_size;
+
+    // open addressing hash of metacache pointers to string indexes
+    const char **hash_keys;
+    uint32_t *hash_values;
+    uint32_t hash_size;
+
+    dbpl_meta_pair_t *meta;
+    uint32_t meta_count;
+    uint32_t meta_allocated;
+} dbpl_writer_t;
+
+static uint32_t
+_dbpl_ptr_hash (const char *ptr) {
+    uintptr_t h = (uintptr_t)ptr;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return (uint32_t)h;
+}
+
+static int
+_dbpl_writer_grow_hash (dbpl_writer_t *w) {
+    uint32_t size = w->hash_size ? w->hash_size * 2 : 4096;
+    const char **keys = calloc (size, sizeof (const char *));
+    uint32_t *values = calloc (size, sizeof (uint32_t));
+    if (!keys || !values) {
+        free (keys);
+        free (values);
+        return -1;
+    }
+    for (uint32_t i = 0; i < w->hash_size; i++) {
+        if (!w->hash_keys[i]) {
+            continue;
+        }
+        uint32_t idx = _dbpl_ptr_hash (w->hash_keys[i]) & (size-1);
+        while (keys[idx]) {
+            idx = (idx + 1) & (size-1);
+        }
+        keys[idx] = w->hash_keys[i];
+        values[idx] = w->hash_values[i];
+    }
+    free (w->hash_keys);
+    free (w->hash_values);
+    w->hash_keys = keys;
+    w->hash_values = values;
+    w->hash_size = size;
+    return 0;
+}
+
+// all strings are owned by metacache, so equal strings have equal pointers
+static int64_t
+_dbpl_writer_add_string (dbpl_writer_t *w, const char *str, uint32_t size) {
+    if (w->string_count * 2 >= w->hash_size && _dbpl_writer_grow_hash (w)) {
+        return -1;
+    }
+    uint32_t idx = _dbpl_ptr_hash (str) & (w->hash_size-1);
+    while (w->hash_keys[idx]) {
+        if (w->hash_keys[idx] == str) {
+            return w->hash_values[idx];
+        }
+        idx = (idx + 1) & (w->hash_size-1);
+    }
+
+    if (w->strings_size + size > UINT32_MAX) {
+        return -1;
+    }
+    if (w->string_count == w->strings_allocated) {
+        uint32_t n = w->strings_allocated ? w->strings_allocated * 2 : 1024;
+        dbpl_string_t *strings = realloc (w->strings, n * sizeof (dbpl_string_t));
+        if (!strings) {
+            return -1;
+        }
+        w->strings = strings;
+        const char **ptrs = realloc (w->string_ptrs, n * sizeof (const char *));
+        if (!ptrs) {
+            return -1;
+        }
+        w->string_ptrs = ptrs;
+        w->strings_allocated = n;
+    }
+    w->strings[w->string_count].offs = (uint32_t)w->strings_size;
+    w->strings[w->string_count].size = size;
+    w->string_ptrs[w->string_count] = str;
+    w->strings_size += size;
+
+    w->hash_keys[idx] = str;
+    w->hash_values[idx] = w->string_count;
+    return w->string_count++;
+}
+
+static int
+_dbpl_writer_add_meta (dbpl_writer_t *w, const char *key, const char *value, uint32_t valuesize) {
+    int64_t k = _dbpl_writer_add_string (w, key, (uint32_t)strlen (key) + 1);
+    int64_t v = _dbpl_writer_add_string (w, value, valuesize);
+    if (k < 0 || v < 0) {
+        return -1;
+    }
+    if (w->meta_count == w->meta_allocated) {
+        uint32_t n = w->meta_allocated ? w->meta_allocated * 2 : 4096;
+        dbpl_meta_pair_t *meta = realloc (w->meta, n * sizeof (dbpl_meta_pair_t));
+        if (!meta) {
+            return -1;
+        }
+        w->meta = meta;
+        w->meta_allocated = n;
+    }
+    w->meta[w->meta_count].key = (uint32_t)k;
+    w->meta[w->meta_count].value = (uint32_t)v;
+    w->meta_count++;
+    return 0;
+}
+
+static void
+_dbpl_writer_free (dbpl_writer_t *w) {
+    free (w->strings);
+    free (w->string_ptrs);
+    free (w->hash_keys);
+    free (w->hash_values);
+    free (w->meta);
+}
+
+static inline int
+_dbpl_meta_is_saved (DB_metaInfo_t *m) {
+    // skip reserved names
+    return m->key[0] != '_' && m->key[0] != '!' && m->value && m->valuesize > 0;
+}
+
+static void
+_dbpl_track_init (dbpl_track_t *trk, playItem_t *it) {
+    memset (trk, 0, sizeof (dbpl_track_t));
+    trk->startsample = it->startsample;
+    trk->endsample = it->endsample;
+    trk->startsample64 = it->startsample64;
+    trk->endsample64 = it->endsample64;
+    trk->track_flags = (it->has_startsample64 ? DBPL_TRACK_HAS_STARTSAMPLE64 : 0) | (it->has_endsample64 ? DBPL_TRACK_HAS_ENDSAMPLE64 : 0);
+    trk->duration = it->_duration;
+    trk->flags = it->_flags;
+}
+
+typedef struct {
+    dbpl_header_t header;
+    dbpl_writer_t w;
+    dbpl_track_t *tracks;
+} dbpl_image_t;
+
+static void
+_dbpl_image_free (dbpl_image_t *img) {
+    free (img->tracks);
+    _dbpl_writer_free (&img->w);
+}
+
+static uint64_t
+_dbpl_image_size (dbpl_image_t *img) {
+    const dbpl_header_t *h = &img->header;
+    return sizeof (dbpl_header_t)
+        + (uint64_t)h->string_count * sizeof (dbpl_string_t)
+        + (uint64_t)h->track_count * sizeof (dbpl_track_t)
+        + (uint64_t)(h->meta_count + h->plt_meta_count) * sizeof (dbpl_meta_pair_t)
+        + h->strings_size;
+}
+
+// Collects everything to be written into memory, must be called with the playlist lock held.
+// The items get new journal ids, matching their order in the file.
+static int
+_dbpl_image_build (playlist_t *plt, dbpl_image_t *img) {
+    memset (img, 0, sizeof (dbpl_image_t));
+    img->tracks = calloc (plt->count[PL_MAIN] ? plt->count[PL_MAIN] : 1, sizeof (dbpl_track_t));
+    if (!img->tracks) {
+        return -1;
+    }
+
+    uint32_t n = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], n++) {
+        dbpl_track_t *trk = &img->tracks[n];
+        _dbpl_track_init (trk, it);
+        it->journal_id = n;
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            if (!_dbpl_meta_is_saved (m)) {
+                continue;
+            }
+            if (_dbpl_writer_add_meta (&img->w, m->key, m->value, m->valuesize)) {
+                goto fail;
+            }
+            trk->meta_count++;
+        }
+    }
+
+    uint32_t track_meta_count = img->w.meta_count;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        if (_dbpl_writer_add_meta (&img->w, m->key, m->value, (uint32_t)strlen (m->value) + 1)) {
+            goto fail;
+        }
+    }
+
+    dbpl_header_t *hdr = &img->header;
+    memcpy (hdr->magic, PLAYLIST_COMPACT_MAGIC, 4);
+    hdr->majorver = PLAYLIST_COMPACT_MAJOR_VER;
+    hdr->minorver = PLAYLIST_COMPACT_MINOR_VER;
+    hdr->track_count = n;
+    hdr->string_count = img->w.string_count;
+    hdr->meta_count = track_meta_count;
+    hdr->plt_meta_count = img->w.meta_count - track_meta_count;
+    hdr->strings_size = img->w.strings_size;
+    return 0;
+fail:
+    _dbpl_image_free (img);
+    return -1;
+}
+
+static int
+_dbpl_image_write (dbpl_image_t *img, const char *fname) {
+    const dbpl_header_t *hdr = &img->header;
+    FILE *fp = fopen (fname, "w+b");
+    if (!fp) {
+        return -1;
+    }
+    int err = 0;
+    if (fwrite (hdr, sizeof (dbpl_header_t), 1, fp) != 1
+        || fwrite (img->w.strings, sizeof (dbpl_string_t), img->w.string_count, fp) != img->w.string_count
+        || fwrite (img->tracks, sizeof (dbpl_track_t), hdr->track_count, fp) != hdr->track_count
+        || fwrite (img->w.meta, sizeof (dbpl_meta_pair_t), img->w.meta_count, fp) != img->w.meta_count) {
+        err = -1;
+    }
+    for (uint32_t i = 0; !err && i < img->w.string_count; i++) {
+        if (fwrite (img->w.string_ptrs[i], 1, img->w.strings[i].size, fp) != img->w.strings[i].size) {
+            err = -1;
+        }
+    }
+    if (fclose (fp)) {
+        err = -1;
+    }
+    if (err) {
+        unlink (fname);
+    }
+    return err;
+}
+
+// {{{ playlist journal, file part
+//
+// The journal is appended to the compact playlist file, right after the data described by the header.
+// Each save appends a batch of records, terminated by a commit record.
+// When loading, only the complete batches are applied, so a save interrupted by a crash
+// leaves the playlist in the state of the previous save.
+//
+// The records refer to the items by journal ids: the items of the file have ids equal to their index,
+// and every item inserted later gets the next free id.
+//
+// record payloads:
+// INSERT: uint32 id, uint32 id of the item to insert after (or DBPL_JOURNAL_NO_ID for the first position), track
+// REMOVE: uint32 id
+// REPLACE: uint32 id, track
+// CLEAR: no payload
+// ORDER: uint32 count, uint32 ids[count] -- the new order of all items
+// PLT_META: uint32 count, count * meta pair -- all playlist metadata
+// COMMIT: uint32 modification_idx
+//
+// track: dbpl_track_t, meta_count * meta pair
+// meta pair: uint32 keysize, uint32 valuesize, key, value -- sizes include the terminating 0
+
+// compact the journal in the background when it gets bigger than this,
+// and bigger than half of the rest of the file
+#define DBPL_JOURNAL_COMPACT_SIZE (1024*1024)
+
+typedef struct {
+    uint32_t type;
+    uint32_t size; // payload size
+    uint32_t checksum; // payload checksum
+} dbpl_journal_record_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t allocated;
+    int error;
+} dbpl_buffer_t;
+
+static uint32_t
+_dbpl_checksum (const uint8_t *data, size_t size) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void
+_dbpl_buffer_append (dbpl_buffer_t *b, const void *data, size_t size) {
+    if (b->error) {
+        return;
+    }
+    if (b->size + size > b->allocated) {
+        size_t n = b->allocated ? b->allocated : 4096;
+        while (n < b->size + size) {
+            n *= 2;
+        }
+        uint8_t *newdata = realloc (b->data, n);
+        if (!newdata) {
+            b->error = 1;
+            return;
+        }
+        b->data = newdata;
+        b->allocated = n;
+    }
+    memcpy (b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void
+_dbpl_buffer_append_uint32 (dbpl_buffer_t *b, uint32_t value) {
+    _dbpl_buffer_append (b, &value, sizeof (value));
+}
+
+static size_t
+_dbpl_journal_begin_record (dbpl_buffer_t *b, uint32_t type) {
+    size_t offs = b->size;
+    dbpl_journal_record_t rec = { .type = type };
+    _dbpl_buffer_append (b, &rec, sizeof (rec));
+    return offs;
+}
+
+static void
+_dbpl_journal_end_record (dbpl_buffer_t *b, size_t offs) {
+    if (b->error) {
+        return;
+    }
+    dbpl_journal_record_t rec;
+    memcpy (&rec, b->data + offs, sizeof (rec));
+    rec.size = (uint32_t)(b->size - offs - sizeof (rec));
+    rec.checksum = _dbpl_checksum (b->data + offs + sizeof (rec), rec.size);
+    memcpy (b->data + offs, &rec, sizeof (rec));
+}
+
+static void
+_dbpl_journal_write_pair (dbpl_buffer_t *b, const char *key, const char *value, uint32_t valuesize) {
+    uint32_t keysize = (uint32_t)strlen (key) + 1;
+    _dbpl_buffer_append_uint32 (b, keysize);
+    _dbpl_buffer_append_uint32 (b, valuesize);
+    _dbpl_buffer_append (b, key, keysize);
+    _dbpl_buffer_append (b, value, valuesize);
+}
+
+static void
+_dbpl_journal_write_track (dbpl_buffer_t *b, playItem_t *it) {
+    dbpl_track_t trk;
+    _dbpl_track_init (&trk, it);
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (_dbpl_meta_is_saved (m)) {
+            trk.meta_count++;
+        }
+    }
+    _dbpl_buffer_append (b, &trk, sizeof (trk));
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (_dbpl_meta_is_saved (m)) {
+            _dbpl_journal_write_pair (b, m->key, m->value, m->valuesize);
+        }
+    }
+}
+
+static void
+_plt_journal_init (playlist_t *plt, const dbpl_header_t *hdr, uint64_t base_size, uint64_t size, uint32_t next_id) {
+    if (!plt->journal) {
+        plt->journal = calloc (1, sizeof (dbpl_journal_t));
+        if (!plt->journal) {
+            return;
+        }
+    }
+    dbpl_journal_t *j = plt->journal;
+    _dbpl_journal_clear_ops (j);
+    memcpy (j->header, hdr, sizeof (dbpl_header_t));
+    j->base_size = base_size;
+    j->size = size;
+    j->next_id = next_id;
+    j->compacting = 0;
+    j->flush_requested = 0;
+}
+
+// Appends the recorded changes to the playlist file as one batch.
+// Must be called with the playlist lock held.
+static int
+_dbpl_journal_flush (playlist_t *plt, const char *fname) {
+    dbpl_journal_t *j = plt->journal;
+    dbpl_buffer_t b;
+    memset (&b, 0, sizeof (b));
+
+    for (int i = 0; i < j->op_count; i++) {
+        dbpl_journal_op_t *op = &j->ops[i];
+        size_t rec = _dbpl_journal_begin_record (&b, op->type);
+        switch (op->type) {
+        case DBPL_JOURNAL_INSERT:
+            _dbpl_buffer_append_uint32 (&b, op->id);
+            _dbpl_buffer_append_uint32 (&b, op->after_id);
+            _dbpl_journal_write_track (&b, op->it);
+            break;
+        case DBPL_JOURNAL_REPLACE:
+            _dbpl_buffer_append_uint32 (&b, op->id);
+            _dbpl_journal_write_track (&b, op->it);
+            break;
+        case DBPL_JOURNAL_REMOVE:
+            _dbpl_buffer_append_uint32 (&b, op->id);
+            break;
+        case DBPL_JOURNAL_ORDER:
+            _dbpl_buffer_append_uint32 (&b, op->order_count);
+            _dbpl_buffer_append (&b, op->order, op->order_count * sizeof (uint32_t));
+            break;
+        }
+        _dbpl_journal_end_record (&b, rec);
+    }
+
+    size_t rec = _dbpl_journal_begin_record (&b, DBPL_JOURNAL_PLT_META);
+    uint32_t plt_meta_count = 0;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        plt_meta_count++;
+    }
+    _dbpl_buffer_append_uint32 (&b, plt_meta_count);
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        _dbpl_journal_write_pair (&b, m->key, m->value, (uint32_t)strlen (m->value) + 1);
+    }
+    _dbpl_journal_end_record (&b, rec);
+
+    rec = _dbpl_journal_begin_record (&b, DBPL_JOURNAL_COMMIT);
+    _dbpl_buffer_append_uint32 (&b, (uint32_t)plt->modification_idx);
+    _dbpl_journal_end_record (&b, rec);
+
+    if (b.error) {
+        free (b.data);
+        return -1;
+    }
+
+    // make sure that the file is still the one the journal belongs to
+    int err = -1;
+    uint64_t offs = j->base_size + j->size;
+    int fd = open (fname, O_RDWR);
+    if (fd != -1) {
+        struct stat st;
+        uint8_t hdr[sizeof (dbpl_header_t)];
+        if (!fstat (fd, &st) && st.st_size >= offs
+            && pread (fd, hdr, sizeof (hdr), 0) == sizeof (hdr) && !memcmp (hdr, j->header, sizeof (hdr))
+            && pwrite (fd, b.data, b.size, offs) == b.size
+            && !ftruncate (fd, offs + b.size)) {
+            err = 0;
+        }
+        close (fd);
+    }
+    if (!err) {
+        j->size += b.size;
+        _dbpl_journal_clear_ops (j);
+        plt->last_save_modification_idx = plt->modification_idx;
+    }
+    free (b.data);
+    return err;
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} dbpl_reader_t;
+
+static int
+_dbpl_read (dbpl_reader_t *r, void *data, size_t size) {
+    if ((size_t)(r->end - r->p) < size) {
+        return -1;
+    }
+    memcpy (data, r->p, size);
+    r->p += size;
+    return 0;
+}
+
+static int
+_dbpl_read_pair (dbpl_reader_t *r, const char **key, const char **value, uint32_t *valuesize) {
+    uint32_t keysize;
+    if (_dbpl_read (r, &keysize, sizeof (keysize)) || _dbpl_read (r, valuesize, sizeof (uint32_t))) {
+        return -1;
+    }
+    if (!keysize || !*valuesize || (uint64_t)keysize + *valuesize > (uint64_t)(r->end - r->p)) {
+        return -1;
+    }
+    *key = (const char *)r->p;
+    *value = (const char *)r->p + keysize;
+    if ((*key)[keysize-1] || (*value)[*valuesize-1]) {
+        return -1;
+    }
+    r->p += keysize + *valuesize;
+    return 0;
+}
+
+static playItem_t *
+_dbpl_journal_read_track (dbpl_reader_t *r) {
+    dbpl_track_t trk;
+    if (_dbpl_read (r, &trk, sizeof (trk))) {
+        return NULL;
+    }
+    playItem_t *it = pl_item_alloc ();
+    it->startsample = trk.startsample;
+    it->endsample = trk.endsample;
+    it->startsample64 = trk.startsample64;
+    it->endsample64 = trk.endsample64;
+    it->has_startsample64 = (trk.track_flags & DBPL_TRACK_HAS_STARTSAMPLE64) ? 1 : 0;
+    it->has_endsample64 = (trk.track_flags & DBPL_TRACK_HAS_ENDSAMPLE64) ? 1 : 0;
+    it->_duration = trk.duration;
+    it->_flags = trk.flags;
+    // keep the saved order of the metadata
+    DB_metaInfo_t *tail = NULL;
+    for (uint32_t i = 0; i < trk.meta_count; i++) {
+        const char *key;
+        const char *value;
+        uint32_t valuesize;
+        if (_dbpl_read_pair (r, &key, &value, &valuesize)) {
+            pl_item_unref (it);
+            return NULL;
+        }
+        DB_metaInfo_t *m = calloc (1, sizeof (DB_metaInfo_t));
+        m->key = metacache_add_string (key);
+        m->value = metacache_add_value (value, valuesize);
+        m->valuesize = valuesize;
+        if (tail) {
+            tail->next = m;
+        }
+        else {
+            it->meta = m;
+        }
+        tail = m;
+    }
+    return it;
+}
+
+// moves the data of a track read from the journal, or of a loaded deferred track, into the existing item
+static void
+_dbpl_journal_replace_track (playlist_t *plt, playItem_t *it, playItem_t *from) {
+    it->startsample = from->startsample;
+    it->endsample = from->endsample;
+    it->startsample64 = from->startsample64;
+    it->endsample64 = from->endsample64;
+    it->has_startsample64 = from->has_startsample64;
+    it->has_endsample64 = from->has_endsample64;
+    it->_flags = from->_flags;
+    if (it->_duration > 0) {
+        plt->totaltime -= it->_duration;
+    }
+    if (from->_duration > 0) {
+        plt->totaltime += from->_duration;
+    }
+    if (plt->totaltime < 0) {
+        plt->totaltime = 0;
+    }
+    it->_duration = from->_duration;
+    while (it->meta) {
+        DB_metaInfo_t *m = it->meta;
+        it->meta = m->next;
+        metacache_remove_string (m->key);
+        pl_meta_free_values (m);
+        free (m);
+    }
+    it->meta = from->meta;
+    from->meta = NULL;
+}
+
+// returns 1 if the decoder claims the file by its extension, or by its file name prefix
+static int
+_decoder_matches_file (DB_decoder_t *decoder, const char *ext, const char *fn) {
+    if (decoder->exts) {
+        for (int e = 0; decoder->exts[e]; e++) {
+            if (!strcasecmp (decoder->exts[e], ext) || !strcmp (decoder->exts[e], "*")) {
+                return 1;
+            }
+        }
+    }
+    if (decoder->prefixes) {
+        for (int e = 0; decoder->prefixes[e]; e++) {
+            size_t len = strlen (decoder->prefixes[e]);
+            if (!strncasecmp (decoder->prefixes[e], fn, len) && fn[len] == '.') {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void
+pl_item_load_deferred (playItem_t *it) {
+    LOCK;
+    const char *uri = pl_find_meta_raw (it, ":URI");
+    if (!(it->_flags & DDB_IS_DEFERRED) || !it->plt || !uri) {
+        UNLOCK;
+        return;
+    }
+    char *fname = strdup (uri);
+    UNLOCK;
+
+    const char *fn = strrchr (fname, '/');
+    fn = fn ? fn + 1 : fname;
+    const char *ext = strrchr (fn, '.');
+    ext = ext ? ext + 1 : "";
+
+    // read the file the same way as plt_insert_file_int does, but into a temporary playlist
+    playlist_t *temp = plt_alloc ("deferred");
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (decoders[i]->insert && _decoder_matches_file (decoders[i], ext, fn)) {
+            if (decoders[i]->insert ((ddb_playlist_t *)temp, NULL, fname)) {
+                break;
+            }
+        }
+    }
+    free (fname);
+
+    int changed = 0;
+    int replaced = 0;
+
+    LOCK;
+    // the track might have been removed, or loaded by another thread meanwhile
+    playlist_t *plt = it->plt;
+    if (plt && (it->_flags & DDB_IS_DEFERRED)) {
+        changed = 1;
+        if (!temp->head[PL_MAIN]) {
+            // not readable: keep the track, the error will be reported on playback
+            it->_flags &= ~DDB_IS_DEFERRED;
+        }
+        else if (temp->count[PL_MAIN] == 1) {
+            _dbpl_journal_replace_track (plt, it, temp->head[PL_MAIN]);
+        }
+        else {
+            // e.g. a file with an embedded cuesheet: the tracks take the place of the deferred one
+            playItem_t *after = it;
+            while (temp->head[PL_MAIN]) {
+                playItem_t *track = temp->head[PL_MAIN];
+                pl_item_ref (track);
+                plt_remove_item (temp, track);
+                after = plt_insert_item (plt, after, track);
+                pl_item_unref (track);
+            }
+            plt_remove_item (plt, it);
+            replaced = 1;
+        }
+        if (!replaced) {
+            pl_item_journal_modified (it);
+            plt_modified (plt);
+        }
+    }
+    UNLOCK;
+
+    plt_free (temp);
+
+    if (replaced) {
+        messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    }
+    else if (changed) {
+        send_trackinfochanged (it);
+    }
+}
+
+typedef struct {
+    playItem_t **items;
+    uint32_t count;
+    uint32_t max_count;
+} dbpl_id_map_t;
+
+static int
+_dbpl_id_map_set (dbpl_id_map_t *map, uint32_t id, playItem_t *it) {
+    if (id >= map->max_count) {
+        return -1;
+    }
+    if (id >= map->count) {
+        playItem_t **items = realloc (map->items, (id + 1) * sizeof (playItem_t *));
+        if (!items) {
+            return -1;
+        }
+        memset (items + map->count, 0, (id + 1 - map->count) * sizeof (playItem_t *));
+        map->items = items;
+        map->count = id + 1;
+    }
+    map->items[id] = it;
+    return 0;
+}
+
+static playItem_t *
+_dbpl_id_map_get (dbpl_id_map_t *map, uint32_t id) {
+    return id < map->count ? map->items[id] : NULL;
+}
+
+static int
+_dbpl_journal_apply_record (playlist_t *plt, dbpl_id_map_t *map, playItem_t *prev, int replace_plt_meta, uint32_t type, dbpl_reader_t *r) {
+    uint32_t id;
+    switch (type) {
+    case DBPL_JOURNAL_INSERT: {
+        uint32_t after_id;
+        if (_dbpl_read (r, &id, sizeof (id)) || _dbpl_read (r, &after_id, sizeof (after_id))) {
+            return -1;
+        }
+        playItem_t *after = prev;
+        if (after_id != DBPL_JOURNAL_NO_ID) {
+            after = _dbpl_id_map_get (map, after_id);
+            if (!after) {
+                return -1;
+            }
+        }
+        playItem_t *it = _dbpl_journal_read_track (r);
+        if (!it) {
+            return -1;
+        }
+        if (_dbpl_id_map_set (map, id, it)) {
+            pl_item_unref (it);
+            return -1;
+        }
+        plt_insert_item (plt, after, it);
+        pl_item_unref (it);
+        break;
+    }
+    case DBPL_JOURNAL_REPLACE: {
+        if (_dbpl_read (r, &id, sizeof (id))) {
+            return -1;
+        }
+        playItem_t *it = _dbpl_id_map_get (map, id);
+        playItem_t *from = _dbpl_journal_read_track (r);
+        if (!it || !from) {
+            if (from) {
+                pl_item_unref (from);
+            }
+            return -1;
+        }
+        _dbpl_journal_replace_track (plt, it, from);
+        pl_item_unref (from);
+        pl_item_journal_modified (it);
+        break;
+    }
+    case DBPL_JOURNAL_REMOVE: {
+        if (_dbpl_read (r, &id, sizeof (id))) {
+            return -1;
+        }
+        playItem_t *it = _dbpl_id_map_get (map, id);
+        if (!it) {
+            return -1;
+        }
+        map->items[id] = NULL;
+        plt_remove_item (plt, it);
+        break;
+    }
+    case DBPL_JOURNAL_CLEAR:
+        for (id = 0; id < map->count; id++) {
+            if (map->items[id]) {
+                plt_remove_item (plt, map->items[id]);
+                map->items[id] = NULL;
+            }
+        }
+        break;
+    case DBPL_JOURNAL_ORDER: {
+        uint32_t count;
+        if (_dbpl_read (r, &count, sizeof (count)) || (uint64_t)count * sizeof (uint32_t) > (uint64_t)(r->end - r->p)) {
+            return -1;
+        }
+        // unlink all items in the list, and link them back in the new order
+        playItem_t **items = malloc ((count ? count : 1) * sizeof (playItem_t *));
+        if (!items) {
+            return -1;
+        }
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            _dbpl_read (r, &id, sizeof (id));
+            playItem_t *it = _dbpl_id_map_get (map, id);
+            if (it && it->plt == plt) {
+                pl_item_ref (it);
+                plt_remove_item (plt, it);
+                items[n++] = it;
+            }
+        }
+        playItem_t *after = prev;
+        for (uint32_t i = 0; i < n; i++) {
+            plt_insert_item (plt, after, items[i]);
+            pl_item_unref (items[i]);
+            after = items[i];
+        }
+        free (items);
+        break;
+    }
+    case DBPL_JOURNAL_PLT_META: {
+        uint32_t count;
+        if (_dbpl_read (r, &count, sizeof (count))) {
+            return -1;
+        }
+        if (replace_plt_meta) {
+            plt_delete_all_meta (plt);
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const char *key;
+            const char *value;
+            uint32_t valuesize;
+            if (_dbpl_read_pair (r, &key, &value, &valuesize)) {
+                return -1;
+            }
+            plt_replace_meta (plt, key, value);
+        }
+        break;
+    }
+    case DBPL_JOURNAL_COMMIT:
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+// Applies the journal stored after the compact playlist data.
+// The tracks of the file must be already linked into the playlist, right after `prev`.
+// If next_id is not NULL, the items get the journal ids used in the file,
+// so that the journal can be continued.
+// Returns 0 on success, and the size of the valid part of the journal in *valid_size.
+static int
+_dbpl_journal_replay (playlist_t *plt, dbpl_compact_t *pl, playItem_t *prev, int replace_plt_meta, uint64_t *valid_size, uint32_t *next_id) {
+    const uint8_t *data = pl->journal;
+    uint64_t size = pl->journal_size;
+
+    // find the end of the last complete batch
+    uint64_t valid = 0;
+    uint64_t offs = 0;
+    uint32_t num_records = 0;
+    dbpl_journal_record_t rec;
+    while (size - offs >= sizeof (rec)) {
+        memcpy (&rec, data + offs, sizeof (rec));
+        if (rec.size > size - offs - sizeof (rec) || _dbpl_checksum (data + offs + sizeof (rec), rec.size) != rec.checksum) {
+            break;
+        }
+        offs += sizeof (rec) + rec.size;
+        num_records++;
+        if (rec.type == DBPL_JOURNAL_COMMIT) {
+            valid = offs;
+        }
+    }
+    if (valid_size) {
+        *valid_size = valid;
+    }
 
-static void
-pl_item_free (playItem_t *it) {
     LOCK;
-    if (it) {
-        while (it->meta) {
-            pl_meta_free_values (it->meta);
-            DB_metaInfo_t *m = it->meta;
-            it->meta = m->next;
-            free (m);
+    int err = 0;
+    // every inserted item needs a record, which limits the ids
+    dbpl_id_map_t map = {
+        .max_count = pl->header->track_count + num_records,
+    };
+    playItem_t *it = prev ? prev->next[PL_MAIN] : plt->head[PL_MAIN];
+    for (uint32_t i = 0; it && i < pl->header->track_count; i++, it = it->next[PL_MAIN]) {
+        if (_dbpl_id_map_set (&map, i, it)) {
+            err = -1;
+            break;
         }
+    }
 
-        free (it);
+    int save_no_remove_notify = no_remove_notify;
+    no_remove_notify = 1;
+    offs = 0;
+    while (!err && offs < valid) {
+        memcpy (&rec, data + offs, sizeof (rec));
+        dbpl_reader_t r = {
+            .p = data + offs + sizeof (rec),
+            .end = data + offs + sizeof (rec) + rec.size,
+        };
+        err = _dbpl_journal_apply_record (plt, &map, prev, replace_plt_meta, rec.type, &r);
+        offs += sizeof (rec) + rec.size;
+    }
+    no_remove_notify = save_no_remove_notify;
+
+    if (!err && next_id) {
+        for (uint32_t id = 0; id < map.count; id++) {
+            if (map.items[id]) {
+                map.items[id]->journal_id = id;
+            }
+        }
+        *next_id = map.count;
     }
+    free (map.items);
     UNLOCK;
+    return err;
 }
 
-void
-pl_item_unref (playItem_t *it) {
-    LOCK;
-    it->_refc--;
-    //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    if (it->_refc < 0) {
-        trace ("\033[0;31mplaylist: bad refcount on item %p\033[37;0m\n", it);
-        assert(0);
-    }
-    if (it->_refc <= 0) {
-        //printf ("\033[0;31mdeleted %s\033[37;0m\n", pl_find_meta_raw (it, ":URI"));
-        pl_item_free (it);
+// Rewrites the whole playlist file, and starts a new journal.
+static int
+_dbpl_save_full (playlist_t *plt, const char *fname) {
+    char tempfile[PATH_MAX];
+    if (snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname) >= sizeof (tempfile)) {
+        return -1;
     }
-    UNLOCK;
-}
 
-int
-plt_delete_selected (playlist_t *playlist) {
     LOCK;
-    int i = 0;
-    int ret = -1;
-    playItem_t *next = NULL;
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = next, i++) {
-        next = it->next[PL_MAIN];
-        if (it->selected) {
-            if (ret == -1) {
-                ret = i;
-            }
-            plt_remove_item (playlist, it);
-        }
+    plt->last_save_modification_idx = plt->modification_idx;
+
+    dbpl_image_t img;
+    if (_dbpl_image_build (plt, &img)) {
+        _plt_journal_free (plt);
+        UNLOCK;
+        return -1;
     }
-    if (playlist->current_row[PL_MAIN] >= playlist->count[PL_MAIN]) {
-        playlist->current_row[PL_MAIN] = playlist->count[PL_MAIN] - 1;
+    int err = _dbpl_image_write (&img, tempfile);
+    if (!err && rename (tempfile, fname) != 0) {
+        fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
+        err = -1;
     }
-    if (playlist->current_row[PL_SEARCH] >= playlist->count[PL_SEARCH]) {
-        playlist->current_row[PL_SEARCH] = playlist->count[PL_SEARCH] - 1;
+    if (!err) {
+        _plt_journal_init (plt, &img.header, _dbpl_image_size (&img), 0, img.header.track_count);
     }
+    else {
+        // the items were renumbered, the old journal can't be continued
+        _plt_journal_free (plt);
+    }
+    _dbpl_image_free (&img);
     UNLOCK;
-    return ret;
+    return err;
 }
 
-int
-pl_delete_selected (void) {
-    LOCK;
-    int ret = plt_delete_selected (_current_playlist);
-    UNLOCK;
-    return ret;
-}
+static int
+plt_save_compact (playlist_t *plt, const char *fname);
 
-void
-plt_crop_selected (playlist_t *playlist) {
+// Rewrites a playlist file with a long journal, without blocking the playlist during the file writing.
+// Saving the playlist meanwhile is deferred until the new file is in place.
+static void
+_dbpl_journal_compact_worker (void *ctx) {
+    playlist_t *plt = ctx;
+    char tempfile[PATH_MAX];
+    int err = snprintf (tempfile, sizeof (tempfile), "%s/playlists/compact.tmp", dbconfdir) >= sizeof (tempfile);
+
+    dbpl_image_t img;
+    int have_image = 0;
     LOCK;
-    playItem_t *next = NULL;
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = next) {
-        next = it->next[PL_MAIN];
-        if (!it->selected) {
-            plt_remove_item (playlist, it);
-        }
+    if (!err && plt->journal && !_dbpl_image_build (plt, &img)) {
+        have_image = 1;
+        // the image includes all recorded changes, and the items have new ids now
+        _dbpl_journal_clear_ops (plt->journal);
+        plt->journal->next_id = img.header.track_count;
+        plt->journal->compacting = 1;
     }
     UNLOCK;
-}
 
-void
-pl_crop_selected (void) {
+    if (have_image) {
+        err = _dbpl_image_write (&img, tempfile);
+    }
+
     LOCK;
-    plt_crop_selected (_current_playlist);
+    char path[PATH_MAX];
+    int idx = plt_get_idx (plt);
+    if (idx < 0 || snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, idx) >= sizeof (path)) {
+        idx = -1;
+    }
+    dbpl_journal_t *j = plt->journal;
+    int flush = j && j->flush_requested;
+    if (have_image && !err && idx >= 0 && j && !rename (tempfile, path)) {
+        memcpy (j->header, &img.header, sizeof (dbpl_header_t));
+        j->base_size = _dbpl_image_size (&img);
+        j->size = 0;
+        j->compacting = 0;
+        j->flush_requested = 0;
+    }
+    else {
+        if (have_image) {
+            unlink (tempfile);
+        }
+        // the changes recorded meanwhile are lost with the journal, rewrite the file
+        _plt_journal_free (plt);
+        flush = 1;
+    }
+    if (have_image) {
+        _dbpl_image_free (&img);
+    }
+    if (flush && idx >= 0) {
+        plt_save_compact (plt, path);
+    }
+    plt_unref (plt);
+    _dbpl_compact_running = 0;
     UNLOCK;
 }
 
-static uint16_t
-length_to_uint16 (size_t len) {
-    return (uint16_t)min(0xffff, len);
+// must be called with the playlist lock held
+static void
+_dbpl_journal_compact_start (playlist_t *plt) {
+    if (_dbpl_compact_running) {
+        return; // one at a time, this playlist will get compacted on a later save
+    }
+    if (_dbpl_compact_tid) {
+        // finished, but not joined yet
+        thread_join (_dbpl_compact_tid);
+        _dbpl_compact_tid = 0;
+    }
+    plt_ref (plt);
+    _dbpl_compact_running = 1;
+    _dbpl_compact_tid = thread_start_low_priority (_dbpl_journal_compact_worker, plt);
+    if (!_dbpl_compact_tid) {
+        _dbpl_compact_running = 0;
+        plt_unref (plt);
+    }
 }
+// }}}
 
-static uint8_t
-length_to_uint8 (size_t len) {
-    return (uint8_t)min(0xff, len);
+// Saves the playlist into the compact format file.
+// If the file was written before, only the changes since then are appended to its journal.
+static int
+plt_save_compact (playlist_t *plt, const char *fname) {
+    LOCK;
+    dbpl_journal_t *j = plt->journal;
+    if (j && j->compacting) {
+        // the changes will be written after the compaction
+        j->flush_requested = 1;
+        plt->last_save_modification_idx = plt->modification_idx;
+        UNLOCK;
+        return 0;
+    }
+    if (j && !_dbpl_journal_flush (plt, fname)) {
+        if (j->size > DBPL_JOURNAL_COMPACT_SIZE && j->size > j->base_size / 2) {
+            _dbpl_journal_compact_start (plt);
+        }
+        UNLOCK;
+        return 0;
+    }
+    int err = _dbpl_save_full (plt, fname);
+    UNLOCK;
+    return err;
 }
+// }}}
 
 int
 plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
@@ -2062,7 +3764,7 @@ plt_save_n (int n) {
     int i;
     playlist_t *plt;
     for (i = 0, plt = _playlists_head; plt && i < n; i++, plt = plt->next);
-    err = plt_save (plt, NULL, NULL, path, NULL, NULL, NULL);
+    err = plt_save_compact (plt, path);
     _plt_loading = 0;
     UNLOCK;
     return err;
@@ -2097,10 +3799,10 @@ pl_save_all (void) {
             err = -1;
             break;
         }
-        if (p->last_save_modification_idx == p->modification_idx) {
+        if (p->last_save_modification_idx == p->modification_idx && !(p->journal && p->journal->op_count)) {
             continue;
         }
-        err = plt_save (p, NULL, NULL, path, NULL, NULL, NULL);
+        err = plt_save_compact (p, path);
         if (err < 0) {
             break;
         }
@@ -2110,6 +3812,62 @@ pl_save_all (void) {
     return err;
 }
 
+// Adds the tracks of a compact playlist file after the given item, or to the end of the playlist if it's NULL.
+// Returns the last added item, without a reference.
+static playItem_t *
+_dbpl_compact_insert (playlist_t *plt, playItem_t *after, dbpl_compact_t *compact, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (!after && !cb) {
+        if (pabort && *pabort) {
+            return NULL;
+        }
+        LOCK;
+        playItem_t *prev = plt->tail[PL_MAIN];
+        _dbpl_compact_link (plt, compact);
+        _dbpl_journal_replay (plt, compact, prev, 0, NULL, NULL);
+        playItem_t *last = plt->tail[PL_MAIN] != prev ? plt->tail[PL_MAIN] : NULL;
+        UNLOCK;
+        return last;
+    }
+
+    // the journal can only be replayed on a playlist of its own,
+    // so load into a temporary playlist, and move the tracks one by one
+    LOCK;
+    playlist_t *temp = plt_alloc ("temp");
+    _dbpl_compact_link (temp, compact);
+    _dbpl_journal_replay (temp, compact, NULL, 0, NULL, NULL);
+    for (DB_metaInfo_t *m = temp->meta; m; m = m->next) {
+        plt_add_meta (plt, m->key, m->value);
+    }
+    UNLOCK;
+
+    playItem_t *last = NULL;
+    while (!pabort || !*pabort) {
+        LOCK;
+        playItem_t *it = temp->head[PL_MAIN];
+        if (!it) {
+            UNLOCK;
+            break;
+        }
+        pl_item_ref (it);
+        plt_remove_item (temp, it);
+        plt_insert_item (plt, last ? last : (after ? after : plt->tail[PL_MAIN]), it);
+        UNLOCK;
+        if (last) {
+            pl_item_unref (last);
+        }
+        last = it; // keeps the reference
+        if (cb && cb (it, user_data) < 0 && pabort) {
+            *pabort = 1;
+        }
+    }
+    plt_free (temp);
+    // same as the DBPL reader, the returned item is not referenced
+    if (last) {
+        pl_item_unref (last);
+    }
+    return last;
+}
+
 static playItem_t *
 plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     playItem_t *it = NULL;
@@ -2164,6 +3922,17 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
             }
         }
     }
+    dbpl_compact_t *compact;
+    int compact_res = _dbpl_compact_open (fname, &compact);
+    if (compact_res <= 0) {
+        if (compact_res < 0) {
+            return NULL;
+        }
+        playItem_t *last = _dbpl_compact_insert (plt, after, compact, pabort, cb, user_data);
+        _dbpl_compact_free (compact);
+        return last;
+    }
+
     FILE *fp = fopen (fname, "rb");
     if (!fp) {
 //        trace ("plt_load: failed to open %s\n", fname);
@@ -2445,11 +4214,71 @@ plt_load (playlist_t *plt, playItem_t *after, const char *fname, int *pabort, in
     return plt_load_int (0, plt, after, fname, pabort, cb, user_data);
 }
 
+typedef struct {
+    char path[PATH_MAX];
+    dbpl_compact_t *compact;
+    int compact_res;
+} pl_load_job_t;
+
+typedef struct {
+    pl_load_job_t *jobs;
+    int count;
+    int next;
+    uintptr_t mutex;
+} pl_load_queue_t;
+
+static void
+_pl_load_worker (void *ctx) {
+    pl_load_queue_t *queue = ctx;
+    for (;;) {
+        mutex_lock (queue->mutex);
+        int idx = queue->next++;
+        mutex_unlock (queue->mutex);
+        if (idx >= queue->count) {
+            break;
+        }
+        pl_load_job_t *job = &queue->jobs[idx];
+        job->compact_res = _dbpl_compact_open (job->path, &job->compact);
+    }
+}
+
+// Reads all playlists in the compact format in parallel, without holding the playlist lock.
+// The results are linked into playlists afterwards, in order.
+static void
+_pl_load_compact_parallel (pl_load_job_t *jobs, int count) {
+    pl_load_queue_t queue = {
+        .jobs = jobs,
+        .count = count,
+        .mutex = mutex_create_nonrecursive (),
+    };
+
+    int nthreads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    nthreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    nthreads = min (nthreads, count);
+    nthreads = min (nthreads, 8);
+
+    intptr_t tids[8];
+    int started = 0;
+    for (int i = 0; i < nthreads; i++) {
+        tids[started] = thread_start (_pl_load_worker, &queue);
+        if (tids[started]) {
+            started++;
+        }
+    }
+    // the calling thread helps too, which also covers the case of failing to start threads
+    _pl_load_worker (&queue);
+    for (int i = 0; i < started; i++) {
+        thread_join (tids[i]);
+    }
+    mutex_free (queue.mutex);
+}
+
 int
 pl_load_all (void) {
     int i = 0;
     int err = 0;
-    char path[1024];
     DB_conf_item_t *it = conf_find ("playlist.tab.", NULL);
     if (!it) {
         // legacy (0.3.3 and earlier)
@@ -2467,25 +4296,60 @@ pl_load_all (void) {
         plt_unref (plt);
         return 0;
     }
+
+    int count = 0;
+    for (DB_conf_item_t *c = it; c; c = conf_find ("playlist.tab.", c)) {
+        count++;
+    }
+    pl_load_job_t *jobs = calloc (count, sizeof (pl_load_job_t));
+    for (i = 0; i < count; i++) {
+        if (snprintf (jobs[i].path, sizeof (jobs[i].path), "%s/playlists/%d.dbpl", dbconfdir, i) >= sizeof (jobs[i].path)) {
+            jobs[i].path[0] = 0;
+            jobs[i].compact_res = -1;
+        }
+    }
+    _pl_load_compact_parallel (jobs, count);
+
     LOCK;
     _plt_loading = 1;
-    while (it) {
+    for (i = 0; it; i++) {
         if (!err) {
             if (plt_add (plt_get_count (), it->value) < 0) {
+                for (; i < count; i++) {
+                    if (jobs[i].compact) {
+                        _dbpl_compact_free (jobs[i].compact);
+                    }
+                }
+                free (jobs);
                 return -1;
             }
             plt_set_curr_idx (plt_get_count () - 1);
         }
         err = 0;
-        if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, i) > sizeof (path)) {
+        if (i >= count || !jobs[i].path[0]) {
             fprintf (stderr, "error: failed to make path string for playlist filename\n");
             err = -1;
         }
         else {
+            const char *path = jobs[i].path;
             fprintf (stderr, "INFO: from file %s\n", path);
 
             playlist_t *plt = plt_get_curr ();
-            /* playItem_t *trk = */ plt_load (plt, NULL, path, NULL, NULL, NULL);
+            if (jobs[i].compact) {
+                dbpl_compact_t *compact = jobs[i].compact;
+                _dbpl_compact_link (plt, compact);
+                uint64_t journal_size;
+                uint32_t next_id;
+                if (!_dbpl_journal_replay (plt, compact, NULL, 1, &journal_size, &next_id)) {
+                    // continue the journal on the next save
+                    _plt_journal_init (plt, compact->header, compact->base_size, journal_size, next_id);
+                }
+                _dbpl_compact_free (compact);
+                jobs[i].compact = NULL;
+            }
+            else if (jobs[i].compact_res > 0) {
+                /* playItem_t *trk = */ plt_load (plt, NULL, path, NULL, NULL, NULL);
+            }
             char conf[100];
             snprintf (conf, sizeof (conf), "playlist.cursor.%d", i);
             plt->current_row[PL_MAIN] = deadbeef->conf_get_int (conf, -1);
@@ -2493,14 +4357,10 @@ pl_load_all (void) {
             plt->scroll = deadbeef->conf_get_int (conf, 0);
             plt->last_save_modification_idx = plt->modification_idx = 0;
             plt_unref (plt);
-
-            if (!it) {
-                fprintf (stderr, "WARNING: there were errors while loading playlist '%s' (%s)\n", it->value, path);
-            }
         }
         it = conf_find ("playlist.tab.", it);
-        i++;
     }
+    free (jobs);
     plt_set_curr_idx (0);
     _plt_loading = 0;
     plt_gen_conf ();
@@ -2535,6 +4395,7 @@ pl_select_all (void) {
 void
 plt_reshuffle (playlist_t *playlist, playItem_t **ppmin, playItem_t **ppmax) {
     LOCK;
+    _plt_shuffle_tree_invalidate (playlist);
     playItem_t *pmin = NULL;
     playItem_t *pmax = NULL;
     playItem_t *prev = NULL;
@@ -2577,6 +4438,128 @@ plt_reshuffle (playlist_t *playlist, playItem_t **ppmin, playItem_t **ppmax) {
     UNLOCK;
 }
 
+void
+pl_item_set_played (playItem_t *it, int played) {
+    LOCK;
+    if (it->played != (played ? 1 : 0)) {
+        it->played = played ? 1 : 0;
+        if (it->plt && it->plt->shuffle_tree_valid) {
+            _shuffle_touch (it->plt->shuffle_root, it);
+        }
+    }
+    UNLOCK;
+}
+
+void
+pl_item_set_shufflerating (playItem_t *it, int32_t shufflerating) {
+    LOCK;
+    if (it->plt) {
+        _plt_shuffle_tree_remove (it->plt, it);
+    }
+    it->shufflerating = shufflerating;
+    if (it->plt) {
+        _plt_shuffle_tree_insert (it->plt, it);
+    }
+    UNLOCK;
+}
+
+static playItem_t *
+_shuffle_first_unplayed (playItem_t *t, int32_t min_rating) {
+    if (!t || t->shuffle_played == t->shuffle_count) {
+        return NULL;
+    }
+    if (t->shufflerating < min_rating) {
+        return _shuffle_first_unplayed (t->shuffle_right, min_rating);
+    }
+    playItem_t *res = _shuffle_first_unplayed (t->shuffle_left, min_rating);
+    if (res) {
+        return res;
+    }
+    if (!t->played) {
+        return t;
+    }
+    return _shuffle_first_unplayed (t->shuffle_right, min_rating);
+}
+
+static playItem_t *
+_shuffle_last_played (playItem_t *t, int32_t max_rating) {
+    if (!t || !t->shuffle_played) {
+        return NULL;
+    }
+    if (t->shufflerating > max_rating) {
+        return _shuffle_last_played (t->shuffle_left, max_rating);
+    }
+    playItem_t *res = _shuffle_last_played (t->shuffle_right, max_rating);
+    if (res) {
+        return res;
+    }
+    if (t->played) {
+        return t;
+    }
+    return _shuffle_last_played (t->shuffle_left, max_rating);
+}
+
+// tracks of one album share the shufflerating, and must be picked in playlist order
+static playItem_t *
+_shuffle_first_with_rating (playItem_t *it, int played) {
+    playItem_t *first = it;
+    while (first->prev[PL_MAIN] && first->prev[PL_MAIN]->shufflerating == it->shufflerating) {
+        first = first->prev[PL_MAIN];
+    }
+    for (; first != it; first = first->next[PL_MAIN]) {
+        if (first->played == played) {
+            return first;
+        }
+    }
+    return it;
+}
+
+playItem_t *
+plt_shuffle_first_unplayed (playlist_t *plt, int32_t min_rating) {
+    LOCK;
+    _plt_shuffle_tree_build (plt);
+    playItem_t *it = _shuffle_first_unplayed (plt->shuffle_root, min_rating);
+    if (it) {
+        it = _shuffle_first_with_rating (it, 0);
+    }
+    UNLOCK;
+    return it;
+}
+
+playItem_t *
+plt_shuffle_last_played (playlist_t *plt, int32_t max_rating) {
+    LOCK;
+    _plt_shuffle_tree_build (plt);
+    playItem_t *it = _shuffle_last_played (plt->shuffle_root, max_rating);
+    if (it) {
+        it = _shuffle_first_with_rating (it, 1);
+    }
+    UNLOCK;
+    return it;
+}
+
+playItem_t *
+plt_shuffle_get_item_for_idx (playlist_t *plt, int idx) {
+    LOCK;
+    _plt_shuffle_tree_build (plt);
+    playItem_t *t = plt->shuffle_root;
+    while (t) {
+        int nleft = t->shuffle_left ? t->shuffle_left->shuffle_count : 0;
+        if (idx < nleft) {
+            t = t->shuffle_left;
+        }
+        else if (idx == nleft) {
+            break;
+        }
+        else {
+            idx -= nleft + 1;
+            t = t->shuffle_right;
+        }
+    }
+    UNLOCK;
+    return t;
+}
+
 void
 plt_set_item_duration (playlist_t *playlist, playItem_t *it, float duration) {
     LOCK;
@@ -3656,7 +5639,11 @@ pl_get_item_flags (playItem_t *it) {
 void
 pl_set_item_flags (playItem_t *it, uint32_t flags) {
     LOCK;
-    it->_flags = flags;
+    if (it->_flags != flags) {
+        it->_flags = flags;
+        // the flags are saved with the track, e.g. DDB_IS_SUBTRACK changes how it's loaded
+        pl_item_journal_modified (it);
+    }
 
     char s[200];
     pl_format_title (it, -1, s, sizeof (s), -1, "%T");
@@ -3667,11 +5654,13 @@ pl_set_item_flags (playItem_t *it, uint32_t flags) {
 
 playlist_t *
 pl_get_playlist (playItem_t *it) {
+    if (!it) {
+        return NULL;
+    }
     LOCK;
     playlist_t *p = _playlists_head;
     while (p) {
-        int idx = plt_get_item_idx (p, it, PL_MAIN);
-        if (idx != -1) {
+        if (p == it->plt) {
             plt_ref (p);
             UNLOCK;
             return p;
@@ -3925,6 +5914,7 @@ plt_add_files_begin (playlist_t *plt, int visibility) {
     plt_ref (addfiles_playlist);
     plt->files_adding = 1;
     plt->files_add_visibility = visibility;
+    plt->defer_metadata = conf_get_int ("playlist.deferred_metadata", 0) ? 1 : 0;
     pl_unlock ();
     ddb_fileadd_data_t d;
     memset (&d, 0, sizeof (d));
@@ -3946,6 +5936,7 @@ plt_add_files_end (playlist_t *plt, int visibility) {
     addfiles_playlist = NULL;
     messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
     plt->files_adding = 0;
+    plt->defer_metadata = 0;
     pl_unlock ();
     ddb_fileadd_data_t d;
     memset (&d, 0, sizeof (d));
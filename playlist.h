@@ -54,11 +54,18 @@ typedef struct playItem_s {
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct playlist_s *plt; // playlist which contains this item, or NULL
+    struct playItem_s *shuffle_left; // shuffle order tree, see plt_shuffle_*
+    struct playItem_s *shuffle_right;
+    uint32_t shuffle_count; // number of items in the shuffle subtree
+    uint32_t shuffle_played; // number of played items in the shuffle subtree
+    uint32_t journal_id; // identifies the item in the playlist file journal
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
     unsigned has_startsample64 : 1;
     unsigned has_endsample64 : 1;
+    unsigned journal_pending : 1; // the item is already going to be written with the next journal flush
 } playItem_t;
 
 typedef struct playlist_s {
@@ -81,6 +88,10 @@ typedef struct playlist_s {
     int cue_samplerate;
 
     int search_cmpidx;
+
+    playItem_t *shuffle_root; // shuffle order tree, built on demand
+
+    struct dbpl_journal_s *journal; // changes since the last save, NULL if the next save must rewrite the file
     
     unsigned fast_mode : 1;
     unsigned files_adding : 1;
@@ -88,6 +99,8 @@ typedef struct playlist_s {
     unsigned loading_cue : 1;
     unsigned ignore_archives : 1;
     unsigned follow_symlinks : 1;
+    unsigned shuffle_tree_valid : 1;
+    unsigned defer_metadata : 1; // insert the added files as deferred tracks, see pl_item_load_deferred
 } playlist_t;
 
 // global playlist control functions
@@ -216,6 +229,12 @@ plt_insert_file (playlist_t *playlist, playItem_t *after, const char *fname, int
 playItem_t *
 pl_insert_item (playItem_t *after, playItem_t *it);
 
+// Reads the metadata of a track inserted with DDB_IS_DEFERRED, using the decoders matching its file name.
+// A single resulting track replaces the contents of the item, multiple tracks (e.g. from a cuesheet) replace the item itself.
+// Blocks on file I/O, so must not be called with the playlist lock held.
+void
+pl_item_load_deferred (playItem_t *it);
+
 playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it);
 
@@ -304,6 +323,15 @@ pl_save_current (void);
 int
 pl_save_all (void);
 
+// record changes for the incremental playlist save, see plt_save_n
+// call after modifying metadata or properties of an item
+void
+pl_item_journal_modified (playItem_t *it);
+
+// call after reordering the items of a playlist
+void
+plt_journal_order_changed (playlist_t *plt);
+
 playItem_t *
 plt_load (playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
 
@@ -319,6 +347,28 @@ pl_select_all (void);
 void
 plt_reshuffle (playlist_t *playlist, playItem_t **ppmin, playItem_t **ppmax);
 
+// setters for the shuffle state, which keep the shuffle order tree up to date
+void
+pl_item_set_played (playItem_t *it, int played);
+
+void
+pl_item_set_shufflerating (playItem_t *it, int32_t shufflerating);
+
+// shuffle order queries, O(log n) each
+// the returned items don't get an extra ref, so the caller must hold pl_lock
+
+// returns the not played item with the lowest shufflerating >= min_rating
+playItem_t *
+plt_shuffle_first_unplayed (playlist_t *plt, int32_t min_rating);
+
+// returns the played item with the highest shufflerating <= max_rating
+playItem_t *
+plt_shuffle_last_played (playlist_t *plt, int32_t max_rating);
+
+// returns the item at position idx in shuffle order
+playItem_t *
+plt_shuffle_get_item_for_idx (playlist_t *plt, int idx);
+
 // required to calculate total playtime
 void
 plt_set_item_duration (playlist_t *playlist, playItem_t *it, float duration);
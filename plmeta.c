@@ -34,6 +34,14 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+// reserved keys are not saved, so changing them doesn't need to be journaled
+static inline void
+_meta_modified (playItem_t *it, const char *key) {
+    if (key[0] != '_' && key[0] != '!') {
+        pl_item_journal_modified (it);
+    }
+}
+
 DB_metaInfo_t *
 pl_meta_for_key_with_override (playItem_t *it, const char *key) {
     pl_ensure_lock ();
@@ -104,6 +112,7 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
     // add
     m = calloc (1, sizeof (DB_metaInfo_t));
     m->key = metacache_add_string (key);
+    _meta_modified (it, key);
 
     if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
         if (tail) {
@@ -266,6 +275,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
     m->value = metacache_add_value (buf, buflen);
     m->valuesize = (int)buflen;
     free (buf);
+    _meta_modified (it, key);
     pl_unlock ();
 }
 
@@ -285,6 +295,7 @@ pl_replace_meta (playItem_t *it, const char *key, const char *value) {
         int l = (int)strlen (value) + 1;
         m->value = metacache_add_value(value, l);
         m->valuesize = l;
+        _meta_modified (it, key);
         UNLOCK;
         return;
     }
@@ -328,6 +339,7 @@ pl_delete_meta (playItem_t *it, const char *key) {
             else {
                 it->meta = m->next;
             }
+            _meta_modified (it, m->key);
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
             free (m);
@@ -425,6 +437,7 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
             else {
                 it->meta = m->next;
             }
+            _meta_modified (it, m->key);
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
             free (m);
@@ -459,6 +472,7 @@ pl_delete_all_meta (playItem_t *it) {
         }
         m = next;
     }
+    pl_item_journal_modified (it);
 
     // delete replaygain fields
     extern const char *ddb_internal_rg_keys[];
@@ -54,6 +54,9 @@
 #include "junklib.h"
 #include "vfs.h"
 #include "premix.h"
+#include "interleave.h"
+#include "jobs.h"
+#include "metaloader.h"
 #include "dsppreset.h"
 #include "pltmeta.h"
 #include "metacache.h"
@@ -67,6 +70,7 @@
 #include "cocoautil.h"
 #endif
 #include "viz.h"
+#include "plugins/libparser/parser.h"
 
 DB_plugin_t main_plugin = {
     .type = DB_PLUGIN_MISC,
@@ -92,11 +96,14 @@ const char *lowprio_plugin_ids[] = {
     NULL
 };
 
+struct lazy_plugin_s;
+
 // internal plugin list
 typedef struct plugin_s {
     void *handle;
     char *filepath;
     DB_plugin_t *plugin;
+    struct lazy_plugin_s *lazy; // set if the plugin is registered from the manifest, and loaded on first use
     struct plugin_s *next;
 } plugin_t;
 
@@ -529,6 +536,14 @@ static DB_functions_t deadbeef_api = {
 
     .plug_get_path_for_plugin_ptr = (const char* (*) (DB_plugin_t *plugin_ptr))plug_get_path_for_plugin_ptr,
     .plt_insert_dir3 = (ddb_playItem_t *(*) (int visibility, ddb_playlist_t *plt, ddb_playItem_t *after, const char *dirname, int *pabort, int (*callback)(ddb_insert_file_result_t result, const char *fname, void *user_data), void *user_data))plt_insert_dir3,
+    .pcm_interleave_int32 = pcm_interleave_int32,
+    .pcm_interleave_float32 = pcm_interleave_float32,
+    .job_submit = job_submit,
+    .job_wait = job_wait,
+    .job_cancel = job_cancel,
+    .job_is_cancelled = job_is_cancelled,
+    .job_release = job_release,
+    .pl_request_deferred_metadata = (void (*) (ddb_playItem_t *it))metaloader_request,
 };
 
 DB_functions_t *deadbeef = &deadbeef_api;
@@ -643,12 +658,13 @@ plug_playback_set_pos (float pos) {
     streamer_set_seek (t);
 }
 
-int
-plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
-    DB_plugin_t *plugin_api = loadfunc (&deadbeef_api);
-    if (!plugin_api) {
-        return -1;
-    }
+static void
+_lazy_plugin_free (struct lazy_plugin_s *lazy);
+
+// Adds the plugin to the list, unless a newer version of it is loaded already.
+// Returns the list entry, or NULL if the plugin was not added.
+static plugin_t *
+_plug_add_plugin (DB_plugin_t *plugin_api, void *handle) {
 
     // check if same plugin with the same or bigger version is loaded already
     plugin_t *prev = NULL;
@@ -659,22 +675,28 @@ plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
             if (plugin_api->version_major > p->plugin->version_major || (plugin_api->version_major == p->plugin->version_major && plugin_api->version_minor > p->plugin->version_minor)) {
                 trace_err ("found newer version of plugin \"%s\" (%s), replacing\n", plugin_api->id, plugin_api->name);
                 // unload older plugin before replacing
-                dlclose (p->handle);
                 if (prev) {
                     prev->next = p->next;
                 }
                 else {
                     plugins = p->next;
                 }
+                if (p == plugins_tail) {
+                    plugins_tail = prev;
+                }
                 if (p->handle) {
                     dlclose (p->handle);
                 }
+                if (p->lazy) {
+                    _lazy_plugin_free (p->lazy);
+                }
+                free (p->filepath);
                 free (p);
                 break;
             }
             else {
                 trace_err ("found copy of plugin \"%s\" (%s), but newer version is already loaded\n", plugin_api->id, plugin_api->name)
-                return -1;
+                return NULL;
             }
         }
     }
@@ -685,7 +707,7 @@ plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
         if (DB_API_VERSION_MAJOR != 9 || DB_API_VERSION_MINOR != 9) {
             if (plugin_api->api_vmajor != DB_API_VERSION_MAJOR || plugin_api->api_vminor > DB_API_VERSION_MINOR) {
                 trace_err ("WARNING: plugin \"%s\" wants API v%d.%d (got %d.%d), will not be loaded\n", plugin_api->name, plugin_api->api_vmajor, plugin_api->api_vminor, DB_API_VERSION_MAJOR, DB_API_VERSION_MINOR);
-                return -1;
+                return NULL;
             }
         }
     }
@@ -726,7 +748,16 @@ plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
         }
     }
 
-    return 0;
+    return plug;
+}
+
+int
+plug_init_plugin (DB_plugin_t* (*loadfunc)(DB_functions_t *), void *handle) {
+    DB_plugin_t *plugin_api = loadfunc (&deadbeef_api);
+    if (!plugin_api) {
+        return -1;
+    }
+    return _plug_add_plugin (plugin_api, handle) ? 0 : -1;
 }
 
 static int dirent_alphasort (const struct dirent **a, const struct dirent **b) {
@@ -773,26 +804,28 @@ plug_remove_plugin (void *p) {
     }
 }
 
-// d_name must be writable w/o sideeffects; contain valid .so name
-// l must be strlen(d_name)
+// Opens the plugin library, and finds its entry point.
+// fullname must be writable, and gets the name of the fallback library if it was used instead.
+// Returns 0 on success, -1 on error, or 1 if the library is not a plugin.
 static int
-load_plugin (const char *plugdir, char *d_name, int l) {
-    // hack for osx to skip *.0.so files
-    if (strstr (d_name, ".0.so")) {
-        return -1;
-    }
-
-    char fullname[PATH_MAX];
-    snprintf (fullname, PATH_MAX, "%s/%s", plugdir, d_name);
-
-    // check if the file exists, to avoid printing bogus errors
-    struct stat s;
-    if (0 != stat (fullname, &s)) {
-        return -1;
+_plug_dlopen (char *fullname, void **phandle, DB_plugin_t *(**pplug_load)(DB_functions_t *api)) {
+    // symbols are resolved on first use, except when a fallback exists,
+    // which is meant to be used if the plugin can't be linked
+    char fallback[PATH_MAX];
+    size_t fl = strlen (fullname);
+    int flags = RTLD_LAZY;
+#if !defined(ANDROID) && !defined(OSX_APPBUNDLE)
+    if (fl >= sizeof (PLUGINEXT)-1 && fl - sizeof (PLUGINEXT) + 1 + sizeof (".fallback.so") <= sizeof (fallback)) {
+        memcpy (fallback, fullname, fl - sizeof (PLUGINEXT) + 1);
+        strcpy (fallback + fl - sizeof (PLUGINEXT) + 1, ".fallback.so");
+        struct stat s;
+        if (!stat (fallback, &s)) {
+            flags = RTLD_NOW;
+        }
     }
+#endif
 
-    trace ("loading plugin %s/%s\n", plugdir, d_name);
-    void *handle = dlopen (fullname, RTLD_NOW);
+    void *handle = dlopen (fullname, flags);
     if (!handle) {
         trace ("dlopen error: %s\n", dlerror ());
 #if defined(ANDROID) || defined(OSX_APPBUNDLE)
@@ -800,7 +833,7 @@ load_plugin (const char *plugdir, char *d_name, int l) {
 #else
         strcpy (fullname + strlen(fullname) - sizeof (PLUGINEXT)+1, ".fallback.so");
         trace ("trying %s...\n", fullname);
-        handle = dlopen (fullname, RTLD_NOW);
+        handle = dlopen (fullname, RTLD_LAZY);
         if (!handle) {
             //trace ("dlopen error: %s\n", dlerror ());
             return -1;
@@ -810,6 +843,20 @@ load_plugin (const char *plugdir, char *d_name, int l) {
         }
 #endif
     }
+
+    // entry point is named after the file, e.g. mp3.so -> mp3_load
+    const char *slash = strrchr (fullname, '/');
+    char d_name[256];
+    snprintf (d_name, sizeof (d_name), "%s", slash ? slash + 1 : fullname);
+    size_t l = strlen (d_name);
+    const char *fb = strstr (d_name, ".fallback.so");
+    if (fb) {
+        l = fb - d_name + sizeof (PLUGINEXT) - 1;
+    }
+    if (l < sizeof (PLUGINEXT) - 1 || l - sizeof (PLUGINEXT) + 1 + sizeof ("_load") > sizeof (d_name)) {
+        dlclose (handle);
+        return -1;
+    }
     d_name[l-sizeof (PLUGINEXT)+1] = 0;
     strcat (d_name, "_load");
 #ifndef ANDROID
@@ -830,14 +877,1098 @@ load_plugin (const char *plugdir, char *d_name, int l) {
             trace ("dlsym error: %s (%s)\n", dlerror (), d_name + 3);
             return -1;
         }
+        return 1;
+    }
+    *phandle = handle;
+    *pplug_load = plug_load;
+    return 0;
+}
+
+// {{{ plugin manifest
+//
+// Decoder and VFS plugins don't need to be loaded until they are used,
+// as long as their file types and URL schemes are known.
+// The manifest caches this information for each plugin file, keyed by the file modification time and size,
+// so that on the next start such plugins are registered as stubs, and loaded on first call.
+//
+// Some plugins compute the list of file extensions from their config,
+// so the manifest also keeps a hash of the "<plugin id>." config items.
+
+#define PLUG_MANIFEST_MAGIC "DBPM"
+#define PLUG_MANIFEST_VERSION 2
+
+// functions implemented by a plugin, to be forwarded by its stub
+enum {
+    PLUG_HAS_STOP = 1<<0,
+    PLUG_HAS_MESSAGE = 1<<1,
+
+    // decoder
+    PLUG_HAS_OPEN = 1<<2,
+    PLUG_HAS_OPEN2 = 1<<3,
+    PLUG_HAS_INIT = 1<<4,
+    PLUG_HAS_FREE = 1<<5,
+    PLUG_HAS_READ = 1<<6,
+    PLUG_HAS_SEEK = 1<<7,
+    PLUG_HAS_SEEK_SAMPLE = 1<<8,
+    PLUG_HAS_INSERT = 1<<9,
+    PLUG_HAS_NUMVOICES = 1<<10,
+    PLUG_HAS_MUTEVOICE = 1<<11,
+    PLUG_HAS_READ_METADATA = 1<<12,
+    PLUG_HAS_WRITE_METADATA = 1<<13,
+    PLUG_HAS_SEEK_SAMPLE64 = 1<<14,
+
+    // vfs
+    PLUG_HAS_GET_SCHEMES = 1<<2,
+    PLUG_HAS_IS_STREAMING = 1<<3,
+    PLUG_HAS_IS_CONTAINER = 1<<4,
+    PLUG_HAS_VFS_OPEN = 1<<5,
+    PLUG_HAS_CLOSE = 1<<6,
+    PLUG_HAS_VFS_READ = 1<<7,
+    PLUG_HAS_VFS_SEEK = 1<<8,
+    PLUG_HAS_TELL = 1<<9,
+    PLUG_HAS_REWIND = 1<<10,
+    PLUG_HAS_GETLENGTH = 1<<11,
+    PLUG_HAS_GET_CONTENT_TYPE = 1<<12,
+    PLUG_HAS_SET_TRACK = 1<<13,
+    PLUG_HAS_SCANDIR = 1<<14,
+    PLUG_HAS_GET_SCHEME_FOR_NAME = 1<<15,
+    PLUG_HAS_GET_IDENTIFIER = 1<<16,
+    PLUG_HAS_ABORT_WITH_IDENTIFIER = 1<<17,
+};
+
+typedef struct plug_manifest_entry_s {
+    char *path;
+    int64_t mtime;
+    int64_t size;
+
+    // set if the plugin can be loaded on first use, the rest of the fields are only valid in this case
+    int lazy;
+    uint32_t config_hash;
+    int32_t type;
+    int16_t api_vmajor;
+    int16_t api_vminor;
+    int16_t version_major;
+    int16_t version_minor;
+    uint32_t flags;
+    uint32_t funcs; // PLUG_HAS_*
+    int32_t is_streaming;
+    char *id;
+    char *name;
+    char *descr;
+    char *copyright;
+    char *website;
+    char *configdialog;
+    char **exts; // decoder file extensions, or vfs schemes
+    char **prefixes;
+
+    // state of the current session
+    unsigned used : 1; // the file was found in the plugin folders
+    unsigned pending : 1; // needs to be updated from the loaded plugin
+    char *loaded_path; // the library which was loaded, if pending
+
+    struct plug_manifest_entry_s *next;
+} plug_manifest_entry_t;
+
+static plug_manifest_entry_t *manifest;
+static int manifest_loaded;
+static int manifest_dirty;
+static int manifest_enabled; // set while loading the plugins, if the manifest is used
+
+#define MAX_LAZY_PLUGINS 32
+
+typedef struct lazy_plugin_s {
+    union {
+        DB_plugin_t plugin;
+        DB_decoder_t decoder;
+#if (DDB_API_LEVEL >= 14)
+        ddb_decoder2_t decoder2;
+#endif
+        DB_vfs_t vfs;
+    } stub;
+    plug_manifest_entry_t *entry;
+    plugin_t *plug;
+    DB_plugin_t *loaded; // published with release semantics once the plugin is started
+    int failed;
+    int in_use;
+    char **config_keys; // the settings from the plugin configdialog
+} lazy_plugin_t;
+
+static lazy_plugin_t lazy_plugins[MAX_LAZY_PLUGINS];
+
+// serializes loading the lazy plugins, separately from the playlist lock,
+// since dlopen and the plugin start can take a long time
+static uintptr_t lazy_load_mutex;
+
+static void
+_manifest_free_list (char **list) {
+    if (list) {
+        for (int i = 0; list[i]; i++) {
+            free (list[i]);
+        }
+        free (list);
+    }
+}
+
+static char **
+_manifest_copy_list (const char **list) {
+    if (!list) {
+        return NULL;
+    }
+    int n;
+    for (n = 0; list[n]; n++);
+    char **copy = calloc (n + 1, sizeof (char *));
+    for (int i = 0; i < n; i++) {
+        copy[i] = strdup (list[i]);
+    }
+    return copy;
+}
+
+static void
+_manifest_entry_clear (plug_manifest_entry_t *e) {
+    free (e->id);
+    free (e->name);
+    free (e->descr);
+    free (e->copyright);
+    free (e->website);
+    free (e->configdialog);
+    _manifest_free_list (e->exts);
+    _manifest_free_list (e->prefixes);
+    free (e->loaded_path);
+    e->id = e->name = e->descr = e->copyright = e->website = e->configdialog = e->loaded_path = NULL;
+    e->exts = e->prefixes = NULL;
+    e->lazy = 0;
+}
+
+static void
+_manifest_entry_free (plug_manifest_entry_t *e) {
+    _manifest_entry_clear (e);
+    free (e->path);
+    free (e);
+}
+
+// Returns the NULL-terminated list of the setting keys from the plugin configdialog
+static char **
+_manifest_config_keys (const char *configdialog) {
+    if (!configdialog) {
+        return NULL;
+    }
+    char **keys = NULL;
+    int count = 0;
+    char token[MAX_TOKEN];
+    const char *script = configdialog;
+    while ((script = gettoken (script, token)) && !strcmp (token, "property")) {
+        // property "title" type[params] [vert] key default ... ;
+        char type[MAX_TOKEN];
+        if (!(script = gettoken (script, token)) || !(script = gettoken (script, type))) {
+            break;
+        }
+        int is_box = !strncmp (type, "hbox[", 5) || !strncmp (type, "vbox[", 5);
+        while ((script = gettoken (script, token)) && !strcmp (token, "vert"));
+        if (!script) {
+            break;
+        }
+        if (!is_box && strcmp (token, ";")) {
+            char **new_keys = realloc (keys, (count + 2) * sizeof (char *));
+            if (!new_keys) {
+                break;
+            }
+            keys = new_keys;
+            keys[count++] = strdup (token);
+            keys[count] = NULL;
+        }
+        while (strcmp (token, ";") && (script = gettoken (script, token)));
+        if (!script) {
+            break;
+        }
+    }
+    return keys;
+}
+
+static uint32_t
+_manifest_config_hash (char **keys) {
+    // FNV-1a over the values of the plugin settings
+    uint32_t h = 2166136261u;
+    if (!keys) {
+        return h;
+    }
+    conf_lock ();
+    for (int i = 0; keys[i]; i++) {
+        const char *value = conf_get_str_fast (keys[i], NULL);
+        if (value) {
+            for (const char *s = value; *s; s++) {
+                h = (h ^ (uint8_t)*s) * 16777619u;
+            }
+        }
+        h = (h ^ (value ? '\n' : 0)) * 16777619u;
+    }
+    conf_unlock ();
+    return h;
+}
+
+static int
+_manifest_get_path (char *path, size_t size) {
+    return !dbcachedir[0] || snprintf (path, size, "%s/plugins.manifest", dbcachedir) >= size ? -1 : 0;
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    int error;
+} manifest_reader_t;
+
+static void
+_manifest_read (manifest_reader_t *r, void *data, size_t size) {
+    if (r->error || (size_t)(r->end - r->p) < size) {
+        r->error = 1;
+        memset (data, 0, size);
+        return;
+    }
+    memcpy (data, r->p, size);
+    r->p += size;
+}
+
+static char *
+_manifest_read_str (manifest_reader_t *r) {
+    uint32_t l;
+    _manifest_read (r, &l, sizeof (l));
+    if (r->error || l == 0xffffffff) {
+        return NULL;
+    }
+    if ((size_t)(r->end - r->p) < l) {
+        r->error = 1;
+        return NULL;
+    }
+    char *s = malloc (l + 1);
+    memcpy (s, r->p, l);
+    s[l] = 0;
+    r->p += l;
+    return s;
+}
+
+static char **
+_manifest_read_list (manifest_reader_t *r) {
+    uint32_t n;
+    _manifest_read (r, &n, sizeof (n));
+    if (r->error || n == 0xffffffff) {
+        return NULL;
+    }
+    if (n > (size_t)(r->end - r->p) / sizeof (uint32_t)) {
+        r->error = 1;
+        return NULL;
+    }
+    char **list = calloc (n + 1, sizeof (char *));
+    for (uint32_t i = 0; i < n && !r->error; i++) {
+        list[i] = _manifest_read_str (r);
+        if (!list[i]) {
+            r->error = 1;
+        }
+    }
+    return list;
+}
+
+static void
+_manifest_load (void) {
+    char path[PATH_MAX];
+    if (_manifest_get_path (path, sizeof (path))) {
+        return;
+    }
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        manifest_dirty = 1;
+        return;
+    }
+    uint8_t *data = NULL;
+    size_t size = 0;
+    if (!fseek (fp, 0, SEEK_END)) {
+        long l = ftell (fp);
+        if (l > 0 && !fseek (fp, 0, SEEK_SET)) {
+            data = malloc (l);
+            if (data && fread (data, 1, l, fp) == (size_t)l) {
+                size = l;
+            }
+        }
+    }
+    fclose (fp);
+
+    manifest_reader_t r = { .p = data, .end = data + size };
+    char magic[4];
+    uint32_t version;
+    _manifest_read (&r, magic, sizeof (magic));
+    _manifest_read (&r, &version, sizeof (version));
+    char *appversion = _manifest_read_str (&r);
+    // the layout of the plugin structures depends on the player version
+    if (r.error || memcmp (magic, PLUG_MANIFEST_MAGIC, 4) || version != PLUG_MANIFEST_VERSION || !appversion || strcmp (appversion, VERSION)) {
+        r.error = 1;
+    }
+    free (appversion);
+
+    plug_manifest_entry_t *tail = NULL;
+    while (!r.error && r.p < r.end) {
+        plug_manifest_entry_t *e = calloc (1, sizeof (plug_manifest_entry_t));
+        e->path = _manifest_read_str (&r);
+        _manifest_read (&r, &e->mtime, sizeof (e->mtime));
+        _manifest_read (&r, &e->size, sizeof (e->size));
+        _manifest_read (&r, &e->lazy, sizeof (e->lazy));
+        if (e->lazy) {
+            _manifest_read (&r, &e->config_hash, sizeof (e->config_hash));
+            _manifest_read (&r, &e->type, sizeof (e->type));
+            _manifest_read (&r, &e->api_vmajor, sizeof (e->api_vmajor));
+            _manifest_read (&r, &e->api_vminor, sizeof (e->api_vminor));
+            _manifest_read (&r, &e->version_major, sizeof (e->version_major));
+            _manifest_read (&r, &e->version_minor, sizeof (e->version_minor));
+            _manifest_read (&r, &e->flags, sizeof (e->flags));
+            _manifest_read (&r, &e->funcs, sizeof (e->funcs));
+            _manifest_read (&r, &e->is_streaming, sizeof (e->is_streaming));
+            e->id = _manifest_read_str (&r);
+            e->name = _manifest_read_str (&r);
+            e->descr = _manifest_read_str (&r);
+            e->copyright = _manifest_read_str (&r);
+            e->website = _manifest_read_str (&r);
+            e->configdialog = _manifest_read_str (&r);
+            e->exts = _manifest_read_list (&r);
+            e->prefixes = _manifest_read_list (&r);
+            if (!e->id) {
+                r.error = 1;
+            }
+        }
+        if (!e->path) {
+            r.error = 1;
+        }
+        if (r.error) {
+            _manifest_entry_free (e);
+            break;
+        }
+        if (tail) {
+            tail->next = e;
+        }
+        else {
+            manifest = e;
+        }
+        tail = e;
+    }
+    free (data);
+    if (r.error) {
+        trace ("plugin manifest %s is invalid, will be rebuilt\n", path);
+        manifest_dirty = 1;
+    }
+}
+
+static void
+_manifest_write (FILE *fp, const void *data, size_t size, int *err) {
+    if (!*err && fwrite (data, 1, size, fp) != size) {
+        *err = 1;
+    }
+}
+
+static void
+_manifest_write_str (FILE *fp, const char *s, int *err) {
+    uint32_t l = s ? (uint32_t)strlen (s) : 0xffffffff;
+    _manifest_write (fp, &l, sizeof (l), err);
+    if (s) {
+        _manifest_write (fp, s, l, err);
+    }
+}
+
+static void
+_manifest_write_list (FILE *fp, char **list, int *err) {
+    uint32_t n = 0xffffffff;
+    if (list) {
+        for (n = 0; list[n]; n++);
+    }
+    _manifest_write (fp, &n, sizeof (n), err);
+    for (uint32_t i = 0; list && i < n; i++) {
+        _manifest_write_str (fp, list[i], err);
+    }
+}
+
+static void
+_manifest_save (void) {
+    char path[PATH_MAX];
+    char tempfile[PATH_MAX];
+    if (_manifest_get_path (path, sizeof (path)) || snprintf (tempfile, sizeof (tempfile), "%s.tmp", path) >= sizeof (tempfile)) {
+        return;
+    }
+    mkdir (dbcachedir, 0755);
+    FILE *fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        return;
+    }
+    int err = 0;
+    uint32_t version = PLUG_MANIFEST_VERSION;
+    _manifest_write (fp, PLUG_MANIFEST_MAGIC, 4, &err);
+    _manifest_write (fp, &version, sizeof (version), &err);
+    _manifest_write_str (fp, VERSION, &err);
+    for (plug_manifest_entry_t *e = manifest; e; e = e->next) {
+        _manifest_write_str (fp, e->path, &err);
+        _manifest_write (fp, &e->mtime, sizeof (e->mtime), &err);
+        _manifest_write (fp, &e->size, sizeof (e->size), &err);
+        _manifest_write (fp, &e->lazy, sizeof (e->lazy), &err);
+        if (e->lazy) {
+            _manifest_write (fp, &e->config_hash, sizeof (e->config_hash), &err);
+            _manifest_write (fp, &e->type, sizeof (e->type), &err);
+            _manifest_write (fp, &e->api_vmajor, sizeof (e->api_vmajor), &err);
+            _manifest_write (fp, &e->api_vminor, sizeof (e->api_vminor), &err);
+            _manifest_write (fp, &e->version_major, sizeof (e->version_major), &err);
+            _manifest_write (fp, &e->version_minor, sizeof (e->version_minor), &err);
+            _manifest_write (fp, &e->flags, sizeof (e->flags), &err);
+            _manifest_write (fp, &e->funcs, sizeof (e->funcs), &err);
+            _manifest_write (fp, &e->is_streaming, sizeof (e->is_streaming), &err);
+            _manifest_write_str (fp, e->id, &err);
+            _manifest_write_str (fp, e->name, &err);
+            _manifest_write_str (fp, e->descr, &err);
+            _manifest_write_str (fp, e->copyright, &err);
+            _manifest_write_str (fp, e->website, &err);
+            _manifest_write_str (fp, e->configdialog, &err);
+            _manifest_write_list (fp, e->exts, &err);
+            _manifest_write_list (fp, e->prefixes, &err);
+        }
+    }
+    if (fclose (fp)) {
+        err = 1;
+    }
+    if (err || rename (tempfile, path)) {
+        trace_err ("failed to write plugin manifest %s\n", path);
+        unlink (tempfile);
+    }
+}
+
+// Fills the manifest entry from a loaded and started plugin.
+static void
+_manifest_entry_set_plugin (plug_manifest_entry_t *e, plugin_t *plug) {
+    _manifest_entry_clear (e);
+    DB_plugin_t *p = plug->plugin;
+    if ((p->type != DB_PLUGIN_DECODER && p->type != DB_PLUGIN_VFS)
+        || !plug->handle || !p->id
+        || p->connect || p->disconnect || p->command || p->exec_cmdline || p->get_actions) {
+        // the plugin may be needed before any of its functions is called
+        return;
+    }
+
+    uint32_t funcs = (p->stop ? PLUG_HAS_STOP : 0) | (p->message ? PLUG_HAS_MESSAGE : 0);
+    if (p->type == DB_PLUGIN_DECODER) {
+        DB_decoder_t *d = (DB_decoder_t *)p;
+        funcs |= (d->open ? PLUG_HAS_OPEN : 0)
+            | (p->api_vminor >= 7 && d->open2 ? PLUG_HAS_OPEN2 : 0)
+            | (d->init ? PLUG_HAS_INIT : 0)
+            | (d->free ? PLUG_HAS_FREE : 0)
+            | (d->read ? PLUG_HAS_READ : 0)
+            | (d->seek ? PLUG_HAS_SEEK : 0)
+            | (d->seek_sample ? PLUG_HAS_SEEK_SAMPLE : 0)
+            | (d->insert ? PLUG_HAS_INSERT : 0)
+            | (d->numvoices ? PLUG_HAS_NUMVOICES : 0)
+            | (d->mutevoice ? PLUG_HAS_MUTEVOICE : 0)
+            | (d->read_metadata ? PLUG_HAS_READ_METADATA : 0)
+            | (d->write_metadata ? PLUG_HAS_WRITE_METADATA : 0);
+#if (DDB_API_LEVEL >= 14)
+        if ((p->flags & DDB_PLUGIN_FLAG_IMPLEMENTS_DECODER2) && ((ddb_decoder2_t *)d)->seek_sample64) {
+            funcs |= PLUG_HAS_SEEK_SAMPLE64;
+        }
+#endif
+        e->exts = _manifest_copy_list (d->exts);
+        e->prefixes = _manifest_copy_list (d->prefixes);
+    }
+    else {
+        DB_vfs_t *v = (DB_vfs_t *)p;
+        funcs |= (v->get_schemes ? PLUG_HAS_GET_SCHEMES : 0)
+            | (v->is_streaming ? PLUG_HAS_IS_STREAMING : 0)
+            | (v->is_container ? PLUG_HAS_IS_CONTAINER : 0)
+            | (v->open ? PLUG_HAS_VFS_OPEN : 0)
+            | (v->close ? PLUG_HAS_CLOSE : 0)
+            | (v->read ? PLUG_HAS_VFS_READ : 0)
+            | (v->seek ? PLUG_HAS_VFS_SEEK : 0)
+            | (v->tell ? PLUG_HAS_TELL : 0)
+            | (v->rewind ? PLUG_HAS_REWIND : 0)
+            | (v->getlength ? PLUG_HAS_GETLENGTH : 0)
+            | (v->get_content_type ? PLUG_HAS_GET_CONTENT_TYPE : 0)
+            | (v->set_track ? PLUG_HAS_SET_TRACK : 0)
+            | (v->scandir ? PLUG_HAS_SCANDIR : 0)
+            | (p->api_vminor >= 6 && v->get_scheme_for_name ? PLUG_HAS_GET_SCHEME_FOR_NAME : 0)
+            | (p->api_vminor >= 11 && v->get_identifier ? PLUG_HAS_GET_IDENTIFIER : 0)
+            | (p->api_vminor >= 11 && v->abort_with_identifier ? PLUG_HAS_ABORT_WITH_IDENTIFIER : 0);
+        e->exts = _manifest_copy_list (v->get_schemes ? v->get_schemes () : NULL);
+        e->is_streaming = v->is_streaming ? v->is_streaming () : 0;
+    }
+
+    e->lazy = 1;
+    char **config_keys = _manifest_config_keys (p->configdialog);
+    e->config_hash = _manifest_config_hash (config_keys);
+    _manifest_free_list (config_keys);
+    e->type = p->type;
+    e->api_vmajor = p->api_vmajor;
+    e->api_vminor = p->api_vminor;
+    e->version_major = p->version_major;
+    e->version_minor = p->version_minor;
+    e->flags = p->flags;
+    e->funcs = funcs;
+    e->id = strdup (p->id);
+    e->name = p->name ? strdup (p->name) : NULL;
+    e->descr = p->descr ? strdup (p->descr) : NULL;
+    e->copyright = p->copyright ? strdup (p->copyright) : NULL;
+    e->website = p->website ? strdup (p->website) : NULL;
+    e->configdialog = p->configdialog ? strdup (p->configdialog) : NULL;
+}
+
+// Updates the entries of the plugins loaded in this session, and drops the entries of removed files.
+static void
+_manifest_update (void) {
+    plug_manifest_entry_t *prev = NULL;
+    for (plug_manifest_entry_t *e = manifest; e;) {
+        plug_manifest_entry_t *next = e->next;
+        if (!e->used) {
+            if (prev) {
+                prev->next = next;
+            }
+            else {
+                manifest = next;
+            }
+            _manifest_entry_free (e);
+            manifest_dirty = 1;
+            e = next;
+            continue;
+        }
+        if (e->pending) {
+            char *loaded_path = e->loaded_path;
+            e->loaded_path = NULL;
+            _manifest_entry_clear (e);
+            if (loaded_path) {
+                for (plugin_t *p = plugins; p; p = p->next) {
+                    if (p->filepath && !strcmp (p->filepath, loaded_path)) {
+                        _manifest_entry_set_plugin (e, p);
+                        break;
+                    }
+                }
+                free (loaded_path);
+            }
+            e->pending = 0;
+            manifest_dirty = 1;
+        }
+        prev = e;
+        e = next;
+    }
+    if (manifest_dirty) {
+        _manifest_save ();
+        manifest_dirty = 0;
+    }
+}
+
+static void
+_manifest_free (void) {
+    while (manifest) {
+        plug_manifest_entry_t *next = manifest->next;
+        _manifest_entry_free (manifest);
+        manifest = next;
+    }
+}
+
+// }}}
+
+// {{{ lazily loaded plugins
+//
+// The stubs registered from the manifest have the same plugin type and properties as the real plugins,
+// and forward all calls to them, loading the plugin library on the first call which needs it.
+// The functions without a context argument need a separate trampoline for every stub.
+
+static DB_plugin_t *
+_lazy_plugin_loaded (lazy_plugin_t *lazy) {
+    return __atomic_load_n (&lazy->loaded, __ATOMIC_ACQUIRE);
+}
+
+static void
+_lazy_plugin_sync (lazy_plugin_t *lazy) {
+    DB_plugin_t *p = _lazy_plugin_loaded (lazy);
+    if (p->type == DB_PLUGIN_DECODER) {
+        // some decoders update the extension lists when the config changes
+        lazy->stub.decoder.exts = ((DB_decoder_t *)p)->exts;
+        lazy->stub.decoder.prefixes = ((DB_decoder_t *)p)->prefixes;
+    }
+}
+
+// must be called with lazy_load_mutex held
+static void
+_lazy_plugin_load (lazy_plugin_t *lazy) {
+    plug_manifest_entry_t *e = lazy->entry;
+    char fullname[PATH_MAX];
+    snprintf (fullname, sizeof (fullname), "%s", e->path);
+
+    trace ("loading plugin %s on first use\n", fullname);
+    lazy->failed = 1;
+    void *handle;
+    DB_plugin_t *(*plug_load)(DB_functions_t *api);
+    if (_plug_dlopen (fullname, &handle, &plug_load)) {
+        trace_err ("plugin %s failed to load, deactivated\n", e->path);
+        return;
+    }
+
+    DB_plugin_t *p = plug_load (&deadbeef_api);
+    if (!p || !p->id || strcmp (p->id, e->id) || p->type != e->type) {
+        trace_err ("plugin %s has changed since it was registered, deactivated\n", e->path);
+        dlclose (handle);
+        return;
+    }
+    if (p->start && p->start () < 0) {
+        trace_err ("plugin %s failed to start, deactivated.\n", p->name);
+        if (p->stop) {
+            p->stop ();
+        }
+        dlclose (handle);
+        return;
+    }
+    lazy->plug->handle = handle;
+    free (lazy->plug->filepath);
+    lazy->plug->filepath = strdup (fullname);
+    lazy->failed = 0;
+    __atomic_store_n (&lazy->loaded, p, __ATOMIC_RELEASE);
+    _lazy_plugin_sync (lazy);
+}
+
+static DB_plugin_t *
+_lazy_plugin_get (int slot) {
+    lazy_plugin_t *lazy = &lazy_plugins[slot];
+    DB_plugin_t *p = _lazy_plugin_loaded (lazy);
+    if (p) {
+        return p;
+    }
+    mutex_lock (lazy_load_mutex);
+    if (!lazy->loaded && !lazy->failed) {
+        _lazy_plugin_load (lazy);
+    }
+    p = lazy->loaded;
+    mutex_unlock (lazy_load_mutex);
+    return p;
+}
+
+static int
+_lazy_stop (int slot) {
+    DB_plugin_t *p = _lazy_plugin_loaded (&lazy_plugins[slot]);
+    return p && p->stop ? p->stop () : 0;
+}
+
+static int
+_lazy_message (int slot, uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    lazy_plugin_t *lazy = &lazy_plugins[slot];
+    DB_plugin_t *p = _lazy_plugin_loaded (lazy);
+    if (!p && id == DB_EV_CONFIGCHANGED && !lazy->failed && lazy->config_keys && _manifest_config_hash (lazy->config_keys) != lazy->entry->config_hash) {
+        // the plugin settings have changed, and the stub properties may be out of date
+        p = _lazy_plugin_get (slot);
+    }
+    if (!p) {
+        return 0;
+    }
+    int res = p->message (id, ctx, p1, p2);
+    _lazy_plugin_sync (lazy);
+    return res;
+}
+
+static DB_fileinfo_t *
+_lazy_open (int slot, uint32_t hints, DB_playItem_t *it, int open2) {
+    DB_decoder_t *d = (DB_decoder_t *)_lazy_plugin_get (slot);
+    if (!d) {
+        return NULL;
+    }
+    DB_fileinfo_t *info = open2 ? d->open2 (hints, it) : d->open (hints);
+    if (info && !info->plugin) {
+        // the functions of the stub use the plugin of the fileinfo
+        info->plugin = d;
+    }
+    return info;
+}
+
+static DB_playItem_t *
+_lazy_insert (int slot, ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    DB_decoder_t *d = (DB_decoder_t *)_lazy_plugin_get (slot);
+    return d ? d->insert (plt, after, fname) : NULL;
+}
+
+static int
+_lazy_read_metadata (int slot, DB_playItem_t *it) {
+    DB_decoder_t *d = (DB_decoder_t *)_lazy_plugin_get (slot);
+    return d ? d->read_metadata (it) : -1;
+}
+
+static int
+_lazy_write_metadata (int slot, DB_playItem_t *it) {
+    DB_decoder_t *d = (DB_decoder_t *)_lazy_plugin_get (slot);
+    return d ? d->write_metadata (it) : -1;
+}
+
+static const char **
+_lazy_get_schemes (int slot) {
+    lazy_plugin_t *lazy = &lazy_plugins[slot];
+    DB_plugin_t *p = _lazy_plugin_loaded (lazy);
+    if (p) {
+        return ((DB_vfs_t *)p)->get_schemes ();
+    }
+    static const char *empty[] = { NULL };
+    return lazy->entry->exts ? (const char **)lazy->entry->exts : empty;
+}
+
+static int
+_lazy_is_streaming (int slot) {
+    lazy_plugin_t *lazy = &lazy_plugins[slot];
+    DB_plugin_t *p = _lazy_plugin_loaded (lazy);
+    if (p) {
+        return ((DB_vfs_t *)p)->is_streaming ();
+    }
+    return lazy->entry->is_streaming;
+}
+
+static int
+_lazy_is_container (int slot, const char *fname) {
+    DB_vfs_t *v = (DB_vfs_t *)_lazy_plugin_get (slot);
+    return v ? v->is_container (fname) : 0;
+}
+
+static DB_FILE *
+_lazy_vfs_open (int slot, const char *fname) {
+    DB_vfs_t *v = (DB_vfs_t *)_lazy_plugin_get (slot);
+    return v ? v->open (fname) : NULL;
+}
+
+static int
+_lazy_scandir (int slot, const char *dir, struct dirent ***namelist, int (*selector) (const struct dirent *), int (*cmp) (const struct dirent **, const struct dirent **)) {
+    DB_vfs_t *v = (DB_vfs_t *)_lazy_plugin_get (slot);
+    return v ? v->scandir (dir, namelist, selector, cmp) : -1;
+}
+
+static const char *
+_lazy_get_scheme_for_name (int slot, const char *fname) {
+    DB_vfs_t *v = (DB_vfs_t *)_lazy_plugin_get (slot);
+    return v ? v->get_scheme_for_name (fname) : NULL;
+}
+
+static void
+_lazy_abort_with_identifier (int slot, uint64_t identifier) {
+    // nothing to abort if the plugin was not loaded yet
+    DB_vfs_t *v = (DB_vfs_t *)_lazy_plugin_loaded (&lazy_plugins[slot]);
+    if (v) {
+        v->abort_with_identifier (identifier);
+    }
+}
+
+#define LAZY_SLOTS(X) \
+    X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15) \
+    X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)
+
+#define LAZY_TRAMPOLINES(n) \
+static int _lazy_stop_##n (void) { return _lazy_stop (n); } \
+static int _lazy_message_##n (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) { return _lazy_message (n, id, ctx, p1, p2); } \
+static DB_fileinfo_t *_lazy_open_##n (uint32_t hints) { return _lazy_open (n, hints, NULL, 0); } \
+static DB_fileinfo_t *_lazy_open2_##n (uint32_t hints, DB_playItem_t *it) { return _lazy_open (n, hints, it, 1); } \
+static DB_playItem_t *_lazy_insert_##n (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) { return _lazy_insert (n, plt, after, fname); } \
+static int _lazy_read_metadata_##n (DB_playItem_t *it) { return _lazy_read_metadata (n, it); } \
+static int _lazy_write_metadata_##n (DB_playItem_t *it) { return _lazy_write_metadata (n, it); } \
+static const char **_lazy_get_schemes_##n (void) { return _lazy_get_schemes (n); } \
+static int _lazy_is_streaming_##n (void) { return _lazy_is_streaming (n); } \
+static int _lazy_is_container_##n (const char *fname) { return _lazy_is_container (n, fname); } \
+static DB_FILE *_lazy_vfs_open_##n (const char *fname) { return _lazy_vfs_open (n, fname); } \
+static int _lazy_scandir_##n (const char *dir, struct dirent ***namelist, int (*selector) (const struct dirent *), int (*cmp) (const struct dirent **, const struct dirent **)) { return _lazy_scandir (n, dir, namelist, selector, cmp); } \
+static const char *_lazy_get_scheme_for_name_##n (const char *fname) { return _lazy_get_scheme_for_name (n, fname); } \
+static void _lazy_abort_with_identifier_##n (uint64_t identifier) { _lazy_abort_with_identifier (n, identifier); }
+
+LAZY_SLOTS(LAZY_TRAMPOLINES)
+
+typedef struct {
+    int (*stop) (void);
+    int (*message) (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2);
+    DB_fileinfo_t *(*open) (uint32_t hints);
+    DB_fileinfo_t *(*open2) (uint32_t hints, DB_playItem_t *it);
+    DB_playItem_t *(*insert) (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname);
+    int (*read_metadata) (DB_playItem_t *it);
+    int (*write_metadata) (DB_playItem_t *it);
+    const char **(*get_schemes) (void);
+    int (*is_streaming) (void);
+    int (*is_container) (const char *fname);
+    DB_FILE *(*vfs_open) (const char *fname);
+    int (*scandir) (const char *dir, struct dirent ***namelist, int (*selector) (const struct dirent *), int (*cmp) (const struct dirent **, const struct dirent **));
+    const char *(*get_scheme_for_name) (const char *fname);
+    void (*abort_with_identifier) (uint64_t identifier);
+} lazy_trampolines_t;
+
+#define LAZY_TRAMPOLINES_ENTRY(n) { \
+    _lazy_stop_##n, _lazy_message_##n, _lazy_open_##n, _lazy_open2_##n, _lazy_insert_##n, \
+    _lazy_read_metadata_##n, _lazy_write_metadata_##n, _lazy_get_schemes_##n, _lazy_is_streaming_##n, \
+    _lazy_is_container_##n, _lazy_vfs_open_##n, _lazy_scandir_##n, _lazy_get_scheme_for_name_##n, \
+    _lazy_abort_with_identifier_##n },
+
+static const lazy_trampolines_t lazy_trampolines[MAX_LAZY_PLUGINS] = {
+    LAZY_SLOTS(LAZY_TRAMPOLINES_ENTRY)
+};
+
+// the rest of the functions get the loaded plugin from their arguments
+
+static int
+_lazy_decoder_init (DB_fileinfo_t *info, DB_playItem_t *it) {
+    return info->plugin->init (info, it);
+}
+
+static void
+_lazy_decoder_free (DB_fileinfo_t *info) {
+    info->plugin->free (info);
+}
+
+static int
+_lazy_decoder_read (DB_fileinfo_t *info, char *buffer, int nbytes) {
+    return info->plugin->read (info, buffer, nbytes);
+}
+
+static int
+_lazy_decoder_seek (DB_fileinfo_t *info, float seconds) {
+    return info->plugin->seek (info, seconds);
+}
+
+static int
+_lazy_decoder_seek_sample (DB_fileinfo_t *info, int sample) {
+    return info->plugin->seek_sample (info, sample);
+}
+
+static int
+_lazy_decoder_numvoices (DB_fileinfo_t *info) {
+    return info->plugin->numvoices (info);
+}
+
+static void
+_lazy_decoder_mutevoice (DB_fileinfo_t *info, int voice, int mute) {
+    info->plugin->mutevoice (info, voice, mute);
+}
+
+#if (DDB_API_LEVEL >= 14)
+static int
+_lazy_decoder_seek_sample64 (DB_fileinfo_t *info, int64_t sample) {
+    return ((ddb_decoder2_t *)info->plugin)->seek_sample64 (info, sample);
+}
+#endif
+
+static void
+_lazy_vfs_close (DB_FILE *f) {
+    f->vfs->close (f);
+}
+
+static size_t
+_lazy_vfs_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
+    return stream->vfs->read (ptr, size, nmemb, stream);
+}
+
+static int
+_lazy_vfs_seek (DB_FILE *stream, int64_t offset, int whence) {
+    return stream->vfs->seek (stream, offset, whence);
+}
+
+static int64_t
+_lazy_vfs_tell (DB_FILE *stream) {
+    return stream->vfs->tell (stream);
+}
+
+static void
+_lazy_vfs_rewind (DB_FILE *stream) {
+    stream->vfs->rewind (stream);
+}
+
+static int64_t
+_lazy_vfs_getlength (DB_FILE *stream) {
+    return stream->vfs->getlength (stream);
+}
+
+static const char *
+_lazy_vfs_get_content_type (DB_FILE *stream) {
+    return stream->vfs->get_content_type (stream);
+}
+
+static void
+_lazy_vfs_set_track (DB_FILE *f, DB_playItem_t *it) {
+    f->vfs->set_track (f, it);
+}
+
+static uint64_t
+_lazy_vfs_get_identifier (DB_FILE *f) {
+    return f->vfs->get_identifier (f);
+}
+
+static void
+_lazy_plugin_free (lazy_plugin_t *lazy) {
+    _manifest_free_list (lazy->config_keys);
+    memset (lazy, 0, sizeof (lazy_plugin_t));
+}
+
+// Registers the plugin described by the manifest entry, without loading it.
+static int
+_lazy_plugin_register (plug_manifest_entry_t *e) {
+    int slot;
+    for (slot = 0; slot < MAX_LAZY_PLUGINS && lazy_plugins[slot].in_use; slot++);
+    if (slot == MAX_LAZY_PLUGINS) {
+        return -1;
+    }
+    lazy_plugin_t *lazy = &lazy_plugins[slot];
+    memset (lazy, 0, sizeof (lazy_plugin_t));
+    lazy->in_use = 1;
+    lazy->entry = e;
+    lazy->config_keys = _manifest_config_keys (e->configdialog);
+
+    const lazy_trampolines_t *t = &lazy_trampolines[slot];
+    uint32_t f = e->funcs;
+    DB_plugin_t *p = &lazy->stub.plugin;
+    p->type = e->type;
+    p->api_vmajor = e->api_vmajor;
+    p->api_vminor = e->api_vminor;
+    p->version_major = e->version_major;
+    p->version_minor = e->version_minor;
+    p->flags = e->flags;
+    p->id = e->id;
+    p->name = e->name;
+    p->descr = e->descr;
+    p->copyright = e->copyright;
+    p->website = e->website;
+    p->configdialog = e->configdialog;
+    p->stop = t->stop;
+    p->message = (f & PLUG_HAS_MESSAGE) ? t->message : NULL;
+
+    if (e->type == DB_PLUGIN_DECODER) {
+        DB_decoder_t *d = &lazy->stub.decoder;
+        d->open = (f & PLUG_HAS_OPEN) ? t->open : NULL;
+        d->open2 = (f & PLUG_HAS_OPEN2) ? t->open2 : NULL;
+        d->init = (f & PLUG_HAS_INIT) ? _lazy_decoder_init : NULL;
+        d->free = (f & PLUG_HAS_FREE) ? _lazy_decoder_free : NULL;
+        d->read = (f & PLUG_HAS_READ) ? _lazy_decoder_read : NULL;
+        d->seek = (f & PLUG_HAS_SEEK) ? _lazy_decoder_seek : NULL;
+        d->seek_sample = (f & PLUG_HAS_SEEK_SAMPLE) ? _lazy_decoder_seek_sample : NULL;
+        d->insert = (f & PLUG_HAS_INSERT) ? t->insert : NULL;
+        d->numvoices = (f & PLUG_HAS_NUMVOICES) ? _lazy_decoder_numvoices : NULL;
+        d->mutevoice = (f & PLUG_HAS_MUTEVOICE) ? _lazy_decoder_mutevoice : NULL;
+        d->read_metadata = (f & PLUG_HAS_READ_METADATA) ? t->read_metadata : NULL;
+        d->write_metadata = (f & PLUG_HAS_WRITE_METADATA) ? t->write_metadata : NULL;
+        d->exts = (const char **)e->exts;
+        d->prefixes = (const char **)e->prefixes;
+#if (DDB_API_LEVEL >= 14)
+        lazy->stub.decoder2.seek_sample64 = (f & PLUG_HAS_SEEK_SAMPLE64) ? _lazy_decoder_seek_sample64 : NULL;
+#endif
+    }
+    else {
+        DB_vfs_t *v = &lazy->stub.vfs;
+        v->get_schemes = (f & PLUG_HAS_GET_SCHEMES) ? t->get_schemes : NULL;
+        v->is_streaming = (f & PLUG_HAS_IS_STREAMING) ? t->is_streaming : NULL;
+        v->is_container = (f & PLUG_HAS_IS_CONTAINER) ? t->is_container : NULL;
+        v->open = (f & PLUG_HAS_VFS_OPEN) ? t->vfs_open : NULL;
+        v->close = (f & PLUG_HAS_CLOSE) ? _lazy_vfs_close : NULL;
+        v->read = (f & PLUG_HAS_VFS_READ) ? _lazy_vfs_read : NULL;
+        v->seek = (f & PLUG_HAS_VFS_SEEK) ? _lazy_vfs_seek : NULL;
+        v->tell = (f & PLUG_HAS_TELL) ? _lazy_vfs_tell : NULL;
+        v->rewind = (f & PLUG_HAS_REWIND) ? _lazy_vfs_rewind : NULL;
+        v->getlength = (f & PLUG_HAS_GETLENGTH) ? _lazy_vfs_getlength : NULL;
+        v->get_content_type = (f & PLUG_HAS_GET_CONTENT_TYPE) ? _lazy_vfs_get_content_type : NULL;
+        v->set_track = (f & PLUG_HAS_SET_TRACK) ? _lazy_vfs_set_track : NULL;
+        v->scandir = (f & PLUG_HAS_SCANDIR) ? t->scandir : NULL;
+        v->get_scheme_for_name = (f & PLUG_HAS_GET_SCHEME_FOR_NAME) ? t->get_scheme_for_name : NULL;
+        v->get_identifier = (f & PLUG_HAS_GET_IDENTIFIER) ? _lazy_vfs_get_identifier : NULL;
+        v->abort_with_identifier = (f & PLUG_HAS_ABORT_WITH_IDENTIFIER) ? t->abort_with_identifier : NULL;
+    }
+
+    plugin_t *plug = _plug_add_plugin (p, NULL);
+    if (!plug) {
+        _lazy_plugin_free (lazy);
+        return 0; // a newer version is loaded already, the same as if the plugin was loaded
+    }
+    plug->lazy = lazy;
+    plug->filepath = strdup (e->path);
+    lazy->plug = plug;
+    return 0;
+}
+
+// Registers the plugin from the manifest, if it's up to date.
+// Otherwise the plugin needs to be loaded, and the manifest gets updated from it.
+static int
+_manifest_register_plugin (const char *fullname, struct stat *st) {
+    if (!manifest_enabled) {
+        return -1;
+    }
+    plug_manifest_entry_t *e;
+    plug_manifest_entry_t *tail = NULL;
+    for (e = manifest; e; tail = e, e = e->next) {
+        if (!strcmp (e->path, fullname)) {
+            break;
+        }
+    }
+    if (e && e->used) {
+        return -1; // duplicate
+    }
+    if (!e) {
+        e = calloc (1, sizeof (plug_manifest_entry_t));
+        e->path = strdup (fullname);
+        if (tail) {
+            tail->next = e;
+        }
+        else {
+            manifest = e;
+        }
+        e->pending = 1;
+    }
+    e->used = 1;
+    if (e->mtime != (int64_t)st->st_mtime || e->size != (int64_t)st->st_size) {
+        e->mtime = st->st_mtime;
+        e->size = st->st_size;
+        e->pending = 1;
+    }
+    if (e->pending || !e->lazy) {
+        return -1;
+    }
+    char **config_keys = _manifest_config_keys (e->configdialog);
+    uint32_t config_hash = _manifest_config_hash (config_keys);
+    _manifest_free_list (config_keys);
+    if (e->config_hash != config_hash || _lazy_plugin_register (e)) {
+        e->pending = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// }}}
+
+// d_name must be writable w/o sideeffects; contain valid .so name
+// l must be strlen(d_name)
+static int
+load_plugin (const char *plugdir, char *d_name, int l) {
+    // hack for osx to skip *.0.so files
+    if (strstr (d_name, ".0.so")) {
+        return -1;
+    }
+
+    char fullname[PATH_MAX];
+    snprintf (fullname, PATH_MAX, "%s/%s", plugdir, d_name);
+
+    // check if the file exists, to avoid printing bogus errors
+    struct stat s;
+    if (0 != stat (fullname, &s)) {
+        return -1;
+    }
+
+    if (!_manifest_register_plugin (fullname, &s)) {
+        trace ("registered plugin %s from manifest\n", fullname);
         return 0;
     }
-    if (plug_init_plugin (plug_load, handle) < 0) {
-        d_name[l-sizeof (PLUGINEXT)+1] = 0;
+
+    trace ("loading plugin %s/%s\n", plugdir, d_name);
+    char loadname[PATH_MAX];
+    snprintf (loadname, sizeof (loadname), "%s", fullname);
+    void *handle;
+    DB_plugin_t *(*plug_load)(DB_functions_t *api);
+    int res = _plug_dlopen (loadname, &handle, &plug_load);
+    if (res) {
+        return res > 0 ? 0 : -1;
+    }
+    DB_plugin_t *plugin_api = plug_load (&deadbeef_api);
+    plugin_t *plug = plugin_api ? _plug_add_plugin (plugin_api, handle) : NULL;
+    if (!plug) {
         dlclose (handle);
         return -1;
     }
-    plugins_tail->filepath = strdup (fullname);
+    plug->filepath = strdup (loadname);
+    if (manifest_enabled) {
+        for (plug_manifest_entry_t *e = manifest; e; e = e->next) {
+            if (e->pending && !strcmp (e->path, fullname)) {
+                free (e->loaded_path);
+                e->loaded_path = strdup (loadname);
+                break;
+            }
+        }
+    }
     return 0;
 }
 
@@ -1007,12 +2138,20 @@ plug_load_all (void) {
 #endif
 
     background_jobs_mutex = mutex_create ();
+    lazy_load_mutex = mutex_create ();
+    jobs_init ();
 
     const char *dirname = plug_get_system_dir (DDB_SYS_DIR_PLUGIN);
 
     // remember how many plugins to skip if called Nth time
     plugin_t *prev_plugins_tail = plugins_tail;
 
+    manifest_enabled = !manifest_loaded && conf_get_int ("plugins.lazy_loading", 1);
+    if (manifest_enabled) {
+        manifest_loaded = 1;
+        _manifest_load ();
+    }
+
 #ifdef OSX_APPBUNDLE
     char libpath[PATH_MAX];
     int res = cocoautil_get_application_support_path (libpath, sizeof (libpath));
@@ -1232,6 +2371,11 @@ plug_load_all (void) {
     g_dsp_plugins[numdsp] = NULL;
     g_playlist_plugins[numplaylist] = NULL;
 
+    if (manifest_enabled) {
+        _manifest_update ();
+        manifest_enabled = 0;
+    }
+
     // select output plugin
 #ifndef XCTEST
     if (plug_reinit_sound () < 0) {
@@ -1316,6 +2460,10 @@ plug_unload_all (void) {
         }
     }
     trace ("stopped all plugins\n");
+
+    // jobs may still be running plugin code
+    jobs_free ();
+
     while (plugins) {
         plugin_t *next = plugins->next;
         if (plugins->handle) {
@@ -1330,6 +2478,9 @@ plug_unload_all (void) {
         g_gui_names[i] = NULL;
     }
     plugins_tail = NULL;
+    memset (lazy_plugins, 0, sizeof (lazy_plugins));
+    _manifest_free ();
+    manifest_loaded = 0;
 
     memset (g_plugins, 0, sizeof (g_plugins));
     memset (g_gui_names, 0, sizeof (g_gui_names));
@@ -1346,6 +2497,10 @@ plug_unload_all (void) {
         mutex_free (background_jobs_mutex);
         background_jobs_mutex = 0;
     }
+    if (lazy_load_mutex) {
+        mutex_free (lazy_load_mutex);
+        lazy_load_mutex = 0;
+    }
 }
 
 void
@@ -1505,7 +2660,7 @@ const char *
 plug_get_path_for_plugin_ptr (DB_plugin_t *plugin_ptr) {
     plugin_t *p;
     for (p = plugins; p; p = p->next) {
-        if (p->plugin == plugin_ptr) {
+        if (p->plugin == plugin_ptr || (p->lazy && p->lazy->loaded == plugin_ptr)) {
             return p->filepath;
         }
     }
@@ -35,6 +35,7 @@
 #include "aac_decoder_faad2.h"
 
 #include "../../shared/mp4tagutil.h"
+#include "../../shared/mp4sampletable.h"
 
 #define min(x,y) ((x)<(y)?(x):(y))
 #define max(x,y) ((x)>(y)?(x):(y))
@@ -84,6 +85,7 @@ typedef struct {
     mp4p_file_callbacks_t mp4reader;
     mp4p_atom_t *mp4file;
     mp4p_atom_t *trak;
+    mp4_sample_table_t sample_table;
     uint64_t mp4samples;
     uint32_t aac_samplerate;
 
@@ -284,11 +286,14 @@ aac_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         mp4p_atom_t *stts_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl/stts");
 
         uint64_t total_sample_duration = mp4p_stts_total_sample_duration (stts_atom);
-        mp4p_atom_t *stsz_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl/stsz");
-        mp4p_stsz_t *stsz = stsz_atom->data;
+
+        mp4p_atom_t *stbl_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl");
+        if (mp4_sample_table_init (&info->sample_table, stbl_atom) < 0) {
+            return -1;
+        }
 
         // init mp4 decoding
-        info->mp4samples = stsz->number_of_entries;
+        info->mp4samples = info->sample_table.count;
         info->dec = aacDecoderOpenFAAD2();
         unsigned samplerate;
         unsigned channels;
@@ -413,6 +418,7 @@ aac_free (DB_fileinfo_t *_info) {
         if (info->mp4file) {
             mp4p_atom_free_list (info->mp4file);
         }
+        mp4_sample_table_free (&info->sample_table);
         if (info->dec) {
             aacDecoderClose (info->dec);
         }
@@ -558,24 +564,16 @@ aac_read (DB_fileinfo_t *_info, char *bytes, int size) {
                 break;
             }
 
-            mp4p_atom_t *stbl_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl");
-            uint64_t offs = mp4p_sample_offset (stbl_atom, info->mp4sample);
-            unsigned int size = mp4p_sample_size (stbl_atom, info->mp4sample);
-//            printf ("%08X %d\n", (int)offs, size);
-
-            uint8_t *mp4packet = malloc (size);
-            deadbeef->fseek (info->file, offs+info->junk, SEEK_SET);
-            if (size != deadbeef->fread (mp4packet, 1, size, info->file)) {
+            unsigned int size = info->sample_table.samples[info->mp4sample].size;
+            const uint8_t *mp4packet = mp4_sample_table_read (&info->sample_table, info->file, info->junk, info->mp4sample);
+            if (!mp4packet) {
                 trace ("aac: failed to read sample\n");
                 info->eof = 1;
                 break;
             }
             info->mp4sample++;
 
-            samples = aacDecoderDecodeFrame (info->dec, &info->frame_info, mp4packet, size);
-
-            free (mp4packet);
-            mp4packet = NULL;
+            samples = aacDecoderDecodeFrame (info->dec, &info->frame_info, (uint8_t *)mp4packet, size);
 
             if (!samples) {
                 trace ("aac: ascDecoderDecodeFrame returned NULL\n");
@@ -698,12 +696,10 @@ aac_seek_sample (DB_fileinfo_t *_info, int sample) {
     sample += info->startsample;
 
     if (info->mp4file) {
-        mp4p_atom_t *stts_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl/stts");
-
         uint64_t seeksample = (int)((int64_t)sample * info->aac_samplerate / _info->fmt.samplerate);
 
         uint64_t startsample = 0;
-        info->mp4sample = mp4p_stts_mp4sample_containing_sample(stts_atom, seeksample, &startsample);
+        info->mp4sample = mp4_sample_table_find (&info->sample_table, seeksample, &startsample);
 
         startsample = startsample * _info->fmt.samplerate / info->aac_samplerate;
         info->skipsamples = sample - startsample;
@@ -771,36 +767,35 @@ aac_load_itunes_chapters (aac_info_t *info, mp4p_chap_t *chap, /* out */ int *nu
             continue;
         }
 
-        mp4p_atom_t *stts_atom = mp4p_atom_find(trak_atom, "trak/mdia/minf/stbl/stts");
         mp4p_atom_t *mdhd_atom = mp4p_atom_find(trak_atom, "trak/mdia/mdhd");
         mp4p_atom_t *stbl_atom = mp4p_atom_find(trak_atom, "trak/mdia/minf/stbl");
-        mp4p_atom_t *stsz_atom = mp4p_atom_find(stbl_atom, "stbl/stsz");
-        if (stts_atom == NULL || mdhd_atom == NULL || stbl_atom == NULL || stsz_atom == NULL) {
+        if (mdhd_atom == NULL || stbl_atom == NULL) {
             return NULL;
         }
 
         mp4p_mdhd_t *mdhd = mdhd_atom->data;
-        mp4p_stsz_t *stsz = stsz_atom->data;
 
         if (mdhd->time_scale == 0) {
             return NULL;
         }
 
-        aac_chapter_t *chapters = calloc (stsz->number_of_entries, sizeof (aac_chapter_t));
+        // chapter titles are usually stored back to back, and get read in a few large reads
+        mp4_sample_table_t table;
+        if (mp4_sample_table_init (&table, stbl_atom) < 0) {
+            return NULL;
+        }
+
+        aac_chapter_t *chapters = calloc (table.count, sizeof (aac_chapter_t));
         *num_chapters = 0;
 
-        int64_t curr_sample = 0;
-        for (int sample = 0; sample < stsz->number_of_entries; sample++)
+        for (uint32_t sample = 0; sample < table.count; sample++)
         {
-            unsigned char *buffer = NULL;
-
-            uint64_t offs = mp4p_sample_offset (stbl_atom, sample);
-            uint32_t size = mp4p_sample_size (stbl_atom, sample);
-
-            buffer = malloc (size);
-            deadbeef->fseek (info->file, offs+info->junk, SEEK_SET);
-            if (size != deadbeef->fread (buffer, 1, size, info->file)) {
-                free (buffer);
+            uint32_t size = table.samples[sample].size;
+            if (size < 2) {
+                continue;
+            }
+            const uint8_t *buffer = mp4_sample_table_read (&table, info->file, info->junk, sample);
+            if (!buffer) {
                 continue;
             }
             int len = (buffer[0] << 8) | buffer[1];
@@ -808,13 +803,13 @@ aac_load_itunes_chapters (aac_info_t *info, mp4p_chap_t *chap, /* out */ int *nu
             if (len > 0) {
                 chapters[*num_chapters].title = strndup ((const char *)&buffer[2], len);
             }
-            chapters[*num_chapters].startsample = (int)curr_sample;
-            uint64_t samplecount = mp4p_stts_sample_duration(stts_atom, sample) / mdhd->time_scale * samplerate;
-            curr_sample += samplecount;
-            chapters[*num_chapters].endsample = (int)curr_sample - 1;
-            free (buffer);
+            uint64_t start = table.samples[sample].timestamp;
+            uint64_t end = sample + 1 < table.count ? table.samples[sample + 1].timestamp : table.total_duration;
+            chapters[*num_chapters].startsample = (int64_t)(start * samplerate / mdhd->time_scale);
+            chapters[*num_chapters].endsample = (int64_t)(end * samplerate / mdhd->time_scale) - 1;
             (*num_chapters)++;
         }
+        mp4_sample_table_free (&table);
         return chapters;
     }
     return NULL;
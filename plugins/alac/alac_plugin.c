@@ -39,6 +39,7 @@
 #include "decomp.h"
 
 #include "../../shared/mp4tagutil.h"
+#include "../../shared/mp4sampletable.h"
 
 #include <mp4p/mp4p.h>
 
@@ -72,6 +73,7 @@ typedef struct {
     mp4p_file_callbacks_t mp4reader;
     mp4p_atom_t *mp4file;
     mp4p_atom_t *trak;
+    mp4_sample_table_t sample_table;
     uint32_t alac_samplerate;
     uint64_t mp4samples;
     alac_file *_alac;
@@ -153,10 +155,12 @@ alacplug_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     totalsamples = total_sample_duration * samplerate / alac->sample_rate;
     duration = total_sample_duration / (float)alac->sample_rate;
 
-    mp4p_atom_t *stsz_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl/stsz");
-    mp4p_stsz_t *stsz = stsz_atom->data;
+    mp4p_atom_t *stbl_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl");
+    if (mp4_sample_table_init (&info->sample_table, stbl_atom) < 0) {
+        return -1;
+    }
 
-    info->mp4samples = stsz->number_of_entries;
+    info->mp4samples = info->sample_table.count;
 
     _info->fmt.samplerate = samplerate;
     _info->fmt.channels = channels;
@@ -196,6 +200,7 @@ alacplug_free (DB_fileinfo_t *_info) {
         if (info->mp4file) {
             mp4p_atom_free_list (info->mp4file);
         }
+        mp4_sample_table_free (&info->sample_table);
 
         if (info->_alac) {
             alac_file_free (info->_alac);
@@ -249,8 +254,6 @@ alacplug_read (DB_fileinfo_t *_info, char *bytes, int size) {
             continue;
         }
 
-        unsigned char *buffer = NULL;
-//        uint32_t buffer_size = 0;
         uint32_t outNumSamples = 0;
 
         if (info->mp4sample >= info->mp4samples) {
@@ -258,27 +261,19 @@ alacplug_read (DB_fileinfo_t *_info, char *bytes, int size) {
             break;
         }
 
-        mp4p_atom_t *stbl_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl");
-        uint64_t offs = mp4p_sample_offset (stbl_atom, info->mp4sample);
-        uint64_t size = mp4p_sample_size (stbl_atom, info->mp4sample);
-
-        buffer = malloc (size);
-        deadbeef->fseek (info->file, offs+info->junk, SEEK_SET);
-        if (size != deadbeef->fread (buffer, 1, size, info->file)) {
+        uint32_t size = info->sample_table.samples[info->mp4sample].size;
+        const uint8_t *buffer = mp4_sample_table_read (&info->sample_table, info->file, info->junk, info->mp4sample);
+        if (!buffer) {
             trace ("alac: failed to read sample\n");
             break;
         }
 
         int outputBytes = 0;
-        decode_frame(info->_alac, buffer, (int)size, info->out_buffer, &outputBytes);
+        decode_frame(info->_alac, (unsigned char *)buffer, (int)size, info->out_buffer, &outputBytes);
         outNumSamples = outputBytes / samplesize;
 
         info->out_remaining += outNumSamples;
         info->mp4sample++;
-
-        if (buffer) {
-            free (buffer);
-        }
     }
 
     info->currentsample += (initsize-size) / samplesize;
@@ -291,12 +286,10 @@ alacplug_seek_sample (DB_fileinfo_t *_info, int sample) {
 
     sample += info->startsample;
 
-    mp4p_atom_t *stts_atom = mp4p_atom_find(info->trak, "trak/mdia/minf/stbl/stts");
-
     uint64_t seeksample = (int)((int64_t)sample * info->alac_samplerate / _info->fmt.samplerate);
 
     uint64_t startsample = 0;
-    info->mp4sample = mp4p_stts_mp4sample_containing_sample(stts_atom, seeksample, &startsample);
+    info->mp4sample = mp4_sample_table_find (&info->sample_table, seeksample, &startsample);
 
     startsample = startsample * _info->fmt.samplerate / info->alac_samplerate;
     info->skipsamples = sample - startsample;
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #if USE_PARANOIA_10_2
     #include <cdio/paranoia/cdda.h>
@@ -56,6 +57,17 @@
 #define SECTORSIZE CDIO_CD_FRAMESIZE_RAW //2352
 #define SAMPLESIZE 4 //bytes
 
+// read-ahead ring, 10 seconds of audio
+#define RING_SECTORS (CDIO_CD_FRAMES_PER_SEC * 10)
+// the number of sectors per read adapts between 1 and MAX_SPAN_SECTORS:
+// doubled after each successful read, halved on errors,
+// and never grows back beyond the size of a failed read, to respect the drive transfer limit
+#define MAX_SPAN_SECTORS 64
+#define INITIAL_SPAN_SECTORS 16
+#define MAX_READ_RETRIES 3
+// index of "Max" in the drive speed list
+#define DRIVE_SPEED_MAX 5
+
 #define CDDB_CATEGORY_SIZE 12
 #define CDDB_DISCID_SIZE 10
 #define MAX_CDDB_DISCS 10
@@ -77,17 +89,35 @@ typedef struct
     cdrom_drive *cdrom;
 #endif
     lsn_t first_sector;
-    lsn_t current_sector;
     lsn_t last_sector;
-    uint8_t buffer[SECTORSIZE];
-    uint8_t *tail;
-    size_t tail_length;
+    int drive_speed;
+
+    // the reader thread fills the ring, cda_read consumes it
+    intptr_t reader_tid;
+    // plain pthread objects, since waiting for the ring state needs a cond_wait on a locked mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t *ring;
+    // protected by the mutex
+    int ring_head; // ring index of the first buffered sector
+    int ring_count; // number of buffered sectors
+    int ring_filled; // the ring had no room for another read since the last seek
+    lsn_t ring_sector; // sector number at ring_head
+    size_t sector_offset; // bytes of the first buffered sector already consumed
+    lsn_t read_sector; // next sector to be read by the reader thread
+    int generation; // incremented on seek, reads which were in flight get discarded
+    int starved; // the ring ran empty during playback
+    int read_error;
+    int quit;
 } cdda_info_t;
 
 struct cddb_thread_params
 {
     DB_playItem_t **items;
     cddb_disc_t *disc;
+    char *device;
+    driver_id_t driver_id;
+    int enable_cddb;
     int got_cdtext;
     int prefer_cdtext;
 };
@@ -124,6 +154,21 @@ create_disc(CdIo_t *cdio)
     return disc;
 }
 
+static int
+is_image_driver (driver_id_t driver_id)
+{
+    return driver_id == DRIVER_NRG || driver_id == DRIVER_BINCUE || driver_id == DRIVER_CDRDAO;
+}
+
+static void
+set_drive_speed (cdda_info_t *info)
+{
+    cdio_set_speed(info->cdio, info->drive_speed < DRIVE_SPEED_MAX ? 1<<info->drive_speed : -1);
+}
+
+static void
+reader_thread (void *ctx);
+
 static DB_fileinfo_t *
 cda_open (uint32_t hints)
 {
@@ -135,6 +180,8 @@ cda_open (uint32_t hints)
         info->info.fmt.channels = 2;
         info->info.fmt.samplerate = 44100;
         info->info.fmt.channelmask = DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT;
+        pthread_mutex_init(&info->mutex, NULL);
+        pthread_cond_init(&info->cond, NULL);
     }
     return (DB_fileinfo_t *)info;
 }
@@ -168,7 +215,8 @@ cda_init (DB_fileinfo_t *_info, DB_playItem_t *it)
 
     const int need_bitrate = info->hints & DDB_DECODER_HINT_NEED_BITRATE;
     const int drive_speed = deadbeef->conf_get_int("cdda.drive_speed", 2);
-    cdio_set_speed(info->cdio, need_bitrate && drive_speed < 5 ? 1<<drive_speed : -1);
+    info->drive_speed = need_bitrate && drive_speed < DRIVE_SPEED_MAX ? drive_speed : DRIVE_SPEED_MAX;
+    set_drive_speed(info);
 
     cddb_disc_t *disc = create_disc(info->cdio);
     if (!disc) {
@@ -193,7 +241,6 @@ cda_init (DB_fileinfo_t *_info, DB_playItem_t *it)
     }
 
     info->first_sector = cdio_get_track_lsn(info->cdio, track_nr);
-    info->current_sector = info->first_sector;
     info->last_sector = info->first_sector + cdio_get_track_sec_count(info->cdio, track_nr) - 1;
     trace("cdio nchannels (should always be 2 for an audio track): %d\n", cdio_get_track_channels (info->cdio, track_nr));
     if (info->first_sector == CDIO_INVALID_LSN || info->last_sector <= info->first_sector) {
@@ -202,7 +249,7 @@ cda_init (DB_fileinfo_t *_info, DB_playItem_t *it)
     }
 
 #if USE_PARANOIA
-    if (cdio_get_driver_id(info->cdio) != DRIVER_NRG) {
+    if (!is_image_driver(cdio_get_driver_id(info->cdio))) {
         info->cdrom = cdda_identify(device, CDDA_MESSAGE_FORGETIT, NULL);
         if (info->cdrom) {
             cdda_open(info->cdrom);
@@ -220,6 +267,19 @@ cda_init (DB_fileinfo_t *_info, DB_playItem_t *it)
         paranoia_seek(info->paranoia, info->first_sector, SEEK_SET);
     }
 #endif
+
+    info->ring = malloc(RING_SECTORS * SECTORSIZE);
+    if (!info->ring) {
+        return -1;
+    }
+    info->ring_sector = info->first_sector;
+    info->read_sector = info->first_sector;
+    info->reader_tid = deadbeef->thread_start(reader_thread, info);
+    if (!info->reader_tid) {
+        trace ("cdda: failed to start the reader thread\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -232,25 +292,123 @@ paranoia_callback(long bytes, int mode)
 }
 #endif
 
-static const char *
-read_sector(cdda_info_t *info)
+// reads count sectors starting at sector, called only from the reader thread
+static int
+read_sectors(cdda_info_t *info, uint8_t *dest, lsn_t sector, int count, int need_seek)
 {
 #if USE_PARANOIA
     if (info->paranoia) {
-        const int16_t *p_readbuf = paranoia_read(info->paranoia, NULL);
-        if (p_readbuf) {
-            info->current_sector++;
-            return (char *)p_readbuf;
+        if (need_seek) {
+            paranoia_seek(info->paranoia, sector, SEEK_SET);
+        }
+        // paranoia only reads one sector at a time
+        for (int i = 0; i < count; i++) {
+            const int16_t *p_readbuf = paranoia_read(info->paranoia, NULL);
+            if (!p_readbuf) {
+                return -1;
+            }
+            memcpy(dest + i * SECTORSIZE, p_readbuf, SECTORSIZE);
         }
+        return 0;
     }
-    else
 #endif
-    if (!cdio_read_audio_sector(info->cdio, info->buffer, info->current_sector)) {
-        info->current_sector++;
-        return info->buffer;
-    }
+    return cdio_read_audio_sectors(info->cdio, dest, sector, count) == DRIVER_OP_SUCCESS ? 0 : -1;
+}
+
+static void
+reader_thread (void *ctx)
+{
+    cdda_info_t *info = ctx;
+    int span = INITIAL_SPAN_SECTORS;
+    int max_span = MAX_SPAN_SECTORS;
+    int retries = 0;
+    int need_seek = 0;
+    int generation = 0;
+
+    pthread_mutex_lock(&info->mutex);
+    for (;;) {
+        // wait until a whole span fits into the ring
+        for (;;) {
+            if (info->quit) {
+                break;
+            }
+            const int remaining = info->last_sector - info->read_sector + 1;
+            const int wanted = span < remaining ? span : remaining;
+            if (!info->read_error && remaining > 0 && RING_SECTORS - info->ring_count >= wanted) {
+                break;
+            }
+            pthread_cond_wait(&info->cond, &info->mutex);
+        }
+        if (info->quit) {
+            break;
+        }
+
+        if (generation != info->generation) {
+            generation = info->generation;
+            need_seek = 1;
+        }
+
+        const lsn_t sector = info->read_sector;
+        const int tail = (info->ring_head + info->ring_count) % RING_SECTORS;
+        int count = span;
+        if (count > RING_SECTORS - info->ring_count) {
+            count = RING_SECTORS - info->ring_count;
+        }
+        if (count > RING_SECTORS - tail) {
+            count = RING_SECTORS - tail;
+        }
+        if (count > info->last_sector - sector + 1) {
+            count = info->last_sector - sector + 1;
+        }
+        // one speed step per underrun: the ring needs to fill up again before the next one
+        const int starved = info->starved;
+        if (starved) {
+            info->starved = 0;
+            info->ring_filled = 0;
+        }
+        pthread_mutex_unlock(&info->mutex);
+
+        // the drive doesn't keep up with playback, spin it faster
+        if (starved && info->drive_speed < DRIVE_SPEED_MAX) {
+            info->drive_speed++;
+            set_drive_speed(info);
+        }
 
-    return NULL;
+        // the consumer doesn't touch the free part of the ring, no need to hold the lock while reading
+        const int res = read_sectors(info, info->ring + tail * SECTORSIZE, sector, count, need_seek);
+        need_seek = 0;
+
+        pthread_mutex_lock(&info->mutex);
+        if (generation != info->generation) {
+            // seeked while reading
+            continue;
+        }
+        if (res) {
+            trace ("cdda: failed to read %d sectors at %d\n", count, sector);
+            need_seek = 1;
+            if (count > 1) {
+                // a read clamped by the ring or the track end says nothing about the span the drive can do
+                if (count == span) {
+                    max_span = span / 2;
+                }
+                span = count / 2;
+            }
+            else if (++retries >= MAX_READ_RETRIES) {
+                info->read_error = 1;
+                pthread_cond_broadcast(&info->cond);
+            }
+            continue;
+        }
+        retries = 0;
+        span = span * 2 < max_span ? span * 2 : max_span;
+        info->ring_count += count;
+        info->read_sector += count;
+        if (RING_SECTORS - info->ring_count < span) {
+            info->ring_filled = 1;
+        }
+        pthread_cond_broadcast(&info->cond);
+    }
+    pthread_mutex_unlock(&info->mutex);
 }
 
 static int
@@ -258,42 +416,52 @@ cda_read (DB_fileinfo_t *_info, char *bytes, int size)
 {
     cdda_info_t *info = (cdda_info_t *)_info;
     char *fill = bytes;
-    const char *high_water = bytes + size;
-
-    if (info->tail_length >= size) {
-        memcpy(fill, info->tail, size);
-        info->tail += size;
-        fill += size;
-        info->tail_length -= size;
-    }
-    else if (info->tail_length > 0) {
-        memcpy(fill, info->tail, info->tail_length);
-        fill += info->tail_length;
-        info->tail_length = 0;
-    }
 
-    while (fill < high_water && info->current_sector <= info->last_sector) {
-        const char *p_readbuf = read_sector(info);
-        if (!p_readbuf) {
-            trace("cda_read: read_sector failed\n");
-            return -1;
+    pthread_mutex_lock(&info->mutex);
+    while (size > 0) {
+        if (!info->ring_count) {
+            if (info->read_error) {
+                trace("cda_read: read error\n");
+                if (fill == bytes) {
+                    pthread_mutex_unlock(&info->mutex);
+                    return -1;
+                }
+                break;
+            }
+            if (info->read_sector > info->last_sector) {
+                break;
+            }
+            if (info->ring_filled) {
+                info->starved = 1;
+            }
+            pthread_cond_broadcast(&info->cond);
+            pthread_cond_wait(&info->cond, &info->mutex);
+            continue;
         }
 
-        if (fill+SECTORSIZE <= high_water) {
-            memcpy(fill, p_readbuf, SECTORSIZE);
-            fill += SECTORSIZE;
+        size_t n = SECTORSIZE - info->sector_offset;
+        if (n > size) {
+            n = size;
         }
-        else {
-            const size_t bytes_left = high_water - fill;
-            memcpy(fill, p_readbuf, bytes_left);
-            fill += bytes_left;
-            info->tail_length = SECTORSIZE - bytes_left;
-            info->tail = (char *)p_readbuf + bytes_left;
+        memcpy(fill, info->ring + info->ring_head * SECTORSIZE + info->sector_offset, n);
+        fill += n;
+        size -= n;
+        info->sector_offset += n;
+        if (info->sector_offset == SECTORSIZE) {
+            info->sector_offset = 0;
+            info->ring_head = (info->ring_head + 1) % RING_SECTORS;
+            info->ring_count--;
+            info->ring_sector++;
+            // wake up the reader once there's room for a full span
+            if (RING_SECTORS - info->ring_count == MAX_SPAN_SECTORS) {
+                pthread_cond_broadcast(&info->cond);
+            }
         }
     }
 
 //    trace ("requested: %d, return: %d\n", size, fill-bytes);
-    _info->readpos = (float)(info->current_sector-info->first_sector) * SECTORSIZE / SAMPLESIZE / _info->fmt.samplerate;
+    _info->readpos = (float)((info->ring_sector-info->first_sector) * SECTORSIZE + info->sector_offset) / SAMPLESIZE / _info->fmt.samplerate;
+    pthread_mutex_unlock(&info->mutex);
     return fill - bytes;
 }
 
@@ -302,6 +470,16 @@ cda_free (DB_fileinfo_t *_info)
 {
     if (_info) {
         cdda_info_t *info = (cdda_info_t *)_info;
+        if (info->reader_tid) {
+            pthread_mutex_lock(&info->mutex);
+            info->quit = 1;
+            pthread_cond_broadcast(&info->cond);
+            pthread_mutex_unlock(&info->mutex);
+            deadbeef->thread_join(info->reader_tid);
+        }
+        pthread_mutex_destroy(&info->mutex);
+        pthread_cond_destroy(&info->cond);
+        free (info->ring);
         if (info->cdio) {
             cdio_destroy (info->cdio);
         }
@@ -325,19 +503,28 @@ cda_seek_sample (DB_fileinfo_t *_info, int sample)
     const int sector = sample * SAMPLESIZE / SECTORSIZE + info->first_sector;
     const int offset = sample * SAMPLESIZE % SECTORSIZE;
 
-#if USE_PARANOIA
-    if (info->paranoia) {
-        paranoia_seek(info->paranoia, sector, SEEK_SET);
-    }
-#endif
-    info->current_sector = sector;
-    const char *p_readbuf = read_sector(info);
-    if (!p_readbuf) {
-        return -1;
+    pthread_mutex_lock(&info->mutex);
+    if (sector >= info->ring_sector && sector < info->ring_sector + info->ring_count) {
+        // already buffered, drop the sectors before the target
+        const int skip = sector - info->ring_sector;
+        info->ring_head = (info->ring_head + skip) % RING_SECTORS;
+        info->ring_count -= skip;
+        info->ring_sector = sector;
     }
+    else {
+        info->ring_head = 0;
+        info->ring_count = 0;
+        info->ring_filled = 0;
+        info->ring_sector = sector;
+        info->read_sector = sector;
+        info->read_error = 0;
+        info->generation++;
+    }
+    info->sector_offset = offset;
+    info->starved = 0;
+    pthread_cond_broadcast(&info->cond);
+    pthread_mutex_unlock(&info->mutex);
 
-    info->tail = (char *)p_readbuf + offset;
-    info->tail_length = SECTORSIZE - offset;
     _info->readpos = (float)sample / _info->fmt.samplerate;
 
     return 0;
@@ -419,6 +606,7 @@ cleanup_thread_params (struct cddb_thread_params *params)
     if (params->disc) {
         cddb_disc_destroy(params->disc);
     }
+    free(params->device);
     free(params);
 }
 
@@ -467,38 +655,6 @@ write_metadata(struct cddb_thread_params *params, DB_playItem_t *it, const cddb_
     deadbeef->event_send((ddb_event_t *)ev, 0, 0);
 }
 
-static void
-cddb_thread (void *params_void)
-{
-    struct cddb_thread_params *params = (struct cddb_thread_params *)params_void;
-
-    char disc_list[(CDDB_CATEGORY_SIZE + CDDB_DISCID_SIZE + 1) * MAX_CDDB_DISCS];
-    const int num_discs = resolve_disc(params->disc, disc_list);
-    if (num_discs <= 0) {
-        trace("disc not resolved\n");
-        cleanup_thread_params(params);
-        return;
-    }
-    trace("disc resolved\n");
-
-    char num_tracks[4];
-    int track_count = cddb_disc_get_track_count(params->disc);
-    snprintf(num_tracks, sizeof(num_tracks), "%02d", track_count);
-    for (size_t i = 0; params->items[i]; i++) {
-        deadbeef->pl_add_meta(params->items[i], CDDB_IDS_TAG, disc_list);
-        write_metadata(params, params->items[i], params->disc, num_tracks);
-    }
-
-    cleanup_thread_params(params);
-
-    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
-    if (plt) {
-        deadbeef->plt_modified (plt);
-        deadbeef->plt_unref (plt);
-    }
-    deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
-}
-
 static void
 read_track_cdtext (CdIo_t *cdio, int track_nr, DB_playItem_t *item)
 {
@@ -632,7 +788,7 @@ read_track_cdtext (CdIo_t *cdio, int track_nr, DB_playItem_t *item)
 }
 
 static int
-read_disc_cdtext (CdIo_t *cdio, DB_playItem_t **items, const track_t tracks)
+read_disc_cdtext (CdIo_t *cdio, DB_playItem_t **items)
 {
 #if CDIO_API_VERSION >= 6
     cdtext_t *cdtext = cdio_get_cdtext(cdio);
@@ -643,13 +799,74 @@ read_disc_cdtext (CdIo_t *cdio, DB_playItem_t **items, const track_t tracks)
         return 0;
     }
 
-    for (track_t i = 0; i < tracks; i++) {
+    for (size_t i = 0; items[i]; i++) {
         read_track_cdtext(cdio, deadbeef->pl_find_meta_int(items[i], "track", 0), items[i]);
     }
 
     return 1;
 }
 
+static void
+notify_playlist_changed (void)
+{
+    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+    if (plt) {
+        deadbeef->plt_modified (plt);
+        deadbeef->plt_unref (plt);
+    }
+    deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+}
+
+// CD-Text can take seconds to read from a spun down drive, and CDDB needs the network,
+// so both run here instead of on the insert path
+static void
+metadata_thread (void *params_void)
+{
+    struct cddb_thread_params *params = (struct cddb_thread_params *)params_void;
+
+    CdIo_t *cdio = cdio_open(params->device, params->driver_id);
+    if (cdio) {
+        params->got_cdtext = read_disc_cdtext(cdio, params->items);
+        cdio_destroy(cdio);
+    }
+    if (params->got_cdtext) {
+        notify_playlist_changed();
+    }
+
+    if (params->enable_cddb) {
+        trace("cdda: querying freedb...\n");
+        char disc_list[(CDDB_CATEGORY_SIZE + CDDB_DISCID_SIZE + 1) * MAX_CDDB_DISCS];
+        const int num_discs = resolve_disc(params->disc, disc_list);
+        if (num_discs > 0) {
+            trace("disc resolved\n");
+            char num_tracks[4];
+            int track_count = cddb_disc_get_track_count(params->disc);
+            snprintf(num_tracks, sizeof(num_tracks), "%02d", track_count);
+            for (size_t i = 0; params->items[i]; i++) {
+                deadbeef->pl_add_meta(params->items[i], CDDB_IDS_TAG, disc_list);
+                write_metadata(params, params->items[i], params->disc, num_tracks);
+            }
+        }
+        else {
+            trace("disc not resolved\n");
+        }
+    }
+
+    // fill empty titles with autogenerated ones
+    for (size_t i = 0; params->items[i]; i++) {
+        DB_playItem_t *it = params->items[i];
+        if (!deadbeef->pl_find_meta (it, "title")) {
+            const int track_nr = deadbeef->pl_find_meta_int(it, "track", 0);
+            char title[50];
+            snprintf(title, sizeof (title), "CD Track %02d", track_nr);
+            deadbeef->pl_add_meta(it, "title", title);
+        }
+    }
+
+    cleanup_thread_params(params);
+    notify_playlist_changed();
+}
+
 static DB_playItem_t *
 insert_track (ddb_playlist_t *plt, DB_playItem_t *after, const char* path, const track_t track_nr, CdIo_t *cdio, const int discid)
 {
@@ -677,12 +894,14 @@ insert_track (ddb_playlist_t *plt, DB_playItem_t *after, const char* path, const
 }
 
 static DB_playItem_t *
-insert_disc (ddb_playlist_t *plt, DB_playItem_t *after, const char *path, const track_t single_track, CdIo_t* cdio)
+insert_disc (ddb_playlist_t *plt, DB_playItem_t *after, const char *path, const track_t single_track, CdIo_t* cdio, driver_id_t driver_id)
 {
     struct cddb_thread_params *p = calloc(1, sizeof(struct cddb_thread_params));
     if (!p) {
         return NULL;
     }
+    p->device = strdup(path);
+    p->driver_id = driver_id;
 
     p->disc = create_disc(cdio);
     if (!p->disc) {
@@ -710,31 +929,14 @@ insert_disc (ddb_playlist_t *plt, DB_playItem_t *after, const char *path, const
         }
     }
 
+    // the tracks are in the playlist now, the metadata arrives later
     intptr_t tid = 0;
     if (item_count) {
-        const int got_cdtext = read_disc_cdtext(cdio, p->items, tracks);
-        const int prefer_cdtext = deadbeef->conf_get_int("cdda.prefer_cdtext", DEFAULT_PREFER_CDTEXT);
-        const int enable_cddb = deadbeef->conf_get_int("cdda.freedb.enable", DEFAULT_USE_CDDB);
-        p->got_cdtext = got_cdtext;
-        p->prefer_cdtext = prefer_cdtext;
-        if (enable_cddb) {
-            trace("cdda: querying freedb...\n");
-            tid = deadbeef->thread_start(cddb_thread, p);
-            if (tid) {
-                deadbeef->thread_detach(tid);
-            }
-        }
-        else {
-            // if cddb is off, fill empty titles with autogenerated ones
-            for (int i = 0; i < item_count; i++) {
-                DB_playItem_t *it = p->items[i];
-                if (!deadbeef->pl_find_meta (it, "title")) {
-                    const int track_nr = deadbeef->pl_find_meta_int(it, "track", 0);
-                    char title[50];
-                    snprintf(title, sizeof (title), "CD Track %02d", track_nr);
-                    deadbeef->pl_add_meta(it, "title", title);
-                }
-            }
+        p->prefer_cdtext = deadbeef->conf_get_int("cdda.prefer_cdtext", DEFAULT_PREFER_CDTEXT);
+        p->enable_cddb = deadbeef->conf_get_int("cdda.freedb.enable", DEFAULT_USE_CDDB);
+        tid = deadbeef->thread_start(metadata_thread, p);
+        if (tid) {
+            deadbeef->thread_detach(tid);
         }
     }
 
@@ -751,19 +953,26 @@ cda_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *path)
     trace("CDA insert: %s\n", path);
     cdio_close_tray(NULL, NULL);
 
-    /* Deal with any NRG files and get them out of the way */
+    /* Deal with any NRG or BIN/CUE images and get them out of the way */
     const char *ext = strrchr(path, '.');
+    driver_id_t image_driver = DRIVER_UNKNOWN;
     if (ext && !strcasecmp(ext, ".nrg")) {
+        image_driver = DRIVER_NRG;
+    }
+    else if (ext && !strcasecmp(ext, ".bin")) {
+        image_driver = DRIVER_BINCUE;
+    }
+    if (image_driver != DRIVER_UNKNOWN) {
         if (!deadbeef->conf_get_int("cdda.enable_nrg", 0)) {
-            trace("cda: NRG found but disabled in preferences\n");
+            trace("cda: disc image found but disabled in preferences\n");
             return NULL;
         }
-        CdIo_t* cdio = cdio_open(path, DRIVER_NRG);
+        CdIo_t* cdio = cdio_open(path, image_driver);
         if (!cdio) {
-            trace("not an NRG image, or file not found (%s)\n", path);
+            trace("not a disc image, or file not found (%s)\n", path);
             return NULL;
         }
-        DB_playItem_t *inserted = insert_disc(plt, after, path, 0, cdio);
+        DB_playItem_t *inserted = insert_disc(plt, after, path, 0, cdio, image_driver);
         cdio_destroy(cdio);
         return inserted;
     }
@@ -814,7 +1023,7 @@ cda_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *path)
             char *track_end;
             const unsigned long track_nr = strtoul(sep ? sep + 1 : path, &track_end, 10);
             const track_t single_track = strcmp(track_end, ".cda") || track_nr > CDIO_CD_MAX_TRACKS ? 0 : track_nr;
-            inserted = insert_disc(plt, after, drive_device, single_track, cdio);
+            inserted = insert_disc(plt, after, drive_device, single_track, cdio, driver_id);
             cdio_destroy(cdio);
         }
     }
@@ -1118,7 +1327,7 @@ static const char settings_dlg[] =
     "property box hbox[1] height=-1;"
     "property \"CDDB port number (e.g. '888')\" entry cdda.freedb.port 888;\n"
     "property \"Use CDDB protocol\" checkbox cdda.protocol 1;\n"
-    "property \"Enable NRG image support\" checkbox cdda.enable_nrg 0;"
+    "property \"Enable NRG and BIN/CUE image support\" checkbox cdda.enable_nrg 0;"
     "property box hbox[1] height=-1;"
     "property \"Drive speed for normal playback\" select[6] cdda.drive_speed 2 1x 2x 4x 8x 16x Max;"
 #if USE_PARANOIA
@@ -1163,7 +1372,7 @@ static DB_decoder_t plugin = {
     .seek = cda_seek,
     .seek_sample = cda_seek_sample,
     .insert = cda_insert,
-    .exts = (char const *[]){"cda", "nrg", NULL}
+    .exts = (char const *[]){"cda", "nrg", "bin", NULL}
 };
 
 DB_plugin_t *
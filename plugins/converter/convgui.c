@@ -169,7 +169,7 @@ overwrite_prompt (const char *outpath) {
 }
 
 static void
-converter_worker (void *ctx) {
+converter_worker (ddb_job_t *job, void *ctx) {
     deadbeef->background_job_increment ();
     converter_ctx_t *conv = ctx;
 
@@ -252,7 +252,7 @@ converter_worker (void *ctx) {
         if (!skip) {
             converter_plugin->convert2 (&settings, conv->convert_items[n], outpath, &conv->cancelled);
         }
-        if (conv->cancelled) {
+        if (conv->cancelled || deadbeef->job_is_cancelled (job)) {
             for (; n < conv->convert_items_count; n++) {
                 deadbeef->pl_item_unref (conv->convert_items[n]);
             }
@@ -358,8 +358,7 @@ converter_process (converter_ctx_t *conv)
 
     conv->progress = progress;
     conv->progress_entry = entry;
-    intptr_t tid = deadbeef->thread_start (converter_worker, conv);
-    deadbeef->thread_detach (tid);
+    deadbeef->job_release (deadbeef->job_submit (DDB_JOB_PRIORITY_BACKGROUND, converter_worker, conv));
     return 0;
 }
 
@@ -57,6 +57,14 @@ static DB_functions_t *deadbeef;
 
 #define EXT_MAX 1024
 
+// Size of the buffer between DeaDBeeF VFS and libavformat.
+// Large reads keep the number of VFS calls low, especially for zip and network files.
+#define FFMPEG_IO_BUFFER_SIZE (256*1024)
+
+// Name of the libavformat demuxer which accepted the file, saved on insert,
+// to skip probing when the track is played.
+#define FFMPEG_FORMAT_META ":FFMPEG_FORMAT"
+
 static char * exts[EXT_MAX+1] = {NULL};
 
 typedef struct {
@@ -65,12 +73,14 @@ typedef struct {
     AVCodecContext *codec_context;
     int need_to_free_codec_context;
     AVFormatContext *format_context;
+    AVIOContext *io_context;
+    DB_FILE *file;
     AVPacket pkt;
     AVFrame *frame;
     int stream_id;
 
-    int left_in_packet;
     int have_packet;
+    int eof;
 
     char *buffer;
     int left_in_buffer;
@@ -79,11 +89,14 @@ typedef struct {
     int64_t startsample;
     int64_t endsample;
     int64_t currentsample;
+
+    uint32_t hints;
 } ffmpeg_info_t;
 
 static DB_fileinfo_t *
 ffmpeg_open (uint32_t hints) {
     ffmpeg_info_t *info = calloc (sizeof (ffmpeg_info_t), 1);
+    info->hints = hints;
     return &info->info;
 }
 
@@ -141,81 +154,183 @@ _get_audio_codec_from_stream(AVFormatContext *format_context, int stream_index,
 }
 
 static int
-ffmpeg_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
-    // Don't allow playing network streams.
-    // Even when ffmpeg has network support, it's causing too many problems this way.
-    const char *fname = deadbeef->pl_find_meta (it, ":URI");
-    if (!deadbeef->is_local_file (fname)) {
-        return -1;
+_vfs_read_packet (void *opaque, uint8_t *buf, int buf_size) {
+    DB_FILE *fp = opaque;
+    size_t rb = deadbeef->fread (buf, 1, buf_size, fp);
+    if (rb == 0) {
+        return AVERROR_EOF;
     }
+    return (int)rb;
+}
 
-    ffmpeg_info_t *info = (ffmpeg_info_t *)_info;
-    trace ("ffmpeg init %s\n", deadbeef->pl_find_meta (it, ":URI"));
-    // prepare to decode the track
-    // return -1 on failure
+static int64_t
+_vfs_seek (void *opaque, int64_t offset, int whence) {
+    DB_FILE *fp = opaque;
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE) {
+        return deadbeef->fgetlength (fp);
+    }
+    if (deadbeef->fseek (fp, offset, whence) < 0) {
+        return -1;
+    }
+    return deadbeef->ftell (fp);
+}
 
-    int ret;
-    char *uri = NULL;
-    int i;
+static void
+print_error(const char *filename, int err);
 
-    deadbeef->pl_lock ();
-    {
-        const char *fname = deadbeef->pl_find_meta (it, ":URI");
-        uri = strdupa (fname);
+// Open the file through DeaDBeeF VFS, and find a decodable audio stream.
+// If format_name is set, the demuxer is not probed, and the stream info is
+// taken from the container header, without decoding any frames.
+// If for_playback is set, the decoder is configured for playback.
+static int
+_ffmpeg_open (ffmpeg_info_t *info, const char *fname, const char *format_name, int for_playback) {
+    info->file = deadbeef->fopen (fname);
+    if (!info->file) {
+        return -1;
     }
-    deadbeef->pl_unlock ();
-    trace ("ffmpeg: uri: %s\n", uri);
 
-    // open file
-    trace ("\033[0;31mffmpeg av_open_input_file\033[37;0m\n");
+    int streaming = info->file->vfs->is_streaming ();
+    unsigned char *buffer = av_malloc (FFMPEG_IO_BUFFER_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    info->io_context = avio_alloc_context (buffer, FFMPEG_IO_BUFFER_SIZE, 0, info->file, _vfs_read_packet, NULL, streaming ? NULL : _vfs_seek);
+    if (!info->io_context) {
+        av_free (buffer);
+        return -1;
+    }
 
     info->format_context = avformat_alloc_context ();
+    info->format_context->pb = info->io_context;
+    info->format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    info->format_context->max_analyze_duration = AV_TIME_BASE;
 
-    if ((ret = avformat_open_input(&info->format_context, uri, NULL, NULL)) < 0) {
-        trace ("\033[0;31minfo->fctx is %p, ret %d/%s\033[0;31m\n", info->fctx, ret, strerror(-ret));
+    AVInputFormat *ifmt = NULL;
+    if (format_name) {
+        ifmt = av_find_input_format (format_name);
+        if (!ifmt) {
+            return -1;
+        }
+    }
+
+    int ret;
+    if ((ret = avformat_open_input (&info->format_context, fname, ifmt, NULL)) < 0) {
+        // format_context is freed by avformat_open_input on failure
+        if (!format_name) {
+            print_error (fname, ret);
+        }
         return -1;
     }
-    trace ("\033[0;31mav_open_input_file done, ret=%d\033[0;31m\n", ret);
 
-    trace ("\033[0;31mffmpeg avformat_find_stream_info\033[37;0m\n");
+    if (!format_name) {
+        ret = avformat_find_stream_info(info->format_context, NULL);
+        if (ret < 0) {
+            trace ("avformat_find_stream_info ret: %d/%s\n", ret, strerror(-ret));
+        }
+    }
+
     info->stream_id = -1;
-    info->format_context->max_analyze_duration = AV_TIME_BASE;
-    avformat_find_stream_info(info->format_context, NULL);
-    AVFormatContext *fctx = info->format_context;
-    for (i = 0; i < info->format_context->nb_streams; i++) {
-        if (_get_audio_codec_from_stream (fctx, i, info)) {
+    for (int i = 0; i < info->format_context->nb_streams; i++) {
+        if (!info->format_context->streams[i]) {
+            continue;
+        }
+        if (_get_audio_codec_from_stream (info->format_context, i, info)) {
             break;
         }
     }
 
-    if (info->codec == NULL)
-    {
-        trace ("ffmpeg can't decode %s\n", deadbeef->pl_find_meta (it, ":URI"));
+    if (info->codec == NULL) {
+        trace ("ffmpeg can't decode %s\n", fname);
         return -1;
     }
-    trace ("ffmpeg can decode %s\n", deadbeef->pl_find_meta (it, ":URI"));
-    trace ("ffmpeg: codec=%s, stream=%d\n", info->codec->name, i);
+    trace ("ffmpeg: codec=%s, stream=%d\n", info->codec->name, info->stream_id);
+
+    if (for_playback) {
+        if (info->hints & DDB_DECODER_HINT_FLOAT32) {
+            // only used by the codecs which support several output formats
+            info->codec_context->request_sample_fmt = AV_SAMPLE_FMT_FLT;
+        }
+
+        // Let the heavy codecs (APE, TAK, DST, etc) decode on several threads.
+        // The number of threads is picked by libavcodec.
+        info->codec_context->thread_count = 0;
+        info->codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
 
     if (avcodec_open2 (info->codec_context, info->codec, NULL) < 0) {
         trace ("ffmpeg: avcodec_open2 failed\n");
         return -1;
     }
 
+    if (av_get_bytes_per_sample (info->codec_context->sample_fmt) <= 0
+        || info->codec_context->channels <= 0
+        || info->codec_context->sample_rate <= 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+_free_info_data(ffmpeg_info_t *info);
+
+static int
+ffmpeg_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
+    ffmpeg_info_t *info = (ffmpeg_info_t *)_info;
+    trace ("ffmpeg init %s\n", deadbeef->pl_find_meta (it, ":URI"));
+    // prepare to decode the track
+    // return -1 on failure
+
+    char *uri = NULL;
+    char *format_name = NULL;
+
+    deadbeef->pl_lock ();
+    {
+        const char *fname = deadbeef->pl_find_meta (it, ":URI");
+        uri = strdupa (fname);
+        const char *fmt = deadbeef->pl_find_meta (it, FFMPEG_FORMAT_META);
+        if (fmt) {
+            format_name = strdupa (fmt);
+        }
+    }
+    deadbeef->pl_unlock ();
+    trace ("ffmpeg: uri: %s\n", uri);
+
+    // reuse the probe result from insert, if any
+    int res = -1;
+    if (format_name) {
+        res = _ffmpeg_open (info, uri, format_name, 1);
+        if (res < 0) {
+            _free_info_data (info);
+        }
+    }
+    if (res < 0) {
+        res = _ffmpeg_open (info, uri, NULL, 1);
+    }
+    if (res < 0) {
+        return -1;
+    }
+
+    deadbeef->fset_track (info->file, it);
     deadbeef->pl_replace_meta (it, "!FILETYPE", info->codec->name);
 
     int bps = av_get_bytes_per_sample (info->codec_context->sample_fmt)*8;
     int samplerate = info->codec_context->sample_rate;
 
-    if (bps <= 0 || info->codec_context->channels <= 0 || samplerate <= 0) {
-        return -1;
+    int64_t totalsamples;
+    if (info->format_context->duration != AV_NOPTS_VALUE && info->format_context->duration > 0) {
+        totalsamples = info->format_context->duration * samplerate / AV_TIME_BASE;
+    }
+    else {
+        // the duration wasn't estimated without probing, take the one computed on insert
+        totalsamples = (int64_t)(deadbeef->pl_get_item_duration (it) * samplerate);
     }
-
-    int64_t totalsamples = info->format_context->duration * samplerate / AV_TIME_BASE;
-    info->left_in_packet = 0;
     info->left_in_buffer = 0;
 
     memset (&info->pkt, 0, sizeof (info->pkt));
     info->have_packet = 0;
+    info->eof = 0;
 
     info->frame = av_frame_alloc();
 
@@ -258,10 +373,13 @@ _free_info_data(ffmpeg_info_t *info) {
     }
     if (info->buffer) {
         free (info->buffer);
+        info->buffer = NULL;
+        info->buffer_size = 0;
     }
     // free everything allocated in _init and _read
     if (info->have_packet) {
         av_packet_unref (&info->pkt);
+        info->have_packet = 0;
     }
     if (info->codec_context) {
         avcodec_close (info->codec_context);
@@ -270,10 +388,26 @@ _free_info_data(ffmpeg_info_t *info) {
         if (info->need_to_free_codec_context) {
             avcodec_free_context (&info->codec_context);
         }
+        info->codec_context = NULL;
+        info->need_to_free_codec_context = 0;
     }
+    info->codec = NULL;
     if (info->format_context) {
         avformat_close_input (&info->format_context);
     }
+    // custom io context is not freed by avformat_close_input
+    if (info->io_context) {
+        av_freep (&info->io_context->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+        avio_context_free (&info->io_context);
+#else
+        av_freep (&info->io_context);
+#endif
+    }
+    if (info->file) {
+        deadbeef->fclose (info->file);
+        info->file = NULL;
+    }
 }
 
 static void
@@ -286,6 +420,96 @@ ffmpeg_free (DB_fileinfo_t *_info) {
     }
 }
 
+// Convert the decoded frame into interleaved samples in info->buffer.
+// Returns the number of bytes written, or -1 on error.
+static int
+_convert_frame (ffmpeg_info_t *info) {
+    DB_fileinfo_t *_info = &info->info;
+    int out_size;
+    if (ensure_buffer (info, info->frame->nb_samples * (_info->fmt.bps >> 3))) {
+        return -1;
+    }
+    if (av_sample_fmt_is_planar(info->codec_context->sample_fmt) && _info->fmt.bps == 32) {
+        int channels = info->codec_context->channels;
+        out_size = info->frame->nb_samples * 4 * channels;
+        if (_info->fmt.is_float) {
+            deadbeef->pcm_interleave_float32 (info->buffer, 32, 1, (const float * const *)info->frame->extended_data, 1, channels, info->frame->nb_samples);
+        }
+        else {
+            deadbeef->pcm_interleave_int32 (info->buffer, 32, (const int32_t * const *)info->frame->extended_data, 1, 0, channels, info->frame->nb_samples);
+        }
+    }
+    else if (av_sample_fmt_is_planar(info->codec_context->sample_fmt)) {
+        out_size = 0;
+        for (int c = 0; c < info->codec_context->channels; c++) {
+            for (int i = 0; i < info->frame->nb_samples; i++) {
+                if (_info->fmt.bps == 8) {
+                    info->buffer[i*info->codec_context->channels+c] = ((int8_t *)info->frame->extended_data[c])[i];
+                    out_size++;
+                }
+                else if (_info->fmt.bps == 16) {
+                    int16_t outsample = ((int16_t *)info->frame->extended_data[c])[i];
+                    ((int16_t*)info->buffer)[i*info->codec_context->channels+c] = outsample;
+                    out_size += 2;
+                }
+                else if (_info->fmt.bps == 24) {
+                    memcpy (&info->buffer[(i*info->codec_context->channels+c)*3], &((int8_t*)info->frame->extended_data[c])[i*3], 3);
+                    out_size += 3;
+                }
+            }
+        }
+    }
+    else {
+        out_size = info->frame->nb_samples * (_info->fmt.bps >> 3) * _info->fmt.channels;
+        memcpy (info->buffer, info->frame->extended_data[0], out_size);
+    }
+    return out_size;
+}
+
+// Read the next packet of the audio stream into info->pkt.
+// Returns -1 at the end of stream.
+static int
+_read_packet (ffmpeg_info_t *info) {
+    if (info->have_packet) {
+        av_packet_unref (&info->pkt);
+        info->have_packet = 0;
+    }
+    int errcount = 0;
+    for (;;) {
+        int ret;
+        if ((ret = av_read_frame (info->format_context, &info->pkt)) < 0) {
+            trace ("ffmpeg: error %d\n", ret);
+            if (ret == AVERROR_EOF || ret == -1) {
+                return -1;
+            }
+            if (++errcount > 4) {
+                trace ("ffmpeg: too many errors in a row (last is %d); interrupting stream\n", ret);
+                return -1;
+            }
+            continue;
+        }
+        trace ("av packet size: %d, numframes: %d\n", info->pkt.size, ret);
+        errcount = 0;
+        //trace ("idx:%d, stream:%d\n", info->pkt.stream_index, info->stream_id);
+        if (info->pkt.stream_index != info->stream_id) {
+            av_packet_unref (&info->pkt);
+            continue;
+        }
+        //trace ("got packet: size=%d\n", info->pkt.size);
+        info->have_packet = 1;
+
+        if (info->pkt.duration > 0) {
+            AVRational *time_base = &info->format_context->streams[info->stream_id]->time_base;
+            float sec = (float)info->pkt.duration * time_base->num / time_base->den;
+            int bitrate = info->pkt.size * 8 / sec;
+            if (bitrate > 0) {
+                deadbeef->streamer_set_bitrate (bitrate / 1000);
+            }
+        }
+        return 0;
+    }
+}
+
 static int
 ffmpeg_read (DB_fileinfo_t *_info, char *bytes, int size) {
     trace ("ffmpeg_read_int16 %d\n", size);
@@ -306,13 +530,9 @@ ffmpeg_read (DB_fileinfo_t *_info, char *bytes, int size) {
 
     int initsize = size;
 
-    int encsize = 0;
-    int decsize = 0;
-
     while (size > 0) {
 
         if (info->left_in_buffer > 0) {
-//            int sz = min (size, info->left_in_buffer);
             int nsamples = size / samplesize;
             int nsamples_buf = info->left_in_buffer / samplesize;
             nsamples = min (nsamples, nsamples_buf);
@@ -325,131 +545,40 @@ ffmpeg_read (DB_fileinfo_t *_info, char *bytes, int size) {
             }
             info->left_in_buffer -= sz;
         }
+        if (size == 0) {
+            break;
+        }
 
-        while (info->left_in_packet > 0 && size > 0) {
-            int out_size = info->buffer_size;
-            int len = 0;
-            //trace ("in: out_size=%d(%d), size=%d\n", out_size, AVCODEC_MAX_AUDIO_FRAME_SIZE, size);
-
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 28, 0)
-            int ret = avcodec_send_packet (info->codec_context, &info->pkt);
-            if (ret < 0) {
-                break;
-            }
-            ret = avcodec_receive_frame (info->codec_context,info->frame);
-            if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-                break;
-            }
-            else {
-                len = info->pkt.size;
-            }
-#else
-            int got_frame = 0;
-            len = avcodec_decode_audio4(info->ctx, info->frame, &got_frame, &info->pkt);
-#endif
-
-            if (len > 0) {
-                if (ensure_buffer (info, info->frame->nb_samples * (_info->fmt.bps >> 3))) {
-                    return -1;
-                }
-                if (av_sample_fmt_is_planar(info->codec_context->sample_fmt)) {
-                    out_size = 0;
-                    for (int c = 0; c < info->codec_context->channels; c++) {
-                        for (int i = 0; i < info->frame->nb_samples; i++) {
-                            if (_info->fmt.bps == 8) {
-                                info->buffer[i*info->codec_context->channels+c] = ((int8_t *)info->frame->extended_data[c])[i];
-                                out_size++;
-                            }
-                            else if (_info->fmt.bps == 16) {
-                                int16_t outsample = ((int16_t *)info->frame->extended_data[c])[i];
-                                ((int16_t*)info->buffer)[i*info->codec_context->channels+c] = outsample;
-                                out_size += 2;
-                            }
-                            else if (_info->fmt.bps == 24) {
-                                memcpy (&info->buffer[(i*info->codec_context->channels+c)*3], &((int8_t*)info->frame->extended_data[c])[i*3], 3);
-                                out_size += 3;
-                            }
-                            else if (_info->fmt.bps == 32) {
-                                int32_t sample = ((int32_t *)info->frame->extended_data[c])[i];
-                                ((int32_t*)info->buffer)[i*info->codec_context->channels+c] = sample;
-                                out_size += 4;
-                            }
-                        }
-                    }
-                }
-                else {
-                    out_size = info->frame->nb_samples * (_info->fmt.bps >> 3) * _info->fmt.channels;
-                    memcpy (info->buffer, info->frame->extended_data[0], out_size);
-                }
-            }
-
-            trace ("out: out_size=%d, len=%d\n", out_size, len);
-            if (len <= 0) {
-                break;
+        // With frame threading, the decoder may return frames several packets
+        // after they were sent, so always drain it before sending more data.
+        int ret = avcodec_receive_frame (info->codec_context, info->frame);
+        if (ret == 0) {
+            int out_size = _convert_frame (info);
+            if (out_size < 0) {
+                return -1;
             }
-            encsize += len;
-            decsize += out_size;
-            info->left_in_packet -= len;
+            trace ("out: out_size=%d\n", out_size);
             info->left_in_buffer = out_size;
+            continue;
         }
-        if (size == 0) {
+        if (ret != AVERROR(EAGAIN) || info->eof) {
+            // AVERROR_EOF after the decoder was drained, or a decoding error
             break;
         }
 
-        // read next packet
-        if (info->have_packet) {
-            av_packet_unref (&info->pkt);
-            info->have_packet = 0;
-        }
-        int errcount = 0;
-        for (;;) {
-            int ret;
-            if ((ret = av_read_frame (info->format_context, &info->pkt)) < 0) {
-                trace ("ffmpeg: error %d\n", ret);
-                if (ret == AVERROR_EOF || ret == -1) {
-                    ret = -1;
-                    break;
-                }
-                else {
-                    if (++errcount > 4) {
-                        trace ("ffmpeg: too many errors in a row (last is %d); interrupting stream\n", ret);
-                        ret = -1;
-                        break;
-                    }
-                    else {
-                        continue;
-                    }
-                }
-            }
-            else {
-                trace ("av packet size: %d, numframes: %d\n", info->pkt.size, ret);
-                errcount = 0;
-            }
-            if (ret == -1) {
-                break;
-            }
-            //trace ("idx:%d, stream:%d\n", info->pkt.stream_index, info->stream_id);
-            if (info->pkt.stream_index != info->stream_id) {
-                av_packet_unref (&info->pkt);
-                continue;
-            }
-            //trace ("got packet: size=%d\n", info->pkt.size);
-            info->have_packet = 1;
-            info->left_in_packet = info->pkt.size;
-
-            if (info->pkt.duration > 0) {
-                AVRational *time_base = &info->format_context->streams[info->stream_id]->time_base;
-                float sec = (float)info->pkt.duration * time_base->num / time_base->den;
-                int bitrate = info->pkt.size * 8 / sec;
-                if (bitrate > 0) {
-                    deadbeef->streamer_set_bitrate (bitrate / 1000);
-                }
-            }
-
-            break;
+        if (_read_packet (info) < 0) {
+            // flush the frames which are still in the decoder
+            info->eof = 1;
+            avcodec_send_packet (info->codec_context, NULL);
+            continue;
         }
-        if (!info->have_packet) {
-            break;
+
+        ret = avcodec_send_packet (info->codec_context, &info->pkt);
+        av_packet_unref (&info->pkt);
+        info->have_packet = 0;
+        if (ret < 0) {
+            // skip the broken packet
+            trace ("ffmpeg: avcodec_send_packet error %d\n", ret);
         }
     }
 
@@ -472,12 +601,13 @@ ffmpeg_seek_sample64 (DB_fileinfo_t *_info, int64_t sample) {
     sample += info->startsample;
     int64_t tm = sample / _info->fmt.samplerate * AV_TIME_BASE;
     trace ("ffmpeg: seek to sample: %d, t: %d\n", sample, (int)tm);
-    info->left_in_packet = 0;
     info->left_in_buffer = 0;
     if (av_seek_frame (info->format_context, -1, tm, AVSEEK_FLAG_ANY) < 0) {
         trace ("ffmpeg: seek error\n");
         return -1;
     }
+    avcodec_flush_buffers (info->codec_context);
+    info->eof = 0;
     
     // update readpos
     info->currentsample = sample;
@@ -619,52 +749,10 @@ ffmpeg_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
 
     ffmpeg_info_t info = {0};
 
-    int ret;
-    char *uri = NULL;
-    int i;
-
-    // construct uri
-    uri = strdupa (fname);
-    trace ("ffmpeg: uri: %s\n", uri);
-
-    // open file
-    info.format_context = avformat_alloc_context ();
-    info.format_context->max_analyze_duration = AV_TIME_BASE;
-    if ((ret = avformat_open_input(&info.format_context, uri, NULL, NULL)) < 0) {
-        print_error (uri, ret);
-        goto error;
-    }
-
-    trace ("fctx is %p, ret %d/%s\n", info.format_context, ret, strerror(-ret));
-    ret = avformat_find_stream_info(info.format_context, NULL);
-    if (ret < 0) {
-        trace ("avformat_find_stream_info ret: %d/%s\n", ret, strerror(-ret));
-    }
-    trace ("nb_streams=%x\n", nb_streams);
-
-    for (i = 0; i < info.format_context->nb_streams; i++)
-    {
-        if (!info.format_context->streams[i]) {
-            continue;
-        }
-        if (_get_audio_codec_from_stream(info.format_context, i, &info)) {
-            break;
-        }
-    }
-
-    if (info.codec == NULL)
-    {
-        trace ("ffmpeg can't decode %s\n", fname);
+    if (_ffmpeg_open (&info, fname, NULL, 0) < 0) {
         goto error;
     }
     trace ("ffmpeg can decode %s\n", fname);
-    trace ("ffmpeg: codec=%s, stream=%d\n", codec->name, i);
-
-    int avcodec_open2_ret = avcodec_open2 (info.codec_context, info.codec, NULL);
-    if (avcodec_open2_ret < 0) {
-        trace ("ffmpeg: avcodec_open2 failed\n");
-        goto error;
-    }
 
     int bps = av_get_bytes_per_sample (info.codec_context->sample_fmt) * 8;
     int samplerate = info.codec_context->sample_rate;
@@ -682,6 +770,7 @@ ffmpeg_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
 
     DB_playItem_t *it = deadbeef->pl_item_alloc_init (fname, plugin.decoder.plugin.id);
     deadbeef->pl_replace_meta (it, ":FILETYPE", info.codec->name);
+    deadbeef->pl_replace_meta (it, FFMPEG_FORMAT_META, info.format_context->iformat->name);
 
     if (!deadbeef->is_local_file (fname)) {
         deadbeef->plt_set_item_duration (plt, it, -1);
@@ -695,12 +784,8 @@ ffmpeg_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
     
     int64_t fsize = -1;
 
-    DB_FILE *fp = deadbeef->fopen (fname);
-    if (fp) {
-        if (!fp->vfs->is_streaming ()) {
-            fsize = deadbeef->fgetlength (fp);
-        }
-        deadbeef->fclose (fp);
+    if (!info.file->vfs->is_streaming ()) {
+        fsize = deadbeef->fgetlength (info.file);
     }
 
     if (fsize >= 0 && duration > 0) {
@@ -868,9 +953,7 @@ ffmpeg_read_metadata (DB_playItem_t *it) {
 
     trace ("ffmpeg_read_metadata: fname %s\n", deadbeef->pl_find_meta (it, ":URI"));
     ffmpeg_info_t info = {0};
-    int ret;
     char *uri = NULL;
-    int i;
 
     deadbeef->pl_lock ();
     const char *fname = deadbeef->pl_find_meta (it, ":URI");
@@ -878,24 +961,7 @@ ffmpeg_read_metadata (DB_playItem_t *it) {
     deadbeef->pl_unlock ();
     trace ("ffmpeg: uri: %s\n", uri);
 
-    // open file
-    if ((ret = avformat_open_input(&info.format_context, uri, NULL, NULL)) < 0) {
-        trace ("fctx is %p, ret %d/%s", info.format_context, ret, strerror(-ret));
-        return -1;
-    }
-
-    avformat_find_stream_info(info.format_context, NULL);
-    for (i = 0; i < info.format_context->nb_streams; i++) {
-        if (_get_audio_codec_from_stream(info.format_context, i, &info)) {
-            break;
-        }
-    }
-    if (info.codec == NULL) {
-        trace ("ffmpeg can't decode %s\n", deadbeef->pl_find_meta (it, ":URI"));
-        goto error;
-    }
-    if (avcodec_open2 (info.codec_context, info.codec, NULL) < 0) {
-        trace ("ffmpeg: avcodec_open2 failed\n");
+    if (_ffmpeg_open (&info, uri, NULL, 0) < 0) {
         goto error;
     }
 
@@ -149,67 +149,15 @@ cflac_write_callback (const FLAC__StreamDecoder *decoder, const FLAC__Frame *fra
 
     unsigned bps = FLAC__stream_decoder_get_bits_per_sample(decoder);
 
-    if (bps == 16) {
-        for (int i = 0; i <  nsamples; i++) {
-            for (int c = 0; c < channels; c++) {
-                int32_t sample = inputbuffer[c][i];
-                *bufptr++ = sample&0xff;
-                *bufptr++ = (sample&0xff00)>>8;
-            }
-        }
-    }
-    else if (bps == 24) {
-        for (int i = 0; i <  nsamples; i++) {
-            for (int c = 0; c < channels; c++) {
-                int32_t sample = inputbuffer[c][i];
-                *bufptr++ = sample&0xff;
-                *bufptr++ = (sample&0xff00)>>8;
-                *bufptr++ = (sample&0xff0000)>>16;
-            }
-        }
-    }
-    else if (bps == 32) {
-        for (int i = 0; i <  nsamples; i++) {
-            for (int c = 0; c < channels; c++) {
-                int32_t sample = inputbuffer[c][i];
-                *((int32_t*)bufptr) = sample;
-                bufptr += 4;
-            }
-        }
-    }
-    else if (bps == 8) {
-        for (int i = 0; i <  nsamples; i++) {
-            for (int c = 0; c < channels; c++) {
-                int32_t sample = inputbuffer[c][i];
-                *bufptr++ = sample&0xff;
-            }
-        }
-    }
-    else if (bps & 7) {
-        // support for non-byte-aligned bps
-        unsigned shift = _info->fmt.bps - bps;
-        bps = _info->fmt.bps;
-        int nsamples = min(bufsize / samplesize, frame->header.blocksize);
-        for (int s = 0; s < nsamples; s++) {
-            for (int c = 0; c < channels; c++) {
-                FLAC__int32 sample = inputbuffer[c][s] << shift;
-                *bufptr++ = sample & 0xff;
-                if (bps > 8) {
-                    *bufptr++ = (sample>>8) & 0xff;
-                    if (bps > 16) {
-                        *bufptr++ = (sample>>16) & 0xff;
-                        if (bps > 24) {
-                            *bufptr++ = (sample>>24) & 0xff;
-                        }
-                    }
-                 }
-             }
-         }
-    }
-    else {
+    // non-byte-aligned bps are padded to the output bps
+    if (bps == 0 || bps > 32 || bps > _info->fmt.bps) {
         trace ("flac: unsupported bits per sample: %d\n", bps);
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
     }
+    unsigned shift = _info->fmt.bps - bps;
+
+    deadbeef->pcm_interleave_int32 (bufptr, _info->fmt.bps, (const int32_t * const *)inputbuffer, 1, shift, channels, nsamples);
+    bufptr += nsamples * samplesize;
 
     info->remaining = (int)(bufptr - info->buffer);
 
@@ -24,16 +24,13 @@
 #include <sys/time.h>
 #include <string.h>
 #include <stdlib.h>
-#include <pthread.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#ifdef __linux__
-#include <sys/prctl.h>
-#endif
 #include "../../deadbeef.h"
 #include "../artwork-legacy/artwork.h"
 #include "gtkui.h"
 #include "coverart.h"
+#include "thumbcache.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(...)
@@ -78,8 +75,8 @@ typedef struct load_query_s {
 
 static int terminate;
 static uintptr_t mutex;
-static uintptr_t cond;
-static uintptr_t tid;
+static ddb_job_t *loading_job;
+static int loading; // loading_job is processing the queue
 static load_query_t *queue;
 static load_query_t *tail;
 
@@ -171,6 +168,23 @@ process_query_callbacks(cover_callback_t *callback, int send)
     }
 }
 
+static void
+loading_job_func (ddb_job_t *job, void *ctx);
+
+// Called with the mutex locked
+static void
+start_loading (void) {
+    if (loading || terminate) {
+        return;
+    }
+    if (loading_job) {
+        // finished
+        deadbeef->job_release (loading_job);
+    }
+    loading = 1;
+    loading_job = deadbeef->job_submit (DDB_JOB_PRIORITY_INTERACTIVE, loading_job_func, NULL);
+}
+
 static void
 queue_add (cache_type_t cache_type, char *fname, int width, int height, cover_avail_callback_t cb, void *ud)
 {
@@ -195,7 +209,7 @@ queue_add (cache_type_t cache_type, char *fname, int width, int height, cover_av
     else {
         queue = tail = q;
     }
-    deadbeef->cond_signal (cond);
+    start_loading ();
 }
 
 static void
@@ -369,7 +383,14 @@ load_image(load_query_t *query)
     /* Create a new pixbuf from this file */
     int width = query->width;
     int height = query->height;
-    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size(query->fname, width, height, NULL);
+
+    /* Scaling the full-size image is expensive, reuse the scaled copy from the disk cache if there is one */
+    int negative;
+    GdkPixbuf *pixbuf = thumbcache_load(query->fname, &stat_buf, width, height, &negative);
+    if (!pixbuf && !negative) {
+        pixbuf = gdk_pixbuf_new_from_file_at_size(query->fname, width, height, NULL);
+        thumbcache_save(query->fname, &stat_buf, width, height, pixbuf);
+    }
 #if 0
     GError *error = NULL;
     GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size(query->fname, width, height, &error);
@@ -393,29 +414,21 @@ load_image(load_query_t *query)
 }
 
 static void
-loading_thread (void *none) {
-#ifdef __linux__
-    prctl (PR_SET_NAME, "deadbeef-gtkui-artwork", 0, 0, 0, 0);
-#endif
-
+loading_job_func (ddb_job_t *job, void *ctx) {
     deadbeef->mutex_lock(mutex);
 
-    while (!terminate) {
-        trace("covercache: waiting for signal...\n");
-        pthread_cond_wait((pthread_cond_t *)cond, (pthread_mutex_t *)mutex);
-        trace("covercache: signal received (terminate=%d, queue=%p)\n", terminate, queue);
-
-        while (!terminate && queue) {
-            if (queue->fname) {
-                load_image(queue);
-            }
-            if (artwork_plugin) {
-                process_query_callbacks(queue->callback, TRUE);
-                queue->callback = NULL;
-            }
-            queue_pop();
+    trace("covercache: processing queue (terminate=%d, queue=%p)\n", terminate, queue);
+    while (!terminate && !deadbeef->job_is_cancelled (job) && queue) {
+        if (queue->fname) {
+            load_image(queue);
         }
+        if (artwork_plugin) {
+            process_query_callbacks(queue->callback, TRUE);
+            queue->callback = NULL;
+        }
+        queue_pop();
     }
+    loading = 0;
 
     deadbeef->mutex_unlock(mutex);
 }
@@ -667,11 +680,8 @@ cover_art_init (void) {
     }
 
     terminate = 0;
+    loading = 0;
     mutex = deadbeef->mutex_create_nonrecursive ();
-    cond = deadbeef->cond_create ();
-    if (mutex && cond) {
-        tid = deadbeef->thread_start_low_priority (loading_thread, NULL);
-    }
 }
 
 void
@@ -696,14 +706,18 @@ void
 cover_art_free (void) {
     trace ("coverart: terminating cover art loader...\n");
 
-    if (tid) {
+    if (mutex) {
         deadbeef->mutex_lock(mutex);
         terminate = 1;
-        trace("coverart: sending terminate signal to art loader thread...\n");
-        deadbeef->cond_signal(cond);
+        ddb_job_t *job = loading_job;
+        loading_job = NULL;
         deadbeef->mutex_unlock(mutex);
-        deadbeef->thread_join(tid);
-        tid = 0;
+        if (job) {
+            trace("coverart: waiting for art loader job...\n");
+            deadbeef->job_cancel(job);
+            deadbeef->job_wait(job);
+            deadbeef->job_release(job);
+        }
     }
 
     while (queue) {
@@ -711,10 +725,6 @@ cover_art_free (void) {
     }
     tail = NULL;
 
-    if (cond) {
-        deadbeef->cond_free(cond);
-        cond = 0;
-    }
     if (mutex) {
         deadbeef->mutex_free(mutex);
         mutex = 0;
@@ -122,6 +122,10 @@ ddb_listview_free_all_groups (DdbListview *listview);
 
 static void
 ddb_listview_update_fonts (DdbListview *ps);
+
+static void
+_cell_cache_remove_row (DdbListview *listview, int row, DdbListviewIter it);
+
 static void
 ddb_listview_header_update_fonts (DdbListview *ps);
 
@@ -562,6 +566,10 @@ ddb_listview_destroy(GObject *object)
     }
     ddb_listview_cancel_autoredraw (listview);
 
+    ddb_listview_cell_cache_clear (listview);
+    free (listview->cell_cache);
+    listview->cell_cache = NULL;
+
     draw_free (&listview->listctx);
     draw_free (&listview->grpctx);
     draw_free (&listview->hdrctx);
@@ -569,6 +577,9 @@ ddb_listview_destroy(GObject *object)
 
 void
 ddb_listview_refresh (DdbListview *listview, uint32_t flags) {
+    if (flags & (DDB_REFRESH_CONFIG | DDB_LIST_CHANGED | DDB_REFRESH_LIST)) {
+        ddb_listview_cell_cache_clear (listview);
+    }
     if (flags & DDB_REFRESH_CONFIG) {
         ddb_listview_update_fonts (listview);
         ddb_listview_header_update_fonts (listview);
@@ -1618,13 +1629,19 @@ ddb_listview_list_setup_hscroll (void *user_data) {
 }
 
 void
-ddb_listview_draw_row (DdbListview *listview, int row, DdbListviewIter it) {
+ddb_listview_redraw_row (DdbListview *listview, int row) {
     int y = ddb_listview_get_row_pos(listview, row, NULL) - listview->scrollpos;
     if (y + listview->rowheight > 0 && y <= listview->list_height) {
         gtk_widget_queue_draw_area (listview->list, 0, y, listview->list_width, listview->rowheight);
     }
 }
 
+void
+ddb_listview_draw_row (DdbListview *listview, int row, DdbListviewIter it) {
+    _cell_cache_remove_row (listview, row, it);
+    ddb_listview_redraw_row (listview, row);
+}
+
 // coords passed are window-relative
 static void
 ddb_listview_list_render_row_background (DdbListview *ps, cairo_t *cr, DdbListviewIter it, int even, int cursor, int x, int y, int w, int h, GdkRectangle *clip) {
@@ -1650,6 +1667,9 @@ ddb_listview_list_render_row_background (DdbListview *ps, cairo_t *cr, DdbListvi
 
 static void
 ddb_listview_list_render_row_foreground (DdbListview *ps, cairo_t *cr, DdbListviewIter it, int even, int idx, int y, int w, int h, int x1, int x2) {
+    // visible rows are loaded before the rest of the deferred tracks
+    deadbeef->pl_request_deferred_metadata ((DB_playItem_t *)it);
+
     int x = -ps->hscrollpos;
     for (DdbListviewColumn *c = ps->columns; c && x < x2; x += c->width, c = c->next) {
         if (x + c->width > x1 && !ps->binding->is_album_art_column(c->user_data)) {
@@ -1687,7 +1707,7 @@ ddb_listview_deselect_all (DdbListview *listview)
         if (listview->binding->is_selected (it)) {
             listview->binding->select (it, 0);
             if (notify_singly) {
-                ddb_listview_draw_row (listview, idx, it);
+                ddb_listview_redraw_row (listview, idx);
                 listview->binding->selection_changed (listview, it, idx);
             }
         }
@@ -1723,7 +1743,7 @@ ddb_listview_select_group (DdbListview *listview, DdbListviewGroup *grp, int fir
             listview->binding->select (it, 1);
         }
         if (notify_singly) {
-            ddb_listview_draw_row (listview, first_item_idx + group_idx, it);
+            ddb_listview_redraw_row (listview, first_item_idx + group_idx);
             listview->binding->selection_changed (listview, it, first_item_idx + group_idx);
         }
         it = next_playitem(listview, it);
@@ -1778,7 +1798,7 @@ ddb_listview_select_single (DdbListview *ps, int sel) {
     DdbListviewIter sel_it = ps->binding->get_for_idx (sel);
     if (sel_it) {
         ps->binding->select (sel_it, 1);
-        ddb_listview_draw_row (ps, sel, sel_it);
+        ddb_listview_redraw_row (ps, sel);
         ps->binding->selection_changed (ps, sel_it, sel);
         ps->binding->unref(sel_it);
     }
@@ -1791,14 +1811,10 @@ ddb_listview_update_cursor (DdbListview *ps, int cursor)
     int prev = ps->binding->cursor ();
     ps->binding->set_cursor (cursor);
     if (cursor != -1) {
-        DdbListviewIter it = ps->binding->get_for_idx (cursor);
-        ddb_listview_draw_row (ps, cursor, it);
-        UNREF (it);
+        ddb_listview_redraw_row (ps, cursor);
     }
     if (prev != -1 && prev != cursor) {
-        DdbListviewIter it = ps->binding->get_for_idx (prev);
-        ddb_listview_draw_row (ps, prev, it);
-        UNREF (it);
+        ddb_listview_redraw_row (ps, prev);
     }
 }
 
@@ -1857,7 +1873,7 @@ ddb_listview_select_range (DdbListview *ps, int start, int end)
             if (!ps->binding->is_selected (it)) {
                 nchanged++;
                 ps->binding->select (it, 1);
-                ddb_listview_draw_row (ps, idx, it);
+                ddb_listview_redraw_row (ps, idx);
                 if (nchanged <= NUM_ROWS_TO_NOTIFY_SINGLY) {
                     ps->binding->selection_changed (ps, it, idx);
                 }
@@ -1867,7 +1883,7 @@ ddb_listview_select_range (DdbListview *ps, int start, int end)
             if (ps->binding->is_selected (it)) {
                 nchanged++;
                 ps->binding->select (it, 0);
-                ddb_listview_draw_row (ps, idx, it);
+                ddb_listview_redraw_row (ps, idx);
                 if (nchanged <= NUM_ROWS_TO_NOTIFY_SINGLY) {
                     ps->binding->selection_changed (ps, it, idx);
                 }
@@ -2061,7 +2077,7 @@ ddb_listview_list_mouse1_pressed (DdbListview *ps, int state, int ex, int ey, Gd
                 DdbListviewIter it = ps->binding->get_for_idx (pick_ctx.item_idx);
                 if (it) {
                     ps->binding->select (it, 1 - ps->binding->is_selected (it));
-                    ddb_listview_draw_row (ps, pick_ctx.item_idx, it);
+                    ddb_listview_redraw_row (ps, pick_ctx.item_idx);
                     ps->binding->selection_changed (ps, it, pick_ctx.item_idx);
                     UNREF (it);
                 }
@@ -2090,14 +2106,10 @@ ddb_listview_list_mouse1_pressed (DdbListview *ps, int state, int ex, int ey, Gd
     }
     cursor = ps->binding->cursor ();
     if (cursor != -1 && pick_ctx.item_idx == -1) {
-        DdbListviewIter it = ps->binding->get_for_idx (cursor);
-        ddb_listview_draw_row (ps, cursor, it);
-        UNREF (it);
+        ddb_listview_redraw_row (ps, cursor);
     }
     if (prev != -1 && prev != cursor) {
-        DdbListviewIter it = ps->binding->get_for_idx (prev);
-        ddb_listview_draw_row (ps, prev, it);
-        UNREF (it);
+        ddb_listview_redraw_row (ps, prev);
     }
     deadbeef->pl_unlock ();
 }
@@ -3227,6 +3239,7 @@ ddb_listview_column_insert (DdbListview *listview, int before, const char *title
 
 void
 ddb_listview_column_free (DdbListview *listview, DdbListviewColumn *c) {
+    ddb_listview_cell_cache_clear (listview);
     if (c->title) {
         free (c->title);
     }
@@ -3344,6 +3357,7 @@ ddb_listview_column_set_info (DdbListview *listview, int col, const char *title,
             c->color_override = color_override;
             c->color = color;
             c->user_data = user_data;
+            ddb_listview_cell_cache_clear (listview);
             listview->binding->columns_changed (listview);
             return 0;
         }
@@ -3357,6 +3371,96 @@ ddb_listview_invalidate_album_art_columns (DdbListview *listview) {
 }
 /////// end of column management code
 
+/////// cell cache
+
+// Direct-mapped: a colliding entry replaces the previous one.
+// Big enough for all the cells of a tall window with many columns.
+#define CELL_CACHE_SIZE 4096
+
+static uint32_t
+_cell_cache_slot (const DdbListviewCellKey *key) {
+    uint64_t h = (uint64_t)(uintptr_t)key->it;
+    h = h * 31 + (uint64_t)(uintptr_t)key->user_data;
+    h = h * 31 + (uint32_t)key->idx;
+    h = h * 31 + (uint32_t)key->width;
+    h = h * 31 + key->style;
+    h = h * 31 + key->color;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return (uint32_t)h & (CELL_CACHE_SIZE-1);
+}
+
+static int
+_cell_key_equal (const DdbListviewCellKey *a, const DdbListviewCellKey *b) {
+    return a->it == b->it
+        && a->user_data == b->user_data
+        && a->idx == b->idx
+        && a->width == b->width
+        && a->style == b->style
+        && a->color == b->color;
+}
+
+static void
+_cell_cache_free_cell (DdbListview *listview, DdbListviewCell *cell) {
+    if (cell->layout) {
+        g_object_unref (cell->layout);
+        cell->layout = NULL;
+    }
+    if (cell->key.it) {
+        listview->binding->unref (cell->key.it);
+        cell->key.it = NULL;
+    }
+}
+
+PangoLayout *
+ddb_listview_cell_cache_get (DdbListview *listview, const DdbListviewCellKey *key) {
+    if (!listview->cell_cache) {
+        return NULL;
+    }
+    DdbListviewCell *cell = &listview->cell_cache[_cell_cache_slot (key)];
+    if (cell->layout && _cell_key_equal (&cell->key, key)) {
+        return cell->layout;
+    }
+    return NULL;
+}
+
+void
+ddb_listview_cell_cache_set (DdbListview *listview, const DdbListviewCellKey *key, PangoLayout *layout) {
+    if (!listview->cell_cache) {
+        listview->cell_cache = calloc (CELL_CACHE_SIZE, sizeof (DdbListviewCell));
+    }
+    DdbListviewCell *cell = &listview->cell_cache[_cell_cache_slot (key)];
+    _cell_cache_free_cell (listview, cell);
+    cell->key = *key;
+    listview->binding->ref (cell->key.it);
+    cell->layout = g_object_ref (layout);
+}
+
+void
+ddb_listview_cell_cache_clear (DdbListview *listview) {
+    if (!listview->cell_cache) {
+        return;
+    }
+    for (int i = 0; i < CELL_CACHE_SIZE; i++) {
+        _cell_cache_free_cell (listview, &listview->cell_cache[i]);
+    }
+}
+
+// Drop the cells of the track, or of the row when the track is not known.
+static void
+_cell_cache_remove_row (DdbListview *listview, int row, DdbListviewIter it) {
+    if (!listview->cell_cache) {
+        return;
+    }
+    for (int i = 0; i < CELL_CACHE_SIZE; i++) {
+        DdbListviewCell *cell = &listview->cell_cache[i];
+        if (cell->layout && (it ? cell->key.it == it : cell->key.idx == row)) {
+            _cell_cache_free_cell (listview, cell);
+        }
+    }
+}
+
 /////// grouping /////
 static void
 ddb_listview_free_group (DdbListview *listview, DdbListviewGroup *group) {
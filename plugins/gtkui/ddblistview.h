@@ -128,6 +128,23 @@ struct _DdbListviewGroupFormat {
 
 typedef struct _DdbListviewGroupFormat DdbListviewGroupFormat;
 
+// Identifies the rendered text of a cell in the cell cache.
+// style and color are defined by the binding, and must include everything
+// that affects the layout, e.g. alignment, font style, or the colors of tinted text.
+typedef struct {
+    DdbListviewIter it;
+    void *user_data; // column user_data
+    int idx;
+    int width;
+    uint32_t style;
+    uint32_t color;
+} DdbListviewCellKey;
+
+typedef struct {
+    DdbListviewCellKey key;
+    PangoLayout *layout;
+} DdbListviewCell;
+
 struct _DdbListview {
     GtkTable parent;
 
@@ -213,6 +230,9 @@ struct _DdbListview {
     guint tf_redraw_timeout_id;
     int tf_redraw_track_idx;
     DdbListviewIter tf_redraw_track;
+
+    // shaped cell text, indexed by hash of the key, allocated on first use
+    DdbListviewCell *cell_cache;
 };
 
 struct _DdbListviewClass {
@@ -227,6 +247,9 @@ void
 ddb_listview_set_binding (DdbListview *listview, DdbListviewBinding *binding);
 void
 ddb_listview_draw_row (DdbListview *listview, int idx, DdbListviewIter iter);
+// keeps the cached cells, for changes which don't affect the cell text, e.g. the selection or the cursor
+void
+ddb_listview_redraw_row (DdbListview *listview, int idx);
 void
 ddb_listview_select_single (DdbListview *listview, int sel);
 void
@@ -275,6 +298,19 @@ ddb_listview_refresh (DdbListview *listview, uint32_t flags);
 void
 ddb_listview_invalidate_album_art_columns (DdbListview *listview);
 
+// Returns the cached layout for the key, or NULL. The cache keeps the reference.
+PangoLayout *
+ddb_listview_cell_cache_get (DdbListview *listview, const DdbListviewCellKey *key);
+
+// Stores the layout for the key, the cache adds its own reference.
+void
+ddb_listview_cell_cache_set (DdbListview *listview, const DdbListviewCellKey *key, PangoLayout *layout);
+
+// Drops all cached cells. Called automatically on list refresh, and for a single
+// track on ddb_listview_draw_row.
+void
+ddb_listview_cell_cache_clear (DdbListview *listview);
+
 void
 ddb_listview_clear_sort (DdbListview *listview);
 
@@ -35,6 +35,7 @@ typedef struct {
     PangoLayout *pangolayout;
     GtkStyle *font_style;
     PangoWeight font_weight;
+    PangoLayout *shown_layout; // the layout passed to the last draw_show_layout call
 } drawctx_t;
 
 // abstract api for drawing primitives
@@ -89,6 +90,15 @@ draw_text_custom (drawctx_t *ctx, float x, float y, int width, int align, int ty
 void
 draw_text_with_colors (drawctx_t *ctx, float x, float y, int width, int align, const char *text);
 
+// Create a layout with the same settings as draw_text_custom would use,
+// which can be kept and drawn repeatedly without re-shaping the text.
+// The caller owns the returned reference.
+PangoLayout *
+draw_create_layout (drawctx_t *ctx, int width, int align, int type, int bold, int italic, const char *text, PangoAttrList *attrs);
+
+void
+draw_show_layout (drawctx_t *ctx, PangoLayout *layout, float x, float y);
+
 void
 draw_get_layout_extents (drawctx_t *ctx, int *w, int *h);
 
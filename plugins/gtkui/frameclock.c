@@ -0,0 +1,225 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdlib.h>
+#include "../../deadbeef.h"
+#include "gtkui.h"
+#include "frameclock.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(...)
+
+struct frameclock_client_s {
+    GtkWidget *widget;
+    gulong map_handler;
+    int fps;
+    uint32_t flags;
+    void (*tick)(void *user_data);
+    void *user_data;
+    gint64 last_tick;
+    struct frameclock_client_s *next;
+};
+
+static GtkWidget *_mainwin;
+static gulong _mainwin_state_handler;
+static gulong _mainwin_map_handler;
+static frameclock_client_t *_clients;
+static guint _timer;
+static int _period; // ms, 0 when the clock is stopped
+static int _gui_fps = 10;
+static int _force_frame;
+static gint _wake_pending;
+
+static int
+_mainwin_visible (void) {
+    if (!_mainwin || !gtk_widget_get_visible (_mainwin)) {
+        return 0;
+    }
+    GdkWindow *window = gtk_widget_get_window (_mainwin);
+    return window && !(gdk_window_get_state (window) & GDK_WINDOW_STATE_ICONIFIED);
+}
+
+static int
+_client_interval (frameclock_client_t *c) {
+    return 1000 / (c->fps > 0 ? c->fps : _gui_fps);
+}
+
+// Tick the due clients, and return the period which the clock needs to run at, or 0 to stop
+static int
+_run_frame (void) {
+    int force = _force_frame;
+    _force_frame = 0;
+
+    if (!_mainwin_visible ()) {
+        return 0;
+    }
+
+    DB_output_t *output = deadbeef->get_output ();
+    int playing = output && output->state () == DDB_PLAYBACK_STATE_PLAYING;
+
+    gint64 now = g_get_monotonic_time ();
+    int period = 0;
+    frameclock_client_t *next;
+    for (frameclock_client_t *c = _clients; c; c = next) {
+        // the client may remove itself in the callback
+        next = c->next;
+
+        if (!gtk_widget_get_visible (c->widget) || !gtk_widget_get_mapped (c->widget)) {
+            continue;
+        }
+
+        int animating = playing || !(c->flags & FRAMECLOCK_PLAYBACK);
+        if (!animating && !force) {
+            continue;
+        }
+
+        int interval = _client_interval (c);
+        // allow for a half frame of the timer jitter, so that slower clients don't skip frames
+        if (force || now - c->last_tick >= (interval - _period / 2) * 1000) {
+            c->last_tick = now;
+            c->tick (c->user_data);
+        }
+
+        if (animating && (!period || interval < period)) {
+            period = interval;
+        }
+    }
+    return period;
+}
+
+static gboolean
+_clock_cb (gpointer data);
+
+// Set the timer to the new period, returns TRUE if the current timer is still valid
+static gboolean
+_schedule (int period) {
+    if (period == _period && (_timer || !period)) {
+        return TRUE;
+    }
+    trace ("frameclock: period %d -> %d ms\n", _period, period);
+    if (_timer) {
+        g_source_remove (_timer);
+        _timer = 0;
+    }
+    _period = period;
+    if (period) {
+        _timer = g_timeout_add (period, _clock_cb, NULL);
+    }
+    return FALSE;
+}
+
+static gboolean
+_clock_cb (gpointer data) {
+    guint timer = _timer;
+    gboolean keep = _schedule (_run_frame ());
+    // the timer may have been replaced while ticking
+    return keep && timer == _timer;
+}
+
+static gboolean
+_wake_cb (gpointer data) {
+    g_atomic_int_set (&_wake_pending, 0);
+    _gui_fps = gtkui_get_gui_refresh_rate ();
+    _force_frame = 1;
+    _schedule (_run_frame ());
+    return FALSE;
+}
+
+void
+frameclock_wake (void) {
+    if (g_atomic_int_compare_and_exchange (&_wake_pending, 0, 1)) {
+        g_idle_add (_wake_cb, NULL);
+    }
+}
+
+static void
+_map_cb (GtkWidget *widget, gpointer user_data) {
+    frameclock_wake ();
+}
+
+static gboolean
+_window_state_cb (GtkWidget *widget, GdkEventWindowState *event, gpointer user_data) {
+    if (event->changed_mask & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) {
+        frameclock_wake ();
+    }
+    return FALSE;
+}
+
+frameclock_client_t *
+frameclock_add (GtkWidget *widget, int fps, uint32_t flags, void (*tick)(void *user_data), void *user_data) {
+    frameclock_client_t *c = calloc (1, sizeof (frameclock_client_t));
+    // keep the widget alive until the client is removed
+    c->widget = g_object_ref (widget);
+    c->map_handler = g_signal_connect ((gpointer)widget, "map", G_CALLBACK (_map_cb), NULL);
+    c->fps = fps;
+    c->flags = flags;
+    c->tick = tick;
+    c->user_data = user_data;
+    c->next = _clients;
+    _clients = c;
+    frameclock_wake ();
+    return c;
+}
+
+void
+frameclock_remove (frameclock_client_t *client) {
+    frameclock_client_t *prev = NULL;
+    for (frameclock_client_t *c = _clients; c; prev = c, c = c->next) {
+        if (c == client) {
+            if (prev) {
+                prev->next = c->next;
+            }
+            else {
+                _clients = c->next;
+            }
+            break;
+        }
+    }
+    g_signal_handler_disconnect (client->widget, client->map_handler);
+    g_object_unref (client->widget);
+    free (client);
+    if (!_clients) {
+        _schedule (0);
+    }
+}
+
+void
+frameclock_init (GtkWidget *mainwin) {
+    _mainwin = mainwin;
+    _gui_fps = gtkui_get_gui_refresh_rate ();
+    _mainwin_state_handler = g_signal_connect ((gpointer)mainwin, "window_state_event", G_CALLBACK (_window_state_cb), NULL);
+    _mainwin_map_handler = g_signal_connect ((gpointer)mainwin, "map", G_CALLBACK (_map_cb), NULL);
+}
+
+void
+frameclock_free (void) {
+    _schedule (0);
+    while (_clients) {
+        frameclock_remove (_clients);
+    }
+    if (_mainwin) {
+        g_signal_handler_disconnect (_mainwin, _mainwin_state_handler);
+        g_signal_handler_disconnect (_mainwin, _mainwin_map_handler);
+        _mainwin = NULL;
+    }
+}
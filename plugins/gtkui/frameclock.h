@@ -0,0 +1,63 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __FRAMECLOCK_H
+#define __FRAMECLOCK_H
+
+#include <stdint.h>
+#include <gtk/gtk.h>
+
+// A single timer which drives all periodically updated widgets.
+// The clients which are due are ticked together in one frame, so their redraws are coalesced.
+// A client is only ticked while its widget is mapped and the main window is shown and not minimized,
+// and the clock stops completely when no client needs ticking.
+
+typedef struct frameclock_client_s frameclock_client_t;
+
+enum {
+    // the client only animates during playback,
+    // while stopped or paused it gets a single frame on frameclock_wake
+    FRAMECLOCK_PLAYBACK = 1,
+};
+
+// Call from the main thread only.
+// fps: frames per second, or 0 for the gtkui refresh rate
+frameclock_client_t *
+frameclock_add (GtkWidget *widget, int fps, uint32_t flags, void (*tick)(void *user_data), void *user_data);
+
+void
+frameclock_remove (frameclock_client_t *client);
+
+// Schedule a frame for all visible clients, and restart the clock if needed,
+// e.g. after playback state or configuration changes.
+// Can be called from any thread.
+void
+frameclock_wake (void);
+
+void
+frameclock_init (GtkWidget *mainwin);
+
+void
+frameclock_free (void);
+
+#endif
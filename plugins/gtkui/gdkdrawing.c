@@ -126,6 +126,10 @@ draw_free (drawctx_t *ctx) {
         g_object_unref (ctx->font_style);
         ctx->font_style = NULL;
     }
+    if (ctx->shown_layout) {
+        g_object_unref (ctx->shown_layout);
+        ctx->shown_layout = NULL;
+    }
 }
 
 void
@@ -208,6 +212,10 @@ draw_text (drawctx_t *ctx, float x, float y, int width, int align, const char *t
 
 void
 draw_text_custom (drawctx_t *ctx, float x, float y, int width, int align, int type, int bold, int italic, const char *text) {
+    if (ctx->shown_layout) {
+        g_object_unref (ctx->shown_layout);
+        ctx->shown_layout = NULL;
+    }
     draw_init_font (ctx, type, 0);
     if (bold || italic) {
         draw_init_font_style (ctx, bold, italic, type);
@@ -219,6 +227,35 @@ draw_text_custom (drawctx_t *ctx, float x, float y, int width, int align, int ty
     pango_cairo_show_layout (ctx->drawable, ctx->pangolayout);
 }
 
+PangoLayout *
+draw_create_layout (drawctx_t *ctx, int width, int align, int type, int bold, int italic, const char *text, PangoAttrList *attrs) {
+    draw_init_font (ctx, type, 0);
+    if (bold || italic) {
+        draw_init_font_style (ctx, bold, italic, type);
+    }
+    PangoLayout *layout = pango_layout_new (ctx->pangoctx);
+    pango_layout_set_ellipsize (layout, PANGO_ELLIPSIZE_END);
+    pango_layout_set_font_description (layout, pango_layout_get_font_description (ctx->pangolayout));
+    pango_layout_set_width (layout, width*PANGO_SCALE);
+    pango_layout_set_alignment (layout, get_pango_alignment (align));
+    if (attrs) {
+        pango_layout_set_attributes (layout, attrs);
+    }
+    pango_layout_set_text (layout, text, -1);
+    return layout;
+}
+
+void
+draw_show_layout (drawctx_t *ctx, PangoLayout *layout, float x, float y) {
+    g_object_ref (layout);
+    if (ctx->shown_layout) {
+        g_object_unref (ctx->shown_layout);
+    }
+    ctx->shown_layout = layout;
+    cairo_move_to (ctx->drawable, x, y);
+    pango_cairo_show_layout (ctx->drawable, layout);
+}
+
 void
 draw_text_with_colors (drawctx_t *ctx, float x, float y, int width, int align, const char *text) {
     draw_init_font (ctx, 0, 0);
@@ -253,12 +290,12 @@ draw_get_text_extents (drawctx_t *ctx, const char *text, int len, int *w, int *h
 
 int
 draw_is_ellipsized (drawctx_t *ctx) {
-    return pango_layout_is_ellipsized (ctx->pangolayout);
+    return pango_layout_is_ellipsized (ctx->shown_layout ? ctx->shown_layout : ctx->pangolayout);
 }
 
 const char *
 draw_get_text (drawctx_t *ctx) {
-    return pango_layout_get_text (ctx->pangolayout);
+    return pango_layout_get_text (ctx->shown_layout ? ctx->shown_layout : ctx->pangolayout);
 }
 
 int
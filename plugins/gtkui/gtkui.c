@@ -47,6 +47,7 @@
 #include "ddbtabstrip.h"
 #include "drawing.h"
 #include "eq.h"
+#include "frameclock.h"
 #include "gtkui.h"
 #include "gtkui_api.h"
 #include "hotkeys.h"
@@ -85,7 +86,7 @@ GtkWidget *logwindow;
 
 static int gtkui_accept_messages = 0;
 
-static gint refresh_timeout = 0;
+static frameclock_client_t *songinfo_clock;
 static guint set_title_timeout_id;
 
 int fileadded_listener_id;
@@ -485,11 +486,9 @@ playlistcontentchanged_cb (gpointer none) {
     return FALSE;
 }
 
-static gboolean
-gtkui_on_frameupdate (gpointer data) {
+static void
+gtkui_on_frameupdate (void *data) {
     update_songinfo (NULL);
-
-    return TRUE;
 }
 
 static gboolean
@@ -604,14 +603,8 @@ gtkui_rename_playlist_at_index (int plt_idx) {
 
 void
 gtkui_setup_gui_refresh (void) {
-    int tm = 1000/gtkui_get_gui_refresh_rate ();
-
-    if (refresh_timeout) {
-        g_source_remove (refresh_timeout);
-        refresh_timeout = 0;
-    }
-
-    refresh_timeout = g_timeout_add (tm, gtkui_on_frameupdate, NULL);
+    // the frame clock picks up the new refresh rate
+    frameclock_wake ();
 }
 
 
@@ -985,6 +978,9 @@ gtkui_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
         break;
     }
 
+    // any event may change what the animated widgets show, e.g. playback state, position or the playlist stats
+    frameclock_wake ();
+
     search_message(id, ctx, p1, p2);
     ddb_gtkui_widget_t *rootwidget = w_get_rootwidget ();
     if (rootwidget) {
@@ -1341,6 +1337,9 @@ gtkui_mainwin_init(void) {
 
     mainwin = create_mainwin ();
 
+    frameclock_init (mainwin);
+    songinfo_clock = frameclock_add (lookup_widget (mainwin, "statusbar"), 0, FRAMECLOCK_PLAYBACK, gtkui_on_frameupdate, NULL);
+
 #if GTK_CHECK_VERSION(3,10,0) && USE_GTK_APPLICATION
      // This must be called before window is shown
      gtk_application_add_window ( GTK_APPLICATION (gapp), GTK_WINDOW (mainwin));
@@ -1469,10 +1468,11 @@ gtkui_mainwin_free(void) {
 
     w_free ();
 
-    if (refresh_timeout) {
-        g_source_remove (refresh_timeout);
-        refresh_timeout = 0;
+    if (songinfo_clock) {
+        frameclock_remove (songinfo_clock);
+        songinfo_clock = NULL;
     }
+    frameclock_free ();
 
     if (set_title_timeout_id) {
         g_source_remove (set_title_timeout_id);
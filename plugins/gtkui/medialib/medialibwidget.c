@@ -33,14 +33,18 @@ typedef struct {
     char *search_text;
     int listener_id;
     GtkTreeIter root_iter;
-    ddb_medialib_item_t *item_tree;
+    int root_count;
+    GSList *pages;
 } w_medialib_viewer_t;
 
 enum {
     COL_TITLE,
     COL_TRACK,
+    COL_ITEM,
 };
 
+#define ML_PAGE_SIZE 1000
+
 static int
 _item_comparator (const void *a, const void *b) {
     const ddb_medialib_item_t *item1 = *((ddb_medialib_item_t **)a);
@@ -60,30 +64,48 @@ _item_comparator (const void *a, const void *b) {
     return n1-n2;
 }
 
+// Fetch all children of the parent item page by page, the pages are kept until the next reload
 static ddb_medialib_item_t **
-_sorted_children_from_item (ddb_medialib_item_t *item) {
-    ddb_medialib_item_t **children = calloc (item->num_children, sizeof (ddb_medialib_item_t *));
-    ddb_medialib_item_t *c = item->children;
-    for (int i = 0; i < item->num_children; i++) {
-        children[i] = c;
-        c = c->next;
-    }
+_sorted_children_from_item (w_medialib_viewer_t *mlv, ddb_medialib_item_t *parent, int *count) {
+    ddb_medialib_item_t **children = NULL;
+    int num_children = 0;
+    int64_t cursor = 0;
+
+    do {
+        int64_t next_cursor = -1;
+        ddb_medialib_item_t *page = mlv->plugin->get_items_page (mlv->source, mlv->selectors[mlv->active_selector], mlv->search_text, parent, cursor, ML_PAGE_SIZE, &next_cursor);
+        if (page == NULL) {
+            break; // the content has changed, and will be reloaded
+        }
+        mlv->pages = g_slist_prepend (mlv->pages, page);
 
-    qsort (children, item->num_children, sizeof (ddb_medialib_item_t *), _item_comparator);
+        int page_count = 0;
+        for (ddb_medialib_item_t *c = page; c; c = c->next) {
+            page_count++;
+        }
+        children = realloc (children, (num_children + page_count) * sizeof (ddb_medialib_item_t *));
+        for (ddb_medialib_item_t *c = page; c; c = c->next) {
+            children[num_children++] = c;
+        }
+        cursor = next_cursor;
+    } while (cursor != -1);
+
+    if (num_children > 0) {
+        qsort (children, num_children, sizeof (ddb_medialib_item_t *), _item_comparator);
+    }
 
+    *count = num_children;
     return children;
 }
 
-static void
+static int
 _add_items (w_medialib_viewer_t *mlv, GtkTreeIter *iter, ddb_medialib_item_t *item) {
-    if (item == NULL) {
-        return;
-    }
     GtkTreeStore *store = GTK_TREE_STORE (gtk_tree_view_get_model (mlv->tree));
 
-    ddb_medialib_item_t **sorted_items = _sorted_children_from_item (item);
+    int count = 0;
+    ddb_medialib_item_t **sorted_items = _sorted_children_from_item (mlv, item, &count);
 
-    for (int i = 0; i < item->num_children; i++) {
+    for (int i = 0; i < count; i++) {
         ddb_medialib_item_t *child_item = sorted_items[i];
         GtkTreeIter child;
         gtk_tree_store_append (store, &child, iter);
@@ -91,19 +113,61 @@ _add_items (w_medialib_viewer_t *mlv, GtkTreeIter *iter, ddb_medialib_item_t *it
             size_t len = strlen(child_item->text) + 20;
             char *text = malloc (len + 20);
             snprintf (text, len, "%s (%d)", child_item->text, child_item->num_children);
-            gtk_tree_store_set (store, &child, COL_TITLE, text, COL_TRACK, child_item->track, -1);
+            gtk_tree_store_set (store, &child, COL_TITLE, text, COL_TRACK, child_item->track, COL_ITEM, child_item, -1);
             free (text);
+
+            // the children are loaded when the row is expanded, until then it has an empty placeholder child
+            GtkTreeIter placeholder;
+            gtk_tree_store_append (store, &placeholder, &child);
         }
         else {
-            gtk_tree_store_set (store, &child, COL_TITLE, child_item->text, COL_TRACK, child_item->track, -1);
-        }
-
-        if (child_item->children != NULL) {
-            _add_items (mlv, &child, child_item);
+            gtk_tree_store_set (store, &child, COL_TITLE, child_item->text, COL_TRACK, child_item->track, COL_ITEM, child_item, -1);
         }
     }
 
     free (sorted_items);
+    return count;
+}
+
+static void
+_load_children (w_medialib_viewer_t *mlv, GtkTreeIter *iter) {
+    GtkTreeModel *model = gtk_tree_view_get_model (mlv->tree);
+    GtkTreeIter child;
+    if (!gtk_tree_model_iter_children (model, &child, iter)) {
+        return;
+    }
+
+    ddb_medialib_item_t *child_item = NULL;
+    gtk_tree_model_get (model, &child, COL_ITEM, &child_item, -1);
+    if (child_item != NULL) {
+        return; // already loaded
+    }
+
+    ddb_medialib_item_t *item = NULL;
+    gtk_tree_model_get (model, iter, COL_ITEM, &item, -1);
+    gtk_tree_store_remove (GTK_TREE_STORE (model), &child);
+    _add_items (mlv, iter, item);
+}
+
+static void
+_load_all_children (w_medialib_viewer_t *mlv, GtkTreeIter *iter) {
+    GtkTreeModel *model = gtk_tree_view_get_model (mlv->tree);
+    GtkTreeIter child;
+    if (gtk_tree_model_iter_children (model, &child, iter)) {
+        do {
+            _load_children (mlv, &child);
+            _load_all_children (mlv, &child);
+        } while (gtk_tree_model_iter_next (model, &child));
+    }
+}
+
+static void
+_free_pages (w_medialib_viewer_t *mlv) {
+    for (GSList *page = mlv->pages; page; page = page->next) {
+        mlv->plugin->plugin.free_item_tree (mlv->source, page->data);
+    }
+    g_slist_free (mlv->pages);
+    mlv->pages = NULL;
 }
 
 static gboolean
@@ -116,7 +180,7 @@ _medialib_state_did_change (void *user_data) {
     case DDB_MEDIASOURCE_STATE_IDLE:
         if (enabled) {
             char text[200];
-            snprintf (text, sizeof (text), "%s (%d)", _("All Music"), mlv->item_tree ? mlv->item_tree->num_children : 0);
+            snprintf (text, sizeof (text), "%s (%d)", _("All Music"), mlv->root_count);
             gtk_tree_store_set (store, &mlv->root_iter, COL_TITLE, text, -1);
         }
         else {
@@ -142,21 +206,21 @@ _medialib_state_did_change (void *user_data) {
 
 static void
 _reload_content (w_medialib_viewer_t *mlv) {
-    // populate the tree
-    if (mlv->item_tree != NULL) {
-        mlv->plugin->plugin.free_item_tree (mlv->source, mlv->item_tree);
-        mlv->item_tree = NULL;
-    }
-    mlv->item_tree = mlv->plugin->plugin.create_item_tree (mlv->source, mlv->selectors[mlv->active_selector], mlv->search_text);
-
     // clear
     GtkTreeIter iter;
     GtkTreeStore *store = GTK_TREE_STORE (gtk_tree_view_get_model (mlv->tree));
     if (gtk_tree_model_iter_children (GTK_TREE_MODEL (store), &iter, &mlv->root_iter)) {
         while (gtk_tree_store_remove (store, &iter));
     }
+    _free_pages (mlv);
 
-    _add_items (mlv, &mlv->root_iter, mlv->item_tree);
+    // populate the top level, the rest is loaded on demand
+    mlv->root_count = _add_items (mlv, &mlv->root_iter, NULL);
+
+    // search results are shown fully expanded
+    if (mlv->search_text != NULL) {
+        _load_all_children (mlv, &mlv->root_iter);
+    }
 
     GtkTreePath *path = gtk_tree_path_new_from_indices (0, -1);
     gtk_tree_view_expand_row (mlv->tree, path, mlv->search_text != NULL);
@@ -243,10 +307,7 @@ w_medialib_viewer_destroy (struct ddb_gtkui_widget_s *w) {
     if (mlv->source != NULL) {
         mlv->plugin->plugin.remove_listener (mlv->source, mlv->listener_id);
     }
-    if (mlv->item_tree != NULL) {
-        mlv->plugin->plugin.free_item_tree (mlv->source, mlv->item_tree);
-        mlv->item_tree = NULL;
-    }
+    _free_pages (mlv);
     if (mlv->selectors != NULL) {
         mlv->plugin->plugin.free_selectors_list (mlv->source, mlv->selectors);
         mlv->selectors = NULL;
@@ -312,7 +373,7 @@ _search_text_did_change (GtkEditable *editable, gpointer user_data) {
 }
 
 static int
-_collect_tracks_from_iter (GtkTreeModel *model, GtkTreeIter *iter, ddb_playItem_t **tracks, int append_position) {
+_collect_tracks_from_iter (w_medialib_viewer_t *mlv, GtkTreeModel *model, GtkTreeIter *iter, ddb_playItem_t **tracks, int append_position) {
     // is it a track?
     GValue value = {0};
     gtk_tree_model_get_value (model, iter, COL_TRACK, &value);
@@ -327,11 +388,12 @@ _collect_tracks_from_iter (GtkTreeModel *model, GtkTreeIter *iter, ddb_playItem_
     }
 
     int count = 0;
-    // recurse into children
+    // recurse into children, loading them if the row was never expanded
+    _load_children (mlv, iter);
     GtkTreeIter child;
     if (gtk_tree_model_iter_children (model, &child, iter)) {
         do {
-            int appended_count = _collect_tracks_from_iter (model, &child, tracks, append_position);
+            int appended_count = _collect_tracks_from_iter (mlv, model, &child, tracks, append_position);
             count += appended_count;
             append_position += appended_count;
         } while (gtk_tree_model_iter_next (model, &child));
@@ -341,7 +403,7 @@ _collect_tracks_from_iter (GtkTreeModel *model, GtkTreeIter *iter, ddb_playItem_
 }
 
 static int
-_collect_selected_tracks (GtkTreeModel *model, GtkTreeSelection *selection, ddb_playItem_t **tracks, int append_position) {
+_collect_selected_tracks (w_medialib_viewer_t *mlv, GtkTreeModel *model, GtkTreeSelection *selection, ddb_playItem_t **tracks, int append_position) {
     GList *selected_rows = gtk_tree_selection_get_selected_rows (selection, NULL);
 
     int count = 0;
@@ -353,7 +415,7 @@ _collect_selected_tracks (GtkTreeModel *model, GtkTreeSelection *selection, ddb_
             continue;
         }
 
-        int appended_count = _collect_tracks_from_iter (model, &iter, tracks, append_position);
+        int appended_count = _collect_tracks_from_iter (mlv, model, &iter, tracks, append_position);
         count += appended_count;
         append_position += appended_count;
     }
@@ -393,6 +455,13 @@ _get_target_playlist (void) {
     return plt;
 }
 
+static gboolean
+_treeview_test_expand_row (GtkTreeView *self, GtkTreeIter *iter, GtkTreePath *path, gpointer user_data) {
+    w_medialib_viewer_t *mlv = user_data;
+    _load_children (mlv, iter);
+    return FALSE;
+}
+
 static void
 _treeview_row_did_activate (GtkTreeView* self, GtkTreePath* path, GtkTreeViewColumn* column, gpointer user_data) {
     w_medialib_viewer_t *mlv = user_data;
@@ -414,13 +483,13 @@ _treeview_row_did_activate (GtkTreeView* self, GtkTreePath* path, GtkTreeViewCol
     GtkTreeSelection *selection = gtk_tree_view_get_selection (self);
 
     // count selected tracks
-    int count = _collect_selected_tracks (model, selection, NULL, 0);
+    int count = _collect_selected_tracks (mlv, model, selection, NULL, 0);
 
     if (count > 0) {
         // create array of tracks
         ddb_playItem_t **tracks = NULL;
         tracks = calloc (count, sizeof (ddb_playItem_t *));
-        _collect_selected_tracks (model, selection, tracks, 0);
+        _collect_selected_tracks (mlv, model, selection, tracks, 0);
 
         _append_tracks_to_playlist (tracks, count, curr_plt);
 
@@ -487,7 +556,7 @@ _treeview_row_mousedown (GtkWidget* self, GdkEventButton *event, gpointer user_d
     }
 
     // count selected tracks
-    int count = _collect_selected_tracks (model, selection, NULL, 0);
+    int count = _collect_selected_tracks (mlv, model, selection, NULL, 0);
 
     // create array of tracks
     ddb_playItem_t **tracks = NULL;
@@ -496,7 +565,7 @@ _treeview_row_mousedown (GtkWidget* self, GdkEventButton *event, gpointer user_d
     }
 
     tracks = calloc (count, sizeof (ddb_playItem_t *));
-    _collect_selected_tracks (model, selection, tracks, 0);
+    _collect_selected_tracks (mlv, model, selection, tracks, 0);
 
     // context menu
     if (event->button == 3) {
@@ -528,17 +597,19 @@ _drag_data_get (
                GdkDragContext* context,
                GtkSelectionData* selection_data,
                guint info,
-               guint time_
+               guint time_,
+               gpointer user_data
                 ) {
+    w_medialib_viewer_t *mlv = user_data;
     GtkTreeModel *model = GTK_TREE_MODEL (gtk_tree_view_get_model (GTK_TREE_VIEW (widget)));
     GtkTreeSelection *selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (widget));
 
-    int count = _collect_selected_tracks (model, selection, NULL, 0);
+    int count = _collect_selected_tracks (mlv, model, selection, NULL, 0);
     if (count == 0) {
         return;
     }
     ddb_playItem_t **tracks = calloc (count, sizeof (ddb_playItem_t *));
-    _collect_selected_tracks (model, selection, tracks, 0);
+    _collect_selected_tracks (mlv, model, selection, tracks, 0);
 
     for (int i = 0; i < count; i++) {
         deadbeef->pl_item_ref (tracks[i]);
@@ -621,7 +692,7 @@ w_medialib_viewer_create (void) {
 
     gtk_container_add (GTK_CONTAINER (scroll), GTK_WIDGET (w->tree));
 
-    GtkTreeStore *store = gtk_tree_store_new (2, G_TYPE_STRING, G_TYPE_POINTER);
+    GtkTreeStore *store = gtk_tree_store_new (3, G_TYPE_STRING, G_TYPE_POINTER, G_TYPE_POINTER);
     gtk_tree_view_set_model (GTK_TREE_VIEW (w->tree), GTK_TREE_MODEL (store));
 
     gtk_tree_view_set_rules_hint (GTK_TREE_VIEW (w->tree), TRUE);
@@ -635,6 +706,7 @@ w_medialib_viewer_create (void) {
 
     g_signal_connect ((gpointer)w->selector, "changed", G_CALLBACK (_active_selector_did_change), w);
     g_signal_connect ((gpointer)w->search_entry, "changed", G_CALLBACK (_search_text_did_change), w);
+    g_signal_connect ((gpointer)w->tree, "test-expand-row", G_CALLBACK (_treeview_test_expand_row), w);
     g_signal_connect ((gpointer)w->tree, "row-activated", G_CALLBACK (_treeview_row_did_activate), w);
     g_signal_connect ((gpointer)w->tree, "button_press_event", G_CALLBACK (_treeview_row_mousedown), w);
     g_signal_connect ((gpointer)configure_button, "clicked", G_CALLBACK (_configure_did_activate), w);
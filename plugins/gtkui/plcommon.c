@@ -545,64 +545,10 @@ pl_common_draw_column_data (DdbListview *listview, cairo_t *cr, DdbListviewIter
         }
     }
     else if (it) {
-        char text[1024] = "";
-        int is_dimmed = 0;
-        if (it == playing_track && info->id == DB_COLUMN_PLAYING) {
-            int paused = deadbeef->get_output ()->state () == DDB_PLAYBACK_STATE_PAUSED;
-            int buffering = !deadbeef->streamer_ok_to_read (-1);
-            if (paused) {
-                strcpy (text, "||");
-            }
-            else if (!buffering) {
-                strcpy (text, "►");
-            }
-            else {
-                strcpy (text, "⋯");
-            }
-        }
-        else {
-            ddb_tf_context_t ctx = {
-                ._size = sizeof (ddb_tf_context_t),
-                .it = it,
-                .plt = deadbeef->plt_get_curr (),
-                .iter = iter,
-                .id = info->id,
-                .idx = idx,
-                .flags = DDB_TF_CONTEXT_HAS_ID | DDB_TF_CONTEXT_HAS_INDEX,
-            };
-            if (!deadbeef->pl_is_selected (it)) {
-                ctx.flags |= DDB_TF_CONTEXT_TEXT_DIM;
-            }
-            deadbeef->tf_eval (&ctx, info->bytecode, text, sizeof (text));
-            is_dimmed = ctx.dimmed;
-            if (ctx.update > 0) {
-                ddb_listview_cancel_autoredraw (listview);
-                if ((ctx.flags & DDB_TF_CONTEXT_HAS_INDEX) && ctx.iter == PL_MAIN) {
-                    listview->tf_redraw_track_idx = ctx.idx;
-                }
-                else {
-                    listview->tf_redraw_track_idx = deadbeef->plt_get_item_idx (ctx.plt, it, ctx.iter);
-                }
-                listview->tf_redraw_timeout_id = g_timeout_add (ctx.update, tf_redraw_cb, listview);
-                listview->tf_redraw_track = it;
-                deadbeef->pl_item_ref (it);
-            }
-            if (ctx.plt) {
-                deadbeef->plt_unref (ctx.plt);
-                ctx.plt = NULL;
-            }
-            char *lb = strchr (text, '\r');
-            if (lb) {
-                *lb = 0;
-            }
-            lb = strchr (text, '\n');
-            if (lb) {
-                *lb = 0;
-            }
-        }
+        int is_selected = deadbeef->pl_is_selected (it);
         GdkColor *color = NULL;
         if (!gtkui_override_listview_colors ()) {
-            if (deadbeef->pl_is_selected (it)) {
+            if (is_selected) {
                 color = &gtk_widget_get_style (theme_treeview)->text[GTK_STATE_SELECTED];
             }
             else {
@@ -616,7 +562,7 @@ pl_common_draw_column_data (DdbListview *listview, cairo_t *cr, DdbListviewIter
         }
         else {
             GdkColor clr;
-            if (deadbeef->pl_is_selected (it)) {
+            if (is_selected) {
                 color = ((void)(gtkui_get_listview_selected_text_color (&clr)), &clr);
             }
             else if (it && it == playing_track) {
@@ -641,7 +587,7 @@ pl_common_draw_column_data (DdbListview *listview, cairo_t *cr, DdbListviewIter
 
         int bold = 0;
         int italic = 0;
-        if (deadbeef->pl_is_selected (it)) {
+        if (is_selected) {
             bold = gtkui_embolden_selected_tracks;
             italic = gtkui_italic_selected_tracks;
         }
@@ -653,52 +599,138 @@ pl_common_draw_column_data (DdbListview *listview, cairo_t *cr, DdbListviewIter
         cairo_rectangle(cr, x+5, y, width-10, height);
         cairo_clip(cr);
 
-        GdkColor *highlight_color;
-        GdkColor hlclr;
-        if (!gtkui_override_listview_colors ()) {
-            highlight_color = &gtk_widget_get_style(theme_treeview)->fg[GTK_STATE_NORMAL];
+        // The text of a cell only depends on the track, the column, and the
+        // styling below, until the track changes, or the list gets refreshed.
+        DdbListviewCellKey key = {
+            .it = it,
+            .user_data = info,
+            .idx = idx,
+            .width = width,
+            .style = (align & 3) | (bold << 2) | (italic << 3) | (is_selected << 4) | ((it == playing_track) << 5) | ((even != 0) << 6) | ((iter == PL_SEARCH) << 7),
+            .color = ((color->red >> 8) << 16) | ((color->green >> 8) << 8) | (color->blue >> 8),
+        };
+
+        PangoLayout *layout = NULL;
+        int is_playing_column = it == playing_track && info->id == DB_COLUMN_PLAYING;
+        if (!is_playing_column) {
+            layout = ddb_listview_cell_cache_get (listview, &key);
         }
-        else {
-            highlight_color = ((void)(gtkui_get_listview_group_text_color (&hlclr)), &hlclr);
+
+        if (layout) {
+            g_object_ref (layout);
         }
+        else {
+            char text[1024] = "";
+            int is_dimmed = 0;
+            int is_dynamic = 0;
+            if (is_playing_column) {
+                int paused = deadbeef->get_output ()->state () == DDB_PLAYBACK_STATE_PAUSED;
+                int buffering = !deadbeef->streamer_ok_to_read (-1);
+                if (paused) {
+                    strcpy (text, "||");
+                }
+                else if (!buffering) {
+                    strcpy (text, "►");
+                }
+                else {
+                    strcpy (text, "⋯");
+                }
+            }
+            else {
+                ddb_tf_context_t ctx = {
+                    ._size = sizeof (ddb_tf_context_t),
+                    .it = it,
+                    .plt = deadbeef->plt_get_curr (),
+                    .iter = iter,
+                    .id = info->id,
+                    .idx = idx,
+                    .flags = DDB_TF_CONTEXT_HAS_ID | DDB_TF_CONTEXT_HAS_INDEX,
+                };
+                if (!is_selected) {
+                    ctx.flags |= DDB_TF_CONTEXT_TEXT_DIM;
+                }
+                deadbeef->tf_eval (&ctx, info->bytecode, text, sizeof (text));
+                is_dimmed = ctx.dimmed;
+                if (ctx.update > 0) {
+                    // the text changes over time, the redraw timer will re-evaluate it
+                    is_dynamic = 1;
+                    ddb_listview_cancel_autoredraw (listview);
+                    if ((ctx.flags & DDB_TF_CONTEXT_HAS_INDEX) && ctx.iter == PL_MAIN) {
+                        listview->tf_redraw_track_idx = ctx.idx;
+                    }
+                    else {
+                        listview->tf_redraw_track_idx = deadbeef->plt_get_item_idx (ctx.plt, it, ctx.iter);
+                    }
+                    listview->tf_redraw_timeout_id = g_timeout_add (ctx.update, tf_redraw_cb, listview);
+                    listview->tf_redraw_track = it;
+                    deadbeef->pl_item_ref (it);
+                }
+                if (ctx.plt) {
+                    deadbeef->plt_unref (ctx.plt);
+                    ctx.plt = NULL;
+                }
+                char *lb = strchr (text, '\r');
+                if (lb) {
+                    *lb = 0;
+                }
+                lb = strchr (text, '\n');
+                if (lb) {
+                    *lb = 0;
+                }
+            }
 
-        float highlight[] = {highlight_color->red/65535., highlight_color->green/65535., highlight_color->blue/65535.};
+            if (is_dimmed) {
+                GdkColor *highlight_color;
+                GdkColor hlclr;
+                if (!gtkui_override_listview_colors ()) {
+                    highlight_color = &gtk_widget_get_style(theme_treeview)->fg[GTK_STATE_NORMAL];
+                }
+                else {
+                    highlight_color = ((void)(gtkui_get_listview_group_text_color (&hlclr)), &hlclr);
+                }
 
-        GdkColor *background_color;
-        GdkColor bgclr;
+                float highlight[] = {highlight_color->red/65535., highlight_color->green/65535., highlight_color->blue/65535.};
 
-        if (!gtkui_override_listview_colors ()) {
-            if (deadbeef->pl_is_selected (it)) {
-                background_color = &gtk_widget_get_style (theme_treeview)->bg[GTK_STATE_SELECTED];
-            } else {
-                background_color = &gtk_widget_get_style(theme_treeview)->bg[GTK_STATE_NORMAL];
-            }
-        } else {
-            if (deadbeef->pl_is_selected (it)) {
-                gtkui_get_listview_selection_color (&bgclr);
-            } else {
-                if (even) {
-                    gtkui_get_listview_even_row_color (&bgclr);
+                GdkColor *background_color;
+                GdkColor bgclr;
+
+                if (!gtkui_override_listview_colors ()) {
+                    if (is_selected) {
+                        background_color = &gtk_widget_get_style (theme_treeview)->bg[GTK_STATE_SELECTED];
+                    } else {
+                        background_color = &gtk_widget_get_style(theme_treeview)->bg[GTK_STATE_NORMAL];
+                    }
                 } else {
-                    gtkui_get_listview_odd_row_color (&bgclr);
+                    if (is_selected) {
+                        gtkui_get_listview_selection_color (&bgclr);
+                    } else {
+                        if (even) {
+                            gtkui_get_listview_even_row_color (&bgclr);
+                        } else {
+                            gtkui_get_listview_odd_row_color (&bgclr);
+                        }
+                    }
+                    background_color = &bgclr;
                 }
+                float bg[] = {background_color->red/65535., background_color->green/65535., background_color->blue/65535.};
+
+                char *plainString;
+                PangoAttrList *attrs = convert_escapetext_to_pango_attrlist(text, &plainString, fg, bg, highlight);
+                layout = draw_create_layout (&listview->listctx, width-10, align, DDB_LIST_FONT, bold, italic, plainString, attrs);
+                pango_attr_list_unref(attrs);
+                free (plainString);
+            } else {
+                layout = draw_create_layout (&listview->listctx, width-10, align, DDB_LIST_FONT, bold, italic, text, NULL);
             }
-            background_color = &bgclr;
-        }
-        float bg[] = {background_color->red/65535., background_color->green/65535., background_color->blue/65535.};
 
-        if (is_dimmed) {
-            char *plainString;
-            PangoAttrList *attrs = convert_escapetext_to_pango_attrlist(text, &plainString, fg, bg, highlight);
-            pango_layout_set_attributes (listview->listctx.pangolayout, attrs);
-            pango_attr_list_unref(attrs);
-            draw_text_custom (&listview->listctx, x + 5, y + 3, width-10, align, DDB_LIST_FONT, bold, italic, plainString);
-            free (plainString);
-            pango_layout_set_attributes (listview->listctx.pangolayout, NULL);
-        } else {
-            draw_text_custom (&listview->listctx, x + 5, y + 3, width-10, align, DDB_LIST_FONT, bold, italic, text);
+            if (!is_playing_column && !is_dynamic) {
+                ddb_listview_cell_cache_set (listview, &key, layout);
+            }
         }
 
+        draw_show_layout (&listview->listctx, layout, x + 5, y + 3);
+        g_object_unref (layout);
+
         cairo_restore(cr);
     }
     if (playing_track) {
@@ -215,9 +215,9 @@ set_cursor (DdbListview *listview, DB_playItem_t *it) {
         int cursor = deadbeef->pl_get_cursor (PL_SEARCH);
         if (new_cursor != cursor) {
             deadbeef->pl_set_cursor (PL_SEARCH, new_cursor);
-            ddb_listview_draw_row (listview, new_cursor, NULL);
+            ddb_listview_redraw_row (listview, new_cursor);
             if (cursor != -1) {
-                ddb_listview_draw_row (listview, cursor, NULL);
+                ddb_listview_redraw_row (listview, cursor);
             }
         }
         ddb_listview_scroll_to (listview, new_cursor);
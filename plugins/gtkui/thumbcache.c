@@ -0,0 +1,343 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../deadbeef.h"
+#include "gtkui.h"
+#include "thumbcache.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(...)
+
+#define DEFAULT_BUDGET_MB 64
+
+// Accounted on top of the file size, so that a lot of empty negative entries still count
+#define ENTRY_OVERHEAD 256
+
+// Don't touch the entries which were used recently, to avoid a write per hit
+#define TOUCH_INTERVAL (60*60)
+
+// Only one loader writes at a time, the mutex just keeps the accounting sane
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t _cache_bytes = -1; // unknown until the first write
+
+typedef struct {
+    char *path;
+    time_t mtime;
+    int64_t size;
+} thumb_entry_t;
+
+static int64_t
+_budget (void) {
+    int mb = deadbeef->conf_get_int ("gtkui.thumbnail_cache_mb", DEFAULT_BUDGET_MB);
+    if (mb <= 0) {
+        return 0;
+    }
+    return (int64_t)mb * 1024 * 1024;
+}
+
+static int
+_cache_root (char *path, size_t size) {
+    const char *cache = deadbeef->get_system_dir (DDB_SYS_DIR_CACHE);
+    if (!cache || !*cache) {
+        return -1;
+    }
+    int n = snprintf (path, size, "%s/thumbnails", cache);
+    return n < 0 || n >= size ? -1 : 0;
+}
+
+static uint64_t
+_fnv1a (uint64_t hash, const void *data, size_t size) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int
+_thumb_path (char *path, size_t size, const char *fname, const struct stat *st, int width, int height) {
+    char root[PATH_MAX];
+    if (_cache_root (root, sizeof (root))) {
+        return -1;
+    }
+
+    int64_t mtime = st->st_mtime;
+    int64_t fsize = st->st_size;
+    int32_t dim[2] = { width, height };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = _fnv1a (hash, fname, strlen (fname) + 1);
+    hash = _fnv1a (hash, &mtime, sizeof (mtime));
+    hash = _fnv1a (hash, &fsize, sizeof (fsize));
+    hash = _fnv1a (hash, dim, sizeof (dim));
+
+    int n = snprintf (path, size, "%s/%02x/%016llx.png", root, (unsigned)(hash >> 56), (unsigned long long)hash);
+    return n < 0 || n >= size ? -1 : 0;
+}
+
+GdkPixbuf *
+thumbcache_load (const char *fname, const struct stat *st, int width, int height, int *negative) {
+    *negative = 0;
+    if (!_budget ()) {
+        return NULL;
+    }
+
+    char path[PATH_MAX];
+    if (_thumb_path (path, sizeof (path), fname, st, width, height)) {
+        return NULL;
+    }
+
+    struct stat thumb_st;
+    if (stat (path, &thumb_st)) {
+        return NULL;
+    }
+
+    GdkPixbuf *pixbuf = NULL;
+    if (thumb_st.st_size == 0) {
+        *negative = 1;
+    }
+    else {
+        pixbuf = gdk_pixbuf_new_from_file (path, NULL);
+        if (!pixbuf) {
+            trace ("thumbcache: removing broken thumbnail %s\n", path);
+            unlink (path);
+            return NULL;
+        }
+        // guard against hash collisions
+        const char *uri = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::URI");
+        if (!uri || strcmp (uri, fname)) {
+            trace ("thumbcache: %s belongs to another image\n", path);
+            g_object_unref (pixbuf);
+            return NULL;
+        }
+    }
+
+    // the mtime of the entry is its last use
+    if (time (NULL) - thumb_st.st_mtime > TOUCH_INTERVAL) {
+        utimes (path, NULL);
+    }
+
+    trace ("thumbcache: hit %s for %s %dx%d\n", path, fname, width, height);
+    return pixbuf;
+}
+
+static int64_t
+_entry_size (int64_t size) {
+    return size + ENTRY_OVERHEAD;
+}
+
+// Calls the callback for each file in the two-level cache directory
+static void
+_scan (const char *root, void (*callback)(const char *path, const struct stat *st, void *ctx), void *ctx) {
+    DIR *dir = opendir (root);
+    if (!dir) {
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir (dir))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char subdir_path[PATH_MAX];
+        if (snprintf (subdir_path, sizeof (subdir_path), "%s/%s", root, de->d_name) >= sizeof (subdir_path)) {
+            continue;
+        }
+        DIR *subdir = opendir (subdir_path);
+        if (!subdir) {
+            continue;
+        }
+        struct dirent *sde;
+        while ((sde = readdir (subdir))) {
+            if (sde->d_name[0] == '.') {
+                continue;
+            }
+            char path[PATH_MAX];
+            struct stat st;
+            if (snprintf (path, sizeof (path), "%s/%s", subdir_path, sde->d_name) < sizeof (path)
+                && !stat (path, &st) && S_ISREG (st.st_mode)) {
+                callback (path, &st, ctx);
+            }
+        }
+        closedir (subdir);
+    }
+    closedir (dir);
+}
+
+static void
+_sum_callback (const char *path, const struct stat *st, void *ctx) {
+    *(int64_t *)ctx += _entry_size (st->st_size);
+}
+
+typedef struct {
+    thumb_entry_t *entries;
+    size_t count;
+    size_t reserved;
+} entry_list_t;
+
+static void
+_list_callback (const char *path, const struct stat *st, void *ctx) {
+    entry_list_t *list = ctx;
+    if (list->count == list->reserved) {
+        size_t reserved = list->reserved ? list->reserved * 2 : 1024;
+        thumb_entry_t *entries = realloc (list->entries, reserved * sizeof (thumb_entry_t));
+        if (!entries) {
+            return;
+        }
+        list->entries = entries;
+        list->reserved = reserved;
+    }
+    char *p = strdup (path);
+    if (!p) {
+        return;
+    }
+    thumb_entry_t *e = &list->entries[list->count++];
+    e->path = p;
+    e->mtime = st->st_mtime;
+    e->size = _entry_size (st->st_size);
+}
+
+static int
+_entry_cmp (const void *a, const void *b) {
+    const thumb_entry_t *e1 = a;
+    const thumb_entry_t *e2 = b;
+    return e1->mtime < e2->mtime ? -1 : e1->mtime > e2->mtime;
+}
+
+// Remove the least recently used entries, until the cache takes 90% of the budget
+static int64_t
+_trim (const char *root, int64_t budget) {
+    entry_list_t list = {0};
+    _scan (root, _list_callback, &list);
+
+    int64_t total = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        total += list.entries[i].size;
+    }
+
+    qsort (list.entries, list.count, sizeof (thumb_entry_t), _entry_cmp);
+
+    int64_t target = budget / 10 * 9;
+    for (size_t i = 0; i < list.count; i++) {
+        if (total > target && !unlink (list.entries[i].path)) {
+            total -= list.entries[i].size;
+        }
+        free (list.entries[i].path);
+    }
+    free (list.entries);
+
+    trace ("thumbcache: trimmed to %lld bytes\n", (long long)total);
+    return total;
+}
+
+static int
+_mkdir_for (const char *path) {
+    char dir[PATH_MAX];
+    strcpy (dir, path);
+    char *slash = strrchr (dir, '/');
+    if (!slash) {
+        return -1;
+    }
+    *slash = 0;
+    if (!mkdir (dir, 0755) || errno == EEXIST) {
+        return 0;
+    }
+    // the thumbnails dir itself
+    char *parent_slash = strrchr (dir, '/');
+    if (!parent_slash) {
+        return -1;
+    }
+    *parent_slash = 0;
+    if (mkdir (dir, 0755) && errno != EEXIST) {
+        return -1;
+    }
+    *parent_slash = '/';
+    return mkdir (dir, 0755) && errno != EEXIST ? -1 : 0;
+}
+
+void
+thumbcache_save (const char *fname, const struct stat *st, int width, int height, GdkPixbuf *pixbuf) {
+    int64_t budget = _budget ();
+    if (!budget) {
+        return;
+    }
+
+    char root[PATH_MAX];
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (_cache_root (root, sizeof (root))
+        || _thumb_path (path, sizeof (path), fname, st, width, height)
+        || snprintf (tmp_path, sizeof (tmp_path), "%s.%d.part", path, (int)getpid ()) >= sizeof (tmp_path)
+        || _mkdir_for (path)) {
+        return;
+    }
+
+    // write to a temporary file, so that an interrupted write never leaves a truncated thumbnail
+    int res = -1;
+    if (pixbuf) {
+        char mtime[32];
+        snprintf (mtime, sizeof (mtime), "%lld", (long long)st->st_mtime);
+        if (gdk_pixbuf_save (pixbuf, tmp_path, "png", NULL, "tEXt::Thumb::URI", fname, "tEXt::Thumb::MTime", mtime, NULL)) {
+            res = 0;
+        }
+    }
+    else {
+        int fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            close (fd);
+            res = 0;
+        }
+    }
+
+    struct stat thumb_st;
+    if (res || stat (tmp_path, &thumb_st) || rename (tmp_path, path)) {
+        trace ("thumbcache: failed to write %s\n", path);
+        unlink (tmp_path);
+        return;
+    }
+
+    pthread_mutex_lock (&_mutex);
+    if (_cache_bytes < 0) {
+        int64_t total = 0;
+        _scan (root, _sum_callback, &total);
+        _cache_bytes = total;
+    }
+    else {
+        _cache_bytes += _entry_size (thumb_st.st_size);
+    }
+    if (_cache_bytes > budget) {
+        _cache_bytes = _trim (root, budget);
+    }
+    pthread_mutex_unlock (&_mutex);
+}
@@ -0,0 +1,45 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __THUMBCACHE_H
+#define __THUMBCACHE_H
+
+#include <sys/stat.h>
+#include <gtk/gtk.h>
+
+// On-disk cache of the scaled cover images, in $cache/thumbnails.
+// The entries are keyed by the source image path, mtime and size, and the requested size,
+// so a changed source image never hits a stale thumbnail.
+// The least recently used entries are removed when the cache grows over
+// gtkui.thumbnail_cache_mb megabytes (0 disables the cache).
+
+// Returns the cached thumbnail, or NULL.
+// If the source image is known to be undecodable, returns NULL and sets *negative to 1.
+GdkPixbuf *
+thumbcache_load (const char *fname, const struct stat *st, int width, int height, int *negative);
+
+// Store the scaled image, or a negative entry if pixbuf is NULL.
+void
+thumbcache_save (const char *fname, const struct stat *st, int width, int height, GdkPixbuf *pixbuf);
+
+#endif
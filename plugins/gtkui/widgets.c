@@ -35,6 +35,7 @@
 #include "../libparser/parser.h"
 #include "trkproperties.h"
 #include "coverart.h"
+#include "frameclock.h"
 #include "namedicons.h"
 #include "hotkeys.h" // for building action treeview
 #include "../../strdupa.h"
@@ -152,7 +153,7 @@ typedef struct {
 typedef struct {
     ddb_gtkui_widget_t base;
     GtkWidget *drawarea;
-    guint drawtimer;
+    frameclock_client_t *drawclock;
     float *samples;
     int nsamples;
     int resized;
@@ -163,7 +164,7 @@ typedef struct {
 typedef struct {
     ddb_gtkui_widget_t base;
     GtkWidget *drawarea;
-    guint drawtimer;
+    frameclock_client_t *drawclock;
 
     intptr_t mutex;
 
@@ -200,7 +201,7 @@ typedef struct {
 typedef struct {
     ddb_gtkui_widget_t base;
     GtkWidget *seekbar;
-    gint timer;
+    frameclock_client_t *clock;
     float last_songpos;
 } w_seekbar_t;
 
@@ -2157,9 +2158,9 @@ playlist_set_cursor (DdbListview *listview, DB_playItem_t *it) {
         int cursor = deadbeef->pl_get_cursor (PL_MAIN);
         if (new_cursor != cursor) {
             deadbeef->pl_set_cursor (PL_MAIN, new_cursor);
-            ddb_listview_draw_row (listview, new_cursor, NULL);
+            ddb_listview_redraw_row (listview, new_cursor);
             if (cursor != -1) {
-                ddb_listview_draw_row (listview, cursor, NULL);
+                ddb_listview_redraw_row (listview, cursor);
             }
         }
         ddb_listview_scroll_to (listview, new_cursor);
@@ -2804,9 +2805,9 @@ void
 w_scope_destroy (ddb_gtkui_widget_t *w) {
     w_scope_t *s = (w_scope_t *)w;
     deadbeef->vis_waveform_unlisten (w);
-    if (s->drawtimer) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
+    if (s->drawclock) {
+        frameclock_remove (s->drawclock);
+        s->drawclock = NULL;
     }
     if (s->surf) {
         cairo_surface_destroy (s->surf);
@@ -2822,11 +2823,10 @@ w_scope_destroy (ddb_gtkui_widget_t *w) {
     }
 }
 
-gboolean
+static void
 w_scope_draw_cb (void *data) {
     w_scope_t *s = data;
     gtk_widget_queue_draw (s->drawarea);
-    return TRUE;
 }
 
 static void
@@ -2977,11 +2977,9 @@ scope_expose_event (GtkWidget *widget, GdkEventExpose *event, gpointer user_data
 void
 w_scope_init (ddb_gtkui_widget_t *w) {
     w_scope_t *s = (w_scope_t *)w;
-    if (s->drawtimer) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
+    if (!s->drawclock) {
+        s->drawclock = frameclock_add (s->drawarea, 30, FRAMECLOCK_PLAYBACK, w_scope_draw_cb, w);
     }
-    s->drawtimer = g_timeout_add (33, w_scope_draw_cb, w);
 }
 
 ddb_gtkui_widget_t *
@@ -3012,9 +3010,9 @@ void
 w_spectrum_destroy (ddb_gtkui_widget_t *w) {
     w_spectrum_t *s = (w_spectrum_t *)w;
     deadbeef->vis_spectrum_unlisten (w);
-    if (s->drawtimer) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
+    if (s->drawclock) {
+        frameclock_remove (s->drawclock);
+        s->drawclock = NULL;
     }
     if (s->surf) {
         cairo_surface_destroy (s->surf);
@@ -3032,11 +3030,10 @@ w_spectrum_destroy (ddb_gtkui_widget_t *w) {
     }
 }
 
-gboolean
+static void
 w_spectrum_draw_cb (void *data) {
     w_spectrum_t *s = data;
     gtk_widget_queue_draw (s->drawarea);
-    return TRUE;
 }
 
 
@@ -3056,24 +3053,6 @@ spectrum_audio_listener (void *ctx, const ddb_audio_data_t *data) {
     deadbeef->mutex_unlock (w->mutex);
 }
 
-static void
-_spectrum_run (ddb_gtkui_widget_t *w) {
-    w_spectrum_t *s = (w_spectrum_t *)w;
-    if (s->drawtimer > 0) {
-        return;
-    }
-    s->drawtimer = g_timeout_add (33, w_spectrum_draw_cb, w);
-}
-
-static void
-_spectrum_stop (ddb_gtkui_widget_t *w) {
-    w_spectrum_t *s = (w_spectrum_t *)w;
-    if (s->drawtimer > 0) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
-    }
-}
-
 static gboolean
 spectrum_draw (GtkWidget *widget, cairo_t *cr, gpointer user_data) {
     w_spectrum_t *w = user_data;
@@ -3138,42 +3117,12 @@ spectrum_expose_event (GtkWidget *widget, GdkEventExpose *event, gpointer user_d
 void
 w_spectrum_init (ddb_gtkui_widget_t *w) {
     w_spectrum_t *s = (w_spectrum_t *)w;
-    if (s->drawtimer) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
-    }
-    ddb_playback_state_t playback_state = deadbeef->get_output ()->state ();
-
-    if (playback_state == DDB_PLAYBACK_STATE_PLAYING) { 
-        _spectrum_run (w);
+    // the frame clock only runs the analyzer during playback
+    if (!s->drawclock) {
+        s->drawclock = frameclock_add (s->drawarea, 30, FRAMECLOCK_PLAYBACK, w_spectrum_draw_cb, w);
     }
 }
 
-static int
-w_spectrum_message (ddb_gtkui_widget_t *w, uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
-    switch (id) {
-    case DB_EV_SONGCHANGED: {
-            ddb_event_trackchange_t *ev = (ddb_event_trackchange_t *)ctx;
-            if (!ev->to) {
-                _spectrum_stop (w);
-            }
-        }
-        break;
-    case DB_EV_SONGSTARTED:
-        _spectrum_run (w);
-        break;
-    case DB_EV_PAUSED:
-        if (p1) {
-            _spectrum_stop (w);
-        }
-        else {
-            _spectrum_run (w);
-        }
-        break;
-    }
-    return 0;
-}
-
 ddb_gtkui_widget_t *
 w_spectrum_create (void) {
     w_spectrum_t *w = malloc (sizeof (w_spectrum_t));
@@ -3182,7 +3131,6 @@ w_spectrum_create (void) {
     w->base.widget = gtk_event_box_new ();
     w->base.init = w_spectrum_init;
     w->base.destroy  = w_spectrum_destroy;
-    w->base.message = w_spectrum_message;
     w->drawarea = gtk_drawing_area_new ();
     gtk_widget_show (w->drawarea);
     gtk_container_add (GTK_CONTAINER (w->base.widget), w->drawarea);
@@ -3894,8 +3842,8 @@ redraw_seekbar_cb (gpointer data) {
     return FALSE;
 }
 
-static gboolean
-seekbar_frameupdate (gpointer data) {
+static void
+seekbar_frameupdate (void *data) {
     w_seekbar_t *w = data;
     DB_output_t *output = deadbeef->get_output ();
     DB_playItem_t *track = deadbeef->streamer_get_playing_track ();
@@ -3919,25 +3867,20 @@ seekbar_frameupdate (gpointer data) {
     if (track) {
         deadbeef->pl_item_unref (track);
     }
-    return TRUE;
 }
 
 static void
 w_seekbar_init (ddb_gtkui_widget_t *base) {
     w_seekbar_t *w = (w_seekbar_t *)base;
-    if (w->timer) {
-        g_source_remove (w->timer);
-        w->timer = 0;
+    if (!w->clock) {
+        w->clock = frameclock_add (w->seekbar, 0, FRAMECLOCK_PLAYBACK, seekbar_frameupdate, w);
     }
-
-    w->timer = g_timeout_add (1000/gtkui_get_gui_refresh_rate (), seekbar_frameupdate, w);
 }
 
 static int
 w_seekbar_message (ddb_gtkui_widget_t *w, uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
     switch (id) {
     case DB_EV_CONFIGCHANGED:
-        w_seekbar_init (w);
         if (ctx) {
             char *conf_str = (char *)ctx;
             if (gtkui_bar_override_conf(conf_str) || gtkui_bar_colors_conf(conf_str)) {
@@ -3955,9 +3898,9 @@ w_seekbar_message (ddb_gtkui_widget_t *w, uint32_t id, uintptr_t ctx, uint32_t p
 static void
 w_seekbar_destroy (ddb_gtkui_widget_t *wbase) {
     w_seekbar_t *w = (w_seekbar_t *)wbase;
-    if (w->timer) {
-        g_source_remove (w->timer);
-        w->timer = 0;
+    if (w->clock) {
+        frameclock_remove (w->clock);
+        w->clock = NULL;
     }
 }
 
@@ -26,10 +26,19 @@
 #include <jansson.h>
 #include <limits.h>
 #include "medialib.h"
+#include "../../utf8.h"
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#ifdef __linux__
+#define ML_WATCH 1
+#include <dirent.h>
+#include <errno.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 //#define FILTER_PERF 1 // measure / log file add filtering performance
 
@@ -53,8 +62,7 @@ typedef struct ml_string_s {
     struct ml_string_s *bucket_next;
     struct ml_string_s *next;
 
-    ddb_medialib_item_t *coll_item; // The item associated with collection string, used while building a list
-    ddb_medialib_item_t *coll_item_tail; // Tail of the children list of coll_item, used while building a list
+    uint32_t query_node; // The query node associated with collection string, used while building a query
 } ml_string_t;
 
 typedef struct ml_entry_s {
@@ -64,8 +72,11 @@ typedef struct ml_entry_s {
     ml_string_t *artist;
     ml_string_t *album;
     ml_string_t *genre;
+    ml_string_t *album_title;
     ml_string_t *folder;
+    struct ml_tree_node_s *folder_node;
     ml_string_t *track_uri;
+    DB_playItem_t *it; // the playlist holds the reference
     struct ml_entry_s *next;
     struct ml_entry_s *bucket_next;
 } ml_entry_t;
@@ -90,12 +101,14 @@ typedef struct ml_tree_node_s {
     ml_collection_item_t *items;
     struct ml_tree_node_s *next;
     struct ml_tree_node_s *children;
+    struct ml_tree_node_s *parent;
 } ml_tree_node_t;
 
 typedef struct {
     // Plain list of all tracks in the entire collection
     // The purpose is to hold references to all metadata strings, used by the DB
     ml_entry_t *tracks;
+    ml_entry_t *tracks_tail;
 
     // hash formed by filename pointer
     // this hash purpose is to quickly check whether the filename is in the library already
@@ -106,6 +119,9 @@ typedef struct {
     ml_collection_t albums;
     ml_collection_t artists;
     ml_collection_t genres;
+
+    // album names, only used for filtering
+    ml_collection_t album_titles;
     //collection_t folders;
 
     // for the folders, a tree structure is used
@@ -126,6 +142,17 @@ typedef struct {
     struct medialib_source_s *source;
 } ml_filter_state_t;
 
+#if ML_WATCH
+#define ML_WATCH_HASH_SIZE 1024
+
+// inotify watch descriptor of a folder
+typedef struct ml_watch_s {
+    int wd;
+    char *path;
+    struct ml_watch_s *next;
+} ml_watch_t;
+#endif
+
 typedef struct medialib_source_s {
     dispatch_queue_t scanner_queue;
     dispatch_queue_t sync_queue;
@@ -150,6 +177,27 @@ typedef struct medialib_source_s {
     int filter_id;
     ml_filter_state_t ml_filter_state;
     char source_conf_prefix[100];
+
+    // cached query results, only access on sync_queue
+    struct ml_query_s *queries;
+    struct ml_query_key_s *query_keys; // ids of the queries built from the current index
+    int64_t query_id;
+    uint64_t query_use_counter;
+
+#if ML_WATCH
+    // Folder watching, the changes are collected for a short time, and then applied on the scanner_queue.
+    // The following properties should only be accessed on the watch_queue
+    dispatch_queue_t watch_queue;
+    dispatch_source_t watch_source;
+    dispatch_source_t rescan_timer;
+    int watch_fd;
+    ml_watch_t *watch_hash[ML_WATCH_HASH_SIZE];
+    char **dirty_paths;
+    size_t dirty_count;
+    size_t dirty_reserved;
+    int watch_flush_scheduled;
+    int64_t watch_generation;
+#endif
 } medialib_source_t;
 
 typedef struct {
@@ -237,12 +285,71 @@ ml_reg_col (ml_collection_t *coll, const char /* nonnull */ *c, DB_playItem_t *i
         }
         coll->count++;
     }
+    else {
+        s = hash_find (coll->hash, c);
+    }
     if (need_unref) {
         deadbeef->metacache_remove_string (c);
     }
     return s;
 }
 
+/// Removes the track from the collection string, and the string from the collection when it has no tracks left.
+/// The unknown artist / album / genre strings are kept, the same as after a full reindex.
+static void
+ml_unreg_col (ml_collection_t *coll, ml_string_t *s, DB_playItem_t *it) {
+    ml_collection_item_t *prev = NULL;
+    for (ml_collection_item_t *item = s->items; item; prev = item, item = item->next) {
+        if (item->it == it) {
+            if (prev) {
+                prev->next = item->next;
+            }
+            else {
+                s->items = item->next;
+            }
+            if (s->items_tail == item) {
+                s->items_tail = prev;
+            }
+            s->items_count--;
+            deadbeef->pl_item_unref (item->it);
+            free (item);
+            break;
+        }
+    }
+
+    if (s->items || !strcmp (s->text, "<?>")) {
+        return;
+    }
+
+    uint32_t h = hash_for_ptr ((void *)s->text);
+    for (ml_string_t **b = &coll->hash[h]; *b; b = &(*b)->bucket_next) {
+        if (*b == s) {
+            *b = s->bucket_next;
+            break;
+        }
+    }
+
+    ml_string_t *prev_s = NULL;
+    for (ml_string_t *c = coll->head; c; prev_s = c, c = c->next) {
+        if (c == s) {
+            if (prev_s) {
+                prev_s->next = s->next;
+            }
+            else {
+                coll->head = s->next;
+            }
+            if (coll->tail == s) {
+                coll->tail = prev_s;
+            }
+            coll->count--;
+            break;
+        }
+    }
+
+    deadbeef->metacache_remove_string (s->text);
+    free (s);
+}
+
 static void
 ml_free_col (ml_collection_t *coll) {
     ml_string_t *s = coll->head;
@@ -268,7 +375,8 @@ ml_free_col (ml_collection_t *coll) {
 }
 
 // path is relative to root
-static void
+// returns the node which the item was added to
+static ml_tree_node_t *
 ml_reg_item_in_folder (ml_tree_node_t *node, const char *path, DB_playItem_t *it) {
     if (*path == 0) {
         // leaf -- add to the node
@@ -285,7 +393,7 @@ ml_reg_item_in_folder (ml_tree_node_t *node, const char *path, DB_playItem_t *it
         else {
             node->items = item;
         }
-        return;
+        return node;
     }
 
     const char *slash = strchr (path, '/');
@@ -303,13 +411,13 @@ ml_reg_item_in_folder (ml_tree_node_t *node, const char *path, DB_playItem_t *it
         if (!strncmp (c->text, path, len)) {
             // found, recurse
             path += len + 1;
-            ml_reg_item_in_folder (c, path, it);
-            return;
+            return ml_reg_item_in_folder (c, path, it);
         }
     }
 
     // not found, start new branch
     ml_tree_node_t *n = calloc (1, sizeof (ml_tree_node_t));
+    n->parent = node;
     ml_tree_node_t *tail = NULL;
     for (tail = node->children; tail && tail->next; tail = tail->next);
     if (tail) {
@@ -325,7 +433,7 @@ ml_reg_item_in_folder (ml_tree_node_t *node, const char *path, DB_playItem_t *it
     path += len + 1;
 
     n->text = deadbeef->metacache_add_string (temp);
-    ml_reg_item_in_folder (n, path, it);
+    return ml_reg_item_in_folder (n, path, it);
 }
 
 static void
@@ -349,20 +457,58 @@ ml_free_tree (ml_tree_node_t *node) {
     free (node);
 }
 
+/// Removes the track from the folder node, and the folders which become empty
+static void
+ml_unreg_item_in_folder (ml_tree_node_t *node, DB_playItem_t *it) {
+    ml_collection_item_t *prev = NULL;
+    for (ml_collection_item_t *item = node->items; item; prev = item, item = item->next) {
+        if (item->it == it) {
+            if (prev) {
+                prev->next = item->next;
+            }
+            else {
+                node->items = item->next;
+            }
+            deadbeef->pl_item_unref (item->it);
+            free (item);
+            break;
+        }
+    }
+
+    while (node->parent && !node->items && !node->children) {
+        ml_tree_node_t *parent = node->parent;
+        for (ml_tree_node_t **c = &parent->children; *c; c = &(*c)->next) {
+            if (*c == node) {
+                *c = node->next;
+                break;
+            }
+        }
+        ml_free_tree (node);
+        node = parent;
+    }
+}
+
 static void
 ml_notify_listeners (medialib_source_t *source, int event);
 
 static void
 ml_index (medialib_source_t *source, ddb_playlist_t *plt);
 
+static void
+ml_query_cache_clear (medialib_source_t *source);
+
 static void
 ml_free_db (medialib_source_t *source) {
     fprintf (stderr, "clearing index...\n");
 
+    // the cached queries point to the tracks and strings of the index
+    ml_query_cache_clear (source);
+
     // NOTE: Currently this is called from ml_index, which is executed on sync_queue
     ml_free_col(&source->db.albums);
     ml_free_col(&source->db.artists);
     ml_free_col(&source->db.genres);
+    ml_free_col(&source->db.album_titles);
     //    ml_free_col(&db.folders);
     ml_free_col(&source->db.track_uris);
 
@@ -408,188 +554,244 @@ _ml_get_music_paths (medialib_source_t *source) {
     return json;
 }
 
-// This should be called only on pre-existing ml playlist.
-// Subsequent indexing should be done on the fly, using fileadd listener.
-static void
-ml_index (medialib_source_t *source, ddb_playlist_t *plt) {
-    ml_free_db(source);
+typedef struct {
+    // NOTE: these are searched by content when creating item trees,
+    // so the values must be the same, as the ones that actually get to the collections.
+    const char *unknown_artist;
+    const char *unknown_album;
+    const char *unknown_genre;
+
+    int has_unknown_artist;
+    int has_unknown_album;
+    int has_unknown_genre;
+} ml_index_context_t;
+
+/// Adds the track to the index.
+/// Returns NULL if the track is not located in any of the music folders, and should be removed from the library.
+static ml_entry_t *
+ml_index_track (medialib_source_t *source, DB_playItem_t *it, ml_index_context_t *ctx) {
+    char folder[PATH_MAX];
 
-    fprintf (stderr, "building index...\n");
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
 
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
+    const char *title = deadbeef->pl_find_meta (it, "title");
+    const char *artist = deadbeef->pl_find_meta (it, "artist");
 
-    ml_entry_t *tail = NULL;
+    if (!artist) {
+        artist = ctx->unknown_artist;
+    }
 
-    char folder[PATH_MAX];
+    if (artist == ctx->unknown_artist) {
+        ctx->has_unknown_artist = 1;
+    }
 
-    source->db.folders_tree = calloc (1, sizeof (ml_tree_node_t));
-    source->db.folders_tree->text = deadbeef->metacache_add_string ("");
+    // find relative uri, or discard from library
+    const char *reluri = NULL;
+    for (int i = 0; i < json_array_size(source->musicpaths_json); i++) {
+        json_t *data = json_array_get (source->musicpaths_json, i);
+        if (!json_is_string (data)) {
+            break;
+        }
+        const char *musicdir = json_string_value (data);
+        if (!strncmp (musicdir, uri, strlen (musicdir))) {
+            reluri = uri + strlen (musicdir);
+            if (*reluri == '/') {
+                reluri++;
+            }
+            break;
+        }
+    }
+    if (!reluri) {
+        return NULL;
+    }
 
-    int has_unknown_artist = 0;
-    int has_unknown_album = 0;
-    int has_unknown_genre = 0;
+    ml_entry_t *en = calloc (1, sizeof (ml_entry_t));
 
-    // NOTE: these are searched by content when creating item trees,
-    // so the values must be the same, as the ones that actually get to the collections.
-    const char *unknown_artist = deadbeef->metacache_add_string("<?>");
-    const char *unknown_album = deadbeef->metacache_add_string("<?>");
-    const char *unknown_genre = deadbeef->metacache_add_string("<?>");
+    // Get a combined cached artist/album string
+    const char *album = deadbeef->pl_find_meta (it, "album");
+    if (!album) {
+        ctx->has_unknown_album = 1;
+    }
+    else {
+        en->album_title = ml_reg_col (&source->db.album_titles, album, it);
+    }
 
-    DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
-    while (it && !source->scanner_terminate) {
-        ml_entry_t *en = calloc (1, sizeof (ml_entry_t));
+    char artistalbum[1000] = "";
+    ddb_tf_context_t tf_ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
+        .it = it,
+    };
 
-        const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    deadbeef->tf_eval (&tf_ctx, artist_album_id_bc, artistalbum, sizeof (artistalbum));
+    album = deadbeef->metacache_add_string (artistalbum);
 
-        const char *title = deadbeef->pl_find_meta (it, "title");
-        const char *artist = deadbeef->pl_find_meta (it, "artist");
+    const char *genre = deadbeef->pl_find_meta (it, "genre");
 
-        if (!artist) {
-            artist = unknown_artist;
-        }
+    if (!genre) {
+        genre = ctx->unknown_genre;
+    }
 
-        if (artist == unknown_artist) {
-            has_unknown_artist = 1;
-        }
+    if (genre == ctx->unknown_genre) {
+        ctx->has_unknown_genre = 1;
+    }
 
-        // find relative uri, or discard from library
-        const char *reluri = NULL;
-        for (int i = 0; i < json_array_size(source->musicpaths_json); i++) {
-            json_t *data = json_array_get (source->musicpaths_json, i);
-            if (!json_is_string (data)) {
-                break;
-            }
-            const char *musicdir = json_string_value (data);
-            if (!strncmp (musicdir, uri, strlen (musicdir))) {
-                reluri = uri + strlen (musicdir);
-                if (*reluri == '/') {
-                    reluri++;
-                }
-                break;
-            }
-        }
-        if (!reluri) {
-            // uri doesn't match musicdir, remove from db
-            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
-            deadbeef->plt_remove_item (plt, it);
-            deadbeef->pl_item_unref (it);
-            it = next;
-            free (en);
-            continue;
-        }
-        // Get a combined cached artist/album string
-        const char *album = deadbeef->pl_find_meta (it, "album");
-        if (!album) {
-            has_unknown_album = 1;
-        }
+    ml_string_t *alb = ml_reg_col (&source->db.albums, album, it);
 
-        char artistalbum[1000] = "";
-        ddb_tf_context_t ctx = {
-            ._size = sizeof (ddb_tf_context_t),
-            .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-            .it = it,
-        };
+    deadbeef->metacache_remove_string (album);
+    album = NULL;
 
-        deadbeef->tf_eval (&ctx, artist_album_id_bc, artistalbum, sizeof (artistalbum));
-        album = deadbeef->metacache_add_string (artistalbum);
+    ml_string_t *art = ml_reg_col (&source->db.artists, artist, it);
+    ml_string_t *gnr = ml_reg_col (&source->db.genres, genre, it);
 
-        const char *genre = deadbeef->pl_find_meta (it, "genre");
+    ml_cached_string_t *cs = calloc (1, sizeof (ml_cached_string_t));
+    cs->s = deadbeef->metacache_add_string (uri);
+    cs->next = source->db.cached_strings;
 
-        if (!genre) {
-            genre = unknown_genre;
-        }
+    ml_string_t *trkuri = ml_reg_col (&source->db.track_uris, cs->s, it);
+    free(cs);
+    cs = NULL;
 
-        if (genre == unknown_genre) {
-            has_unknown_genre = 1;
-        }
+    char *fn = strrchr (reluri, '/');
+    ml_string_t *fld = NULL;
+    if (fn) {
+        memcpy (folder, reluri, fn-reluri);
+        folder[fn-reluri] = 0;
+    }
+    else {
+        strcpy (folder, "/");
+    }
+    const char *s = deadbeef->metacache_add_string (folder);
+    //fld = ml_reg_col (&db.folders, s, it);
 
-        ml_string_t *alb = ml_reg_col (&source->db.albums, album, it);
+    // add to tree
+    en->folder_node = ml_reg_item_in_folder (source->db.folders_tree, s, it);
 
-        deadbeef->metacache_remove_string (album);
-        album = NULL;
+    deadbeef->metacache_remove_string (s);
 
-        ml_string_t *art = ml_reg_col (&source->db.artists, artist, it);
-        ml_string_t *gnr = ml_reg_col (&source->db.genres, genre, it);
+    // uri and title are not indexed, only a part of track list,
+    // that's why they have an extra ref for each entry
+    deadbeef->metacache_add_string (uri);
+    en->file = uri;
+    if (title) {
+        deadbeef->metacache_add_string (title);
+    }
+    if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
+        en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+    }
+    else {
+        en->subtrack = -1;
+    }
+    en->title = title;
+    en->artist = art;
+    en->album = alb;
+    en->genre = gnr;
+    en->folder = fld;
+    en->track_uri = trkuri;
+    en->it = it;
 
-        ml_cached_string_t *cs = calloc (1, sizeof (ml_cached_string_t));
-        cs->s = deadbeef->metacache_add_string (uri);
-        cs->next = source->db.cached_strings;
+    if (source->db.tracks_tail) {
+        source->db.tracks_tail->next = en;
+        source->db.tracks_tail = en;
+    }
+    else {
+        source->db.tracks = source->db.tracks_tail = en;
+    }
 
-        ml_string_t *trkuri = ml_reg_col (&source->db.track_uris, cs->s, it);
-        free(cs);
-        cs = NULL;
+    // add to the hash table
+    // at this point, we only have unique pointers, and don't need a duplicate check
+    uint32_t hash = hash_for_ptr ((void *)en->file);
+    en->bucket_next = source->db.filename_hash[hash];
+    source->db.filename_hash[hash] = en;
 
-        char *fn = strrchr (reluri, '/');
-        ml_string_t *fld = NULL;
-        if (fn) {
-            memcpy (folder, reluri, fn-reluri);
-            folder[fn-reluri] = 0;
-        }
-        else {
-            strcpy (folder, "/");
+    return en;
+}
+
+/// Removes the track entry from the collections, the folder tree and the filename hash.
+/// The caller is responsible for removing the entry from the track list.
+static void
+ml_unindex_entry (medialib_source_t *source, ml_entry_t *en) {
+    if (en->album_title) {
+        ml_unreg_col (&source->db.album_titles, en->album_title, en->it);
+    }
+    ml_unreg_col (&source->db.albums, en->album, en->it);
+    ml_unreg_col (&source->db.artists, en->artist, en->it);
+    ml_unreg_col (&source->db.genres, en->genre, en->it);
+    ml_unreg_col (&source->db.track_uris, en->track_uri, en->it);
+    ml_unreg_item_in_folder (en->folder_node, en->it);
+
+    uint32_t hash = hash_for_ptr ((void *)en->file);
+    for (ml_entry_t **b = &source->db.filename_hash[hash]; *b; b = &(*b)->bucket_next) {
+        if (*b == en) {
+            *b = en->bucket_next;
+            break;
         }
-        const char *s = deadbeef->metacache_add_string (folder);
-        //fld = ml_reg_col (&db.folders, s, it);
+    }
 
-        // add to tree
-        ml_reg_item_in_folder (source->db.folders_tree, s, it);
+    if (en->title) {
+        deadbeef->metacache_remove_string (en->title);
+    }
+    if (en->file) {
+        deadbeef->metacache_remove_string (en->file);
+    }
+    free (en);
+}
 
-        deadbeef->metacache_remove_string (s);
+static void
+ml_index_context_init (ml_index_context_t *ctx) {
+    memset (ctx, 0, sizeof (ml_index_context_t));
+    ctx->unknown_artist = deadbeef->metacache_add_string("<?>");
+    ctx->unknown_album = deadbeef->metacache_add_string("<?>");
+    ctx->unknown_genre = deadbeef->metacache_add_string("<?>");
+}
 
-        // uri and title are not indexed, only a part of track list,
-        // that's why they have an extra ref for each entry
-        deadbeef->metacache_add_string (uri);
-        en->file = uri;
-        if (title) {
-            deadbeef->metacache_add_string (title);
-        }
-        if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
-            en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
-        }
-        else {
-            en->subtrack = -1;
-        }
-        en->title = title;
-        en->artist = art;
-        en->album = alb;
-        en->genre = gnr;
-        en->folder = fld;
-        en->track_uri = trkuri;
+/// Adds unknown artist / album / genre, if necessary, and releases the context
+static void
+ml_index_context_finish (medialib_source_t *source, ml_index_context_t *ctx) {
+    if (!ctx->has_unknown_artist) {
+        ml_reg_col (&source->db.artists, ctx->unknown_artist, NULL);
+    }
+    if (!ctx->has_unknown_album) {
+        ml_reg_col (&source->db.albums, ctx->unknown_album, NULL);
+    }
+    if (!ctx->has_unknown_genre) {
+        ml_reg_col (&source->db.genres, ctx->unknown_genre, NULL);
+    }
 
-        if (tail) {
-            tail->next = en;
-            tail = en;
-        }
-        else {
-            tail = source->db.tracks = en;
-        }
+    deadbeef->metacache_remove_string (ctx->unknown_artist);
+    deadbeef->metacache_remove_string (ctx->unknown_album);
+    deadbeef->metacache_remove_string (ctx->unknown_genre);
+}
+
+// This should be called only on pre-existing ml playlist.
+// Subsequent indexing should be done on the fly, using fileadd listener.
+static void
+ml_index (medialib_source_t *source, ddb_playlist_t *plt) {
+    ml_free_db(source);
+
+    fprintf (stderr, "building index...\n");
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    source->db.folders_tree = calloc (1, sizeof (ml_tree_node_t));
+    source->db.folders_tree->text = deadbeef->metacache_add_string ("");
 
-        // add to the hash table
-        // at this point, we only have unique pointers, and don't need a duplicate check
-        uint32_t hash = hash_for_ptr ((void *)en->file);
-        en->bucket_next = source->db.filename_hash[hash];
-        source->db.filename_hash[hash] = en;
+    ml_index_context_t ctx;
+    ml_index_context_init (&ctx);
 
+    DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+    while (it && !source->scanner_terminate) {
         DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        if (!ml_index_track (source, it, &ctx)) {
+            // uri doesn't match musicdir, remove from db
+            deadbeef->plt_remove_item (plt, it);
+        }
         deadbeef->pl_item_unref (it);
         it = next;
     }
 
-    // Add unknown artist / album / genre, if necessary
-    if (!has_unknown_artist) {
-        ml_reg_col (&source->db.artists, unknown_artist, NULL);
-    }
-    if (!has_unknown_album) {
-        ml_reg_col (&source->db.albums, unknown_album, NULL);
-    }
-    if (!has_unknown_genre) {
-        ml_reg_col (&source->db.genres, unknown_genre, NULL);
-    }
-
-    deadbeef->metacache_remove_string (unknown_artist);
-    deadbeef->metacache_remove_string (unknown_album);
-    deadbeef->metacache_remove_string (unknown_genre);
+    ml_index_context_finish (source, &ctx);
 
     int nalb = 0;
     int nart = 0;
@@ -695,94 +897,615 @@ _status_callback (ddb_insert_file_result_t result, const char *fname, void *user
     return 0;
 }
 
-static void
-scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf) {
-    char plpath[PATH_MAX];
-    snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
-
-    _ml_load_playlist(source, plpath);
-
-    struct timeval tm1, tm2;
-
-    source->_ml_state = DDB_MEDIASOURCE_STATE_SCANNING;
-    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
-
-    gettimeofday (&tm1, NULL);
+#pragma mark - file system watching
 
-    ddb_playlist_t *plt = deadbeef->plt_alloc("medialib");
-    // doesn't need to be protected by mutex -- this is only supposed to be accessed on the scan thread
-    source->ml_filter_state.plt = plt;
+static void
+ml_refresh (ddb_mediasource_source_t _source);
 
-    for (int i = 0; i < conf.medialib_paths_count; i++) {
-        const char *musicdir = conf.medialib_paths[i];
-        printf ("adding dir: %s\n", musicdir);
-        // update & index the cloned playlist
-        deadbeef->plt_insert_dir3 (-1, plt, NULL, musicdir, &source->scanner_terminate, _status_callback, NULL);
-    }
+#if ML_WATCH
 
-    source->ml_filter_state.plt = NULL;
+#define ML_WATCH_MASK (IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+#define ML_WATCH_APPLY_DELAY_SEC 2
 
-    source->_ml_state = DDB_MEDIASOURCE_STATE_INDEXING;
-    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
+static uint32_t
+_ml_watch_hash (int wd) {
+    return (uint32_t)wd & (ML_WATCH_HASH_SIZE-1);
+}
 
-    // set current time as timestamp
-    time_t timestamp = time(NULL);
-    dispatch_sync(source->sync_queue, ^{
-        char stimestamp[100];
-        snprintf (stimestamp, sizeof (stimestamp), "%lld", (int64_t)timestamp);
-        ddb_playItem_t *it = deadbeef->plt_get_head_item (plt, PL_MAIN);
-        while (it) {
-            deadbeef->pl_replace_meta (it, ":MEDIALIB_SCAN_TIME", stimestamp);
-            ddb_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
-            deadbeef->pl_item_unref (it);
-            it = next;
+static ml_watch_t *
+_ml_watch_find (medialib_source_t *source, int wd) {
+    for (ml_watch_t *w = source->watch_hash[_ml_watch_hash (wd)]; w; w = w->next) {
+        if (w->wd == wd) {
+            return w;
         }
-    });
-
-    if (!source->disable_file_operations) {
-        deadbeef->plt_save (plt, NULL, NULL, plpath, NULL, NULL, NULL);
     }
+    return NULL;
+}
 
-    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_CONTENT_DID_CHANGE);
-
-    gettimeofday (&tm2, NULL);
-    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (source->ml_playlist, PL_MAIN));
-
-    source->_ml_state = DDB_MEDIASOURCE_STATE_SAVING;
-    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
-
-    // update the current ml playlist and index transactionally
-    dispatch_sync(source->sync_queue, ^{
-        if (source->ml_playlist) {
-            deadbeef->plt_free (source->ml_playlist);
+static void
+_ml_watch_remove (medialib_source_t *source, int wd) {
+    ml_watch_t **pw = &source->watch_hash[_ml_watch_hash (wd)];
+    while (*pw) {
+        if ((*pw)->wd == wd) {
+            ml_watch_t *w = *pw;
+            *pw = w->next;
+            free (w->path);
+            free (w);
+            return;
         }
-        source->ml_playlist = plt;
-        ml_index (source, source->ml_playlist);
-    });
-
-    free_medialib_paths (conf.medialib_paths, conf.medialib_paths_count);
-
-    source->_ml_state = DDB_MEDIASOURCE_STATE_IDLE;
-    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
+        pw = &(*pw)->next;
+    }
 }
 
-// NOTE: make sure to run on sync_queue
-/// Returns 1 for the files which need to be included in the scan, based on their timestamp and metadata
+/// Watch the folder and all of its subfolders, returns -1 when out of watches
 static int
-ml_filter_int (ddb_file_found_data_t *data, time_t mtime, medialib_source_t *source) {
-    int res = 0;
-
-    const char *s = deadbeef->metacache_get_string (data->filename);
-    if (!s) {
+_ml_watch_add_recursive (medialib_source_t *source, const char *path) {
+    int wd = inotify_add_watch (source->watch_fd, path, ML_WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC || errno == ENOMEM) {
+            fprintf (stderr, "medialib: failed to watch %s: %s\n", path, strerror (errno));
+            return -1;
+        }
         return 0;
     }
 
-    uint32_t hash = hash_for_ptr((void *)s);
-
-    if (!source->db.filename_hash[hash]) {
-        deadbeef->metacache_remove_string (s);
-        return 0;
+    // the same folder may come again after being moved, keep the new path
+    ml_watch_t *w = _ml_watch_find (source, wd);
+    if (w) {
+        free (w->path);
+    }
+    else {
+        w = calloc (1, sizeof (ml_watch_t));
+        w->wd = wd;
+        uint32_t h = _ml_watch_hash (wd);
+        w->next = source->watch_hash[h];
+        source->watch_hash[h] = w;
+    }
+    w->path = strdup (path);
+
+    DIR *dir = opendir (path);
+    if (!dir) {
+        return 0;
+    }
+    int res = 0;
+    struct dirent *de;
+    char subdir[PATH_MAX];
+    while (!res && (de = readdir (dir))) {
+        if (de->d_name[0] == '.' && (!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2]))) {
+            continue;
+        }
+        if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        snprintf (subdir, sizeof (subdir), "%s/%s", path, de->d_name);
+        if (de->d_type == DT_UNKNOWN) {
+            // same as the scanner, don't follow symlinks
+            struct stat st;
+            if (lstat (subdir, &st) || !S_ISDIR (st.st_mode)) {
+                continue;
+            }
+        }
+        res = _ml_watch_add_recursive (source, subdir);
+    }
+    closedir (dir);
+    return res;
+}
+
+// Sort order where a folder is immediately followed by its contents
+static int
+_ml_path_cmp (const void *a, const void *b) {
+    const unsigned char *s1 = *(const unsigned char **)a;
+    const unsigned char *s2 = *(const unsigned char **)b;
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    int c1 = *s1 == '/' ? 1 : *s1 ? *s1 + 1 : 0;
+    int c2 = *s2 == '/' ? 1 : *s2 ? *s2 + 1 : 0;
+    return c1 - c2;
+}
+
+/// Returns 1 if the uri is one of the changed paths, or is located in one of the changed folders
+static int
+_ml_path_is_changed (const char *uri, char **paths, size_t count) {
+    char prefix[PATH_MAX];
+    size_t len = strlen (uri);
+    if (len >= sizeof (prefix)) {
+        return 0;
+    }
+    memcpy (prefix, uri, len + 1);
+    const char *key = prefix;
+    for (;;) {
+        if (bsearch (&key, paths, count, sizeof (char *), _ml_path_cmp)) {
+            return 1;
+        }
+        char *slash = strrchr (prefix, '/');
+        if (!slash || slash == prefix) {
+            return 0;
+        }
+        *slash = 0;
+    }
+}
+
+/// Rescan the changed paths, and replace the corresponding tracks in the medialib playlist.
+/// Runs on scanner_queue.
+static void
+_ml_apply_changes (medialib_source_t *source, char **paths, size_t count) {
+    __block int cancel = 0;
+    dispatch_sync(source->sync_queue, ^{
+        // a full rescan is pending, or the source is going away
+        cancel = source->scanner_terminate || !source->enabled || !source->ml_playlist;
+    });
+    if (cancel) {
+        return;
+    }
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    ddb_playlist_t *plt = deadbeef->plt_alloc("medialib");
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+        if (stat (paths[i], &st)) {
+            continue; // deleted or moved away
+        }
+        ddb_playItem_t *tail = deadbeef->plt_get_tail_item (plt, PL_MAIN);
+        ddb_playItem_t *it = NULL;
+        if (S_ISDIR (st.st_mode)) {
+            it = deadbeef->plt_insert_dir3 (-1, plt, tail, paths[i], &source->scanner_terminate, _status_callback, NULL);
+        }
+        else if (S_ISREG (st.st_mode)) {
+            it = deadbeef->plt_insert_file2 (-1, plt, tail, paths[i], &source->scanner_terminate, NULL, NULL);
+        }
+        if (it) {
+            deadbeef->pl_item_unref (it);
+        }
+        if (tail) {
+            deadbeef->pl_item_unref (tail);
+        }
+    }
+
+    char stimestamp[100];
+    snprintf (stimestamp, sizeof (stimestamp), "%lld", (int64_t)time(NULL));
+
+    __block int changed = 0;
+    dispatch_sync(source->sync_queue, ^{
+        if (!source->ml_playlist || source->scanner_terminate) {
+            return;
+        }
+
+        ml_index_context_t ctx;
+        ml_index_context_init (&ctx);
+
+        // update the index in place: drop the entries of the changed paths, and add the rescanned tracks below
+        ml_entry_t *prev = NULL;
+        ml_entry_t *en = source->db.tracks;
+        while (en) {
+            ml_entry_t *next = en->next;
+            if (en->file && _ml_path_is_changed (en->file, paths, count)) {
+                if (prev) {
+                    prev->next = next;
+                }
+                else {
+                    source->db.tracks = next;
+                }
+                ml_unindex_entry (source, en);
+                changed = 1;
+            }
+            else {
+                if (!en->album_title) {
+                    ctx.has_unknown_album = 1;
+                }
+                prev = en;
+            }
+            en = next;
+        }
+        source->db.tracks_tail = prev;
+
+        ddb_playItem_t *it = deadbeef->plt_get_head_item (source->ml_playlist, PL_MAIN);
+        while (it) {
+            ddb_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            const char *uri = deadbeef->pl_find_meta (it, ":URI");
+            if (uri && _ml_path_is_changed (uri, paths, count)) {
+                deadbeef->plt_remove_item (source->ml_playlist, it);
+                changed = 1;
+            }
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+
+        ddb_playItem_t *tail = deadbeef->plt_get_tail_item (source->ml_playlist, PL_MAIN);
+        it = deadbeef->plt_get_head_item (plt, PL_MAIN);
+        while (it) {
+            ddb_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->plt_remove_item (plt, it);
+            if (ml_index_track (source, it, &ctx)) {
+                deadbeef->pl_replace_meta (it, ":MEDIALIB_SCAN_TIME", stimestamp);
+                deadbeef->plt_insert_item (source->ml_playlist, tail, it);
+                if (tail) {
+                    deadbeef->pl_item_unref (tail);
+                }
+                tail = it;
+                changed = 1;
+            }
+            else {
+                deadbeef->pl_item_unref (it);
+            }
+            it = next;
+        }
+        if (tail) {
+            deadbeef->pl_item_unref (tail);
+        }
+
+        ml_index_context_finish (source, &ctx);
+
+        if (changed) {
+            // the cached queries point to the tracks and strings of the old index
+            ml_query_cache_clear (source);
+        }
+    });
+    deadbeef->plt_free (plt);
+
+    if (!changed) {
+        return;
+    }
+
+    gettimeofday (&tm2, NULL);
+    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+    fprintf (stderr, "medialib: applied %d changed paths in %f seconds\n", (int)count, ms / 1000.f);
+
+    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_CONTENT_DID_CHANGE);
+
+    if (!source->disable_file_operations) {
+        char plpath[PATH_MAX];
+        snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+        dispatch_sync(source->sync_queue, ^{
+            deadbeef->plt_save (source->ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL);
+        });
+    }
+}
+
+// Runs on watch_queue
+static void
+_ml_watch_flush (medialib_source_t *source) {
+    source->watch_flush_scheduled = 0;
+    if (!source->dirty_count) {
+        return;
+    }
+
+    char **paths = source->dirty_paths;
+    size_t count = source->dirty_count;
+    source->dirty_paths = NULL;
+    source->dirty_count = 0;
+    source->dirty_reserved = 0;
+
+    // drop duplicates, and the paths inside of changed folders
+    qsort (paths, count, sizeof (char *), _ml_path_cmp);
+    size_t n = 0;
+    const char *folder = NULL;
+    size_t folder_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        char *p = paths[i];
+        if ((n && !strcmp (p, paths[n-1]))
+            || (folder && !strncmp (p, folder, folder_len) && p[folder_len] == '/')) {
+            free (p);
+            continue;
+        }
+        paths[n++] = p;
+        folder = p;
+        folder_len = strlen (p);
+    }
+    count = n;
+
+    dispatch_async(source->scanner_queue, ^{
+        _ml_apply_changes (source, paths, count);
+        for (size_t i = 0; i < count; i++) {
+            free (paths[i]);
+        }
+        free (paths);
+    });
+}
+
+static void
+_ml_watch_mark_dirty (medialib_source_t *source, const char *path) {
+    // a cue sheet produces tracks for another file, so the whole folder needs to be rescanned
+    const char *ext = strrchr (path, '.');
+    if (ext && !strcasecmp (ext, ".cue")) {
+        const char *slash = strrchr (path, '/');
+        if (slash && slash != path) {
+            char *folder = strndup (path, slash - path);
+            _ml_watch_mark_dirty (source, folder);
+            free (folder);
+            return;
+        }
+    }
+
+    if (source->dirty_count == source->dirty_reserved) {
+        source->dirty_reserved = source->dirty_reserved ? source->dirty_reserved * 2 : 64;
+        source->dirty_paths = realloc (source->dirty_paths, source->dirty_reserved * sizeof (char *));
+    }
+    source->dirty_paths[source->dirty_count++] = strdup (path);
+
+    // wait for more changes to come, e.g. when an album is being copied
+    if (!source->watch_flush_scheduled) {
+        source->watch_flush_scheduled = 1;
+        int64_t generation = source->watch_generation;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, ML_WATCH_APPLY_DELAY_SEC * NSEC_PER_SEC), source->watch_queue, ^{
+            if (generation == source->watch_generation) {
+                _ml_watch_flush (source);
+            }
+        });
+    }
+}
+
+// Runs on watch_queue
+static void
+_ml_watch_read_events (medialib_source_t *source) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int need_rescan = 0;
+    char path[PATH_MAX];
+
+    for (;;) {
+        ssize_t len = read (source->watch_fd, buf, sizeof (buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char *ptr = buf; ptr < buf + len; ptr += sizeof (struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                need_rescan = 1;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                _ml_watch_remove (source, event->wd);
+                continue;
+            }
+
+            ml_watch_t *w = _ml_watch_find (source, event->wd);
+            if (!w || !event->len || event->name[0] == '.') {
+                continue;
+            }
+            snprintf (path, sizeof (path), "%s/%s", w->path, event->name);
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE|IN_MOVED_TO)) {
+                    if (_ml_watch_add_recursive (source, path) < 0) {
+                        need_rescan = 1;
+                    }
+                }
+                _ml_watch_mark_dirty (source, path);
+            }
+            else if (event->mask & (IN_CLOSE_WRITE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)) {
+                _ml_watch_mark_dirty (source, path);
+            }
+        }
+    }
+
+    if (need_rescan) {
+        // some changes were lost, fall back to the full rescan
+        fprintf (stderr, "medialib: file change events were lost, rescanning\n");
+        ml_refresh ((ddb_mediasource_source_t)source);
+    }
+}
+
+static void
+_ml_watch_free_watches (medialib_source_t *source) {
+    for (int i = 0; i < ML_WATCH_HASH_SIZE; i++) {
+        while (source->watch_hash[i]) {
+            ml_watch_t *next = source->watch_hash[i]->next;
+            free (source->watch_hash[i]->path);
+            free (source->watch_hash[i]);
+            source->watch_hash[i] = next;
+        }
+    }
+    for (size_t i = 0; i < source->dirty_count; i++) {
+        free (source->dirty_paths[i]);
+    }
+    free (source->dirty_paths);
+    source->dirty_paths = NULL;
+    source->dirty_count = 0;
+    source->dirty_reserved = 0;
+    source->watch_flush_scheduled = 0;
+}
+
+// Runs on watch_queue
+static void
+_ml_watch_stop (medialib_source_t *source) {
+    source->watch_generation++;
+    if (source->watch_source) {
+        // the file descriptor is closed by the cancel handler
+        dispatch_source_cancel (source->watch_source);
+        dispatch_release (source->watch_source);
+        source->watch_source = NULL;
+        source->watch_fd = -1;
+    }
+    if (source->rescan_timer) {
+        dispatch_source_cancel (source->rescan_timer);
+        dispatch_release (source->rescan_timer);
+        source->rescan_timer = NULL;
+    }
+    _ml_watch_free_watches (source);
+}
+
+// Runs on watch_queue
+static void
+_ml_watch_start (medialib_source_t *source, char **paths, size_t count) {
+    _ml_watch_stop (source);
+
+    char conf_name[200];
+
+    // periodic full rescan, as a fallback for the changes which can't be watched
+    snprintf (conf_name, sizeof (conf_name), "%srescan_interval", source->source_conf_prefix);
+    int interval = deadbeef->conf_get_int (conf_name, 24); // hours
+    if (interval > 0) {
+        uint64_t interval_ns = (uint64_t)interval * 3600 * NSEC_PER_SEC;
+        source->rescan_timer = dispatch_source_create (DISPATCH_SOURCE_TYPE_TIMER, 0, 0, source->watch_queue);
+        dispatch_source_set_timer (source->rescan_timer, dispatch_time (DISPATCH_TIME_NOW, interval_ns), interval_ns, 60 * NSEC_PER_SEC);
+        dispatch_source_set_event_handler (source->rescan_timer, ^{
+            ml_refresh ((ddb_mediasource_source_t)source);
+        });
+        dispatch_resume (source->rescan_timer);
+    }
+
+    snprintf (conf_name, sizeof (conf_name), "%swatch", source->source_conf_prefix);
+    if (!deadbeef->conf_get_int (conf_name, 1)) {
+        return;
+    }
+
+    int fd = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf (stderr, "medialib: inotify_init1 failed: %s\n", strerror (errno));
+        return;
+    }
+    source->watch_fd = fd;
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!paths[i]) {
+            continue;
+        }
+        // the track URIs are made of resolved paths
+        char resolved[PATH_MAX];
+        const char *path = realpath (paths[i], resolved) ? resolved : paths[i];
+        if (_ml_watch_add_recursive (source, path) < 0) {
+            fprintf (stderr, "medialib: not enough inotify watches, changes will only be picked up by rescanning\n");
+            _ml_watch_free_watches (source);
+            close (fd);
+            source->watch_fd = -1;
+            return;
+        }
+    }
+
+    gettimeofday (&tm2, NULL);
+    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+    fprintf (stderr, "medialib: watching folders, setup time: %f seconds\n", ms / 1000.f);
+
+    source->watch_source = dispatch_source_create (DISPATCH_SOURCE_TYPE_READ, fd, 0, source->watch_queue);
+    dispatch_source_set_event_handler (source->watch_source, ^{
+        _ml_watch_read_events (source);
+    });
+    dispatch_source_set_cancel_handler (source->watch_source, ^{
+        close (fd);
+    });
+    dispatch_resume (source->watch_source);
+}
+
+#endif
+
+/// Start watching the folders for changes, replacing the previous watches.
+static void
+ml_watch_folders (medialib_source_t *source, char **paths, size_t count) {
+#if ML_WATCH
+    dispatch_sync(source->watch_queue, ^{
+        _ml_watch_start (source, paths, count);
+    });
+#endif
+}
+
+static void
+ml_unwatch_folders (medialib_source_t *source) {
+#if ML_WATCH
+    dispatch_sync(source->watch_queue, ^{
+        _ml_watch_stop (source);
+    });
+#endif
+}
+
+
+static void
+scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf) {
+    char plpath[PATH_MAX];
+    snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+
+    _ml_load_playlist(source, plpath);
+
+    struct timeval tm1, tm2;
+
+    source->_ml_state = DDB_MEDIASOURCE_STATE_SCANNING;
+    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
+
+    gettimeofday (&tm1, NULL);
+
+    ddb_playlist_t *plt = deadbeef->plt_alloc("medialib");
+    // doesn't need to be protected by mutex -- this is only supposed to be accessed on the scan thread
+    source->ml_filter_state.plt = plt;
+
+    for (int i = 0; i < conf.medialib_paths_count; i++) {
+        const char *musicdir = conf.medialib_paths[i];
+        printf ("adding dir: %s\n", musicdir);
+        // update & index the cloned playlist
+        deadbeef->plt_insert_dir3 (-1, plt, NULL, musicdir, &source->scanner_terminate, _status_callback, NULL);
+    }
+
+    source->ml_filter_state.plt = NULL;
+
+    source->_ml_state = DDB_MEDIASOURCE_STATE_INDEXING;
+    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
+
+    // set current time as timestamp
+    time_t timestamp = time(NULL);
+    dispatch_sync(source->sync_queue, ^{
+        char stimestamp[100];
+        snprintf (stimestamp, sizeof (stimestamp), "%lld", (int64_t)timestamp);
+        ddb_playItem_t *it = deadbeef->plt_get_head_item (plt, PL_MAIN);
+        while (it) {
+            deadbeef->pl_replace_meta (it, ":MEDIALIB_SCAN_TIME", stimestamp);
+            ddb_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+    });
+
+    if (!source->disable_file_operations) {
+        deadbeef->plt_save (plt, NULL, NULL, plpath, NULL, NULL, NULL);
+    }
+
+    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_CONTENT_DID_CHANGE);
+
+    gettimeofday (&tm2, NULL);
+    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+    fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (source->ml_playlist, PL_MAIN));
+
+    source->_ml_state = DDB_MEDIASOURCE_STATE_SAVING;
+    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
+
+    // update the current ml playlist and index transactionally
+    dispatch_sync(source->sync_queue, ^{
+        if (source->ml_playlist) {
+            deadbeef->plt_free (source->ml_playlist);
+        }
+        source->ml_playlist = plt;
+        ml_index (source, source->ml_playlist);
+    });
+
+    // from now on, pick up the changes without rescanning everything
+    ml_watch_folders (source, conf.medialib_paths, conf.medialib_paths_count);
+
+    free_medialib_paths (conf.medialib_paths, conf.medialib_paths_count);
+
+    source->_ml_state = DDB_MEDIASOURCE_STATE_IDLE;
+    ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
+}
+
+// NOTE: make sure to run on sync_queue
+/// Returns 1 for the files which need to be included in the scan, based on their timestamp and metadata
+static int
+ml_filter_int (ddb_file_found_data_t *data, time_t mtime, medialib_source_t *source) {
+    int res = 0;
+
+    const char *s = deadbeef->metacache_get_string (data->filename);
+    if (!s) {
+        return 0;
+    }
+
+    uint32_t hash = hash_for_ptr((void *)s);
+
+    if (!source->db.filename_hash[hash]) {
+        deadbeef->metacache_remove_string (s);
+        return 0;
     }
 
     ml_entry_t *en = source->db.filename_hash[hash];
@@ -896,48 +1619,259 @@ ml_start (void) {
     return 0;
 }
 
-static int
-ml_stop (void) {
-    if (artist_album_bc) {
-        deadbeef->tf_free (artist_album_bc);
-        artist_album_bc = NULL;
+static int
+ml_stop (void) {
+    if (artist_album_bc) {
+        deadbeef->tf_free (artist_album_bc);
+        artist_album_bc = NULL;
+    }
+
+    if (artist_album_id_bc) {
+        deadbeef->tf_free (artist_album_id_bc);
+        artist_album_id_bc = NULL;
+    }
+
+    if (title_bc) {
+        deadbeef->tf_free (title_bc);
+        title_bc = NULL;
+    }
+    printf ("medialib cleanup done\n");
+
+    return 0;
+}
+
+static int
+ml_add_listener (ddb_mediasource_source_t _source, ddb_medialib_listener_t listener, void *user_data) {
+    medialib_source_t *source = (medialib_source_t *)_source;
+
+    for (int i = 0; i < MAX_LISTENERS; i++) {
+        if (!source->ml_listeners[i]) {
+            source->ml_listeners[i] = listener;
+            source->ml_listeners_userdatas[i] = user_data;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void
+ml_remove_listener (ddb_mediasource_source_t _source, int listener_id) {
+    medialib_source_t *source = (medialib_source_t *)_source;
+
+    source->ml_listeners[listener_id] = NULL;
+    source->ml_listeners_userdatas[listener_id] = NULL;
+}
+
+typedef enum {
+    SEL_ALBUMS = 1,
+    SEL_ARTISTS = 2,
+    SEL_GENRES = 3,
+    SEL_FOLDERS = 4,
+    SEL_FILLER = -1UL,
+} medialibSelector_t;
+
+#pragma mark - filtering
+
+// The filter is matched against the artist, album, genre, title, file and folder names held by the index,
+// each unique collection string is only compared once, and the playlist selection is not used.
+
+// Set of tracks, open addressing
+typedef struct {
+    DB_playItem_t **items;
+    uint32_t size; // power of 2
+    uint32_t count;
+} ml_track_set_t;
+
+static uint32_t
+_ml_track_set_slot (const ml_track_set_t *set, DB_playItem_t *it) {
+    uint64_t scrambled = 1181783497276652981ULL * (uintptr_t)it;
+    return (uint32_t)(scrambled >> 32) & (set->size - 1);
+}
+
+static void
+_ml_track_set_add (ml_track_set_t *set, DB_playItem_t *it) {
+    if ((set->count + 1) * 2 > set->size) {
+        ml_track_set_t grown = {
+            .size = set->size ? set->size * 2 : 1024,
+        };
+        grown.items = calloc (grown.size, sizeof (DB_playItem_t *));
+        for (uint32_t i = 0; i < set->size; i++) {
+            if (set->items[i]) {
+                _ml_track_set_add (&grown, set->items[i]);
+            }
+        }
+        free (set->items);
+        *set = grown;
+    }
+
+    uint32_t slot = _ml_track_set_slot (set, it);
+    while (set->items[slot]) {
+        if (set->items[slot] == it) {
+            return;
+        }
+        slot = (slot + 1) & (set->size - 1);
+    }
+    set->items[slot] = it;
+    set->count++;
+}
+
+static int
+_ml_track_set_contains (const ml_track_set_t *set, DB_playItem_t *it) {
+    if (!set->count) {
+        return 0;
+    }
+    uint32_t slot = _ml_track_set_slot (set, it);
+    while (set->items[slot]) {
+        if (set->items[slot] == it) {
+            return 1;
+        }
+        slot = (slot + 1) & (set->size - 1);
+    }
+    return 0;
+}
+
+static void
+_ml_track_set_free (ml_track_set_t *set) {
+    free (set->items);
+    memset (set, 0, sizeof (ml_track_set_t));
+}
+
+/// @param lc lowercase filter text
+static int
+_ml_filter_match (const char *text, const char *lc) {
+    return text && u8_valid (text, (int)strlen (text), NULL) && utfcasestr_fast (text, lc);
+}
+
+static void
+_ml_filter_add_collection_matches (ml_track_set_t *set, ml_collection_t *coll, const char *lc) {
+    for (ml_string_t *s = coll->head; s; s = s->next) {
+        if (!s->items_count || !_ml_filter_match (s->text, lc)) {
+            continue;
+        }
+        for (ml_collection_item_t *item = s->items; item; item = item->next) {
+            _ml_track_set_add (set, item->it);
+        }
+    }
+}
+
+static void
+_ml_filter_add_folder_matches (ml_track_set_t *set, ml_tree_node_t *folder, const char *lc, int matched) {
+    if (!matched) {
+        matched = _ml_filter_match (folder->text, lc);
     }
-
-    if (artist_album_id_bc) {
-        deadbeef->tf_free (artist_album_id_bc);
-        artist_album_id_bc = NULL;
+    if (matched) {
+        for (ml_collection_item_t *item = folder->items; item; item = item->next) {
+            _ml_track_set_add (set, item->it);
+        }
+    }
+    for (ml_tree_node_t *c = folder->children; c; c = c->next) {
+        _ml_filter_add_folder_matches (set, c, lc, matched);
     }
+}
 
-    if (title_bc) {
-        deadbeef->tf_free (title_bc);
-        title_bc = NULL;
+/// Collect the tracks matching the filter into the @c set
+static void
+_ml_filter_tracks (medialib_source_t *source, const char *filter, ml_track_set_t *set) {
+    // convert text to lowercase, to save some cycles
+    char lc[1000];
+    int n = sizeof (lc)-1;
+    const char *p = filter;
+    char *out = lc;
+    while (*p) {
+        int32_t i = 0;
+        char s[10];
+        u8_nextchar (p, &i);
+        int l = u8_tolower ((const signed char *)p, i, s);
+        n -= l;
+        if (n < 0) {
+            break;
+        }
+        memcpy (out, s, l);
+        p += i;
+        out += l;
     }
-    printf ("medialib cleanup done\n");
+    *out = 0;
 
-    return 0;
-}
+    if (!lc[0] || !u8_valid (lc, (int)strlen (lc), NULL)) {
+        return;
+    }
 
-static int
-ml_add_listener (ddb_mediasource_source_t _source, ddb_medialib_listener_t listener, void *user_data) {
-    medialib_source_t *source = (medialib_source_t *)_source;
+    _ml_filter_add_collection_matches (set, &source->db.artists, lc);
+    _ml_filter_add_collection_matches (set, &source->db.album_titles, lc);
+    _ml_filter_add_collection_matches (set, &source->db.genres, lc);
 
-    for (int i = 0; i < MAX_LISTENERS; i++) {
-        if (!source->ml_listeners[i]) {
-            source->ml_listeners[i] = listener;
-            source->ml_listeners_userdatas[i] = user_data;
-            return i;
+    for (ml_entry_t *en = source->db.tracks; en; en = en->next) {
+        if (_ml_filter_match (en->title, lc)) {
+            _ml_track_set_add (set, en->it);
+            continue;
+        }
+        const char *fname = en->file ? strrchr (en->file, '/') : NULL;
+        if (fname && _ml_filter_match (fname + 1, lc)) {
+            _ml_track_set_add (set, en->it);
         }
     }
-    return -1;
+
+    if (source->db.folders_tree) {
+        _ml_filter_add_folder_matches (set, source->db.folders_tree, lc, 0);
+    }
 }
 
-static void
-ml_remove_listener (ddb_mediasource_source_t _source, int listener_id) {
-    medialib_source_t *source = (medialib_source_t *)_source;
+#pragma mark - queries
 
-    source->ml_listeners[listener_id] = NULL;
-    source->ml_listeners_userdatas[listener_id] = NULL;
-}
+// Query results are kept as flat node arrays, and converted to ddb_medialib_item_t on request.
+// The album and track titles are only evaluated when the corresponding items are requested.
+
+#define ML_QUERY_CACHE_SIZE 4
+
+// The ids of the evicted queries are remembered, so that a rebuilt query gets the same id,
+// and the items which the UI holds stay valid, as long as the index doesn't change.
+#define ML_QUERY_KEYS_MAX 64
+
+typedef enum {
+    ML_NODE_ROOT,
+    ML_NODE_FOLDER,
+    ML_NODE_BUCKET, // artist, genre
+    ML_NODE_ALBUM, // album in a bucket
+    ML_NODE_TOP_ALBUM, // album at the top level
+    ML_NODE_TRACK,
+} ml_node_kind_t;
+
+// The children are linked by index, 0 means no node
+typedef struct {
+    const char *text; // metacache string, NULL until evaluated
+    DB_playItem_t *it; // the track of a leaf node, or the first track of an album, used to evaluate the text
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t next;
+    uint32_t num_children;
+    ml_node_kind_t kind;
+} ml_query_node_t;
+
+typedef struct ml_query_s {
+    int64_t id;
+    medialibSelector_t selector;
+    char *filter;
+    ml_query_node_t *nodes; // nodes[0] is the root
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t last_used;
+    struct ml_query_s *next;
+} ml_query_t;
+
+typedef struct ml_query_key_s {
+    int64_t id;
+    medialibSelector_t selector;
+    char *filter;
+    struct ml_query_key_s *next;
+} ml_query_key_t;
+
+// The items returned by get_items_page remember their node, for expanding them later
+typedef struct {
+    ddb_medialib_item_t item;
+    int64_t query_id;
+    uint32_t node;
+} ml_page_item_t;
 
 static int _is_blank_text (const char *track_field) {
     if (!track_field) {
@@ -951,384 +1885,416 @@ static int _is_blank_text (const char *track_field) {
     return 1;
 }
 
-static void
-get_albums_for_collection_group_by_field (medialib_source_t *source, ddb_medialib_item_t *root, ml_collection_t *coll, const char *field, int field_tf, const char /* nonnull */ *default_field_value, int selected) {
-
-    default_field_value = deadbeef->metacache_add_string (default_field_value);
-
-    ml_string_t *album = source->db.albums.head;
-    char text[1024];
+static uint32_t
+_ml_query_add_node (ml_query_t *q, uint32_t parent, ml_node_kind_t kind, const char *text, DB_playItem_t *it) {
+    if (q->count == q->reserved) {
+        q->reserved = q->reserved ? q->reserved * 2 : 1024;
+        q->nodes = realloc (q->nodes, q->reserved * sizeof (ml_query_node_t));
+    }
+    uint32_t idx = q->count++;
+    ml_query_node_t *node = &q->nodes[idx];
+    memset (node, 0, sizeof (ml_query_node_t));
+    node->kind = kind;
+    node->it = it;
+    node->parent = parent;
+    if (text) {
+        node->text = deadbeef->metacache_add_string (text);
+    }
+
+    if (idx != 0) {
+        ml_query_node_t *p = &q->nodes[parent];
+        if (p->last_child) {
+            q->nodes[p->last_child].next = idx;
+        }
+        else {
+            p->first_child = idx;
+        }
+        p->last_child = idx;
+        p->num_children++;
+    }
+    return idx;
+}
 
-    char *tf = NULL;
-    if (field_tf) {
-        tf = deadbeef->tf_compile (field);
+// Remove the node, which must be the last child of its parent, together with all nodes added after it
+static void
+_ml_query_remove_last_node (ml_query_t *q, uint32_t idx, uint32_t prev_sibling) {
+    ml_query_node_t *p = &q->nodes[q->nodes[idx].parent];
+    if (prev_sibling) {
+        q->nodes[prev_sibling].next = 0;
+    }
+    else {
+        p->first_child = 0;
     }
+    p->last_child = prev_sibling;
+    p->num_children--;
 
-    ddb_medialib_item_t *root_tail = NULL;
+    for (uint32_t i = idx; i < q->count; i++) {
+        if (q->nodes[i].text) {
+            deadbeef->metacache_remove_string (q->nodes[i].text);
+        }
+    }
+    q->count = idx;
+}
 
-    for (int i = 0; i < source->db.albums.count; i++, album = album->next) {
-        if (!album->items_count) {
+static void
+_ml_query_add_folder (ml_query_t *q, uint32_t idx, ml_tree_node_t *folder, const ml_track_set_t *filter_set) {
+    for (ml_tree_node_t *c = folder->children; c; c = c->next) {
+        uint32_t prev_sibling = q->nodes[idx].last_child;
+        uint32_t subfolder = _ml_query_add_node (q, idx, ML_NODE_FOLDER, c->text, NULL);
+        _ml_query_add_folder (q, subfolder, c, filter_set);
+        if (!q->nodes[subfolder].num_children) {
+            _ml_query_remove_last_node (q, subfolder, prev_sibling);
+        }
+    }
+    for (ml_collection_item_t *i = folder->items; i; i = i->next) {
+        if (filter_set && !_ml_track_set_contains (filter_set, i->it)) {
             continue;
         }
+        _ml_query_add_node (q, idx, ML_NODE_TRACK, NULL, i->it);
+    }
+}
 
-        ddb_medialib_item_t *album_item = NULL;
-        ddb_medialib_item_t *album_tail = NULL;
-
+// Group the albums by artist or genre
+static void
+_ml_query_add_albums_grouped_by_field (medialib_source_t *source, ml_query_t *q, ml_collection_t *coll, const char *field, const char /* nonnull */ *default_field_value, const ml_track_set_t *filter_set) {
+    default_field_value = deadbeef->metacache_add_string (default_field_value);
 
-        // find the bucket -- a genre or artist
-        const char *mc_str_for_track_field = NULL;
-        const char *track_field = NULL;
-        if (!tf) {
-            track_field = deadbeef->pl_find_meta (album->items->it, field);
-        }
-        else {
-            ddb_tf_context_t ctx = {
-                ._size = sizeof (ddb_tf_context_t),
-                .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-                .it = album->items->it,
-            };
+    for (ml_string_t *s = coll->head; s; s = s->next) {
+        s->query_node = 0;
+    }
 
-            deadbeef->tf_eval (&ctx, tf, text, sizeof (text));
-            track_field = mc_str_for_track_field = deadbeef->metacache_add_string (text);
+    for (ml_string_t *album = source->db.albums.head; album; album = album->next) {
+        if (!album->items_count) {
+            continue;
         }
 
+        // find the bucket -- a genre or artist
+        const char *track_field = deadbeef->pl_find_meta (album->items->it, field);
         if (_is_blank_text (track_field)) {
             track_field = default_field_value;
         }
 
-        // Find the bucket of this album - e.g. a genre or an artist
         // NOTE: multiple albums may belong to the same bucket
-        ml_string_t *s = NULL;
-        for (s = coll->head; s; s = s->next) {
-            if (track_field == s->text) {
-                break;
-            }
-        }
-
-        if (s == NULL) {
-            if (mc_str_for_track_field) {
-                deadbeef->metacache_remove_string (mc_str_for_track_field);
-            }
+        ml_string_t *s = hash_find (coll->hash, track_field);
+        if (!s) {
             continue;
         }
 
-        // Add all of the album's tracks into that bucket
-        ml_collection_item_t *album_coll_item = album->items;
-        for (int j = 0; j < album->items_count; j++, album_coll_item = album_coll_item->next) {
-            if (selected && !deadbeef->pl_is_selected (album_coll_item->it)) {
+        uint32_t album_node = 0;
+        for (ml_collection_item_t *item = album->items; item; item = item->next) {
+            if (filter_set && !_ml_track_set_contains (filter_set, item->it)) {
                 continue;
             }
-            int append = 0;
-
-            if (!s->coll_item) {
-                s->coll_item = calloc (1, sizeof (ddb_medialib_item_t));
-                s->coll_item->text = deadbeef->metacache_add_string (s->text);
-                append = 1;
+            if (!s->query_node) {
+                s->query_node = _ml_query_add_node (q, 0, ML_NODE_BUCKET, s->text, NULL);
             }
+            if (!album_node) {
+                album_node = _ml_query_add_node (q, s->query_node, ML_NODE_ALBUM, NULL, item->it);
+            }
+            _ml_query_add_node (q, album_node, ML_NODE_TRACK, NULL, item->it);
+        }
+    }
 
-            DB_playItem_t *it = album_coll_item->it;
-
-            ddb_medialib_item_t *libitem = s->coll_item;
-
-            if (!album_item && s->coll_item) {
-                album_item = calloc (1, sizeof (ddb_medialib_item_t));
-                if (s->coll_item_tail) {
-                    s->coll_item_tail->next = album_item;
-                    s->coll_item_tail = album_item;
-                }
-                else {
-                    s->coll_item_tail = libitem->children = album_item;
-                }
+    for (ml_string_t *s = coll->head; s; s = s->next) {
+        s->query_node = 0;
+    }
 
-                ddb_tf_context_t ctx = {
-                    ._size = sizeof (ddb_tf_context_t),
-                    .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-                    .it = it,
-                };
+    deadbeef->metacache_remove_string (default_field_value);
+}
 
-                deadbeef->tf_eval (&ctx, artist_album_bc, text, sizeof (text));
+static void
+_ml_query_free (ml_query_t *q) {
+    for (uint32_t i = 0; i < q->count; i++) {
+        if (q->nodes[i].text) {
+            deadbeef->metacache_remove_string (q->nodes[i].text);
+        }
+    }
+    free (q->nodes);
+    free (q->filter);
+    free (q);
+}
 
-                album_item->text = deadbeef->metacache_add_string (text);
-                libitem->num_children++;
-            }
+// NOTE: make sure to run on sync_queue
+static void
+ml_query_cache_clear (medialib_source_t *source) {
+    while (source->queries) {
+        ml_query_t *next = source->queries->next;
+        _ml_query_free (source->queries);
+        source->queries = next;
+    }
+    // the queries built from the new index get new ids
+    while (source->query_keys) {
+        ml_query_key_t *next = source->query_keys->next;
+        free (source->query_keys->filter);
+        free (source->query_keys);
+        source->query_keys = next;
+    }
+}
 
-            ddb_medialib_item_t *track_item = calloc(1, sizeof (ddb_medialib_item_t));
+static int
+_ml_query_matches (medialibSelector_t selector, const char *filter, medialibSelector_t q_selector, const char *q_filter) {
+    return q_selector == selector && ((!q_filter && !filter) || (q_filter && filter && !strcmp (q_filter, filter)));
+}
 
-            if (album_tail) {
-                album_tail->next = track_item;
-                album_tail = track_item;
+// Returns the id which the query had when it was built before, or a new one
+static int64_t
+_ml_query_id (medialib_source_t *source, medialibSelector_t selector, const char *filter) {
+    int count = 0;
+    ml_query_key_t **pk = &source->query_keys;
+    for (ml_query_key_t *k = source->query_keys; k; pk = &k->next, k = k->next, count++) {
+        if (_ml_query_matches (selector, filter, k->selector, k->filter)) {
+            // move to front
+            *pk = k->next;
+            k->next = source->query_keys;
+            source->query_keys = k;
+            return k->id;
+        }
+        if (count == ML_QUERY_KEYS_MAX - 1 && k->next) {
+            // forget the least recently built queries
+            ml_query_key_t *tail = k->next;
+            k->next = NULL;
+            while (tail) {
+                ml_query_key_t *next = tail->next;
+                free (tail->filter);
+                free (tail);
+                tail = next;
             }
-            else {
-                album_tail = album_item->children = track_item;
-            }
-            album_item->num_children++;
-
-            ddb_tf_context_t ctx = {
-                ._size = sizeof (ddb_tf_context_t),
-                .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-                .it = it,
-            };
+        }
+    }
 
-            deadbeef->tf_eval (&ctx, title_bc, text, sizeof (text));
+    ml_query_key_t *k = calloc (1, sizeof (ml_query_key_t));
+    k->id = ++source->query_id;
+    k->selector = selector;
+    k->filter = filter ? strdup (filter) : NULL;
+    k->next = source->query_keys;
+    source->query_keys = k;
+    return k->id;
+}
 
-            track_item->text = deadbeef->metacache_add_string (text);
-            deadbeef->pl_item_ref (it);
-            track_item->track = it;
+static ml_query_t *
+_ml_query_build (medialib_source_t *source, medialibSelector_t selector, const char *filter) {
+    ml_track_set_t matches = {0};
+    const ml_track_set_t *filter_set = NULL;
+    if (filter) {
+        _ml_filter_tracks (source, filter, &matches);
+        filter_set = &matches;
+    }
 
-            if (!libitem->children) {
-                ml_free_list (source, libitem);
-                s->coll_item = NULL;
-                s->coll_item_tail = NULL;
-                continue;
-            }
+    ml_query_t *q = calloc (1, sizeof (ml_query_t));
+    q->id = _ml_query_id (source, selector, filter);
+    q->selector = selector;
+    q->filter = filter ? strdup (filter) : NULL;
+    _ml_query_add_node (q, 0, ML_NODE_ROOT, "All Music", NULL);
 
-            if (append) {
-                if (root_tail) {
-                    root_tail->next = libitem;
-                    root_tail = libitem;
+    switch (selector) {
+    case SEL_FOLDERS:
+        _ml_query_add_folder (q, 0, source->db.folders_tree, filter_set);
+        break;
+    case SEL_ARTISTS:
+        _ml_query_add_albums_grouped_by_field (source, q, &source->db.artists, "artist", "<?>", filter_set);
+        break;
+    case SEL_GENRES:
+        _ml_query_add_albums_grouped_by_field (source, q, &source->db.genres, "genre", "<?>", filter_set);
+        break;
+    case SEL_ALBUMS:
+        for (ml_string_t *s = source->db.albums.head; s; s = s->next) {
+            uint32_t album_node = 0;
+            for (ml_collection_item_t *item = s->items; item; item = item->next) {
+                if (filter_set && !_ml_track_set_contains (filter_set, item->it)) {
+                    continue;
                 }
-                else {
-                    root_tail = root->children = libitem;
+                if (!album_node) {
+                    album_node = _ml_query_add_node (q, 0, ML_NODE_TOP_ALBUM, NULL, item->it);
                 }
-                root->num_children++;
+                _ml_query_add_node (q, album_node, ML_NODE_TRACK, NULL, item->it);
             }
         }
-
-        if (mc_str_for_track_field) {
-            deadbeef->metacache_remove_string (mc_str_for_track_field);
-        }
+        break;
+    default:
+        break;
     }
 
-    deadbeef->metacache_remove_string (default_field_value);
+    _ml_track_set_free (&matches);
 
-    if (tf) {
-        deadbeef->tf_free (tf);
-    }
+    return q;
 }
 
-static void
-get_list_of_tracks_for_album (ddb_medialib_item_t *libitem, ml_string_t *album, int selected) {
-    char text[1024];
-
-    ddb_medialib_item_t *album_item = NULL;
-    ddb_medialib_item_t *album_tail = NULL;
+/// Returns the cached query result, or builds a new one.
+/// NOTE: make sure to run on sync_queue
+static ml_query_t *
+_ml_query_get (medialib_source_t *source, medialibSelector_t selector, const char *filter) {
+    int count = 0;
+    ml_query_t *lru = NULL;
+    for (ml_query_t *q = source->queries; q; q = q->next, count++) {
+        if (_ml_query_matches (selector, filter, q->selector, q->filter)) {
+            q->last_used = ++source->query_use_counter;
+            return q;
+        }
+        if (!lru || q->last_used < lru->last_used) {
+            lru = q;
+        }
+    }
 
-    ml_collection_item_t *album_coll_item = album->items;
-    for (int j = 0; j < album->items_count; j++, album_coll_item = album_coll_item->next) {
-        DB_playItem_t *it = album_coll_item->it;
-        if (selected && !deadbeef->pl_is_selected(it)) {
-            continue;
+    if (count >= ML_QUERY_CACHE_SIZE) {
+        ml_query_t **pq = &source->queries;
+        while (*pq != lru) {
+            pq = &(*pq)->next;
         }
-        ddb_tf_context_t ctx = {
-            ._size = sizeof (ddb_tf_context_t),
-            .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-            .it = it,
-        };
+        *pq = lru->next;
+        _ml_query_free (lru);
+    }
 
-        if (!album_item) {
-            album_item = libitem;
-            deadbeef->tf_eval (&ctx, artist_album_bc, text, sizeof (text));
+    ml_query_t *q = _ml_query_build (source, selector, filter);
+    q->last_used = ++source->query_use_counter;
+    q->next = source->queries;
+    source->queries = q;
+    return q;
+}
 
-            if (!_is_blank_text(text)) {
-                album_item->text = deadbeef->metacache_add_string (text);
-            }
-            else {
-                album_item->text = deadbeef->metacache_add_string ("<?>");
-            }
-        }
+static const char *
+_ml_query_node_text (ml_query_t *q, uint32_t idx) {
+    ml_query_node_t *node = &q->nodes[idx];
+    if (node->text) {
+        return node->text;
+    }
 
-        ddb_medialib_item_t *track_item = calloc(1, sizeof (ddb_medialib_item_t));
+    char text[1024];
+    ddb_tf_context_t ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
+        .it = node->it,
+    };
 
-        if (album_tail) {
-            album_tail->next = track_item;
-            album_tail = track_item;
-        }
-        else {
-            album_tail = album_item->children = track_item;
+    switch (node->kind) {
+    case ML_NODE_ALBUM:
+        deadbeef->tf_eval (&ctx, artist_album_bc, text, sizeof (text));
+        break;
+    case ML_NODE_TOP_ALBUM:
+        deadbeef->tf_eval (&ctx, artist_album_bc, text, sizeof (text));
+        if (_is_blank_text (text)) {
+            strcpy (text, "<?>");
         }
-        album_item->num_children++;
-
+        break;
+    case ML_NODE_TRACK:
         deadbeef->tf_eval (&ctx, title_bc, text, sizeof (text));
-
-        track_item->text = deadbeef->metacache_add_string (text);
-        deadbeef->pl_item_ref (it);
-        track_item->track = it;
+        break;
+    default:
+        text[0] = 0;
+        break;
     }
+
+    node->text = deadbeef->metacache_add_string (text);
+    return node->text;
 }
 
 static void
-get_subfolders_for_folder (ddb_medialib_item_t *folderitem, ml_tree_node_t *folder, int selected) {
-    if (!folderitem->text) {
-        folderitem->text = deadbeef->metacache_add_string (folder->text);
+_ml_query_fill_item (ml_query_t *q, uint32_t idx, ddb_medialib_item_t *item) {
+    ml_query_node_t *node = &q->nodes[idx];
+    item->text = deadbeef->metacache_add_string (_ml_query_node_text (q, idx));
+    item->num_children = node->num_children;
+    if (node->kind == ML_NODE_TRACK) {
+        deadbeef->pl_item_ref (node->it);
+        item->track = node->it;
     }
+}
+
+static ddb_medialib_item_t *
+_ml_query_create_tree (ml_query_t *q, uint32_t idx) {
+    ddb_medialib_item_t *item = calloc (1, sizeof (ddb_medialib_item_t));
+    _ml_query_fill_item (q, idx, item);
 
     ddb_medialib_item_t *tail = NULL;
-    if (folder->children) {
-        for (ml_tree_node_t *c = folder->children; c; c = c->next) {
-            ddb_medialib_item_t *subfolder = calloc (1, sizeof (ddb_medialib_item_t));
-            get_subfolders_for_folder (subfolder, c, selected);
-            if (subfolder->num_children > 0) {
-                if (tail) {
-                    tail->next = subfolder;
-                    tail = subfolder;
-                }
-                else {
-                    folderitem->children = tail = subfolder;
-                }
-                folderitem->num_children++;
-            }
-            else {
-                ml_free_list (NULL, subfolder);
-            }
+    for (uint32_t c = q->nodes[idx].first_child; c; c = q->nodes[c].next) {
+        ddb_medialib_item_t *child = _ml_query_create_tree (q, c);
+        if (tail) {
+            tail->next = child;
         }
-    }
-    if (folder->items) {
-        for (ml_collection_item_t *i = folder->items; i; i = i->next) {
-            if (selected && !deadbeef->pl_is_selected(i->it)) {
-                continue;
-            }
-            ddb_medialib_item_t *trackitem = calloc (1, sizeof (ddb_medialib_item_t));
-            ddb_tf_context_t ctx = {
-                ._size = sizeof (ddb_tf_context_t),
-                .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-                .it = i->it,
-            };
-            char text[1000];
-            deadbeef->tf_eval (&ctx, title_bc, text, sizeof (text));
-
-            trackitem->text = deadbeef->metacache_add_string (text);
-            trackitem->track = i->it;
-            deadbeef->pl_item_ref (i->it);
-
-            if (tail) {
-                tail->next = trackitem;
-                tail = trackitem;
-            }
-            else {
-                folderitem->children = tail = trackitem;
-            }
-            folderitem->num_children++;
+        else {
+            item->children = child;
         }
+        tail = child;
     }
+    return item;
 }
 
-typedef enum {
-    SEL_ALBUMS = 1,
-    SEL_ARTISTS = 2,
-    SEL_GENRES = 3,
-    SEL_FOLDERS = 4,
-    SEL_FILLER = -1UL,
-} medialibSelector_t;
-
 static ddb_medialib_item_t *
-_create_item_tree_from_collection(ml_collection_t *coll, const char *filter, medialibSelector_t index, medialib_source_t *source) {
-    int selected = 0;
-    if (filter && source->ml_playlist) {
-        deadbeef->plt_search_reset (source->ml_playlist);
-        deadbeef->plt_search_process2 (source->ml_playlist, filter, 1);
-        selected = 1;
-    }
-
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
-
-    ddb_medialib_item_t *root = calloc (1, sizeof (ddb_medialib_item_t));
-    root->text = deadbeef->metacache_add_string ("All Music");
-
-    // make sure no dangling pointers from the previous run
-    if (coll) {
-        for (ml_string_t *s = coll->head; s; s = s->next) {
-            s->coll_item = NULL;
-            s->coll_item_tail = NULL;
-        }
-    }
-
-    if (index == SEL_FOLDERS) {
-        get_subfolders_for_folder(root, source->db.folders_tree, selected);
-    }
-    else if (index == SEL_ARTISTS) {
-        // list of albums for artist
-        get_albums_for_collection_group_by_field (source, root, coll, "artist", 0, "<?>", selected);
-    }
-    else if (index == SEL_GENRES) {
-        // list of albums for genre
-        get_albums_for_collection_group_by_field (source, root, coll, "genre", 0, "<?>", selected);
-    }
-    else if (index == SEL_ALBUMS) {
-        // list of tracks for album
-        ddb_medialib_item_t *tail = NULL;
-        ddb_medialib_item_t *parent = root;
-        for (ml_string_t *s = coll->head; s; s = s->next) {
-            ddb_medialib_item_t *item = calloc (1, sizeof (ddb_medialib_item_t));
-
-            get_list_of_tracks_for_album (item, s, selected);
+ml_create_item_tree (ddb_mediasource_source_t _source, ddb_mediasource_list_selector_t selector, const char *filter) {
+    medialib_source_t *source = (medialib_source_t *)_source;
 
-            if (!item->children) {
-                ml_free_list (source, item);
-                continue;
-            }
+    __block ddb_medialib_item_t *root = NULL;
 
-            if (tail) {
-                tail->next = item;
-                tail = item;
-            }
-            else {
-                tail = parent->children = item;
-            }
-            parent->num_children++;
+    dispatch_sync(source->sync_queue, ^{
+        if (!source->enabled) {
+            return;
         }
-    }
 
-    // cleanup
-    if (coll) {
-        for (ml_string_t *s = coll->head; s; s = s->next) {
-            s->coll_item = NULL;
-            s->coll_item_tail = NULL;
+        medialibSelector_t index = (medialibSelector_t)selector;
+        if (index < SEL_ALBUMS || index > SEL_FOLDERS) {
+            return;
         }
-    }
 
-    gettimeofday (&tm2, NULL);
-    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+        ml_query_t *q = _ml_query_get (source, index, filter);
+        root = _ml_query_create_tree (q, 0);
+    });
 
-    fprintf (stderr, "tree build time: %f seconds\n", ms / 1000.f);
     return root;
 }
 
 static ddb_medialib_item_t *
-ml_create_item_tree (ddb_mediasource_source_t _source, ddb_mediasource_list_selector_t selector, const char *filter) {
+ml_get_items_page (ddb_mediasource_source_t _source, ddb_mediasource_list_selector_t selector, const char *filter, const ddb_medialib_item_t *parent, int64_t cursor, int count, int64_t *next_cursor) {
     medialib_source_t *source = (medialib_source_t *)_source;
 
-    __block ddb_medialib_item_t *root = NULL;
+    __block ddb_medialib_item_t *head = NULL;
+    __block int64_t next = -1;
 
     dispatch_sync(source->sync_queue, ^{
-        if (!source->enabled) {
+        medialibSelector_t index = (medialibSelector_t)selector;
+        if (!source->enabled || index < SEL_ALBUMS || index > SEL_FOLDERS) {
             return;
         }
 
-        ml_collection_t *coll = NULL;
+        ml_query_t *q = _ml_query_get (source, index, filter);
 
-        medialibSelector_t index = (medialibSelector_t)selector;
+        uint32_t parent_node = 0;
+        if (parent) {
+            const ml_page_item_t *parent_item = (const ml_page_item_t *)parent;
+            if (parent_item->query_id != q->id) {
+                return; // the content has changed since the parent was returned
+            }
+            parent_node = parent_item->node;
+        }
 
-        switch (index) {
-        case SEL_ALBUMS:
-            coll = &source->db.albums;
-            break;
-        case SEL_ARTISTS:
-            coll = &source->db.artists;
-            break;
-        case SEL_GENRES:
-            coll = &source->db.genres;
-            break;
-        case SEL_FOLDERS:
-            break;
-        default:
-            return;
+        // the cursor is the query id in the high bits, and the index of the next node in the low bits
+        uint32_t idx = q->nodes[parent_node].first_child;
+        if (cursor > 0) {
+            idx = (uint32_t)(cursor & 0xffffffff);
+            if ((cursor >> 32) != (q->id & 0x7fffffff) || idx >= q->count || q->nodes[idx].parent != parent_node) {
+                return;
+            }
+        }
+
+        ddb_medialib_item_t *tail = NULL;
+        for (int i = 0; idx && i < count; i++, idx = q->nodes[idx].next) {
+            ml_page_item_t *item = calloc (1, sizeof (ml_page_item_t));
+            _ml_query_fill_item (q, idx, &item->item);
+            item->query_id = q->id;
+            item->node = idx;
+            if (tail) {
+                tail->next = &item->item;
+            }
+            else {
+                head = &item->item;
+            }
+            tail = &item->item;
         }
 
-        root = _create_item_tree_from_collection(coll, filter, index, source);
+        if (idx) {
+            next = ((q->id & 0x7fffffff) << 32) | idx;
+        }
     });
 
-    return root;
+    *next_cursor = next;
+    return head;
 }
 
 static void
@@ -1562,6 +2528,10 @@ ml_create_source (const char *source_path) {
 
     source->sync_queue = dispatch_queue_create("MediaLibSyncQueue", NULL);
     source->scanner_queue = dispatch_queue_create("MediaLibScanQueue", NULL);
+#if ML_WATCH
+    source->watch_queue = dispatch_queue_create("MediaLibWatchQueue", NULL);
+    source->watch_fd = -1;
+#endif
 
     char conf_name[200];
     snprintf (conf_name, sizeof (conf_name), "%senabled", source->source_conf_prefix);
@@ -1583,14 +2553,25 @@ ml_free_source (ddb_mediasource_source_t _source) {
     });
     printf ("scanner queue finished\n");
 
+    ml_unwatch_folders (source);
+    // the watch changes may have been queued before the watching was stopped
+    dispatch_sync(source->scanner_queue, ^{
+    });
+
     dispatch_release(source->scanner_queue);
     dispatch_release(source->sync_queue);
+#if ML_WATCH
+    dispatch_release(source->watch_queue);
+#endif
 
     if (source->filter_id) {
         deadbeef->unregister_fileadd_filter (source->filter_id);
         source->filter_id = 0;
     }
 
+    // the queues are finished at this point
+    ml_query_cache_clear (source);
+
     if (source->ml_playlist) {
         printf ("free medialib database\n");
         deadbeef->plt_free (source->ml_playlist);
@@ -1716,6 +2697,7 @@ ml_refresh (ddb_mediasource_source_t _source) {
         });
 
         if (conf.medialib_paths == NULL || !enabled) {
+            ml_unwatch_folders (source);
             // content became empty
             ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_CONTENT_DID_CHANGE);
             return;
@@ -1785,6 +2767,7 @@ static ddb_medialib_plugin_t plugin = {
     .insert_folder_at_index = ml_insert_folder_at_index,
     .remove_folder_at_index = ml_remove_folder_at_index,
     .append_folder = ml_append_folder,
+    .get_items_page = ml_get_items_page,
 };
 
 DB_plugin_t *
@@ -27,7 +27,7 @@
 #include "../../deadbeef.h"
 
 #define DDB_MEDIALIB_VERSION_MAJOR 1
-#define DDB_MEDIALIB_VERSION_MINOR 0
+#define DDB_MEDIALIB_VERSION_MINOR 1
 
 typedef enum {
     DDB_MEDIALIB_MEDIASOURCE_EVENT_FOLDERS_DID_CHANGE = 1000,
@@ -58,6 +58,21 @@ typedef struct ddb_medialib_plugin_s {
     void (*remove_folder_at_index) (ddb_mediasource_source_t source, int index);
 
     void (*append_folder) (ddb_mediasource_source_t source, const char *folder);
+
+#pragma mark - Lazy item trees
+
+    /// Get a page of the children of the @c parent item, without their own children.
+    /// This is a lightweight alternative to @c create_item_tree, for showing large libraries:
+    /// the query results are cached per selector and filter, until the content changes,
+    /// and the titles are only formatted for the returned items.
+    /// @param parent: NULL to get the top level items, or an item returned by a previous call with the same selector and filter.
+    /// @param cursor: 0 to get the first page, or the @c next_cursor value from the previous call to get the next page.
+    /// @param count: maximum number of items to return.
+    /// @param next_cursor: out: the cursor of the next page, or -1 when there are no more items.
+    /// @return a list of items, linked via @c next, with @c num_children set and @c children set to NULL.
+    /// NULL if the content has changed since the @c parent or the @c cursor were returned.
+    /// The caller must free the list by calling @c free_item_tree.
+    ddb_medialib_item_t *(*get_items_page) (ddb_mediasource_source_t source, ddb_mediasource_list_selector_t selector, const char *filter, const ddb_medialib_item_t *parent, int64_t cursor, int count, /* out */ int64_t *next_cursor);
 } ddb_medialib_plugin_t;
 
 #endif /* medialib_h */
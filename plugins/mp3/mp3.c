@@ -28,6 +28,7 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include "../../deadbeef.h"
 #include "../../strdupa.h"
 #include "mp3.h"
@@ -57,6 +58,150 @@ FILE *out;
 static DB_decoder_t plugin;
 DB_functions_t *deadbeef;
 
+// {{{ seek index disk cache
+#define SEEK_INDEX_MAGIC "DBMI"
+#define SEEK_INDEX_VERSION 1
+
+// don't cache indexes of short files, which can be rescanned quickly
+#define SEEK_INDEX_MIN_CACHED_POINTS 256
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t interval;
+    uint32_t startoffs;
+    uint32_t endoffs;
+    uint32_t complete;
+    int64_t fsize;
+    int64_t mtime;
+    int64_t count;
+} seek_index_header_t;
+
+static int
+seek_index_stat (const char *fname, struct stat *st) {
+    if (!strncmp (fname, "file://", 7)) {
+        fname += 7;
+    }
+    if (fname[0] != '/' || stat (fname, st) || !S_ISREG (st->st_mode)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+seek_index_cache_path (const char *fname, char *path, size_t size, int create_dir) {
+    const char *cachedir = deadbeef->get_system_dir (DDB_SYS_DIR_CACHE);
+    if (!cachedir) {
+        return -1;
+    }
+    if (create_dir) {
+        mkdir (cachedir, 0755);
+        if (snprintf (path, size, "%s/mp3index", cachedir) >= size) {
+            return -1;
+        }
+        mkdir (path, 0755);
+    }
+
+    uint8_t sig[16];
+    char hash[33];
+    deadbeef->md5 (sig, fname, (int)strlen (fname));
+    deadbeef->md5_to_str (hash, sig);
+    if (snprintf (path, size, "%s/mp3index/%s", cachedir, hash) >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+seek_index_header_init (seek_index_header_t *hdr, mp3_info_t *info, struct stat *st) {
+    memset (hdr, 0, sizeof (seek_index_header_t));
+    memcpy (hdr->magic, SEEK_INDEX_MAGIC, 4);
+    hdr->version = SEEK_INDEX_VERSION;
+    hdr->interval = MP3_SEEK_INDEX_INTERVAL;
+    hdr->startoffs = info->startoffs;
+    hdr->endoffs = info->endoffs;
+    hdr->fsize = st->st_size;
+    hdr->mtime = st->st_mtime;
+}
+
+static void
+seek_index_load (mp3_info_t *info, const char *fname) {
+    struct stat st;
+    char path[PATH_MAX];
+    if (seek_index_stat (fname, &st) || seek_index_cache_path (fname, path, sizeof (path), 0)) {
+        return;
+    }
+
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return;
+    }
+
+    seek_index_header_t expected, hdr;
+    seek_index_header_init (&expected, info, &st);
+    if (fread (&hdr, sizeof (hdr), 1, fp) != 1) {
+        goto error;
+    }
+    expected.complete = hdr.complete;
+    expected.count = hdr.count;
+    if (memcmp (&hdr, &expected, sizeof (hdr)) || hdr.count <= 0 || hdr.count > st.st_size) {
+        goto error;
+    }
+
+    mp3_seek_point_t *points = malloc (hdr.count * sizeof (mp3_seek_point_t));
+    if (!points) {
+        goto error;
+    }
+    if (fread (points, sizeof (mp3_seek_point_t), hdr.count, fp) != hdr.count) {
+        free (points);
+        goto error;
+    }
+
+    mp3_seek_index_free (&info->seek_index);
+    info->seek_index.points = points;
+    info->seek_index.count = hdr.count;
+    info->seek_index.size = hdr.count;
+    info->seek_index.complete = hdr.complete;
+    trace ("mp3: loaded seek index with %lld points for %s\n", (long long)hdr.count, fname);
+error:
+    fclose (fp);
+}
+
+static void
+seek_index_save (mp3_info_t *info, const char *fname) {
+    struct stat st;
+    char path[PATH_MAX];
+    char temp[PATH_MAX];
+    if (seek_index_stat (fname, &st) || seek_index_cache_path (fname, path, sizeof (path), 1)) {
+        return;
+    }
+    if (snprintf (temp, sizeof (temp), "%s.part", path) >= sizeof (temp)) {
+        return;
+    }
+
+    FILE *fp = fopen (temp, "w+b");
+    if (!fp) {
+        return;
+    }
+
+    seek_index_header_t hdr;
+    seek_index_header_init (&hdr, info, &st);
+    hdr.complete = info->seek_index.complete;
+    hdr.count = info->seek_index.count;
+
+    if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1
+        || fwrite (info->seek_index.points, sizeof (mp3_seek_point_t), hdr.count, fp) != hdr.count) {
+        fclose (fp);
+        unlink (temp);
+        return;
+    }
+    fclose (fp);
+    if (rename (temp, path)) {
+        unlink (temp);
+    }
+}
+// }}}
+
 int
 cmp3_seek_stream (DB_fileinfo_t *_info, int sample) {
     mp3_info_t *info = (mp3_info_t *)_info;
@@ -69,7 +214,7 @@ cmp3_seek_stream (DB_fileinfo_t *_info, int sample) {
 #endif
 
     mp3info_t mp3info;
-    int res = mp3_parse_file(&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample);
+    int res = mp3_parse_file_indexed (&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample, &info->seek_index);
 
     if (!res) {
         deadbeef->fseek (info->file, mp3info.packet_offs, SEEK_SET);
@@ -96,7 +241,8 @@ cmp3_open (uint32_t hints) {
     }
 
 #ifndef ANDROID // force 16 bit on android
-    if ((hints & DDB_DECODER_HINT_16BIT) || deadbeef->conf_get_int ("mp3.force16bit", 0))
+    // the force16bit option is ignored when the output is going to be converted back to float
+    if ((hints & DDB_DECODER_HINT_16BIT) || (!(hints & DDB_DECODER_HINT_FLOAT32) && deadbeef->conf_get_int ("mp3.force16bit", 0)))
 #endif
     {
         info->want_16bit = 1;
@@ -255,7 +401,10 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         if (info->startoffs > 0) {
             trace ("mp3: skipping %d(%xH) bytes of junk\n", info->startoffs, info->endoffs);
         }
-        int res = mp3_parse_file(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1);
+        if (deadbeef->conf_get_int ("mp3.seek_index_cache", 0)) {
+            seek_index_load (info, uri);
+        }
+        int res = mp3_parse_file_indexed (&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1, &info->seek_index);
         if (res < 0) {
             trace ("mp3: cmp3_init: initial mp3_parse_file failed\n");
             return -1;
@@ -412,8 +561,17 @@ static void
 cmp3_free (DB_fileinfo_t *_info) {
     mp3_info_t *info = (mp3_info_t *)_info;
     if (info->it) {
+        if (info->seek_index.modified
+            && info->seek_index.count >= SEEK_INDEX_MIN_CACHED_POINTS
+            && deadbeef->conf_get_int ("mp3.seek_index_cache", 0)) {
+            deadbeef->pl_lock ();
+            const char *uri = strdupa (deadbeef->pl_find_meta (info->it, ":URI"));
+            deadbeef->pl_unlock ();
+            seek_index_save (info, uri);
+        }
         deadbeef->pl_item_unref (info->it);
     }
+    mp3_seek_index_free (&info->seek_index);
     if (info->conv_buf) {
         free (info->conv_buf);
     }
@@ -519,17 +677,31 @@ cmp3_seek_sample (DB_fileinfo_t *_info, int sample) {
 
             int r;
 
-            // seek to beginning of the frame
-            int64_t frm = sample / info->mp3info.avg_samples_per_frame;
-            r = deadbeef->fseek (info->file, frm * info->mp3info.avg_packetlength + info->startoffs, SEEK_SET);
+            if (info->mp3info.have_xing_toc && info->mp3info.datasize > 0) {
+                // VBR stream: interpolate the position from the Xing TOC
+                double percent = (double)sample * 100 / info->mp3info.totalsamples;
+                if (percent > 99.999) {
+                    percent = 99.999;
+                }
+                int i = (int)percent;
+                double a = info->mp3info.xing_toc[i];
+                double b = i < 99 ? info->mp3info.xing_toc[i+1] : 256;
+                double pos = (a + (b - a) * (percent - i)) / 256 * info->mp3info.datasize;
+                r = deadbeef->fseek (info->file, (int64_t)pos + info->startoffs, SEEK_SET);
+                info->skipsamples = 0;
+            }
+            else {
+                // seek to beginning of the frame
+                int64_t frm = sample / info->mp3info.avg_samples_per_frame;
+                r = deadbeef->fseek (info->file, frm * info->mp3info.avg_packetlength + info->startoffs, SEEK_SET);
+                info->skipsamples = (int)(sample - frm * info->mp3info.avg_samples_per_frame);
+            }
 
             if (r < 0) {
                 trace ("seek failed!\n");
                 return -1;
             }
 
-            info->skipsamples = (int)(sample - frm * info->mp3info.avg_samples_per_frame);
-
             info->currentsample = sample;
             _info->readpos = (float)(info->currentsample - info->startsample) / info->mp3info.ref_packet.samplerate;
 
@@ -708,6 +880,7 @@ static const char *exts[] = {
 
 static const char settings_dlg[] =
     "property \"Force 16 bit output\" checkbox mp3.force16bit 0;\n"
+    "property \"Remember seek positions of long files\" checkbox mp3.seek_index_cache 0;\n"
 #if defined(USE_LIBMAD) && defined(USE_LIBMPG123)
     "property \"Backend\" select[2] mp3.backend 0 mpg123 mad;\n"
 #endif
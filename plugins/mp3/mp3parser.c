@@ -264,6 +264,8 @@ _check_xing_header (mp3info_t *info, mp3packet_t *packet, uint8_t *buffer, int b
         if (buffer_size < 100) {
             return -1;
         }
+        memcpy (info->xing_toc, buffer, 100);
+        info->have_xing_toc = 1;
         buffer += 100;
         buffer_size -= 100;
     }
@@ -400,8 +402,62 @@ _packet_same_fmt (mp3packet_t *ref_packet, mp3packet_t *packet) {
         && packet->ver == ref_packet->ver;
 }
 
+const mp3_seek_point_t *
+mp3_seek_index_lookup (const mp3_seek_index_t *index, int64_t sample) {
+    if (!index->count || index->points[0].pcmsample > sample) {
+        return NULL;
+    }
+
+    int64_t l = 0;
+    int64_t r = index->count - 1;
+    while (l < r) {
+        int64_t m = (l + r + 1) / 2;
+        if (index->points[m].pcmsample <= sample) {
+            l = m;
+        }
+        else {
+            r = m - 1;
+        }
+    }
+    return &index->points[l];
+}
+
+static void
+_seek_index_add (mp3_seek_index_t *index, int64_t packet_idx, mp3packet_t *packet, int64_t pcmsample) {
+    if (packet_idx % MP3_SEEK_INDEX_INTERVAL || packet_idx / MP3_SEEK_INDEX_INTERVAL != index->count) {
+        return;
+    }
+    if (index->count && index->points[index->count-1].offs >= packet->offs) {
+        return;
+    }
+    if (index->count == index->size) {
+        int64_t size = index->size ? index->size * 2 : 1024;
+        mp3_seek_point_t *points = realloc (index->points, size * sizeof (mp3_seek_point_t));
+        if (!points) {
+            return;
+        }
+        index->points = points;
+        index->size = size;
+    }
+    index->points[index->count].pcmsample = pcmsample;
+    index->points[index->count].offs = packet->offs;
+    index->count++;
+    index->modified = 1;
+}
+
+void
+mp3_seek_index_free (mp3_seek_index_t *index) {
+    free (index->points);
+    memset (index, 0, sizeof (mp3_seek_index_t));
+}
+
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample) {
+    return mp3_parse_file_indexed (info, flags, fp, fsize, startoffs, endoffs, seek_to_sample, NULL);
+}
+
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seek_index_t *index) {
 #if PERFORMANCE_STATS
     struct timeval start_tv;
     struct timeval end_tv;
@@ -422,7 +478,29 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
 
     int err = -1;
 
-    deadbeef->fseek (fp, startoffs, SEEK_SET);
+    int64_t offs = startoffs;
+
+    // number of valid packets processed, and their total sample count, counting from startoffs
+    int64_t packet_idx = 0;
+    int64_t packet_pcmsample = 0;
+
+    if (fsize < 0 || fp->vfs->is_streaming ()) {
+        index = NULL;
+    }
+
+    if (index && seek_to_sample > 0) {
+        const mp3_seek_point_t *pt = mp3_seek_index_lookup (index, seek_to_sample);
+        if (pt) {
+            // the indexed packets are always past the Xing/Info packet
+            offs = pt->offs;
+            info->pcmsample = pt->pcmsample;
+            info->checked_xing_header = 1;
+            packet_idx = (pt - index->points) * MP3_SEEK_INDEX_INTERVAL;
+            packet_pcmsample = pt->pcmsample;
+        }
+    }
+
+    deadbeef->fseek (fp, offs, SEEK_SET);
     info->num_seeks++;
 
     int64_t datasize = fsize;
@@ -438,8 +516,7 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
 
     mp3packet_t packet;
 
-    int64_t offs = startoffs;
-    int64_t fileoffs = startoffs;
+    int64_t fileoffs = offs;
 
     int prev_br = -1;
     int prev_length = -1;
@@ -453,6 +530,9 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
         }
 
         if (readsize <= 0) {
+            if (index && info->valid_packets) {
+                index->complete = 1;
+            }
             break;
         }
 
@@ -509,6 +589,9 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
             // EOF
             if (fsize >= 0 && offs + res > fsize - endoffs) {
                 if (info->valid_packets) {
+                    if (index) {
+                        index->complete = 1;
+                    }
                     goto end;
                 }
                 else {
@@ -560,6 +643,10 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
             }
 
             if (!got_xing) {
+                if (index) {
+                    _seek_index_add (index, packet_idx, &packet, packet_pcmsample);
+                }
+
                 // interrupt if the current packet contains the sample being seeked to
                 if (seek_to_sample > 0 && info->pcmsample+packet.samples_per_frame >= seek_to_sample) {
                     goto end;
@@ -568,6 +655,8 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
                 if (_process_packet (info, &packet, seek_to_sample) > 0) {
                     goto end;
                 }
+                packet_idx++;
+                packet_pcmsample += packet.samples_per_frame;
                 memcpy (&info->prev_packet, &packet, sizeof (packet));
             }
 
@@ -70,6 +70,8 @@ typedef struct {
 
     int have_xing_header;
     int have_xing_nframes;
+    int have_xing_toc;
+    uint8_t xing_toc[100]; // byte positions at each percent of duration, in 1/256 of datasize
     int vbr_type;
 
     // FIXME: these fields should be filled/used only for network streams of finite length
@@ -99,6 +101,23 @@ typedef struct {
     uint64_t bytes_read;
 } mp3info_t;
 
+// Seek index: stream positions of every MP3_SEEK_INDEX_INTERVAL-th packet,
+// collected while scanning, so that subsequent seeks don't need to rescan from the start.
+#define MP3_SEEK_INDEX_INTERVAL 32
+
+typedef struct {
+    int64_t pcmsample; // sample position at the start of the packet
+    int64_t offs; // stream position of the packet
+} mp3_seek_point_t;
+
+typedef struct {
+    mp3_seek_point_t *points;
+    int64_t count;
+    int64_t size; // number of allocated points
+    int complete; // set to 1 when the whole stream has been indexed
+    int modified; // set to 1 when new points have been added
+} mp3_seek_index_t;
+
 // Params:
 // seek_to_sample: -1 means to the end (scan whole file), otherwise a sample to seek to
 // When seeking, the packet offset returned will be the one containing seek_to_sample, not accounting for delay.
@@ -114,4 +133,18 @@ typedef struct {
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample);
 
+// Same as mp3_parse_file, but uses the index to start seeking from the nearest known packet,
+// and adds the packets found while scanning to the index.
+// The index must be used with the same startoffs/endoffs on every call.
+// index can be NULL.
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seek_index_t *index);
+
+// Returns the last indexed packet starting at or before the sample, or NULL
+const mp3_seek_point_t *
+mp3_seek_index_lookup (const mp3_seek_index_t *index, int64_t sample);
+
+void
+mp3_seek_index_free (mp3_seek_index_t *index);
+
 #endif /* mp3parser_h */
@@ -458,14 +458,12 @@ opusdec_read (DB_fileinfo_t *_info, char *bytes, int size) {
             break;
         }
         else if (ret > 0) {
+            float *ptr = (float *)bytes + samples_read*_info->fmt.channels;
+            const float *channels[_info->fmt.channels];
             for (int channel = 0; channel < _info->fmt.channels; channel++) {
-                const float *pcm_channel = &pcm[info->channelmap ? info->channelmap[channel] : channel];
-                float *ptr = ((float *)bytes + samples_read*_info->fmt.channels) + channel;
-                for (int sample = 0; sample < ret; sample ++, pcm_channel += _info->fmt.channels) {
-                    *ptr = *pcm_channel;
-                    ptr += _info->fmt.channels;
-                }
+                channels[channel] = &pcm[info->channelmap ? info->channelmap[channel] : channel];
             }
+            deadbeef->pcm_interleave_float32 ((char *)ptr, 32, 1, channels, _info->fmt.channels, _info->fmt.channels, ret);
             samples_read += ret;
         }
     }
@@ -22,10 +22,10 @@
 #  include "../../config.h"
 #endif
 
-#include <pulse/simple.h>
-#include <pulse/error.h>
+#include <pulse/pulseaudio.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #ifdef __linux__
@@ -45,12 +45,24 @@ DB_functions_t * deadbeef;
 // value has different meaning.
 #define CONFSTR_PULSE_SERVERADDR "pulse.serveraddr2"
 #define CONFSTR_PULSE_BUFFERSIZE "pulse.buffersize"
+#define CONFSTR_PULSE_LATENCY "pulse.latency"
 #define PULSE_DEFAULT_BUFFERSIZE 4096
+#define PULSE_DEFAULT_LATENCY 250
+
+// How long to wait before asking the streamer again, when it had no data
+#define PULSE_RETRY_MIN_USEC 5000
+#define PULSE_RETRY_MAX_USEC 50000
 
 static intptr_t pulse_tid;
 static int pulse_terminate;
 
-static pa_simple *s;
+// All the pa_* objects below are protected by the mainloop lock.
+// The lock order is: mutex, then mainloop lock.
+static pa_threaded_mainloop *mainloop;
+static pa_context *context;
+static pa_stream *stream;
+static pa_time_event *retry_event;
+
 static pa_sample_spec ss;
 static int _setformat_requested;
 static ddb_waveformat_t requested_fmt;
@@ -59,8 +71,239 @@ static uintptr_t mutex;
 static int in_callback;
 
 static int buffer_size;
+static char *write_buffer;
+static int write_buffer_size;
+
+static int underrun_count;
+
+static void pulse_thread(void *ctx);
+
+#pragma mark - Callbacks
+
+// Callbacks run on the mainloop thread, with the mainloop lock held.
+// They never call into the streamer, only wake up pulse_thread.
 
-static void pulse_thread(void *context);
+static void
+_context_state_cb (pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static void
+_stream_state_cb (pa_stream *s, void *userdata) {
+    pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static void
+_stream_write_cb (pa_stream *s, size_t nbytes, void *userdata) {
+    pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static void
+_stream_success_cb (pa_stream *s, int success, void *userdata) {
+    pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static pa_usec_t
+_stream_get_latency (void) {
+    pa_usec_t latency = 0;
+    int negative = 0;
+    if (!stream || pa_stream_get_latency (stream, &latency, &negative) < 0 || negative) {
+        return 0;
+    }
+    return latency;
+}
+
+static void
+_stream_underflow_cb (pa_stream *s, void *userdata) {
+    underrun_count++;
+    trace ("pulse: underrun #%d, latency %d usec\n", underrun_count, (int)_stream_get_latency ());
+}
+
+static void
+_retry_cb (pa_mainloop_api *api, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    api->time_free (e);
+    retry_event = NULL;
+    pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+// Wake up pulse_thread after a while, if the streamer couldn't provide data.
+// The delay is derived from the amount of audio still queued in the server,
+// so that the retry happens well before the buffer runs out.
+static void
+_schedule_retry (void) {
+    if (retry_event || !context) {
+        return;
+    }
+    pa_usec_t delay = _stream_get_latency () / 4;
+    if (delay < PULSE_RETRY_MIN_USEC) {
+        delay = PULSE_RETRY_MIN_USEC;
+    }
+    else if (delay > PULSE_RETRY_MAX_USEC) {
+        delay = PULSE_RETRY_MAX_USEC;
+    }
+    retry_event = pa_context_rttime_new (context, pa_rtclock_now () + delay, _retry_cb, NULL);
+}
+
+#pragma mark - Connection
+
+// Wait for the operation to complete, with the mainloop lock held.
+static void
+_wait_operation (pa_operation *op) {
+    if (!op) {
+        return;
+    }
+    while (pa_operation_get_state (op) == PA_OPERATION_RUNNING) {
+        pa_threaded_mainloop_wait (mainloop);
+    }
+    pa_operation_unref (op);
+}
+
+static void
+_stream_free (void) {
+    if (!stream) {
+        return;
+    }
+    pa_stream_set_state_callback (stream, NULL, NULL);
+    pa_stream_set_write_callback (stream, NULL, NULL);
+    pa_stream_set_underflow_callback (stream, NULL, NULL);
+    pa_stream_disconnect (stream);
+    pa_stream_unref (stream);
+    stream = NULL;
+}
+
+static int
+_context_connect (void) {
+    char server[1000];
+
+    // migrate from 0.7.x
+    deadbeef->conf_lock ();
+    int has_server2 = deadbeef->conf_get_str_fast (CONFSTR_PULSE_SERVERADDR, NULL) != NULL;
+    deadbeef->conf_unlock ();
+
+    if (!has_server2) {
+        deadbeef->conf_get_str ("pulse.serveraddr", "", server, sizeof (server));
+        // convert default
+        if (!strcasecmp (server, "default")) {
+            *server = 0;
+        }
+    }
+    else {
+        deadbeef->conf_get_str (CONFSTR_PULSE_SERVERADDR, "", server, sizeof (server));
+    }
+
+    mainloop = pa_threaded_mainloop_new ();
+    if (!mainloop) {
+        return -1;
+    }
+
+    context = pa_context_new (pa_threaded_mainloop_get_api (mainloop), "Deadbeef");
+    if (!context) {
+        return -1;
+    }
+    pa_context_set_state_callback (context, _context_state_cb, NULL);
+
+    if (pa_context_connect (context, *server ? server : NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+        fprintf (stderr, "pa_context_connect failed: %s\n", pa_strerror (pa_context_errno (context)));
+        return -1;
+    }
+
+    pa_threaded_mainloop_lock (mainloop);
+    if (pa_threaded_mainloop_start (mainloop) < 0) {
+        pa_threaded_mainloop_unlock (mainloop);
+        return -1;
+    }
+    pa_threaded_mainloop_set_name (mainloop, "deadbeef-pulse-ml");
+
+    pa_context_state_t st;
+    while ((st = pa_context_get_state (context)) != PA_CONTEXT_READY && PA_CONTEXT_IS_GOOD (st)) {
+        pa_threaded_mainloop_wait (mainloop);
+    }
+    pa_threaded_mainloop_unlock (mainloop);
+
+    if (st != PA_CONTEXT_READY) {
+        fprintf (stderr, "pulse: failed to connect to server: %s\n", pa_strerror (pa_context_errno (context)));
+        return -1;
+    }
+    return 0;
+}
+
+static void
+_context_disconnect (void) {
+    if (mainloop) {
+        pa_threaded_mainloop_stop (mainloop);
+    }
+    if (retry_event) {
+        pa_threaded_mainloop_get_api (mainloop)->time_free (retry_event);
+        retry_event = NULL;
+    }
+    _stream_free ();
+    if (context) {
+        pa_context_set_state_callback (context, NULL, NULL);
+        pa_context_disconnect (context);
+        pa_context_unref (context);
+        context = NULL;
+    }
+    if (mainloop) {
+        pa_threaded_mainloop_free (mainloop);
+        mainloop = NULL;
+    }
+}
+
+// Create a playback stream for ss, and wait until it's ready.
+// Must be called with the mainloop lock held.
+static int
+_stream_connect (const pa_channel_map *channel_map, int corked) {
+    _stream_free ();
+
+    stream = pa_stream_new (context, "Music", &ss, channel_map);
+    if (!stream) {
+        return -1;
+    }
+
+    pa_stream_set_state_callback (stream, _stream_state_cb, NULL);
+    pa_stream_set_write_callback (stream, _stream_write_cb, NULL);
+    pa_stream_set_underflow_callback (stream, _stream_underflow_cb, NULL);
+
+    buffer_size = deadbeef->conf_get_int (CONFSTR_PULSE_BUFFERSIZE, PULSE_DEFAULT_BUFFERSIZE);
+    int latency = deadbeef->conf_get_int (CONFSTR_PULSE_LATENCY, PULSE_DEFAULT_LATENCY);
+    if (latency < 10) {
+        latency = 10;
+    }
+
+    // The server asks for more data whenever the queued amount drops below
+    // tlength - minreq, and never asks for less than minreq bytes.
+    pa_buffer_attr attr;
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = (uint32_t)pa_usec_to_bytes ((pa_usec_t)latency * PA_USEC_PER_MSEC, &ss);
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = (uint32_t)buffer_size;
+    attr.fragsize = (uint32_t)-1;
+
+    pa_stream_flags_t flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING;
+    if (corked) {
+        flags |= PA_STREAM_START_CORKED;
+    }
+
+    // TODO: where list of all available devices? add this option to config too..
+    if (pa_stream_connect_playback (stream, NULL, &attr, flags, NULL, NULL) < 0) {
+        return -1;
+    }
+
+    pa_stream_state_t st;
+    while ((st = pa_stream_get_state (stream)) != PA_STREAM_READY && PA_STREAM_IS_GOOD (st)) {
+        pa_threaded_mainloop_wait (mainloop);
+    }
+
+    if (st != PA_STREAM_READY) {
+        return -1;
+    }
+
+    const pa_buffer_attr *a = pa_stream_get_buffer_attr (stream);
+    if (a) {
+        trace ("pulse: tlength=%u minreq=%u\n", a->tlength, a->minreq);
+    }
+    return 0;
+}
 
 static int pulse_set_spec(ddb_waveformat_t *fmt)
 {
@@ -108,47 +351,18 @@ static int pulse_set_spec(ddb_waveformat_t *fmt)
         return -1;
     };
 
-    if (s) {
-        pa_simple_free(s);
-    }
-
-    pa_buffer_attr * attr = NULL;
-    //attr->maxlength = Maximum length of the buffer.
-    //attr->tlength = Playback only: target length of the buffer.
-    //attr->prebuf = Playback only: pre-buffering.
-    //attr->minreq = Playback only: minimum request.
-    //attr->fragsize = Recording only: fragment size.
-
-    buffer_size = deadbeef->conf_get_int(CONFSTR_PULSE_BUFFERSIZE, PULSE_DEFAULT_BUFFERSIZE);
-
-    // TODO: where list of all available devices? add this option to config too..
-    char * dev = NULL;
-
-    int error;
-
-    // Read serveraddr from config
-    char server[1000];
-
-    // migrate from 0.7.x
-    deadbeef->conf_lock ();
-    int has_server2 = deadbeef->conf_get_str_fast (CONFSTR_PULSE_SERVERADDR, NULL) != NULL;
-    deadbeef->conf_unlock ();
-
-    if (!has_server2) {
-        deadbeef->conf_get_str ("pulse.serveraddr", "", server, sizeof (server));
-        // convert default
-        if (!strcasecmp (server, "default")) {
-            *server = 0;
-        }
-    }
-    else {
-        deadbeef->conf_get_str (CONFSTR_PULSE_SERVERADDR, "", server, sizeof (server));
+    if (!context && _context_connect () < 0) {
+        _context_disconnect ();
+        return -1;
     }
 
+    pa_threaded_mainloop_lock (mainloop);
+    int corked = state != DDB_PLAYBACK_STATE_PLAYING;
+    int res;
     for (;;) {
-        s = pa_simple_new(*server ? server : NULL, "Deadbeef", PA_STREAM_PLAYBACK, dev, "Music", &ss, &channel_map, attr, &error);
+        res = _stream_connect (&channel_map, corked);
 
-        if (s != NULL || ss.rate <= 192000) {
+        if (res == 0 || ss.rate <= 192000) {
             break;
         }
 
@@ -157,16 +371,18 @@ static int pulse_set_spec(ddb_waveformat_t *fmt)
         ss.rate = plugin.fmt.samplerate = 192000;
     }
 
-    if (s == NULL)
+    if (res < 0)
     {
-        const char *strerr = pa_strerror (error);
-        fprintf (stderr, "pa_simple_new failed: %s\n", strerr);
-        return -1;
+        fprintf (stderr, "pulse: failed to create stream: %s\n", pa_strerror (pa_context_errno (context)));
+        _stream_free ();
     }
+    pa_threaded_mainloop_unlock (mainloop);
 
-    return 0;
+    return res;
 }
 
+#pragma mark - Output API
+
 static int
 pulse_init(void) {
     trace ("pulse_init\n");
@@ -182,7 +398,10 @@ pulse_init(void) {
         memcpy (&plugin.fmt, &requested_fmt, sizeof (ddb_waveformat_t));
     }
 
+    underrun_count = 0;
+
     if (0 != pulse_set_spec(&plugin.fmt)) {
+        _context_disconnect ();
         deadbeef->mutex_unlock (mutex);
         return -1;
     }
@@ -236,6 +455,9 @@ static int pulse_free(void)
     }
 
     pulse_terminate = 1;
+    pa_threaded_mainloop_lock (mainloop);
+    pa_threaded_mainloop_signal (mainloop, 0);
+    pa_threaded_mainloop_unlock (mainloop);
     deadbeef->mutex_unlock(mutex);
 
     deadbeef->thread_join(pulse_tid);
@@ -243,6 +465,20 @@ static int pulse_free(void)
     return 0;
 }
 
+// Cork or uncork the stream, and wake up pulse_thread.
+static void
+_stream_set_corked (int corked, int flush) {
+    pa_threaded_mainloop_lock (mainloop);
+    if (stream) {
+        if (flush) {
+            _wait_operation (pa_stream_flush (stream, _stream_success_cb, NULL));
+        }
+        _wait_operation (pa_stream_cork (stream, corked, _stream_success_cb, NULL));
+    }
+    pa_threaded_mainloop_signal (mainloop, 0);
+    pa_threaded_mainloop_unlock (mainloop);
+}
+
 static int pulse_play(void)
 {
     trace ("pulse_play\n");
@@ -256,8 +492,8 @@ static int pulse_play(void)
         }
     }
 
-    pa_simple_flush (s, NULL);
     state = DDB_PLAYBACK_STATE_PLAYING;
+    _stream_set_corked (0, 1);
     deadbeef->mutex_unlock (mutex);
 
     return 0;
@@ -273,8 +509,20 @@ static int pulse_stop(void)
 static int pulse_pause(void)
 {
     trace ("pulse_pause\n");
-    pulse_free();
+    deadbeef->mutex_lock (mutex);
+    if (!pulse_tid)
+    {
+        if (pulse_init () < 0)
+        {
+            deadbeef->mutex_unlock (mutex);
+            return -1;
+        }
+    }
+
+    // keep the connection, so that unpause is instant
     state = DDB_PLAYBACK_STATE_PAUSED;
+    _stream_set_corked (1, 0);
+    deadbeef->mutex_unlock (mutex);
     return 0;
 }
 
@@ -284,12 +532,13 @@ static int pulse_unpause(void)
     deadbeef->mutex_lock (mutex);
     if (state == DDB_PLAYBACK_STATE_PAUSED)
     {
-        if (pulse_init () < 0)
+        if (!pulse_tid && pulse_init () < 0)
         {
             deadbeef->mutex_unlock (mutex);
             return -1;
         }
         state = DDB_PLAYBACK_STATE_PLAYING;
+        _stream_set_corked (0, 0);
     }
 
     deadbeef->mutex_unlock (mutex);
@@ -297,25 +546,24 @@ static int pulse_unpause(void)
     return 0;
 }
 
-static void pulse_thread(void *context)
+#pragma mark - Playback thread
+
+// Sleeps until the server requests more data, then fills the request from
+// the streamer. The streamer is never called with the mainloop lock held,
+// since the streamer may be locked by a thread waiting for that lock.
+static void pulse_thread(void *ctx)
 {
 #ifdef __linux__
     prctl(PR_SET_NAME, "deadbeef-pulse", 0, 0, 0, 0);
 #endif
 
     trace ("pulse thread started \n");
-    while (!pulse_terminate)
+    for (;;)
     {
-        if (state != DDB_PLAYBACK_STATE_PLAYING || !deadbeef->streamer_ok_to_read (-1))
-        {
-            usleep(10000);
-            continue;
-        }
-
         // setformat
         deadbeef->mutex_lock (mutex);
         int res = 0;
-        if (_setformat_requested) {
+        if (_setformat_requested && !pulse_terminate) {
             res = _setformat_apply ();
         }
         if (res != 0) {
@@ -326,46 +574,84 @@ static void pulse_thread(void *context)
         }
         deadbeef->mutex_unlock(mutex);
 
-        int sample_size = plugin.fmt.channels * (plugin.fmt.bps / 8);
-        char buf[buffer_size];
+        pa_threaded_mainloop_lock (mainloop);
+        size_t nbytes = 0;
+        while (!pulse_terminate && !_setformat_requested) {
+            if (state == DDB_PLAYBACK_STATE_PLAYING
+                && stream
+                && pa_stream_get_state (stream) == PA_STREAM_READY
+                && !pa_stream_is_corked (stream)) {
+                nbytes = pa_stream_writable_size (stream);
+                if (nbytes != (size_t)-1 && nbytes > 0) {
+                    break;
+                }
+                nbytes = 0;
+            }
+            pa_threaded_mainloop_wait (mainloop);
+        }
+        pa_threaded_mainloop_unlock (mainloop);
 
-        in_callback = 1;
-        int bytesread = deadbeef->streamer_read(buf, buffer_size);
-        in_callback = 0;
         if (pulse_terminate) {
             break;
         }
-        if (bytesread < 0) {
-            bytesread = 0;
+        if (!nbytes) {
+            continue;
         }
 
-        int error;
+        int sample_size = plugin.fmt.channels * (plugin.fmt.bps / 8);
+        int size = (int)(nbytes < buffer_size ? nbytes : buffer_size);
+        size -= size % sample_size;
+        if (size <= 0) {
+            size = sample_size;
+        }
 
-        res = 0;
-        if (bytesread > 0) {
-            deadbeef->mutex_lock (mutex);
-            res = pa_simple_write(s, buf, bytesread, &error);
-            deadbeef->mutex_unlock(mutex);
+        if (write_buffer_size < size) {
+            free (write_buffer);
+            write_buffer = malloc (size);
+            write_buffer_size = size;
         }
 
+        int bytesread = 0;
+        if (deadbeef->streamer_ok_to_read (-1)) {
+            in_callback = 1;
+            bytesread = deadbeef->streamer_read(write_buffer, size);
+            in_callback = 0;
+        }
         if (pulse_terminate) {
             break;
         }
 
-        if (res < 0)
-        {
-            usleep(10000);
+        pa_threaded_mainloop_lock (mainloop);
+        if (bytesread > 0 && stream && !_setformat_requested) {
+            if (pa_stream_write (stream, write_buffer, bytesread, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+                trace ("pa_stream_write failed: %s\n", pa_strerror (pa_context_errno (pa_stream_get_context (stream))));
+                _schedule_retry ();
+                pa_threaded_mainloop_wait (mainloop);
+            }
         }
+        else if (bytesread <= 0) {
+            // buffering or starving: don't spin, try again later
+            _schedule_retry ();
+            pa_threaded_mainloop_wait (mainloop);
+        }
+        pa_threaded_mainloop_unlock (mainloop);
     }
 
     deadbeef->mutex_lock (mutex);
     state = DDB_PLAYBACK_STATE_STOPPED;
-    if (s)
+    if (mainloop)
     {
-        pa_simple_drain (s, NULL);
-        pa_simple_free(s);
-        s = NULL;
+        pa_threaded_mainloop_lock (mainloop);
+        if (stream && pa_stream_get_state (stream) == PA_STREAM_READY && !pa_stream_is_corked (stream)) {
+            _wait_operation (pa_stream_drain (stream, _stream_success_cb, NULL));
+        }
+        pa_threaded_mainloop_unlock (mainloop);
+        trace ("pulse: %d underruns\n", underrun_count);
+        _context_disconnect ();
     }
+    free (write_buffer);
+    write_buffer = NULL;
+    write_buffer_size = 0;
     pulse_terminate = 0;
     pulse_tid = 0;
     deadbeef->mutex_unlock (mutex);
@@ -402,7 +688,8 @@ DB_plugin_t * pulse_load(DB_functions_t *api)
 
 static const char settings_dlg[] =
     "property \"PulseAudio server (leave empty for default)\" entry " CONFSTR_PULSE_SERVERADDR " \"\";\n"
-    "property \"Preferred buffer size\" entry " CONFSTR_PULSE_BUFFERSIZE " " STR(PULSE_DEFAULT_BUFFERSIZE) ";\n";
+    "property \"Preferred buffer size\" entry " CONFSTR_PULSE_BUFFERSIZE " " STR(PULSE_DEFAULT_BUFFERSIZE) ";\n"
+    "property \"Target latency (ms)\" entry " CONFSTR_PULSE_LATENCY " " STR(PULSE_DEFAULT_LATENCY) ";\n";
 
 static DB_output_t plugin =
 {
@@ -49,8 +49,8 @@ typedef struct {
     ebur128_state **peak_state;
 } track_state_t;
 
-void
-rg_calc_thread(void *ctx) {
+static void
+rg_calc_job (ddb_job_t *job, void *ctx) {
     DB_decoder_t *dec = NULL;
     DB_fileinfo_t *fileinfo = NULL;
 
@@ -58,7 +58,7 @@ rg_calc_thread(void *ctx) {
     float *bufferf = NULL;
 
     track_state_t *st = (track_state_t *)ctx;
-    if (st->settings->pabort && *(st->settings->pabort)) {
+    if ((st->settings->pabort && *(st->settings->pabort)) || deadbeef->job_is_cancelled (job)) {
         return;
     }
     if (deadbeef->pl_get_item_duration (st->settings->tracks[st->track_index]) <= 0) {
@@ -290,8 +290,8 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
     gain_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
     peak_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
 
-    // used for joining threads
-    intptr_t *rg_threads = calloc (settings->num_tracks, sizeof (intptr_t));
+    // used for waiting for the jobs
+    ddb_job_t **rg_jobs = calloc (settings->num_tracks, sizeof (ddb_job_t *));
     track_state_t *track_states = calloc (settings->num_tracks, sizeof (track_state_t));
 
     // calculate gain for each track and album
@@ -299,11 +299,12 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
         if (settings->progress_callback) {
             settings->progress_callback (i, settings->progress_cb_user_data);
         }
-        // limit number of parallel threads
+        // limit number of parallel jobs
         if (i >= settings->num_threads) {
-            // simple blocking mechanism: join the 'oldest' thread
-            deadbeef->thread_join(rg_threads[i - settings->num_threads]);
-            rg_threads[i - settings->num_threads] = 0;
+            // simple blocking mechanism: wait for the 'oldest' job
+            deadbeef->job_wait (rg_jobs[i - settings->num_threads]);
+            deadbeef->job_release (rg_jobs[i - settings->num_threads]);
+            rg_jobs[i - settings->num_threads] = NULL;
         }
 
         if (settings->pabort && *(settings->pabort)) {
@@ -316,18 +317,19 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
         track_states[i].gain_state = gain_state;
         track_states[i].peak_state = peak_state;
 
-        // run thread
-        rg_threads[i] = deadbeef->thread_start(&rg_calc_thread, (void*)(&track_states[i]));
+        // run job
+        rg_jobs[i] = deadbeef->job_submit (DDB_JOB_PRIORITY_BACKGROUND, rg_calc_job, (void*)(&track_states[i]));
     }
 
-    // wait for remaining threads to join
+    // wait for remaining jobs to finish
     int remaining_thread_id = settings->num_tracks - settings->num_threads;
     if (remaining_thread_id < 0) {
         remaining_thread_id = 0;
     }
     for (int i = remaining_thread_id; i < settings->num_tracks; ++i) {
-        deadbeef->thread_join(rg_threads[i]);
-        rg_threads[i] = 0;
+        deadbeef->job_wait (rg_jobs[i]);
+        deadbeef->job_release (rg_jobs[i]);
+        rg_jobs[i] = NULL;
 
         if (settings->pabort && *(settings->pabort)) {
             goto cleanup;
@@ -381,18 +383,19 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
     }
 
 cleanup:
-    // free thread storage
-    if (rg_threads) {
-        // join the still-active threads
+    // free job storage
+    if (rg_jobs) {
+        // wait for the still-active jobs
         for (int i = 0; i < settings->num_tracks; i++) {
-            if (rg_threads[i]) {
-                deadbeef->thread_join (rg_threads[i]);
-                rg_threads[i] = 0;
+            if (rg_jobs[i]) {
+                deadbeef->job_wait (rg_jobs[i]);
+                deadbeef->job_release (rg_jobs[i]);
+                rg_jobs[i] = NULL;
             }
         }
 
-        free (rg_threads);
-        rg_threads = NULL;
+        free (rg_jobs);
+        rg_jobs = NULL;
     }
 
     if (track_states) {
@@ -68,7 +68,7 @@ typedef struct {
     // Preferred config variable: rg_scanner.target_db=89
     float ref_loudness;
 
-    // Max number of concurrent threads
+    // Max number of tracks scanned concurrently
     int num_threads;
 
     // Optional pointer to the abort flag; the scanner will abort if the pointed value is non-zero
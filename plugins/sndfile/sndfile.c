@@ -48,7 +48,9 @@ typedef struct {
     int bitrate;
     int sf_format;
     int read_as_short;
+    int read_as_float;
     int sf_need_endswap;
+    uint32_t hints;
 } sndfile_info_t;
 
 // vfs wrapper for sf
@@ -96,6 +98,7 @@ static SF_VIRTUAL_IO vfs = {
 static DB_fileinfo_t *
 sndfile_open (uint32_t hints) {
     sndfile_info_t *info = calloc (sizeof (sndfile_info_t), 1);
+    info->hints = hints;
     return &info->info;
 }
 
@@ -200,8 +203,16 @@ sndfile_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         _info->fmt.bps = 32;
         break;
     default:
-        info->read_as_short = 1;
-        _info->fmt.bps = 16;
+        // compressed formats are decoded by libsndfile
+        if (info->hints & DDB_DECODER_HINT_FLOAT32) {
+            info->read_as_float = 1;
+            _info->fmt.is_float = 1;
+            _info->fmt.bps = 32;
+        }
+        else {
+            info->read_as_short = 1;
+            _info->fmt.bps = 16;
+        }
         trace ("[sndfile] unidentified input format: 0x%X\n", inf.format&SF_FORMAT_SUBMASK);
         break;
     }
@@ -283,6 +294,9 @@ sndfile_read (DB_fileinfo_t *_info, char *bytes, int size) {
     if (info->read_as_short) {
         n = sf_readf_short(info->ctx, (short *)bytes, size/samplesize);
     }
+    else if (info->read_as_float) {
+        n = sf_readf_float(info->ctx, (float *)bytes, size/samplesize);
+    }
     else {
         n = sf_read_raw (info->ctx, (short *)bytes, size);
 
@@ -23,41 +23,397 @@
 
 #include <string.h>
 #include <zip.h>
+#include <zlib.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include "../../deadbeef.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
 
-#define ENABLE_CACHE 1
-
 #define min(x,y) ((x)<(y)?(x):(y))
 
 static DB_functions_t *deadbeef;
 static DB_vfs_t plugin;
 
-#if ENABLE_CACHE
+void
+vfs_zip_close (DB_FILE *f);
+
 #define ZIP_BUFFER_SIZE 8192
-#endif
+#define ZIP_INPUT_BUFFER_SIZE 32768
+
+// number of archives which are kept open after their last file was closed
+#define ZIP_MAX_IDLE_ARCHIVES 4
+
+// distance between the inflate checkpoints, grows as the checkpoint table fills up
+#define ZIP_CHECKPOINT_INTERVAL (1024*1024)
+#define ZIP_MAX_CHECKPOINTS 32
+
+// Opened archives are shared between all files opened from them, and kept open for a while after use,
+// to avoid re-reading the central directory for every file, e.g. when adding the contents of a large zip.
+// libzip handles are not thread safe, so every call on the handle is made with the archive mutex locked.
+typedef struct ddb_zip_archive_s {
+    char *path;
+    time_t mtime;
+    off_t size;
+    struct zip *z;
+    uintptr_t mutex;
+    int refc;
+    int detached; // removed from the list, closed on last release
+    struct ddb_zip_archive_s *next;
+} ddb_zip_archive_t;
+
+static ddb_zip_archive_t *archives;
+static uintptr_t archives_mutex;
+
+typedef enum {
+    ZIP_MODE_GENERIC, // decoded by libzip, seeking backwards reopens the file
+    ZIP_MODE_STORED, // not compressed, seek directly in the archive
+    ZIP_MODE_DEFLATE, // raw data decoded with zlib, seeking restarts from the nearest checkpoint
+} zip_mode_t;
+
+typedef struct {
+    int64_t out_offset;
+    int64_t in_offset;
+    z_stream *strm;
+} zip_checkpoint_t;
 
 typedef struct {
     DB_FILE file;
-    struct zip* z;
+    ddb_zip_archive_t *archive;
     struct zip_file *zf;
     int64_t offset;
     zip_uint64_t index;
     int64_t size;
+    zip_mode_t mode;
+
+    // ZIP_MODE_STORED: position of zf, if different from offset
+    int64_t zf_offset;
+
+    // ZIP_MODE_DEFLATE
+    z_stream strm;
+    int64_t in_offset; // position of zf in the compressed data
+    int64_t out_offset; // number of bytes decoded so far, i.e. the offset of the end of buffer
+    int stream_end;
+    uint8_t *in_buffer;
+    zip_checkpoint_t checkpoints[ZIP_MAX_CHECKPOINTS];
+    int num_checkpoints;
+    int64_t checkpoint_interval;
 
-#if ENABLE_CACHE
     uint8_t buffer[ZIP_BUFFER_SIZE];
     zip_int64_t buffer_remaining;
     int buffer_pos;
-#endif
 } ddb_zip_file_t;
 
 static const char *scheme_names[] = { "zip://", NULL };
 
+// {{{ archive cache
+static void
+_archive_free (ddb_zip_archive_t *a) {
+    trace ("vfs_zip: close archive %s\n", a->path);
+    zip_close (a->z);
+    deadbeef->mutex_free (a->mutex);
+    free (a->path);
+    free (a);
+}
+
+// must be called with archives_mutex locked
+static void
+_archive_trim_idle (void) {
+    int idle = 0;
+    ddb_zip_archive_t *prev = NULL;
+    ddb_zip_archive_t *a = archives;
+    while (a) {
+        ddb_zip_archive_t *next = a->next;
+        if (a->refc == 0 && ++idle > ZIP_MAX_IDLE_ARCHIVES) {
+            if (prev) {
+                prev->next = next;
+            }
+            else {
+                archives = next;
+            }
+            _archive_free (a);
+        }
+        else {
+            prev = a;
+        }
+        a = next;
+    }
+}
+
+// Returns a referenced archive handle, or NULL if the file doesn't exist or is not a zip
+static ddb_zip_archive_t *
+_archive_acquire (const char *path) {
+    struct stat st;
+    if (stat (path, &st) || !S_ISREG (st.st_mode)) {
+        return NULL;
+    }
+
+    deadbeef->mutex_lock (archives_mutex);
+    ddb_zip_archive_t *prev = NULL;
+    for (ddb_zip_archive_t *a = archives; a; prev = a, a = a->next) {
+        if (strcmp (a->path, path)) {
+            continue;
+        }
+        if (prev) {
+            prev->next = a->next;
+        }
+        else {
+            archives = a->next;
+        }
+        if (a->mtime == st.st_mtime && a->size == st.st_size) {
+            // move to front
+            a->refc++;
+            a->next = archives;
+            archives = a;
+            deadbeef->mutex_unlock (archives_mutex);
+            return a;
+        }
+
+        // the archive has changed
+        if (a->refc == 0) {
+            _archive_free (a);
+        }
+        else {
+            a->detached = 1;
+        }
+        break;
+    }
+    deadbeef->mutex_unlock (archives_mutex);
+
+    struct zip *z = zip_open (path, 0, NULL);
+    if (!z) {
+        return NULL;
+    }
+
+    ddb_zip_archive_t *a = calloc (1, sizeof (ddb_zip_archive_t));
+    a->path = strdup (path);
+    a->mtime = st.st_mtime;
+    a->size = st.st_size;
+    a->z = z;
+    a->mutex = deadbeef->mutex_create ();
+    a->refc = 1;
+
+    deadbeef->mutex_lock (archives_mutex);
+    a->next = archives;
+    archives = a;
+    deadbeef->mutex_unlock (archives_mutex);
+
+    return a;
+}
+
+static void
+_archive_release (ddb_zip_archive_t *a) {
+    deadbeef->mutex_lock (archives_mutex);
+    a->refc--;
+    if (a->refc == 0) {
+        if (a->detached) {
+            _archive_free (a);
+        }
+        else {
+            _archive_trim_idle ();
+        }
+    }
+    deadbeef->mutex_unlock (archives_mutex);
+}
+
+static void
+_archive_free_all_idle (void) {
+    deadbeef->mutex_lock (archives_mutex);
+    ddb_zip_archive_t *prev = NULL;
+    ddb_zip_archive_t *a = archives;
+    while (a) {
+        ddb_zip_archive_t *next = a->next;
+        if (a->refc == 0) {
+            if (prev) {
+                prev->next = next;
+            }
+            else {
+                archives = next;
+            }
+            _archive_free (a);
+        }
+        else {
+            prev = a;
+        }
+        a = next;
+    }
+    deadbeef->mutex_unlock (archives_mutex);
+}
+// }}}
+
+// {{{ libzip calls, must be made with the archive mutex locked
+static struct zip_file *
+_zip_fopen (ddb_zip_file_t *f) {
+    return zip_fopen_index (f->archive->z, f->index, f->mode == ZIP_MODE_DEFLATE ? ZIP_FL_COMPRESSED : 0);
+}
+
+static int
+_zip_fseek (struct zip_file *zf, int64_t offset) {
+#if defined(LIBZIP_VERSION_MAJOR) && (LIBZIP_VERSION_MAJOR > 1 || LIBZIP_VERSION_MINOR >= 2)
+    return zip_fseek (zf, offset, SEEK_SET);
+#else
+    return -1;
+#endif
+}
+
+// Positions the entry at the offset, using zip_fseek if the data is seekable,
+// or reopening and reading up to the offset otherwise.
+static int
+_zip_reposition (ddb_zip_file_t *f, int64_t current, int64_t offset) {
+    if (current == offset) {
+        return 0;
+    }
+    if (!_zip_fseek (f->zf, offset)) {
+        return 0;
+    }
+
+    if (offset < current || current < 0) {
+        zip_fclose (f->zf);
+        f->zf = _zip_fopen (f);
+        if (!f->zf) {
+            return -1;
+        }
+        current = 0;
+    }
+
+    char buf[4096];
+    int64_t n = offset - current;
+    while (n > 0) {
+        int64_t sz = min (n, sizeof (buf));
+        zip_int64_t rb = zip_fread (f->zf, buf, sz);
+        if (rb <= 0) {
+            break;
+        }
+        n -= rb;
+    }
+    return n > 0 ? -1 : 0;
+}
+// }}}
+
+// {{{ inflate
+static int
+_inflate_reset (ddb_zip_file_t *f) {
+    if (inflateReset (&f->strm) != Z_OK) {
+        return -1;
+    }
+    f->strm.avail_in = 0;
+    deadbeef->mutex_lock (f->archive->mutex);
+    int res = _zip_reposition (f, f->in_offset, 0);
+    deadbeef->mutex_unlock (f->archive->mutex);
+    f->in_offset = 0;
+    f->out_offset = 0;
+    f->stream_end = 0;
+    return res;
+}
+
+static void
+_inflate_add_checkpoint (ddb_zip_file_t *f) {
+    if (f->num_checkpoints == ZIP_MAX_CHECKPOINTS) {
+        // keep every other checkpoint
+        for (int i = 0; i < ZIP_MAX_CHECKPOINTS; i++) {
+            if (i & 1) {
+                inflateEnd (f->checkpoints[i].strm);
+                free (f->checkpoints[i].strm);
+            }
+            else {
+                f->checkpoints[i/2] = f->checkpoints[i];
+            }
+        }
+        f->num_checkpoints = ZIP_MAX_CHECKPOINTS/2;
+        f->checkpoint_interval *= 2;
+    }
+
+    int64_t last = f->num_checkpoints ? f->checkpoints[f->num_checkpoints-1].out_offset : 0;
+    if (f->out_offset < last + f->checkpoint_interval) {
+        return;
+    }
+
+    z_stream *strm = malloc (sizeof (z_stream));
+    if (inflateCopy (strm, &f->strm) != Z_OK) {
+        free (strm);
+        return;
+    }
+    zip_checkpoint_t *cp = &f->checkpoints[f->num_checkpoints++];
+    cp->out_offset = f->out_offset;
+    cp->in_offset = f->in_offset - f->strm.avail_in;
+    cp->strm = strm;
+    trace ("vfs_zip: checkpoint %d at %lld\n", f->num_checkpoints-1, cp->out_offset);
+}
+
+// Continue decoding from the latest checkpoint before offset
+static int
+_inflate_restore_checkpoint (ddb_zip_file_t *f, int64_t offset) {
+    zip_checkpoint_t *cp = NULL;
+    for (int i = 0; i < f->num_checkpoints && f->checkpoints[i].out_offset <= offset; i++) {
+        cp = &f->checkpoints[i];
+    }
+
+    if (offset >= f->out_offset && (!cp || cp->out_offset <= f->out_offset)) {
+        // decoding forward from the current position is cheaper
+        return 0;
+    }
+
+    if (!cp) {
+        return _inflate_reset (f);
+    }
+
+    trace ("vfs_zip: restore checkpoint at %lld for %lld\n", cp->out_offset, offset);
+    inflateEnd (&f->strm);
+    if (inflateCopy (&f->strm, cp->strm) != Z_OK) {
+        return -1;
+    }
+    f->strm.next_in = f->in_buffer;
+    f->strm.avail_in = 0;
+
+    deadbeef->mutex_lock (f->archive->mutex);
+    int res = _zip_reposition (f, f->in_offset, cp->in_offset);
+    deadbeef->mutex_unlock (f->archive->mutex);
+    f->in_offset = cp->in_offset;
+    f->out_offset = cp->out_offset;
+    f->stream_end = 0;
+    return res;
+}
+
+// Decodes the next chunk into the buffer, returns the number of bytes decoded
+static zip_int64_t
+_inflate_fill_buffer (ddb_zip_file_t *f) {
+    f->strm.next_out = f->buffer;
+    f->strm.avail_out = ZIP_BUFFER_SIZE;
+
+    while (!f->stream_end && f->strm.avail_out == ZIP_BUFFER_SIZE) {
+        if (f->strm.avail_in == 0) {
+            deadbeef->mutex_lock (f->archive->mutex);
+            zip_int64_t rb = zip_fread (f->zf, f->in_buffer, ZIP_INPUT_BUFFER_SIZE);
+            deadbeef->mutex_unlock (f->archive->mutex);
+            if (rb <= 0) {
+                break;
+            }
+            f->in_offset += rb;
+            f->strm.next_in = f->in_buffer;
+            f->strm.avail_in = (uInt)rb;
+        }
+
+        int ret = inflate (&f->strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            f->stream_end = 1;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            trace ("vfs_zip: inflate error %d\n", ret);
+            break;
+        }
+    }
+
+    zip_int64_t rb = ZIP_BUFFER_SIZE - f->strm.avail_out;
+    f->out_offset += rb;
+    if (rb > 0) {
+        _inflate_add_checkpoint (f);
+    }
+    return rb;
+}
+// }}}
+
 const char **
 vfs_zip_get_schemes (void) {
     return scheme_names;
@@ -78,7 +434,7 @@ vfs_zip_open (const char *fname) {
 
     fname += 6;
 
-    struct zip *z = NULL;
+    ddb_zip_archive_t *a = NULL;
     struct zip_stat st;
 
     const char *colon = fname;
@@ -95,8 +451,8 @@ vfs_zip_open (const char *fname) {
 
         colon = colon+1;
 
-        z = zip_open (zipname, 0, NULL);
-        if (!z) {
+        a = _archive_acquire (zipname);
+        if (!a) {
             continue;
         }
         memset (&st, 0, sizeof (st));
@@ -104,32 +460,53 @@ vfs_zip_open (const char *fname) {
         while (*colon == '/') {
             colon++;
         }
-        int res = zip_stat(z, colon, 0, &st);
+        deadbeef->mutex_lock (a->mutex);
+        int res = zip_stat(a->z, colon, 0, &st);
+        deadbeef->mutex_unlock (a->mutex);
         if (res != 0) {
-            zip_close (z);
+            _archive_release (a);
             return NULL;
         }
 
         break;
     }
 
-    if (!z) {
-        return NULL;
-    }
-
-    struct zip_file *zf = zip_fopen_index (z, st.index, 0);
-    if (!zf) {
-        zip_close (z);
+    if (!a) {
         return NULL;
     }
 
-    ddb_zip_file_t *f = malloc (sizeof (ddb_zip_file_t));
-    memset (f, 0, sizeof (ddb_zip_file_t));
+    ddb_zip_file_t *f = calloc (1, sizeof (ddb_zip_file_t));
     f->file.vfs = &plugin;
-    f->z = z;
-    f->zf = zf;
+    f->archive = a;
     f->index = st.index;
     f->size = st.size;
+
+    int encrypted = (st.valid & ZIP_STAT_ENCRYPTION_METHOD) && st.encryption_method != ZIP_EM_NONE;
+    if (!encrypted && (st.valid & ZIP_STAT_COMP_METHOD)) {
+        if (st.comp_method == ZIP_CM_STORE) {
+            f->mode = ZIP_MODE_STORED;
+        }
+        else if (st.comp_method == ZIP_CM_DEFLATE) {
+            f->in_buffer = malloc (ZIP_INPUT_BUFFER_SIZE);
+            if (inflateInit2 (&f->strm, -MAX_WBITS) == Z_OK) {
+                f->mode = ZIP_MODE_DEFLATE;
+                f->checkpoint_interval = ZIP_CHECKPOINT_INTERVAL;
+            }
+            else {
+                free (f->in_buffer);
+                f->in_buffer = NULL;
+            }
+        }
+    }
+
+    deadbeef->mutex_lock (a->mutex);
+    f->zf = _zip_fopen (f);
+    deadbeef->mutex_unlock (a->mutex);
+    if (!f->zf) {
+        vfs_zip_close (&f->file);
+        return NULL;
+    }
+
     trace ("vfs_zip: end open %s\n", fname);
     return (DB_FILE*)f;
 }
@@ -138,26 +515,66 @@ void
 vfs_zip_close (DB_FILE *f) {
     trace ("vfs_zip: close\n");
     ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
+    if (zf->mode == ZIP_MODE_DEFLATE) {
+        inflateEnd (&zf->strm);
+        for (int i = 0; i < zf->num_checkpoints; i++) {
+            inflateEnd (zf->checkpoints[i].strm);
+            free (zf->checkpoints[i].strm);
+        }
+        free (zf->in_buffer);
+    }
     if (zf->zf) {
+        deadbeef->mutex_lock (zf->archive->mutex);
         zip_fclose (zf->zf);
+        deadbeef->mutex_unlock (zf->archive->mutex);
     }
-    if (zf->z) {
-        zip_close (zf->z);
-    }
+    _archive_release (zf->archive);
     free (zf);
 }
 
+static size_t
+_read_stored (void *ptr, size_t sz, ddb_zip_file_t *zf) {
+    zip_int64_t rb = 0;
+    deadbeef->mutex_lock (zf->archive->mutex);
+    if (!_zip_reposition (zf, zf->zf_offset, zf->offset)) {
+        zf->zf_offset = zf->offset;
+        rb = zip_fread (zf->zf, ptr, sz);
+        if (rb < 0) {
+            rb = 0;
+        }
+        zf->zf_offset += rb;
+    }
+    else {
+        // zf is not at a known position anymore
+        zf->zf_offset = -1;
+    }
+    deadbeef->mutex_unlock (zf->archive->mutex);
+    zf->offset += rb;
+    return rb;
+}
+
 size_t
 vfs_zip_read (void *ptr, size_t size, size_t nmemb, DB_FILE *f) {
     ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
 //    printf ("read: %d\n", size*nmemb);
 
     size_t sz = size * nmemb;
-#if ENABLE_CACHE
+    if (zf->mode == ZIP_MODE_STORED) {
+        return _read_stored (ptr, sz, zf) / size;
+    }
+
     while (sz) {
         if (zf->buffer_remaining == 0) {
             zf->buffer_pos = 0;
-            zip_int64_t rb = zip_fread (zf->zf, zf->buffer, ZIP_BUFFER_SIZE);
+            zip_int64_t rb;
+            if (zf->mode == ZIP_MODE_DEFLATE) {
+                rb = _inflate_fill_buffer (zf);
+            }
+            else {
+                deadbeef->mutex_lock (zf->archive->mutex);
+                rb = zip_fread (zf->zf, zf->buffer, ZIP_BUFFER_SIZE);
+                deadbeef->mutex_unlock (zf->archive->mutex);
+            }
             if (rb <= 0) {
                 break;
             }
@@ -171,15 +588,39 @@ vfs_zip_read (void *ptr, size_t size, size_t nmemb, DB_FILE *f) {
         sz -= from_buf;
         ptr += from_buf;
     }
-#else
-    rb = zip_fread (zf->zf, ptr, sz);
-    sz -= rb;
-    zf->offset += rb;
-#endif
 
     return (size * nmemb - sz) / size;
 }
 
+static int
+_seek_deflate (ddb_zip_file_t *zf, int64_t offset) {
+    if (_inflate_restore_checkpoint (zf, offset) < 0) {
+        return -1;
+    }
+    zf->buffer_pos = 0;
+    zf->buffer_remaining = 0;
+    zf->offset = zf->out_offset;
+
+    while (zf->out_offset <= offset) {
+        if (zf->out_offset == offset && (zf->stream_end || offset == zf->size)) {
+            zf->offset = offset;
+            return 0;
+        }
+        zip_int64_t rb = _inflate_fill_buffer (zf);
+        if (rb <= 0) {
+            zf->offset = zf->out_offset;
+            return -1;
+        }
+    }
+
+    // the buffer contains the offset
+    zip_int64_t rb = ZIP_BUFFER_SIZE - zf->strm.avail_out;
+    zf->buffer_pos = (int)(offset - (zf->out_offset - rb));
+    zf->buffer_remaining = zf->out_offset - offset;
+    zf->offset = offset;
+    return 0;
+}
+
 int
 vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
     ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
@@ -192,7 +633,16 @@ vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
         offset = zf->size + offset;
     }
 
-#if ENABLE_CACHE
+    if (offset < 0 || offset > zf->size) {
+        return -1;
+    }
+
+    if (zf->mode == ZIP_MODE_STORED) {
+        // the actual seek happens on next read
+        zf->offset = offset;
+        return 0;
+    }
+
     int64_t offs = offset - zf->offset;
     if ((offs < 0 && -offs <= zf->buffer_pos) || (offs >= 0 && offs < zf->buffer_remaining)) {
         if (offs != 0) {
@@ -222,36 +672,21 @@ vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
 //        printf ("cache miss: abs_offs: %lld, offs: %lld, rem: %d, pos: %d\n", offset, offs, zf->buffer_remaining, zf->buffer_pos);
 //    }
 
-    zf->offset += zf->buffer_remaining;
-#endif
-    if (offset < zf->offset) {
-        // reopen
-        zip_fclose (zf->zf);
-        zf->zf = zip_fopen_index (zf->z, zf->index, 0);
-        if (!zf->zf) {
-            return -1;
-        }
-        zf->offset = 0;
+    if (zf->mode == ZIP_MODE_DEFLATE) {
+        return _seek_deflate (zf, offset);
     }
-#if ENABLE_CACHE
+
+    zf->offset += zf->buffer_remaining;
     zf->buffer_pos = 0;
     zf->buffer_remaining = 0;
-#endif
-    char buf[4096];
-    int64_t n = offset - zf->offset;
-    while (n > 0) {
-        int64_t sz = min (n, sizeof (buf));
-        ssize_t rb = zip_fread (zf->zf, buf, sz);
-        n -= rb;
-        assert (n >= 0);
-        zf->offset += rb;
-        if (rb != sz) {
-            break;
-        }
-    }
-    if (n > 0) {
+
+    deadbeef->mutex_lock (zf->archive->mutex);
+    int res = _zip_reposition (zf, zf->offset, offset);
+    deadbeef->mutex_unlock (zf->archive->mutex);
+    if (res < 0) {
         return -1;
     }
+    zf->offset = offset;
     return 0;
 }
 
@@ -263,14 +698,7 @@ vfs_zip_tell (DB_FILE *f) {
 
 void
 vfs_zip_rewind (DB_FILE *f) {
-    ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
-    zip_fclose (zf->zf);
-    zf->zf = zip_fopen_index (zf->z, zf->index, 0);
-    assert (zf->zf); // FIXME: better error handling?
-    zf->offset = 0;
-#if ENABLE_CACHE
-    zf->buffer_remaining = 0;
-#endif
+    vfs_zip_seek (f, 0, SEEK_SET);
 }
 
 int64_t
@@ -282,13 +710,14 @@ vfs_zip_getlength (DB_FILE *f) {
 int
 vfs_zip_scandir (const char *dir, struct dirent ***namelist, int (*selector) (const struct dirent *), int (*cmp) (const struct dirent **, const struct dirent **)) {
     trace ("vfs_zip_scandir: %s\n", dir);
-    int error;
-    struct zip *z = zip_open (dir, 0, &error);
-    if (!z) {
-        trace ("zip_open failed (code: %d)\n", error);
+    ddb_zip_archive_t *a = _archive_acquire (dir);
+    if (!a) {
+        trace ("zip_open failed\n");
         return -1;
     }
 
+    deadbeef->mutex_lock (a->mutex);
+    struct zip *z = a->z;
     int num_files = 0;
     const int n = zip_get_num_files(z);
     *namelist = malloc(sizeof(void *) * n);
@@ -305,7 +734,8 @@ vfs_zip_scandir (const char *dir, struct dirent ***namelist, int (*selector) (co
         }
     }
 
-    zip_close (z);
+    deadbeef->mutex_unlock (a->mutex);
+    _archive_release (a);
     trace ("vfs_zip: scandir done\n");
     return num_files;
 }
@@ -323,6 +753,22 @@ vfs_zip_get_scheme_for_name (const char *fname) {
     return scheme_names[0];
 }
 
+static int
+vfs_zip_start (void) {
+    archives_mutex = deadbeef->mutex_create ();
+    return 0;
+}
+
+static int
+vfs_zip_stop (void) {
+    if (archives_mutex) {
+        _archive_free_all_idle ();
+        deadbeef->mutex_free (archives_mutex);
+        archives_mutex = 0;
+    }
+    return 0;
+}
+
 static DB_vfs_t plugin = {
     DDB_PLUGIN_SET_API_VERSION
     .plugin.version_major = 1,
@@ -354,6 +800,8 @@ static DB_vfs_t plugin = {
         "3. This notice may not be removed or altered from any source distribution.\n"
     ,
     .plugin.website = "http://deadbeef.sf.net",
+    .plugin.start = vfs_zip_start,
+    .plugin.stop = vfs_zip_stop,
     .open = vfs_zip_open,
     .close = vfs_zip_close,
     .read = vfs_zip_read,
@@ -517,12 +517,11 @@ cvorbis_read (DB_fileinfo_t *_info, char *buffer, int bytes_to_read) {
         }
         else if (ret > 0) {
             float *ptr = (float *)buffer + samples_read*_info->fmt.channels;
-            for (int channel = 0; channel < _info->fmt.channels; channel++, ptr++) {
-                const float *pcm_channel = pcm[info->channel_map ? info->channel_map[channel] : channel];
-                for (int sample = 0; sample < ret; sample++) {
-                    ptr[sample*_info->fmt.channels] = pcm_channel[sample];
-                }
+            const float *channels[_info->fmt.channels];
+            for (int channel = 0; channel < _info->fmt.channels; channel++) {
+                channels[channel] = pcm[info->channel_map ? info->channel_map[channel] : channel];
             }
+            deadbeef->pcm_interleave_float32 ((char *)ptr, 32, 1, channels, 1, _info->fmt.channels, ret);
             samples_read += ret;
         }
 
@@ -255,7 +255,8 @@ project "aac_plugin"
     "plugins/aac/aac_decoder_faad2.c",
     "plugins/aac/aac_decoder_wrap.c",
     "plugins/aac/aac_parser.c",
-    "shared/mp4tagutil.c"
+    "shared/mp4tagutil.c",
+    "shared/mp4sampletable.c"
   }
   links { "faad", "mp4p" }
 end
@@ -282,7 +283,8 @@ project "alac_plugin"
   files {
     "plugins/alac/alac_plugin.c",
     "plugins/alac/alac.c",
-    "shared/mp4tagutil.c"
+    "shared/mp4tagutil.c",
+    "shared/mp4sampletable.c"
   }
   links {"faad", "mp4p"}
 end
@@ -560,13 +562,13 @@ project "oss_plugin"
   }
 end
 
-if option ("plugin-pulse", "libpulse-simple") then
+if option ("plugin-pulse", "libpulse") then
 project "pulse_plugin"
   targetname "pulse"
   files {
     "plugins/pulse/pulse.c"
   }
-  pkgconfig ("libpulse-simple")
+  pkgconfig ("libpulse")
 end
 
 if option ("plugin-sc68") then
@@ -667,6 +669,7 @@ project "vfs_zip"
     "plugins/vfs_zip/vfs_zip.c"
   }
   pkgconfig ("libzip")
+  links {"z"}
 end
 
 if option ("plugin-vtx") then
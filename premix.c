@@ -532,6 +532,11 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     int outputsamplesize = (outputfmt->bps >> 3) * outputfmt->channels;
     int nsamples = inputsize / inputsamplesize;
 
+    if (output && !memcmp (inputfmt, outputfmt, sizeof (ddb_waveformat_t))) {
+        memcpy (output, input, nsamples * outputsamplesize);
+        return nsamples * outputsamplesize;
+    }
+
     // The conversion preserves the speaker mapping,
     // which means that if a channel doesn't map to a speaker in the output -- it will be discarded.
 
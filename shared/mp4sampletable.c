@@ -0,0 +1,188 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mp4sampletable.h"
+
+extern DB_functions_t *deadbeef;
+
+// how many bytes of contiguous samples to read at once
+#define MP4_SAMPLE_TABLE_READ_SIZE (256*1024)
+
+int
+mp4_sample_table_init (mp4_sample_table_t *table, mp4p_atom_t *stbl_atom) {
+    memset (table, 0, sizeof (mp4_sample_table_t));
+
+    if (!stbl_atom) {
+        return -1;
+    }
+
+    mp4p_atom_t *stsc_atom = mp4p_atom_find (stbl_atom, "stbl/stsc");
+    mp4p_atom_t *stsz_atom = mp4p_atom_find (stbl_atom, "stbl/stsz");
+    mp4p_atom_t *stts_atom = mp4p_atom_find (stbl_atom, "stbl/stts");
+    mp4p_atom_t *stco_atom = mp4p_atom_find (stbl_atom, "stbl/co64");
+    if (!stco_atom) {
+        stco_atom = mp4p_atom_find (stbl_atom, "stbl/stco");
+    }
+    if (!stsc_atom || !stsz_atom || !stts_atom || !stco_atom) {
+        return -1;
+    }
+
+    mp4p_stsc_t *stsc = stsc_atom->data;
+    mp4p_stsz_t *stsz = stsz_atom->data;
+    mp4p_stts_t *stts = stts_atom->data;
+    mp4p_stco_t *stco = stco_atom->data;
+
+    if (stsz->number_of_entries == 0 || stsc->number_of_entries == 0) {
+        return -1;
+    }
+
+    table->samples = malloc (stsz->number_of_entries * sizeof (mp4_sample_t));
+    if (!table->samples) {
+        return -1;
+    }
+
+    // offsets and sizes: walk the chunks, advancing through stsc as the chunk index passes first_chunk of the next entry
+    uint32_t sample = 0;
+    uint32_t stsc_index = 0;
+    for (uint32_t chunk = 0; chunk < stco->number_of_entries && sample < stsz->number_of_entries; chunk++) {
+        while (stsc_index + 1 < stsc->number_of_entries && stsc->entries[stsc_index + 1].first_chunk <= chunk + 1) {
+            stsc_index++;
+        }
+
+        uint64_t offset = stco->entries[chunk].offset;
+        uint32_t samples_per_chunk = stsc->entries[stsc_index].samples_per_chunk;
+        for (uint32_t i = 0; i < samples_per_chunk && sample < stsz->number_of_entries; i++, sample++) {
+            uint32_t size = stsz->sample_size ? stsz->sample_size : stsz->entries[sample].sample_size;
+            table->samples[sample].offset = offset;
+            table->samples[sample].size = size;
+            offset += size;
+        }
+    }
+
+    // chunk table shorter than the sample table: the rest can't be located
+    table->count = sample;
+    if (table->count == 0) {
+        mp4_sample_table_free (table);
+        return -1;
+    }
+
+    // timestamps
+    uint64_t timestamp = 0;
+    sample = 0;
+    for (uint32_t i = 0; i < stts->number_of_entries && sample < table->count; i++) {
+        for (uint32_t j = 0; j < stts->entries[i].sample_count && sample < table->count; j++, sample++) {
+            table->samples[sample].timestamp = timestamp;
+            timestamp += stts->entries[i].sample_duration;
+        }
+    }
+    for (; sample < table->count; sample++) {
+        table->samples[sample].timestamp = timestamp;
+    }
+    table->total_duration = timestamp;
+
+    return 0;
+}
+
+void
+mp4_sample_table_free (mp4_sample_table_t *table) {
+    free (table->samples);
+    free (table->buffer);
+    memset (table, 0, sizeof (mp4_sample_table_t));
+}
+
+uint32_t
+mp4_sample_table_find (mp4_sample_table_t *table, uint64_t timestamp, uint64_t *start_timestamp) {
+    // last sample with samples[i].timestamp <= timestamp
+    uint32_t lo = 0;
+    uint32_t hi = table->count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (table->samples[mid].timestamp <= timestamp) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (start_timestamp) {
+        *start_timestamp = table->count > 0 ? table->samples[lo].timestamp : 0;
+    }
+    return lo;
+}
+
+const uint8_t *
+mp4_sample_table_read (mp4_sample_table_t *table, DB_FILE *fp, int64_t base_offset, uint32_t sample) {
+    if (sample >= table->count) {
+        return NULL;
+    }
+
+    mp4_sample_t *samples = table->samples;
+
+    if (sample >= table->buffer_first && sample < table->buffer_first + table->buffer_count) {
+        return table->buffer + (samples[sample].offset - samples[table->buffer_first].offset);
+    }
+
+    // extend the run while the next sample immediately follows the previous one
+    size_t size = samples[sample].size;
+    uint32_t count = 1;
+    while (sample + count < table->count
+           && samples[sample + count].offset == samples[sample + count - 1].offset + samples[sample + count - 1].size
+           && size + samples[sample + count].size <= MP4_SAMPLE_TABLE_READ_SIZE) {
+        size += samples[sample + count].size;
+        count++;
+    }
+
+    if (table->buffer_size < size) {
+        size_t buffer_size = size > MP4_SAMPLE_TABLE_READ_SIZE ? size : MP4_SAMPLE_TABLE_READ_SIZE;
+        uint8_t *buffer = realloc (table->buffer, buffer_size);
+        if (!buffer) {
+            return NULL;
+        }
+        table->buffer = buffer;
+        table->buffer_size = buffer_size;
+    }
+
+    table->buffer_count = 0;
+
+    if (deadbeef->fseek (fp, (int64_t)samples[sample].offset + base_offset, SEEK_SET)) {
+        return NULL;
+    }
+
+    size_t rb = deadbeef->fread (table->buffer, 1, size, fp);
+    if (rb < samples[sample].size) {
+        return NULL;
+    }
+
+    // short read: keep the samples which made it
+    while (count > 1 && samples[sample + count - 1].offset + samples[sample + count - 1].size - samples[sample].offset > rb) {
+        count--;
+    }
+
+    table->buffer_first = sample;
+    table->buffer_count = count;
+
+    return table->buffer;
+}
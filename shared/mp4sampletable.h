@@ -0,0 +1,69 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef mp4sampletable_h
+#define mp4sampletable_h
+
+#include "../deadbeef.h"
+#include <mp4p/mp4p.h>
+
+typedef struct {
+    uint64_t offset;
+    uint64_t timestamp; // in the track time scale
+    uint32_t size;
+} mp4_sample_t;
+
+// Flattened stsc/stco/stsz/stts of a single track,
+// plus a read buffer holding a run of contiguous samples.
+typedef struct {
+    mp4_sample_t *samples;
+    uint32_t count;
+    uint64_t total_duration;
+
+    uint8_t *buffer;
+    size_t buffer_size;
+    uint32_t buffer_first; // index of the first sample in the buffer
+    uint32_t buffer_count;
+} mp4_sample_table_t;
+
+// Builds the sample index from the stbl atom of a track.
+// Returns 0 on success, -1 if the tables are missing or empty.
+int
+mp4_sample_table_init (mp4_sample_table_t *table, mp4p_atom_t *stbl_atom);
+
+void
+mp4_sample_table_free (mp4_sample_table_t *table);
+
+// Returns the index of the sample containing the timestamp,
+// and the timestamp of that sample in start_timestamp.
+uint32_t
+mp4_sample_table_find (mp4_sample_table_t *table, uint64_t timestamp, uint64_t *start_timestamp);
+
+// Returns the data of the sample, or NULL on read error.
+// The data stays valid until the next call.
+// Contiguous samples following the requested one are read in the same fread call.
+// base_offset is added to the sample offsets, e.g. to skip leading ID3v2 tags.
+const uint8_t *
+mp4_sample_table_read (mp4_sample_table_t *table, DB_FILE *fp, int64_t base_offset, uint32_t sample);
+
+#endif /* mp4sampletable_h */
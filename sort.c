@@ -188,6 +188,9 @@ plt_sort_random (playlist_t *playlist, int iter) {
 
     free (array);
 
+    if (iter == PL_MAIN) {
+        plt_journal_order_changed (playlist);
+    }
     plt_modified (playlist);
 
     pl_unlock ();
@@ -291,6 +294,9 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         pl_item_unref (track_under_cursor);
     }
 
+    if (iter == PL_MAIN) {
+        plt_journal_order_changed (playlist);
+    }
     plt_modified (playlist);
 
     if (version == 0) {
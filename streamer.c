@@ -34,6 +34,7 @@
 #endif
 #include <sys/time.h>
 #include <errno.h>
+#include <pthread.h>
 #include "threading.h"
 #include "playlist.h"
 #include "plmeta.h"
@@ -57,6 +58,7 @@
 #include "playmodes.h"
 #include "viz.h"
 #include "fft.h"
+#include "metaloader.h"
 
 #ifdef trace
 #undef trace
@@ -87,6 +89,7 @@ static int conf_streamer_samplerate_mult_48 = 48000;
 static int conf_streamer_samplerate_mult_44 = 44100;
 static float conf_format_silence = -1.f;
 static float conf_playback_buffer_size = 0.3f;
+static int conf_viz_fft_size = 4096;
 
 static int trace_bufferfill = 0;
 
@@ -439,22 +442,25 @@ get_random_track (void) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
+    pl_lock ();
     playlist_t *plt = streamer_playlist;
     int cnt = plt->count[PL_MAIN];
     if (!cnt) {
         trace ("empty playlist\n");
+        pl_unlock ();
         return NULL;
     }
-    int curr = str_get_idx_of (streaming_track);
-    int r = (int)(rand () / (double)RAND_MAX * cnt);
-    if (r == curr) {
-        r++;
-        if (r >= cnt) {
-            r = 0;
-        }
+    // pick by position in shuffle order, which doesn't require walking the list
+    int r = (int)(rand () / ((double)RAND_MAX + 1) * cnt);
+    playItem_t *it = plt_shuffle_get_item_for_idx (plt, r);
+    if (it == streaming_track && cnt > 1) {
+        it = plt_shuffle_get_item_for_idx (plt, (r + 1) % cnt);
     }
-
-    return plt_get_item_for_idx (plt, r, PL_MAIN);
+    if (it) {
+        pl_item_ref (it);
+    }
+    pl_unlock ();
+    return it;
 }
 
 static playItem_t *
@@ -493,16 +499,7 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
         playItem_t *it = NULL;
         if (!curr || shuffle == DDB_SHUFFLE_TRACKS) {
             // find minimal notplayed
-            playItem_t *pmin = NULL; // notplayed minimum
-            for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i->played) {
-                    continue;
-                }
-                if (!pmin || i->shufflerating < pmin->shufflerating) {
-                    pmin = i;
-                }
-            }
-            it = pmin;
+            it = plt_shuffle_first_unplayed (plt, INT32_MIN);
             if (!it) {
                 // all songs played, reshuffle and try again
                 if (repeat == DDB_REPEAT_ALL) { // loop
@@ -516,17 +513,7 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
         }
         else {
             // find minimal notplayed above current
-            int rating = curr->shufflerating;
-            playItem_t *pmin = NULL; // notplayed minimum
-            for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i->played || i->shufflerating < rating) {
-                    continue;
-                }
-                if (!pmin || i->shufflerating < pmin->shufflerating) {
-                    pmin = i;
-                }
-            }
-            it = pmin;
+            it = plt_shuffle_first_unplayed (plt, curr->shufflerating);
             if (!it) {
                 // all songs played, reshuffle and try again
                 if (repeat == DDB_REPEAT_ALL) { // loop
@@ -593,11 +580,6 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
 static playItem_t *
 get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
     pl_lock ();
-    
-    // check if prev song is in this playlist
-    if (curr && -1 == str_get_idx_of (curr)) {
-        curr = NULL;
-    }
 
     if (!streamer_playlist) {
         playlist_t *plt = plt_get_curr ();
@@ -607,6 +589,11 @@ get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
     
     playlist_t *plt = streamer_playlist;
 
+    // check if prev song is in this playlist
+    if (curr && curr->plt != plt) {
+        curr = NULL;
+    }
+
     if (!plt->head[PL_MAIN]) {
         pl_unlock ();
         return NULL;
@@ -619,22 +606,9 @@ get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
             return it;
         }
         else {
-            curr->played = 0;
+            pl_item_set_played (curr, 0);
             // find already played song with maximum shuffle rating below prev song
-            int rating = curr->shufflerating;
-            playItem_t *pmax = NULL; // played maximum
-            playItem_t *amax = NULL; // absolute maximum
-            for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i != curr && i->played && (!amax || i->shufflerating > amax->shufflerating)) {
-                    amax = i;
-                }
-                if (i == curr || i->shufflerating > rating || !i->played) {
-                    continue;
-                }
-                if (!pmax || i->shufflerating > pmax->shufflerating) {
-                    pmax = i;
-                }
-            }
+            playItem_t *pmax = plt_shuffle_last_played (plt, curr->shufflerating); // played maximum
 
             if (pmax && shuffle == DDB_SHUFFLE_ALBUMS) {
                 while (pmax && pmax->next[PL_MAIN] && pmax->next[PL_MAIN]->played && pmax->shufflerating == pmax->next[PL_MAIN]->shufflerating) {
@@ -646,6 +620,7 @@ get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
             if (!it) {
                 // that means 1st in playlist, take amax
                 if (repeat == DDB_REPEAT_ALL) {
+                    playItem_t *amax = plt_shuffle_last_played (plt, INT32_MAX); // absolute maximum
                     if (!amax) {
                         plt_reshuffle (streamer_playlist, NULL, &amax);
                     }
@@ -760,6 +735,19 @@ is_remote_stream (playItem_t *it) {
     return remote;
 }
 
+// Ask for float output when the data is going to be converted to float anyway
+static uint32_t
+_get_decoder_hints (void) {
+    uint32_t hints = STREAMER_HINTS;
+#if !defined(ANDROID) && !defined(HAVE_XGUI)
+    DB_output_t *output = plug_get_output ();
+    if (dsp_is_active () || (output && output->fmt.is_float)) {
+        hints |= DDB_DECODER_HINT_FLOAT32;
+    }
+#endif
+    return hints;
+}
+
 static DB_fileinfo_t *dec_open (DB_decoder_t *dec, uint32_t hints, playItem_t *it) {
     if (dec->plugin.api_vminor >= 7 && dec->open2) {
         DB_fileinfo_t *fi = dec->open2 (hints, DB_PLAYITEM (it));
@@ -822,6 +810,253 @@ fileinfo_free (DB_fileinfo_t *fileinfo) {
     }
 }
 
+// {{{ next track preloading
+// The decoder of the track which is expected to play next is opened and initialized
+// on a helper thread shortly before the current track ends, and handed over to stream_track,
+// which hides slow file opening (network mounts, archives, http) from the playback.
+typedef struct preload_s {
+    playItem_t *track;
+    DB_decoder_t *dec;
+    uint32_t hints;
+    intptr_t tid;
+
+    // protected by preload_mutex
+    DB_fileinfo_t *fileinfo;
+    DB_vfs_t *file_vfs;
+    uint64_t file_identifier;
+    int done;
+    int cancelled; // set by _preload_cancel, the thread owns and frees the data from then on
+} preload_t;
+
+static float conf_preload_next_track = 10.f;
+static pthread_mutex_t preload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t preload_cond = PTHREAD_COND_INITIALIZER; // a preload thread has exited
+static preload_t *preload; // accessed only from the streamer thread
+static playItem_t *preload_checked_track; // the streaming track, for which the next track was already looked up
+static int preload_threads_running; // protected by preload_mutex
+
+static void
+_preload_free (preload_t *p) {
+    if (p->fileinfo) {
+        fileinfo_free (p->fileinfo);
+    }
+    pl_item_unref (p->track);
+    free (p);
+}
+
+static void
+_preload_thread (void *ctx) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-preload", 0, 0, 0, 0);
+#endif
+    preload_t *p = ctx;
+
+    trace ("preloading %s (%s)\n", pl_find_meta (p->track, ":URI"), p->dec->plugin.id);
+    DB_fileinfo_t *fi = dec_open (p->dec, p->hints, p->track);
+    if (fi && fi->file) {
+        pthread_mutex_lock (&preload_mutex);
+        p->file_vfs = fi->file->vfs;
+        p->file_identifier = vfs_get_identifier (fi->file);
+        pthread_mutex_unlock (&preload_mutex);
+    }
+    pthread_mutex_lock (&preload_mutex);
+    int cancelled = p->cancelled;
+    pthread_mutex_unlock (&preload_mutex);
+    if (fi && (cancelled || p->dec->init (fi, DB_PLAYITEM (p->track)) != 0)) {
+        p->dec->free (fi);
+        fi = NULL;
+    }
+
+    pthread_mutex_lock (&preload_mutex);
+    p->fileinfo = fi;
+    p->done = 1;
+    cancelled = p->cancelled;
+    pthread_mutex_unlock (&preload_mutex);
+
+    // the thread was detached by _preload_cancel, nobody else is going to release the data,
+    // otherwise p may be freed by the streamer at any moment after done was set
+    if (cancelled) {
+        _preload_free (p);
+    }
+
+    pthread_mutex_lock (&preload_mutex);
+    preload_threads_running--;
+    pthread_cond_broadcast (&preload_cond);
+    pthread_mutex_unlock (&preload_mutex);
+}
+
+static void
+_preload_cancel (void) {
+    preload_t *p = preload;
+    if (!p) {
+        return;
+    }
+    preload = NULL;
+
+    // once cancelled is set, p belongs to the thread and must not be touched
+    pthread_mutex_lock (&preload_mutex);
+    intptr_t tid = p->tid;
+    int done = p->done;
+    if (!done) {
+        p->cancelled = 1;
+        if (p->file_vfs && p->file_identifier) {
+            vfs_abort_with_identifier (p->file_vfs, p->file_identifier);
+        }
+    }
+    pthread_mutex_unlock (&preload_mutex);
+
+    if (done) {
+        thread_join (tid);
+        _preload_free (p);
+    }
+    else {
+        // don't wait for a slow open, the thread will clean up after itself
+        thread_detach (tid);
+    }
+}
+
+// Returns the preloaded fileinfo if it was opened for the track, otherwise drops the preloaded data.
+static DB_fileinfo_t *
+_preload_take (playItem_t *it) {
+    if (!preload || preload->track != it) {
+        _preload_cancel ();
+        return NULL;
+    }
+
+    preload_t *p = preload;
+    preload = NULL;
+
+    // the track is needed right now, so waiting for the init to finish is not worse than opening it here
+    thread_join (p->tid);
+    DB_fileinfo_t *fi = p->fileinfo;
+    p->fileinfo = NULL;
+    _preload_free (p);
+    return fi;
+}
+
+static void
+_preload_start (playItem_t *it) {
+    char decoder_id[100] = "";
+    pl_lock ();
+    const char *dec_id = pl_find_meta (it, ":DECODER");
+    if (dec_id) {
+        strncpy (decoder_id, dec_id, sizeof (decoder_id));
+        decoder_id[sizeof (decoder_id) - 1] = 0;
+    }
+    pl_unlock ();
+
+    // the tracks which need content-type detection or a decoder lookup are handled by stream_track
+    if (!decoder_id[0]) {
+        return;
+    }
+    DB_decoder_t *dec = plug_get_decoder_for_id (decoder_id);
+    if (!dec) {
+        return;
+    }
+
+    preload_t *p = calloc (1, sizeof (preload_t));
+    p->track = it;
+    pl_item_ref (it);
+    p->dec = dec;
+    p->hints = _get_decoder_hints ();
+
+    pthread_mutex_lock (&preload_mutex);
+    preload_threads_running++;
+    // tid is only read under the lock, the thread may free p as soon as it's cancelled
+    intptr_t tid = thread_start (_preload_thread, p);
+    p->tid = tid;
+    if (!tid) {
+        preload_threads_running--;
+    }
+    pthread_mutex_unlock (&preload_mutex);
+
+    if (!tid) {
+        _preload_free (p);
+        return;
+    }
+    preload = p;
+}
+
+// Same as get_next_track, but without side effects,
+// returns NULL when the next track can't be known in advance.
+static playItem_t *
+_peek_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+    if (repeat == DDB_REPEAT_SINGLE) {
+        pl_item_ref (curr);
+        return curr;
+    }
+    if (playqueue_getcount () || shuffle == DDB_SHUFFLE_OFF) {
+        return get_next_track (curr, shuffle, repeat);
+    }
+    if (shuffle != DDB_SHUFFLE_TRACKS && shuffle != DDB_SHUFFLE_ALBUMS) {
+        return NULL; // random
+    }
+
+    // get_next_track would reshuffle the playlist if there are no unplayed tracks left
+    pl_lock ();
+    playItem_t *it = NULL;
+    playlist_t *item_plt = pl_get_playlist (curr);
+    if (item_plt && item_plt == streamer_playlist) {
+        int32_t min_rating = shuffle == DDB_SHUFFLE_ALBUMS ? curr->shufflerating : INT32_MIN;
+        if (plt_shuffle_first_unplayed (streamer_playlist, min_rating) && plt_shuffle_first_unplayed (streamer_playlist, INT32_MIN)) {
+            it = get_next_track (curr, shuffle, repeat);
+        }
+    }
+    if (item_plt) {
+        plt_unref (item_plt);
+    }
+    pl_unlock ();
+    return it;
+}
+
+// Called after each block, starts preloading when the streaming track is close to the end.
+static void
+_preload_next_track_if_needed (ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+    if (conf_preload_next_track <= 0 || !streaming_track || streaming_track == preload_checked_track) {
+        return;
+    }
+    if (!fileinfo_curr || !fileinfo_curr->plugin || stop_after_current || stop_after_album) {
+        return;
+    }
+    float duration = pl_get_item_duration (streaming_track);
+    if (duration <= 0 || duration - fileinfo_curr->readpos > conf_preload_next_track) {
+        return;
+    }
+
+    if (preload_checked_track) {
+        pl_item_unref (preload_checked_track);
+    }
+    preload_checked_track = streaming_track;
+    pl_item_ref (preload_checked_track);
+
+    playItem_t *next = _peek_next_track (streaming_track, shuffle, repeat);
+    if (!next) {
+        return;
+    }
+    if (!preload || preload->track != next) {
+        _preload_cancel ();
+        _preload_start (next);
+    }
+    pl_item_unref (next);
+}
+
+static void
+_preload_free_all (void) {
+    _preload_cancel ();
+    if (preload_checked_track) {
+        pl_item_unref (preload_checked_track);
+        preload_checked_track = NULL;
+    }
+
+    // wait for the detached threads, they still use the decoder plugins
+    pthread_mutex_lock (&preload_mutex);
+    while (preload_threads_running > 0) {
+        pthread_cond_wait (&preload_cond, &preload_mutex);
+    }
+    pthread_mutex_unlock (&preload_mutex);
+}
+// }}}
+
 static int
 stream_track (playItem_t *it, int startpaused) {
     if (fileinfo_curr) {
@@ -837,10 +1072,24 @@ stream_track (playItem_t *it, int startpaused) {
 
     if (first_failed_track && first_failed_track == it) {
         // looped to the first failed track
+        _preload_cancel ();
         _handle_playback_stopped();
         goto error;
     }
 
+    // the track can be played before its metadata is loaded, but it should be loaded next
+    if (it) {
+        metaloader_request (it);
+    }
+
+    DB_fileinfo_t *preloaded = NULL;
+    if (it && !startpaused) {
+        preloaded = _preload_take (it);
+    }
+    else {
+        _preload_cancel ();
+    }
+
     // need to add refs here, because streamer_start_playback can destroy items
     from = playing_track;
     to = it;
@@ -848,7 +1097,7 @@ stream_track (playItem_t *it, int startpaused) {
         pl_item_ref (from);
     }
     if (to) {
-        to->played = 1;
+        pl_item_set_played (to, 1);
         pl_item_ref (to);
     }
 
@@ -868,6 +1117,21 @@ stream_track (playItem_t *it, int startpaused) {
         goto success;
     }
 
+    if (preloaded) {
+        trace ("using preloaded decoder for %s\n", pl_find_meta (it, ":URI"));
+        new_fileinfo = preloaded;
+        if (new_fileinfo->file) {
+            new_fileinfo_file_vfs = new_fileinfo->file->vfs;
+            new_fileinfo_file_identifier = vfs_get_identifier (new_fileinfo->file);
+        }
+        if (streaming_track) {
+            pl_item_unref (streaming_track);
+        }
+        streaming_track = it;
+        pl_item_ref (streaming_track);
+        goto success;
+    }
+
     char decoder_id[100] = "";
     char filetype[100] = "";
     pl_lock ();
@@ -1098,7 +1362,7 @@ m3u_error:
     int plug_idx = 0;
     for (;;) {
         if (!decoder_id[0] && plugs[0] && !plugs[plug_idx]) {
-            it->played = 1;
+            pl_item_set_played (it, 1);
             trace_err ("No suitable decoder found for stream %s of content-type %s\n", pl_find_meta (playing_track, ":URI"), cct);
 
             if (!startpaused) {
@@ -1168,7 +1432,7 @@ m3u_error:
         }
 
         trace ("\033[0;33minit decoder for %s (%s)\033[37;0m\n", pl_find_meta (it, ":URI"), dec->plugin.id);
-        new_fileinfo = dec_open (dec, STREAMER_HINTS, it);
+        new_fileinfo = dec_open (dec, _get_decoder_hints (), it);
         if (new_fileinfo && new_fileinfo->file) {
             new_fileinfo_file_vfs = new_fileinfo->file->vfs;
             new_fileinfo_file_identifier = vfs_get_identifier(new_fileinfo->file);
@@ -1472,6 +1736,17 @@ _streamer_requeue_after_current (ddb_repeat_t repeat, ddb_shuffle_t shuffle) {
 
 static void
 _streamer_track_deleted (ddb_repeat_t repeat, ddb_shuffle_t shuffle) {
+    // drop the preloaded track, if it's not in playlist anymore
+    if (preload) {
+        playlist_t *plt = pl_get_playlist (preload->track);
+        if (!plt) {
+            _preload_cancel ();
+        }
+        else {
+            plt_unref (plt);
+        }
+    }
+
     // cancel buffering of next track, if it's not in playlist anymore
 
     if (!streaming_track) {
@@ -1626,6 +1901,9 @@ streamer_thread (void *unused) {
             streamreader_enqueue_block (block);
             last = block->last;
             streamer_unlock ();
+            if (!last) {
+                _preload_next_track_if_needed (shuffle, repeat);
+            }
         }
 
         if (res < 0 || last) {
@@ -1665,6 +1943,8 @@ streamer_thread (void *unused) {
     // drain event queue
     while (!handler_pop (handler, &id, &ctx, &p1, &p2));
 
+    _preload_free_all ();
+
     // stop streaming song
     if (fileinfo_curr) {
         fileinfo_free (fileinfo_curr);
@@ -2170,7 +2450,7 @@ streamer_read (char *bytes, int size) {
 #ifndef ANDROID
     // Read extra bytes from output buffer
     int viz_bytes = min (_outbuffer_remaining, max_bytes);
-    viz_process (_output_buffer, viz_bytes, output, 4096); // FIXME: fft size needs to be configurable
+    viz_process (_output_buffer, viz_bytes, output, conf_viz_fft_size);
 #endif
 
     // Play
@@ -2205,7 +2485,7 @@ streamer_configchanged (void) {
     streamer_set_repeat (repeat);
 
     if (playing_track) {
-        playing_track->played = 1;
+        pl_item_set_played (playing_track, 1);
     }
 
     int formatchanged = 0;
@@ -2255,6 +2535,7 @@ streamer_configchanged (void) {
     conf_streamer_samplerate_mult_44 = new_conf_streamer_samplerate_mult_44;
 
     conf_format_silence = conf_get_float ("streamer.format_change_silence", -1.f);
+    conf_preload_next_track = conf_get_float ("streamer.preload_next_track", 10.f);
 
     int playback_buffer_size = conf_get_int ("streamer.playback_buffer_size", 300);
     if (playback_buffer_size < 100) {
@@ -2265,6 +2546,20 @@ streamer_configchanged (void) {
     }
     conf_playback_buffer_size = playback_buffer_size / 1000.f;
 
+    // spectrum resolution, rounded down to a power of 2
+    int viz_fft_size = conf_get_int ("viz.fft_size", 4096);
+    if (viz_fft_size < 256) {
+        viz_fft_size = 256;
+    }
+    else if (viz_fft_size > 32768) {
+        viz_fft_size = 32768;
+    }
+    while (viz_fft_size & (viz_fft_size - 1)) {
+        viz_fft_size &= viz_fft_size - 1;
+    }
+    conf_viz_fft_size = viz_fft_size;
+    viz_set_fft_window (conf_get_int ("viz.fft_window", 0));
+
     streamer_unlock ();
 
     streamreader_configchanged ();
@@ -2341,7 +2636,7 @@ _rebuild_shuffle_albums_after_manual_trigger(playlist_t *plt, playItem_t *it) {
     else {
         // This ensures that the manually triggered item becomes first in shuffle queue.
         // It works because shufflerating is generated using rand(), which gives only numbers in the [0..RAND_MAX] range.
-        it->shufflerating = -1;
+        pl_item_set_shufflerating (it, -1);
     }
 }
 
@@ -2480,13 +2775,15 @@ streamer_get_next_track_with_direction (int dir, ddb_shuffle_t shuffle, ddb_repe
                 plt_reshuffle (streamer_playlist, dir > 0 ? &next : NULL, dir < 0 ? &next : NULL);
                 if (next && dir < 0) {
                     // mark all songs as played except the current one
+                    pl_lock ();
                     playItem_t *it = streamer_playlist->head[PL_MAIN];
                     while (it) {
                         if (it != next) {
-                            it->played = 1;
+                            pl_item_set_played (it, 1);
                         }
                         it = it->next[PL_MAIN];
                     }
+                    pl_unlock ();
                 }
                 if (next) {
                     pl_item_ref (next);
@@ -2587,11 +2884,11 @@ _streamer_mark_album_played_up_to (playItem_t *item) {
     pl_lock ();
     const char *alb = pl_find_meta_raw (item, "album");
     const char *art = pl_find_meta_raw (item, "artist");
-    item->played = 1;
+    pl_item_set_played (item, 1);
     playItem_t *next = item->prev[PL_MAIN];
     while (next) {
         if (alb == pl_find_meta_raw (next, "album") && art == pl_find_meta_raw (next, "artist")) {
-            next->played = 1;
+            pl_item_set_played (next, 1);
             next = next->prev[PL_MAIN];
         }
         else {
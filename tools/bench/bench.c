@@ -0,0 +1,653 @@
+/*
+  This file is part of Deadbeef Player source code
+  http://deadbeef.sourceforge.net
+
+  headless benchmarks of the playback pipeline
+
+  Copyright (C) 2009-2021 Alexey Yakovenko and other contributors
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Alexey Yakovenko waker@users.sourceforge.net
+*/
+
+// Boots the core with the nullout output plugin, runs the benchmarks,
+// and prints the results as JSON to stdout.
+//
+// usage: ddb_bench [-p plugindir] [-n num_tracks] [-t min_seconds] [-b benchmarks] [files or folders...]
+//
+// The files are used for the decoder benchmarks, osx/Tests/TestData by default.
+// The benchmarks are a comma separated list of: decode, pcm_convert, dsp, tf, sort, playlist_io.
+
+#ifdef HAVE_CONFIG_H
+#include "../../config.h"
+#endif
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "../../common.h"
+#include "../../conf.h"
+#include "../../dsp.h"
+#include "../../logger.h"
+#include "../../messagepump.h"
+#include "../../playlist.h"
+#include "../../plmeta.h"
+#include "../../playmodes.h"
+#include "../../plugins.h"
+#include "../../premix.h"
+#include "../../sort.h"
+#include "../../streamer.h"
+#include "../../tf.h"
+
+// some common global variables, normally defined in main.c
+char sys_install_path[PATH_MAX];
+char confdir[PATH_MAX];
+char dbconfdir[PATH_MAX];
+char dbinstalldir[PATH_MAX];
+char dbdocdir[PATH_MAX];
+char dbplugindir[PATH_MAX];
+char dbpixmapdir[PATH_MAX];
+char dbcachedir[PATH_MAX];
+char dbruntimedir[PATH_MAX];
+char dbresourcedir[PATH_MAX];
+
+static double min_seconds = 0.5;
+static int num_tracks = 1000000;
+static int num_results;
+
+#pragma mark - Reporting
+
+static double
+now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void
+print_json_string (const char *s) {
+    putchar ('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            printf ("\\%c", c);
+        }
+        else if (c < 0x20) {
+            printf ("\\u%04x", c);
+        }
+        else {
+            putchar (c);
+        }
+    }
+    putchar ('"');
+}
+
+// One result per line, so that the output is easy to diff between runs.
+// items is the amount of work done in total, e.g. the number of frames decoded,
+// realtime is the playback duration of the processed audio divided by the run time, or 0 if not applicable.
+static void
+report (const char *group, const char *name, int64_t iterations, double seconds, double items, const char *unit, double realtime) {
+    printf ("%s\n    {\"group\": ", num_results ? "," : "");
+    print_json_string (group);
+    printf (", \"name\": ");
+    print_json_string (name);
+    printf (", \"iterations\": %lld, \"seconds\": %.6f, \"%s_per_second\": %.1f", (long long)iterations, seconds, unit, seconds > 0 ? items / seconds : 0);
+    if (realtime > 0) {
+        printf (", \"realtime\": %.2f", realtime);
+    }
+    printf ("}");
+    fflush (stdout);
+    num_results++;
+
+    fprintf (stderr, "%s: %s: %.1f %s/s\n", group, name, seconds > 0 ? items / seconds : 0, unit);
+}
+
+static void
+drain_messages (void) {
+    uint32_t msg;
+    uintptr_t ctx;
+    uint32_t p1;
+    uint32_t p2;
+    while (messagepump_pop (&msg, &ctx, &p1, &p2) != -1) {
+        if (msg >= DB_EV_FIRST && ctx) {
+            messagepump_event_free ((ddb_event_t *)ctx);
+        }
+    }
+}
+
+#pragma mark - Decoders
+
+static void
+bench_decode (playlist_t *plt) {
+    static char buffer[16384];
+
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        pl_lock ();
+        const char *decoder_id = pl_find_meta (it, ":DECODER");
+        const char *uri = pl_find_meta (it, ":URI");
+        char name[300];
+        const char *fname = strrchr (uri, '/');
+        snprintf (name, sizeof (name), "%s %s", decoder_id ? decoder_id : "", fname ? fname + 1 : uri);
+        DB_decoder_t *dec = decoder_id ? plug_get_decoder_for_id (decoder_id) : NULL;
+        pl_unlock ();
+
+        if (!dec) {
+            fprintf (stderr, "decode: %s: decoder not found\n", name);
+            continue;
+        }
+
+        int64_t iterations = 0;
+        int64_t frames = 0;
+        int samplerate = 0;
+        double start = now ();
+        double elapsed = 0;
+        do {
+            DB_fileinfo_t *fileinfo = dec->open (0);
+            if (!fileinfo) {
+                break;
+            }
+            if (dec->init (fileinfo, DB_PLAYITEM (it)) != 0) {
+                dec->free (fileinfo);
+                break;
+            }
+            int samplesize = fileinfo->fmt.channels * fileinfo->fmt.bps / 8;
+            samplerate = fileinfo->fmt.samplerate;
+            int res;
+            while (samplesize > 0 && (res = dec->read (fileinfo, buffer, sizeof (buffer))) > 0) {
+                frames += res / samplesize;
+            }
+            dec->free (fileinfo);
+            iterations++;
+            elapsed = now () - start;
+        } while (elapsed < min_seconds);
+
+        if (!iterations || !frames) {
+            fprintf (stderr, "decode: %s: failed to decode\n", name);
+            continue;
+        }
+        report ("decode", name, iterations, elapsed, frames, "frames", (double)frames / samplerate / elapsed);
+    }
+}
+
+#pragma mark - Sample format conversion
+
+static const struct {
+    int bps;
+    int is_float;
+    const char *name;
+} pcm_formats[] = {
+    { 8, 0, "s8" },
+    { 16, 0, "s16" },
+    { 24, 0, "s24" },
+    { 32, 0, "s32" },
+    { 32, 1, "f32" },
+};
+
+#define NUM_PCM_FORMATS (sizeof (pcm_formats) / sizeof (pcm_formats[0]))
+
+// 1 second of stereo audio, with random samples in the valid range of the format
+static char *
+make_test_signal (const ddb_waveformat_t *fmt, int nframes) {
+    int nsamples = nframes * fmt->channels;
+    char *buffer = malloc (nsamples * fmt->bps / 8);
+    srand (1);
+    for (int i = 0; i < nsamples; i++) {
+        float s = rand () / (float)RAND_MAX * 2 - 1;
+        if (fmt->is_float) {
+            ((float *)buffer)[i] = s;
+            continue;
+        }
+        int32_t v = (int32_t)(s * 0x7fffffff);
+        switch (fmt->bps) {
+        case 8:
+            buffer[i] = (char)(v >> 24);
+            break;
+        case 16:
+            ((int16_t *)buffer)[i] = (int16_t)(v >> 16);
+            break;
+        case 24:
+            buffer[i*3] = (char)(v >> 8);
+            buffer[i*3+1] = (char)(v >> 16);
+            buffer[i*3+2] = (char)(v >> 24);
+            break;
+        case 32:
+            ((int32_t *)buffer)[i] = v;
+            break;
+        }
+    }
+    return buffer;
+}
+
+static void
+bench_pcm_convert (void) {
+    const int nframes = 44100;
+    char *output = malloc (nframes * 2 * 4);
+
+    for (int i = 0; i < NUM_PCM_FORMATS; i++) {
+        ddb_waveformat_t infmt = {
+            .bps = pcm_formats[i].bps,
+            .is_float = pcm_formats[i].is_float,
+            .channels = 2,
+            .samplerate = 44100,
+            .channelmask = DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT,
+        };
+        char *input = make_test_signal (&infmt, nframes);
+        int inputsize = nframes * infmt.channels * infmt.bps / 8;
+
+        for (int o = 0; o < NUM_PCM_FORMATS; o++) {
+            ddb_waveformat_t outfmt = infmt;
+            outfmt.bps = pcm_formats[o].bps;
+            outfmt.is_float = pcm_formats[o].is_float;
+
+            int64_t iterations = 0;
+            double start = now ();
+            double elapsed = 0;
+            do {
+                pcm_convert (&infmt, input, &outfmt, output, inputsize);
+                iterations++;
+                elapsed = now () - start;
+            } while (elapsed < min_seconds);
+
+            char name[100];
+            snprintf (name, sizeof (name), "%s -> %s", pcm_formats[i].name, pcm_formats[o].name);
+            report ("pcm_convert", name, iterations, elapsed, (double)iterations * nframes, "frames", (double)iterations * nframes / infmt.samplerate / elapsed);
+        }
+        free (input);
+    }
+    free (output);
+}
+
+#pragma mark - DSP
+
+// Chains are described as comma separated plugin ids, with optional param=value pairs after a colon
+static const char *dsp_chains[] = {
+    "supereq:4=6",
+    "SRC:0=48000",
+    "supereq:4=6,SRC:0=48000",
+    NULL
+};
+
+static ddb_dsp_context_t *
+make_dsp_chain (const char *descr) {
+    ddb_dsp_context_t *chain = NULL;
+    ddb_dsp_context_t *tail = NULL;
+    char *s = strdup (descr);
+    char *saveptr = NULL;
+    for (char *item = strtok_r (s, ",", &saveptr); item; item = strtok_r (NULL, ",", &saveptr)) {
+        char *params = strchr (item, ':');
+        if (params) {
+            *params++ = 0;
+        }
+        DB_dsp_t *plugin = (DB_dsp_t *)plug_get_for_id (item);
+        if (!plugin || plugin->plugin.type != DB_PLUGIN_DSP) {
+            fprintf (stderr, "dsp: plugin %s not found\n", item);
+            dsp_chain_free (chain);
+            chain = NULL;
+            break;
+        }
+        ddb_dsp_context_t *ctx = plugin->open ();
+        ctx->enabled = 1;
+        while (params && *params) {
+            int idx = atoi (params);
+            char *val = strchr (params, '=');
+            if (!val) {
+                break;
+            }
+            val++;
+            char *next = strchr (val, ';');
+            if (next) {
+                *next++ = 0;
+            }
+            plugin->set_param (ctx, idx, val);
+            params = next;
+        }
+        if (tail) {
+            tail->next = ctx;
+        }
+        else {
+            chain = ctx;
+        }
+        tail = ctx;
+    }
+    free (s);
+    return chain;
+}
+
+static void
+bench_dsp (void) {
+    // the format of a typical decoder output, in blocks of the same size as the streamer uses
+    ddb_waveformat_t fmt = {
+        .bps = 16,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT,
+    };
+    const int nframes = 4096;
+    char *input = make_test_signal (&fmt, nframes);
+    int inputsize = nframes * fmt.channels * fmt.bps / 8;
+
+    for (int i = 0; dsp_chains[i]; i++) {
+        ddb_dsp_context_t *chain = make_dsp_chain (dsp_chains[i]);
+        if (!chain) {
+            continue;
+        }
+        streamer_set_dsp_chain_real (chain);
+
+        int64_t iterations = 0;
+        double start = now ();
+        double elapsed = 0;
+        do {
+            ddb_waveformat_t outfmt;
+            char *out = NULL;
+            int outsize = 0;
+            float ratio = 1;
+            dsp_apply (&fmt, input, inputsize, &outfmt, &out, &outsize, &ratio);
+            iterations++;
+            elapsed = now () - start;
+        } while (elapsed < min_seconds);
+
+        report ("dsp", dsp_chains[i], iterations, elapsed, (double)iterations * nframes, "frames", (double)iterations * nframes / fmt.samplerate / elapsed);
+        drain_messages ();
+    }
+
+    streamer_set_dsp_chain_real (NULL);
+    drain_messages ();
+    free (input);
+}
+
+#pragma mark - Synthetic playlist
+
+static const char *genres[] = { "Rock", "Jazz", "Classical", "Electronic", "Pop", "Metal", "Ambient" };
+
+static playlist_t *
+make_synthetic_playlist (int count) {
+    playlist_t *plt = plt_alloc ("bench");
+    playItem_t *after = NULL;
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = pl_item_alloc ();
+        char s[200];
+        int artist = (i / 100) % 997;
+        int album = i / 10;
+        snprintf (s, sizeof (s), "/music/Artist %d/Album %d/%02d Track %d.flac", artist, album, i % 10 + 1, i);
+        pl_add_meta (it, ":URI", s);
+        pl_add_meta (it, ":DECODER", "flac");
+        snprintf (s, sizeof (s), "Artist %d", artist);
+        pl_add_meta (it, "artist", s);
+        snprintf (s, sizeof (s), "Album %d", album);
+        pl_add_meta (it, "album", s);
+        snprintf (s, sizeof (s), "Track %d", (i * 7919) % count);
+        pl_add_meta (it, "title", s);
+        snprintf (s, sizeof (s), "%d", i % 10 + 1);
+        pl_add_meta (it, "track", s);
+        snprintf (s, sizeof (s), "%d", 1960 + album % 60);
+        pl_add_meta (it, "year", s);
+        pl_add_meta (it, "genre", genres[album % (sizeof (genres) / sizeof (genres[0]))]);
+        plt_set_item_duration (plt, it, 120 + i % 300);
+        after = plt_insert_item (plt, after, it);
+        pl_item_unref (it);
+    }
+    return plt;
+}
+
+#pragma mark - Title formatting
+
+static const char *tf_scripts[] = {
+    "%title%",
+    "%artist% - %title%",
+    "$if(%album artist%,%album artist%,%artist%) - [%album% - ]$num(%tracknumber%,2). %title%",
+    "%length% $upper(%genre%) %year%",
+    NULL
+};
+
+static void
+bench_tf (playlist_t *plt) {
+    char buffer[1000];
+    for (int i = 0; tf_scripts[i]; i++) {
+        char *code = tf_compile (tf_scripts[i]);
+        ddb_tf_context_t ctx = {
+            ._size = sizeof (ddb_tf_context_t),
+            .plt = (ddb_playlist_t *)plt,
+            .iter = PL_MAIN,
+        };
+
+        int64_t iterations = 0;
+        double start = now ();
+        double elapsed = 0;
+        do {
+            for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                ctx.it = (ddb_playItem_t *)it;
+                tf_eval (&ctx, code, buffer, sizeof (buffer));
+            }
+            iterations++;
+            elapsed = now () - start;
+        } while (elapsed < min_seconds);
+
+        tf_free (code);
+        report ("tf", tf_scripts[i], iterations, elapsed, (double)iterations * plt->count[PL_MAIN], "tracks", 0);
+    }
+}
+
+#pragma mark - Sorting
+
+static const char *sort_formats[] = {
+    "%title%",
+    "%artist% %album% %tracknumber%",
+    "%year%",
+    "%length%",
+    NULL
+};
+
+static void
+bench_sort (playlist_t *plt) {
+    for (int i = 0; sort_formats[i]; i++) {
+        double start = now ();
+        plt_sort_v2 (plt, PL_MAIN, -1, sort_formats[i], DDB_SORT_ASCENDING);
+        double elapsed = now () - start;
+        report ("sort", sort_formats[i], 1, elapsed, plt->count[PL_MAIN], "tracks", 0);
+    }
+}
+
+#pragma mark - Playlist load and save
+
+static void
+bench_playlist_io (playlist_t *plt) {
+    char fname[PATH_MAX];
+    snprintf (fname, sizeof (fname), "%s/bench.dbpl", dbconfdir);
+
+    double start = now ();
+    int res = plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL);
+    double elapsed = now () - start;
+    if (res < 0) {
+        fprintf (stderr, "playlist_io: failed to save %s\n", fname);
+        return;
+    }
+    report ("playlist_io", "save", 1, elapsed, plt->count[PL_MAIN], "tracks", 0);
+
+    playlist_t *loaded = plt_alloc ("bench-load");
+    start = now ();
+    plt_load (loaded, NULL, fname, NULL, NULL, NULL);
+    elapsed = now () - start;
+    if (loaded->count[PL_MAIN] != plt->count[PL_MAIN]) {
+        fprintf (stderr, "playlist_io: loaded %d tracks out of %d\n", loaded->count[PL_MAIN], plt->count[PL_MAIN]);
+    }
+    else {
+        report ("playlist_io", "load", 1, elapsed, loaded->count[PL_MAIN], "tracks", 0);
+    }
+    plt_free (loaded);
+    unlink (fname);
+}
+
+#pragma mark - Setup
+
+static int
+remove_cb (const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    return remove (fpath);
+}
+
+static int
+enabled (const char *benchmarks, const char *name) {
+    if (!benchmarks) {
+        return 1;
+    }
+    size_t l = strlen (name);
+    for (const char *p = benchmarks; (p = strstr (p, name)); p += l) {
+        if ((p == benchmarks || p[-1] == ',') && (p[l] == 0 || p[l] == ',')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+print_usage (void) {
+    fprintf (stderr, "usage: ddb_bench [-p plugindir] [-n num_tracks] [-t min_seconds] [-b benchmarks] [files or folders...]\n");
+    fprintf (stderr, "benchmarks: decode,pcm_convert,dsp,tf,sort,playlist_io\n");
+}
+
+int
+main (int argc, char *argv[]) {
+    const char *benchmarks = NULL;
+    const char *plugindir = getenv ("DEADBEEF_PLUGIN_DIR");
+
+    int opt;
+    while ((opt = getopt (argc, argv, "p:n:t:b:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            plugindir = optarg;
+            break;
+        case 'n':
+            num_tracks = atoi (optarg);
+            break;
+        case 't':
+            min_seconds = atof (optarg);
+            break;
+        case 'b':
+            benchmarks = optarg;
+            break;
+        default:
+            print_usage ();
+            return 1;
+        }
+    }
+
+    if (plugindir) {
+        snprintf (dbplugindir, sizeof (dbplugindir), "%s", plugindir);
+    }
+    else {
+        snprintf (dbplugindir, sizeof (dbplugindir), "%s/deadbeef", LIBDIR);
+    }
+    strcpy (dbresourcedir, dbplugindir);
+
+    // use an empty temporary config, to not depend on the user settings
+    char tmpdir[] = "/tmp/ddb_bench.XXXXXX";
+    if (!mkdtemp (tmpdir)) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    strcpy (confdir, tmpdir);
+    strcpy (dbconfdir, tmpdir);
+    snprintf (dbcachedir, sizeof (dbcachedir), "%s/cache", tmpdir);
+    strcpy (dbruntimedir, tmpdir);
+
+    ddb_logger_init ();
+    pl_init ();
+    conf_init ();
+    conf_enable_saving (0);
+    conf_set_str ("output_plugin", "nullout");
+    messagepump_init ();
+    if (plug_load_all ()) {
+        fprintf (stderr, "ddb_bench: failed to load plugins from %s\n", dbplugindir);
+        nftw (tmpdir, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+        return 1;
+    }
+    streamer_playmodes_init ();
+    streamer_init ();
+    plug_connect_all ();
+    drain_messages ();
+
+    printf ("{\n  \"version\": ");
+    print_json_string (VERSION);
+    printf (",\n  \"tracks\": %d,\n  \"results\": [", num_tracks);
+
+    if (enabled (benchmarks, "decode")) {
+        playlist_t *plt = plt_alloc ("bench-files");
+        if (optind < argc) {
+            for (int i = optind; i < argc; i++) {
+                struct stat st;
+                if (!stat (argv[i], &st) && S_ISDIR (st.st_mode)) {
+                    plt_add_dir2 (0, plt, argv[i], NULL, NULL);
+                }
+                else {
+                    plt_add_file2 (0, plt, argv[i], NULL, NULL);
+                }
+            }
+        }
+        else {
+            plt_add_dir2 (0, plt, "osx/Tests/TestData", NULL, NULL);
+        }
+        bench_decode (plt);
+        plt_free (plt);
+    }
+
+    if (enabled (benchmarks, "pcm_convert")) {
+        bench_pcm_convert ();
+    }
+
+    if (enabled (benchmarks, "dsp")) {
+        bench_dsp ();
+    }
+
+    if (enabled (benchmarks, "tf") || enabled (benchmarks, "sort") || enabled (benchmarks, "playlist_io")) {
+        double start = now ();
+        playlist_t *plt = make_synthetic_playlist (num_tracks);
+        fprintf (stderr, "created %d tracks in %.2f seconds\n", num_tracks, now () - start);
+        if (enabled (benchmarks, "tf")) {
+            bench_tf (plt);
+        }
+        if (enabled (benchmarks, "sort")) {
+            bench_sort (plt);
+        }
+        if (enabled (benchmarks, "playlist_io")) {
+            bench_playlist_io (plt);
+        }
+        plt_free (plt);
+    }
+
+    printf ("\n  ]\n}\n");
+
+    DB_output_t *output = plug_get_output ();
+    output->stop ();
+    streamer_free ();
+    drain_messages ();
+    output->free ();
+    plug_disconnect_all ();
+    plug_unload_all ();
+    pl_free ();
+    conf_free ();
+    messagepump_free ();
+    plug_cleanup ();
+    ddb_logger_free ();
+
+    nftw (tmpdir, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -33,6 +33,14 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#define USE_MMAP 1
+#define USE_PREAD 1
+#else
+#define USE_MMAP 0
+#define USE_PREAD 0
+#endif
 
 #ifndef __linux__
 #define off64_t off_t
@@ -40,29 +48,46 @@
 #define O_LARGEFILE 0
 #endif
 
-//#define USE_STDIO
-#define USE_BUFFERING
+// The read size starts small, since after opening a file most of the reads are
+// tag parsing, which seeks around, and doubles up to the max while the reads are sequential.
+// Reads which are larger than the buffer go directly into the destination.
+#define MIN_BUFSIZE (64*1024)
+#define MAX_BUFSIZE (1024*1024)
 
-#ifndef USE_STDIO
-#define BUFSIZE 1024
-#endif
+// The number of consecutive sequential reads, after which the file is considered streamed,
+// e.g. by a playing decoder, and the readahead hints are given to the kernel.
+#define SEQUENTIAL_READS 2
+
+// Regular files can be memory mapped with vfs_stdio.mmap=1, except for large files on 32 bit systems,
+// to save the address space. It's off by default: reading a mapped file which was truncated,
+// or which fails with an I/O error, raises SIGBUS instead of returning an error.
+#define MAX_MMAP_SIZE_32BIT (64*1024*1024)
 
 static DB_functions_t *deadbeef;
 typedef struct {
     DB_vfs_t *vfs;
-#ifdef USE_STDIO
-    FILE *stream;
-#else
     int stream;
     int64_t offs;
-#ifdef USE_BUFFERING
-    uint8_t buffer[BUFSIZE];
-    uint8_t *bufptr;
-    int bufremaining;
-#endif
     int have_size;
-    size_t size;
-#endif
+    int64_t size;
+
+    // mapped file, the buffer is only used past the end of the mapping, if the file grows
+    uint8_t *map;
+    int64_t map_size;
+
+    uint8_t *buffer;
+    size_t bufsize; // current read size
+    size_t bufalloc;
+    int64_t buffer_offs; // file offset of the buffer
+    size_t buffer_len;
+
+    int can_pread; // otherwise the descriptor position is tracked in fd_offs
+    int64_t fd_offs;
+
+    // access pattern
+    int64_t next_offs; // where the next read is expected, if the file is read sequentially
+    int sequential;
+    int64_t advised_offs; // end of the region requested with the readahead hint
 } STDIO_FILE;
 
 static DB_vfs_t plugin;
@@ -72,158 +97,317 @@ stdio_open (const char *fname) {
     if (!memcmp (fname, "file://", 7)) {
         fname += 7;
     }
-#ifdef USE_STDIO
-    FILE *file = fopen (fname, "rb");
-    if (!file) {
-        return NULL;
-    }
-#else
     int file = open (fname, O_LARGEFILE);
     if (file == -1) {
         return NULL;
     }
-#endif
     STDIO_FILE *fp = malloc (sizeof (STDIO_FILE));
     memset (fp, 0, sizeof (STDIO_FILE));
     fp->vfs = &plugin;
     fp->stream = file;
+    fp->bufsize = MIN_BUFSIZE;
+
+    struct stat st;
+    if (!fstat (file, &st) && S_ISREG (st.st_mode)) {
+        fp->have_size = 1;
+        fp->size = st.st_size;
+        fp->can_pread = USE_PREAD;
+#if USE_MMAP
+        if (fp->size > 0
+            && (sizeof (void *) >= 8 || fp->size <= MAX_MMAP_SIZE_32BIT)
+            && deadbeef->conf_get_int ("vfs_stdio.mmap", 0)) {
+            void *map = mmap (NULL, (size_t)fp->size, PROT_READ, MAP_SHARED, file, 0);
+            if (map != MAP_FAILED) {
+                fp->map = map;
+                fp->map_size = fp->size;
+            }
+        }
+#endif
+    }
     return (DB_FILE*)fp;
 }
 
 static void
 stdio_close (DB_FILE *stream) {
     assert (stream);
-#ifdef USE_STDIO
-    fclose (((STDIO_FILE *)stream)->stream);
-#else
-    close (((STDIO_FILE *)stream)->stream);
+    STDIO_FILE *f = (STDIO_FILE *)stream;
+#if USE_MMAP
+    if (f->map) {
+        munmap (f->map, (size_t)f->map_size);
+    }
+#endif
+    close (f->stream);
+    free (f->buffer);
+    free (f);
+}
+
+// Tracks whether the file is read sequentially, grows the read size,
+// and asks the kernel to read ahead of the position while it is.
+static void
+_access (STDIO_FILE *f, int64_t offs, size_t count) {
+    if (offs == f->next_offs) {
+        f->sequential++;
+    }
+    else {
+        if (f->sequential >= SEQUENTIAL_READS) {
+            // back to random access, e.g. after seeking
+#if USE_MMAP
+            if (f->map) {
+                posix_madvise (f->map, (size_t)f->map_size, POSIX_MADV_NORMAL);
+            }
+#endif
+#ifdef POSIX_FADV_NORMAL
+            posix_fadvise (f->stream, 0, 0, POSIX_FADV_NORMAL);
+#endif
+        }
+        f->sequential = 0;
+        f->bufsize = MIN_BUFSIZE;
+        f->advised_offs = 0;
+    }
+    f->next_offs = offs + count;
+
+    if (f->sequential < SEQUENTIAL_READS) {
+        return;
+    }
+
+    if (f->sequential == SEQUENTIAL_READS) {
+#if USE_MMAP
+        if (f->map) {
+            posix_madvise (f->map, (size_t)f->map_size, POSIX_MADV_SEQUENTIAL);
+        }
+#endif
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise (f->stream, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    if (!f->map && f->bufsize < MAX_BUFSIZE) {
+        f->bufsize *= 2;
+    }
+
+    // keep the next read size worth of data requested ahead
+    int64_t ahead = f->map ? MAX_BUFSIZE : (int64_t)f->bufsize;
+    if (f->next_offs + ahead / 2 < f->advised_offs) {
+        return;
+    }
+    int64_t start = f->advised_offs > f->next_offs ? f->advised_offs : f->next_offs;
+    int64_t end = f->next_offs + ahead;
+    if (f->map && end > f->map_size) {
+        end = f->map_size;
+    }
+    else if (f->have_size && end > f->size) {
+        end = f->size;
+    }
+    if (end <= start) {
+        return;
+    }
+#if USE_MMAP
+    if (f->map) {
+        long pagesize = sysconf (_SC_PAGESIZE);
+        int64_t page_start = start - start % pagesize;
+        posix_madvise (f->map + page_start, (size_t)(end - page_start), POSIX_MADV_WILLNEED);
+    }
+    else
+#endif
+    {
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise (f->stream, start, end - start, POSIX_FADV_WILLNEED);
+#endif
+    }
+    f->advised_offs = end;
+}
+
+static ssize_t
+_read_at (STDIO_FILE *f, void *ptr, size_t count, int64_t offs) {
+    ssize_t rd;
+#if USE_PREAD
+    if (f->can_pread) {
+        rd = pread (f->stream, ptr, count, offs);
+    }
+    else
 #endif
-    free (stream);
+    {
+        if (f->fd_offs != offs) {
+            if (lseek64 (f->stream, offs, SEEK_SET) == -1) {
+                return -1;
+            }
+            f->fd_offs = offs;
+        }
+        rd = read (f->stream, ptr, count);
+        if (rd > 0) {
+            f->fd_offs += rd;
+        }
+    }
+    if (rd > 0) {
+        _access (f, offs, rd);
+    }
+    return rd;
 }
 
-#ifndef USE_STDIO
-#ifdef USE_BUFFERING
 static int
 fillbuffer (STDIO_FILE *f) {
-    assert (f->bufremaining >= 0);
-    if (f->bufremaining == 0) {
-        f->bufremaining = (int)read (f->stream, f->buffer, BUFSIZE);
-        if (f->bufremaining < 0) {
-            f->bufremaining = 0;
+    if (f->bufalloc < f->bufsize) {
+        uint8_t *buffer = realloc (f->buffer, f->bufsize);
+        if (!buffer) {
             return -1;
         }
-        f->bufptr = f->buffer;
+        f->buffer = buffer;
+        f->bufalloc = f->bufsize;
+    }
+    f->buffer_len = 0;
+    ssize_t rd = _read_at (f, f->buffer, f->bufsize, f->offs);
+    if (rd <= 0) {
+        return (int)rd;
     }
-    return f->bufremaining;
+    f->buffer_offs = f->offs;
+    f->buffer_len = rd;
+    return 1;
 }
-#endif
-#endif
 
 static size_t
 stdio_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     assert (stream);
     assert (ptr);
-#ifdef USE_STDIO
-    return fread (ptr, size, nmemb, ((STDIO_FILE*)stream)->stream);
-#else
     STDIO_FILE *f = (STDIO_FILE*)stream;
 
     size_t nb = size * nmemb;
-#ifdef USE_BUFFERING
-    while (nb > 0) {
-        if (fillbuffer (f) <= 0) {
-            break;
+    if (nb == 0) {
+        return 0;
+    }
+
+    // the most common case: small reads from the buffer
+    if (f->buffer_len > 0 && f->offs >= f->buffer_offs && f->offs + (int64_t)nb <= f->buffer_offs + (int64_t)f->buffer_len) {
+        memcpy (ptr, f->buffer + (f->offs - f->buffer_offs), nb);
+        f->offs += nb;
+        return nmemb;
+    }
+
+    uint8_t *out = ptr;
+    size_t total = 0;
+
+    if (f->map && f->offs < f->map_size) {
+        size_t r = nb;
+        if (r > f->map_size - f->offs) {
+            r = (size_t)(f->map_size - f->offs);
+        }
+        if (f->offs == f->next_offs && f->offs + (int64_t)r + MAX_BUFSIZE / 2 < f->advised_offs) {
+            // streaming, and the readahead was already requested
+            f->next_offs += r;
         }
-        int r = f->bufremaining;
-        if (r > nb) {
-            r = (int)nb;
+        else {
+            _access (f, f->offs, r);
         }
-        memcpy (ptr, f->bufptr, r);
-        f->bufremaining -= r;
-        f->bufptr += r;
-        ptr += r;
+        memcpy (out, f->map + f->offs, r);
+        out += r;
         f->offs += r;
+        total += r;
         nb -= r;
+        // the rest, if any, was appended to the file after it was mapped
     }
-    size_t ret = ((size * nmemb) - nb) / size;
-#else
-    ssize_t ret = read (f->stream, ptr, nb);
-    if (ret < 0) {
-        return -1;
+
+    while (nb > 0) {
+        if (f->buffer_len > 0 && f->offs >= f->buffer_offs && f->offs < f->buffer_offs + (int64_t)f->buffer_len) {
+            size_t pos = (size_t)(f->offs - f->buffer_offs);
+            size_t r = f->buffer_len - pos;
+            if (r > nb) {
+                r = nb;
+            }
+            memcpy (out, f->buffer + pos, r);
+            out += r;
+            f->offs += r;
+            total += r;
+            nb -= r;
+            continue;
+        }
+        if (nb >= f->bufsize) {
+            // too large to buffer
+            ssize_t rd = _read_at (f, out, nb, f->offs);
+            if (rd <= 0) {
+                break;
+            }
+            out += rd;
+            f->offs += rd;
+            total += rd;
+            nb -= rd;
+            continue;
+        }
+        if (fillbuffer (f) <= 0) {
+            break;
+        }
     }
-    f->offs += ret;
-    ret = ret / size;
-#endif
-    return ret;
-#endif
+    return total / size;
 }
 
 static int
 stdio_seek (DB_FILE *stream, int64_t offset, int whence) {
     assert (stream);
-#ifdef USE_STDIO
-    return fseek (((STDIO_FILE *)stream)->stream, offset, whence);
-#else
+    STDIO_FILE *f = (STDIO_FILE*)stream;
     // convert offset to absolute
     if (whence == SEEK_CUR) {
-        whence = SEEK_SET;
-        offset = ((STDIO_FILE*)stream)->offs + offset;
+        offset = f->offs + offset;
     }
-    off64_t res = lseek64 (((STDIO_FILE *)stream)->stream, offset, whence);
-    if (res == -1) {
+    else if (whence == SEEK_END) {
+        if (!f->have_size) {
+            // not a regular file, let the system decide
+            off64_t res = lseek64 (f->stream, offset, SEEK_END);
+            if (res == -1) {
+                return -1;
+            }
+            f->fd_offs = res;
+            f->offs = res;
+            return 0;
+        }
+        offset = f->size + offset;
+    }
+    else if (whence != SEEK_SET) {
         return -1;
     }
-//    printf ("lseek res: %lld (%lld, %d, prev=%lld)\n", res, offset, whence,  ((STDIO_FILE*)stream)->offs);
-    ((STDIO_FILE*)stream)->offs = res;
-#ifdef USE_BUFFERING
-    ((STDIO_FILE*)stream)->bufremaining = 0;
-#endif
-#endif
+    if (offset < 0) {
+        return -1;
+    }
+    if (!f->can_pread) {
+        // make sure that the file is seekable
+        off64_t res = lseek64 (f->stream, offset, SEEK_SET);
+        if (res == -1) {
+            return -1;
+        }
+        f->fd_offs = res;
+    }
+    // the buffer is kept, seeking within it is free
+    f->offs = offset;
     return 0;
 }
 
 static int64_t
 stdio_tell (DB_FILE *stream) {
     assert (stream);
-#ifdef USE_STDIO
-    return ftell (((STDIO_FILE*)stream)->stream);
-#else
     return ((STDIO_FILE*)stream)->offs;
-#endif
 }
 
 static void
 stdio_rewind (DB_FILE *stream) {
     assert (stream);
-#ifdef USE_STDIO
-    rewind (((STDIO_FILE*)stream)->stream);
-#else
     stdio_seek (stream, 0, SEEK_SET);
-#endif
 }
 
 static int64_t
 stdio_getlength (DB_FILE *stream) {
     assert (stream);
     STDIO_FILE *f = (STDIO_FILE *)stream;
-#ifdef USE_STDIO
-    size_t offs = ftell (f->stream);
-    fseek (f->stream, 0, SEEK_END);
-    size_t l = ftell (f->stream);
-    fseek (f->stream, offs, SEEK_SET);
-    return l;
-#else
+    struct stat st;
+    if (f->have_size && !fstat (f->stream, &st) && S_ISREG (st.st_mode)) {
+        // the file may have grown since it was opened
+        f->size = st.st_size;
+    }
     if (!f->have_size) {
         int64_t size = lseek64 (f->stream, 0, SEEK_END);
-        lseek64 (f->stream, f->offs, SEEK_SET);
-#ifdef USE_BUFFERING
-        f->bufremaining = 0;
-#endif
+        if (size != -1) {
+            f->fd_offs = size;
+        }
         f->have_size = 1;
         f->size = size;
     }
     return f->size;
-#endif
 }
 
 const char *
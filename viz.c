@@ -20,7 +20,6 @@
 
     3. This notice may not be removed or altered from any source distribution.
 */
-#include <assert.h>
 #include <dispatch/dispatch.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +29,12 @@
 #include "threading.h"
 #include "viz.h"
 
+// The output thread converts each block into a snapshot, and publishes it for the process queue,
+// which runs the listeners. The snapshots are preallocated, and swapped without locking:
+// the output thread owns the back snapshot, the process queue owns the front one,
+// and the latest published one is exchanged between them.
+// Nothing is done on the output thread when there are no listeners.
+
 static dispatch_queue_t sync_queue;
 static dispatch_queue_t process_queue;
 
@@ -42,33 +47,66 @@ typedef struct wavedata_listener_s {
 
 static wavedata_listener_t *waveform_listeners;
 static wavedata_listener_t *spectrum_listeners;
-
-//#define HISTORY_FRAMES 100000
-
-static int _fft_size = 0;
+static int _listener_count; // read by the output thread without locking
+
+typedef struct {
+    ddb_waveformat_t fmt;
+    float *data; // interleaved
+    size_t size; // allocated floats
+    int nframes;
+    int fft_size;
+} viz_snapshot_t;
+
+#define SNAPSHOT_DIRTY 4 // set in _published_snapshot until the process queue takes it
+
+static viz_snapshot_t _snapshots[3];
+static int _back_snapshot = 0; // output thread
+static int _front_snapshot = 1; // process queue
+static int _published_snapshot = 2;
+static int _process_scheduled;
+static int _need_reset;
+static int _fft_window;
+
+// spectrum, process queue only
 static float *_freq_data;
-static float *_audio_data;
-static int _need_reset = 0;
-static int audio_data_channels = 0;
+static float *_channel_data;
+static int _fft_size;
 
 static void
 _free_buffers (void) {
+    for (int i = 0; i < 3; i++) {
+        free (_snapshots[i].data);
+        memset (&_snapshots[i], 0, sizeof (viz_snapshot_t));
+    }
     free (_freq_data);
-    free (_audio_data);
+    free (_channel_data);
     _freq_data = NULL;
-    _audio_data = NULL;
+    _channel_data = NULL;
+    _fft_size = 0;
 }
 
-static void
-_init_buffers (int fft_size) {
+static int
+_init_spectrum_buffers (int fft_size) {
     if (fft_size != _fft_size) {
-        _free_buffers ();
+        free (_freq_data);
+        free (_channel_data);
+        _freq_data = NULL;
+        _channel_data = NULL;
+        _fft_size = 0;
         if (fft_size != 0) {
-            _freq_data = calloc(fft_size * DDB_FREQ_MAX_CHANNELS, sizeof (float));
-            _audio_data = calloc(fft_size * 2 * DDB_FREQ_MAX_CHANNELS, sizeof (float));
+            _freq_data = calloc (fft_size * DDB_FREQ_MAX_CHANNELS, sizeof (float));
+            _channel_data = calloc (fft_size * 2, sizeof (float));
+            if (!_freq_data || !_channel_data) {
+                free (_freq_data);
+                free (_channel_data);
+                _freq_data = NULL;
+                _channel_data = NULL;
+                return -1;
+            }
         }
         _fft_size = fft_size;
     }
+    return 0;
 }
 
 void
@@ -79,169 +117,186 @@ viz_init (void) {
 
 void
 viz_free (void) {
+    // wait for the pending processing
+    dispatch_sync(process_queue, ^{});
     dispatch_release(process_queue);
     dispatch_release(sync_queue);
     _free_buffers();
 }
 
-void
-viz_waveform_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data_t *data)) {
+static void
+_listen (wavedata_listener_t **listeners, void *ctx, void (*callback)(void *ctx, const ddb_audio_data_t *data)) {
     dispatch_sync(sync_queue, ^{
         wavedata_listener_t *l = malloc (sizeof (wavedata_listener_t));
         memset (l, 0, sizeof (wavedata_listener_t));
         l->ctx = ctx;
         l->callback = callback;
-        l->next = waveform_listeners;
-        waveform_listeners = l;
+        l->next = *listeners;
+        *listeners = l;
+        __atomic_add_fetch (&_listener_count, 1, __ATOMIC_SEQ_CST);
     });
 }
 
-void
-viz_waveform_unlisten (void *ctx) {
+static void
+_unlisten (wavedata_listener_t **listeners, void *ctx) {
     dispatch_sync(sync_queue, ^{
         wavedata_listener_t *l, *prev = NULL;
-        for (l = waveform_listeners; l; prev = l, l = l->next) {
+        for (l = *listeners; l; prev = l, l = l->next) {
             if (l->ctx == ctx) {
                 if (prev) {
                     prev->next = l->next;
                 }
                 else {
-                    waveform_listeners = l->next;
+                    *listeners = l->next;
                 }
                 free (l);
+                __atomic_sub_fetch (&_listener_count, 1, __ATOMIC_SEQ_CST);
                 break;
             }
         }
     });
 }
 
+void
+viz_waveform_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data_t *data)) {
+    _listen (&waveform_listeners, ctx, callback);
+}
+
+void
+viz_waveform_unlisten (void *ctx) {
+    _unlisten (&waveform_listeners, ctx);
+}
+
 void
 viz_spectrum_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data_t *data)) {
-    dispatch_sync(sync_queue, ^{
-        wavedata_listener_t *l = malloc (sizeof (wavedata_listener_t));
-        memset (l, 0, sizeof (wavedata_listener_t));
-        l->ctx = ctx;
-        l->callback = callback;
-        l->next = spectrum_listeners;
-        spectrum_listeners = l;
-    });
+    _listen (&spectrum_listeners, ctx, callback);
 }
 
 void
 viz_spectrum_unlisten (void *ctx) {
-    dispatch_sync(sync_queue, ^{
-        wavedata_listener_t *l, *prev = NULL;
-        for (l = spectrum_listeners; l; prev = l, l = l->next) {
-            if (l->ctx == ctx) {
-                if (prev) {
-                    prev->next = l->next;
-                }
-                else {
-                    spectrum_listeners = l->next;
-                }
-                free (l);
-                break;
-            }
-        }
-    });
+    _unlisten (&spectrum_listeners, ctx);
 }
 
 void
 viz_reset (void) {
-    dispatch_sync(sync_queue, ^{
-        _need_reset = 1;
-    });
+    __atomic_store_n (&_need_reset, 1, __ATOMIC_SEQ_CST);
 }
 
 void
-viz_process (char * restrict _bytes, int _bytes_size, DB_output_t *output, int fft_size) {
+viz_set_fft_window (int window) {
+    __atomic_store_n (&_fft_window, window, __ATOMIC_SEQ_CST);
+}
+
+// process queue
+static void
+_process (void *unused) {
+    __atomic_store_n (&_process_scheduled, 0, __ATOMIC_SEQ_CST);
+
+    if (!(__atomic_load_n (&_published_snapshot, __ATOMIC_SEQ_CST) & SNAPSHOT_DIRTY)) {
+        return;
+    }
+    _front_snapshot = __atomic_exchange_n (&_published_snapshot, _front_snapshot, __ATOMIC_SEQ_CST) & ~SNAPSHOT_DIRTY;
+
+    if (__atomic_exchange_n (&_need_reset, 0, __ATOMIC_SEQ_CST)) {
+        // the snapshot may be from before the reset
+        return;
+    }
+
+    viz_snapshot_t *snapshot = &_snapshots[_front_snapshot];
+    fft_window_t window = __atomic_load_n (&_fft_window, __ATOMIC_SEQ_CST);
+
     dispatch_sync(sync_queue, ^{
-        _init_buffers(fft_size);
-        if (!waveform_listeners && !spectrum_listeners) {
+        ddb_audio_data_t waveform_data = {
+            .fmt = &snapshot->fmt,
+            .data = snapshot->data,
+            .nframes = snapshot->nframes
+        };
+        for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
+            l->callback (l->ctx, &waveform_data);
+        }
+
+        if (!spectrum_listeners || _init_spectrum_buffers (snapshot->fft_size) < 0) {
             return;
         }
 
-        char * bytes = _bytes;
-        int bytes_size = _bytes_size;
-
-        int in_frame_size = (output->fmt.bps >> 3) * output->fmt.channels;
-        int in_frames = in_frame_size != 0 ? bytes_size / in_frame_size : 0;
-
-        // convert to float
-        ddb_waveformat_t *out_fmt = calloc (1, sizeof (ddb_waveformat_t));
-        out_fmt->bps = 32;
-        out_fmt->channels = output->fmt.channels;
-        out_fmt->samplerate = output->fmt.samplerate;
-        out_fmt->channelmask = output->fmt.channelmask;
-        out_fmt->is_float = 1;
-        out_fmt->is_bigendian = 0;
-
-        int process_samples = in_frames;
-        // if the input is smaller than the buffer, pad with zeroes
-        if (process_samples != fft_size * 2) {
-            process_samples = fft_size * 2;
-            bytes_size = process_samples * output->fmt.channels * output->fmt.bps/8;
+        int channels = snapshot->fmt.channels;
+        if (channels > DDB_FREQ_MAX_CHANNELS) {
+            channels = DDB_FREQ_MAX_CHANNELS;
+        }
+        if (_fft_size != 0) {
+            for (int c = 0; c < channels; c++) {
+                // deinterleave
+                for (int s = 0; s < _fft_size * 2; s++) {
+                    _channel_data[s] = snapshot->data[s * snapshot->fmt.channels + c];
+                }
+                fft_calculate (_channel_data, &_freq_data[_fft_size * c], _fft_size, window);
+            }
         }
-        size_t data_size = process_samples * out_fmt->channels * sizeof (float);
-        __block float *data = calloc(1, data_size);
 
-        if (bytes != NULL) {
-            pcm_convert (&output->fmt, bytes, out_fmt, (char *)data, bytes_size);
+        ddb_waveformat_t fmt = snapshot->fmt;
+        fmt.channels = channels;
+        ddb_audio_data_t spectrum_data = {
+            .fmt = &fmt,
+            .data = _freq_data,
+            .nframes = _fft_size
+        };
+        for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
+            l->callback (l->ctx, &spectrum_data);
         }
+    });
+}
 
-        ddb_audio_data_t *waveform_data = calloc(1, sizeof(ddb_audio_data_t));
-        waveform_data->fmt = out_fmt;
-        waveform_data->data = data;
-        waveform_data->nframes = process_samples;
+// output thread
+void
+viz_process (char * restrict bytes, int bytes_size, DB_output_t *output, int fft_size) {
+    if (!__atomic_load_n (&_listener_count, __ATOMIC_SEQ_CST)) {
+        return;
+    }
 
-        // Pass to async queue for processing and callbacks
-        dispatch_async (process_queue, ^{
-            for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
-                l->callback (l->ctx, waveform_data);
-            }
+    viz_snapshot_t *snapshot = &_snapshots[_back_snapshot];
 
-            if (_need_reset || out_fmt->channels != audio_data_channels || !spectrum_listeners) {
-                // reset
-                audio_data_channels = out_fmt->channels;
-                memset (_freq_data, 0, sizeof (float) * _fft_size * DDB_FREQ_MAX_CHANNELS);
-                memset (_audio_data, 0, sizeof (float) * _fft_size * 2 * DDB_FREQ_MAX_CHANNELS);
-                _need_reset = 0;
-            }
+    int channels = output->fmt.channels;
+    int in_frame_size = (output->fmt.bps >> 3) * channels;
+    int in_frames = in_frame_size != 0 && bytes != NULL ? bytes_size / in_frame_size : 0;
 
-            if (spectrum_listeners) {
-                // convert samples in planar layout
-                assert (process_samples == _fft_size * 2);
-                for (int c = 0; c < audio_data_channels; c++) {
-                    float *channel = &_audio_data[_fft_size * 2 * c];
-                    for (int s = 0; s < process_samples; s++) {
-                        channel[s] = data[s * audio_data_channels + c];
-                    }
-                    // pad zeroes
-                    for (int s = process_samples; s < _fft_size * 2; s++) {
-                        channel[s] = 0;
-                    }
-                }
+    // always deliver fft_size*2 frames, for the spectrum
+    int process_frames = fft_size * 2;
+    if (in_frames > process_frames) {
+        in_frames = process_frames;
+    }
 
-                // calc fft
-                if (_audio_data != NULL) {
-                    for (int c = 0; c < audio_data_channels; c++) {
-                        fft_calculate (&_audio_data[_fft_size * 2 * c], &_freq_data[_fft_size * c], _fft_size);
-                    }
-                }
-                ddb_audio_data_t spectrum_data = {
-                    .fmt = out_fmt,
-                    .data = _freq_data,
-                    .nframes = _fft_size
-                };
-                for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
-                    l->callback (l->ctx, &spectrum_data);
-                }
-            }
+    // the buffer only grows, when the format or the fft size change
+    size_t size = (size_t)process_frames * channels;
+    if (size > snapshot->size) {
+        float *data = realloc (snapshot->data, size * sizeof (float));
+        if (!data) {
+            return;
+        }
+        snapshot->data = data;
+        snapshot->size = size;
+    }
 
-            free (data);
-            free (out_fmt);
-            free (waveform_data);
-        });
-    });
-}
+    snapshot->fmt.bps = 32;
+    snapshot->fmt.channels = channels;
+    snapshot->fmt.samplerate = output->fmt.samplerate;
+    snapshot->fmt.channelmask = output->fmt.channelmask;
+    snapshot->fmt.is_float = 1;
+    snapshot->fmt.is_bigendian = 0;
+    snapshot->nframes = process_frames;
+    snapshot->fft_size = fft_size;
+
+    // convert to float, and pad with zeroes if the input is smaller than the buffer
+    if (in_frames > 0) {
+        pcm_convert (&output->fmt, bytes, &snapshot->fmt, (char *)snapshot->data, in_frames * in_frame_size);
+    }
+    if (size > 0) {
+        memset (snapshot->data + in_frames * channels, 0, (size - (size_t)in_frames * channels) * sizeof (float));
+    }
+
+    // publish, and take the previously published snapshot back, unless it was taken by the process queue
+    _back_snapshot = __atomic_exchange_n (&_published_snapshot, _back_snapshot | SNAPSHOT_DIRTY, __ATOMIC_SEQ_CST) & ~SNAPSHOT_DIRTY;
 
+    if (!__atomic_exchange_n (&_process_scheduled, 1, __ATOMIC_SEQ_CST)) {
+        dispatch_async_f (process_queue, NULL, _process);
+    }
+}
@@ -37,6 +37,10 @@ viz_free (void);
 void
 viz_reset (void);
 
+// fft_window_t of the spectrum
+void
+viz_set_fft_window (int window);
+
 void
 viz_waveform_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data_t *data));
 